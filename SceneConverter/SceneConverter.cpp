@@ -0,0 +1,79 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include "LoadProfiler.h"
+#include "Scene.h"
+#include "SceneFile.h"
+
+/**
+ * \brief Bake a glTF file into a .tlscene file once, so that the renderer starts from mapped GPU layout sections
+ *        instead of parsing, transforming and building the BVH on every run.
+ *        Usage: SceneConverter <gltf file> [tlscene file] [scene options] [--profile-json=<file>]
+ */
+int main(int argc, char **argv) {
+	if (argc < 2 || std::string(argv[1]).compare(0, 2, "--") == 0)
+	{
+		printf("Usage: SceneConverter [gltf file] [tlscene file] [--wide-bvh] [--sbvh] [--split-budget=<fraction>] [--gpu-bvh] [--weld] [--optimize-vertex-cache] [--lod] [--profile-json=<file>]\n");
+		return 1;
+	}
+
+	const std::string inputFileName(argv[1]);
+	std::string outputFileName = inputFileName.substr(0, inputFileName.find_last_of(".")) + ".tlscene";
+
+	// Always build from the glTF file, the scene cache would only store what is about to be written anyway
+	SceneOptions sceneOptions;
+	std::string profileFileName;
+	for (int i = 2; i < argc; ++i)
+	{
+		if (std::string(argv[i]).compare(0, 15, "--profile-json=") == 0)
+		{
+			profileFileName = std::string(argv[i]).substr(15);
+		}
+		else if (!ParseSceneOption(argv[i], sceneOptions))
+		{
+			if (std::string(argv[i]).compare(0, 2, "--") == 0)
+			{
+				printf("Unknown option %s\n", argv[i]);
+				return 1;
+			}
+			outputFileName = argv[i];
+		}
+	}
+	sceneOptions.useCache = false;
+	sceneOptions.asyncLoad = false;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	Scene scene(inputFileName, sceneOptions);
+	if (scene.indices.empty())
+	{
+		printf("Nothing to convert in %s\n", inputFileName.c_str());
+		return 1;
+	}
+
+	auto built = std::chrono::high_resolution_clock::now();
+	ProfileScope writeScope("Write scene file");
+	if (!SaveSceneFile(scene, outputFileName))
+	{
+		printf("Failed to write %s\n", outputFileName.c_str());
+		return 1;
+	}
+	writeScope.End();
+	auto end = std::chrono::high_resolution_clock::now();
+
+	SceneFile sceneFile;
+	sceneFile.Open(outputFileName);
+	printf("Converted %s to %s: built in %.2f ms, written in %.2f ms, %.1f MB\n",
+		inputFileName.c_str(),
+		outputFileName.c_str(),
+		std::chrono::duration<double, std::milli>(built - start).count(),
+		std::chrono::duration<double, std::milli>(end - built).count(),
+		sceneFile.FileSize() / (1024.0 * 1024.0));
+
+	LoadProfiler::Global().Print();
+	if (!profileFileName.empty() && !LoadProfiler::Global().WriteJson(profileFileName))
+	{
+		printf("Failed to write profile %s\n", profileFileName.c_str());
+		return 1;
+	}
+	return 0;
+}
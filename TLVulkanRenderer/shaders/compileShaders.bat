@@ -1,3 +1,3 @@
-glslangvalidator -V fragShader.frag -o fragShader.spv
-glslangvalidator -V vertShader.vert -o vertShader.spv
+glslangvalidator -V fragShader.frag -o frag.spv
+glslangvalidator -V vertShader.vert -o vert.spv
 pause
\ No newline at end of file
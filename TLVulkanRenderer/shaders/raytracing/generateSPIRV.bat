@@ -1,3 +1,4 @@
 glslangvalidator -V -t raytrace.comp -o raytrace.comp.spv
 glslangvalidator -V -t raytrace.frag -o raytrace.frag.spv
 glslangvalidator -V -t raytrace.vert -o raytrace.vert.spv
+glslangvalidator -V -t lbvh.comp -o lbvh.comp.spv
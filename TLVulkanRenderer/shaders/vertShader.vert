@@ -11,20 +11,35 @@ layout(binding = 0) uniform UniformBufferObject {
 	mat4 proj;
 } ubo;
 
+// 16-bit unsigned normalized relative to the bounds of the mesh, and octahedral
 layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inNormal;
+layout(location = 1) in vec2 inNormal;
+
+// Per mesh, the draw's first instance selects them
+layout(location = 2) in vec3 inBoundsMin;
+layout(location = 3) in vec3 inBoundsExtent;
 
 layout(location = 0) out vec3 fragNormal;
 layout(location = 2) out vec3 lightDirection;
 layout(location = 3) out vec3 fragPosition;
 
 
+// Same as DecodeOctahedral in src/mesh/VertexQuantization.cpp
+vec3 decodeOctahedral(vec2 folded) {
+	vec3 normal = vec3(folded, 1.0 - abs(folded.x) - abs(folded.y));
+	float fold = max(-normal.z, 0.0);
+	normal.x += normal.x >= 0.0 ? -fold : fold;
+	normal.y += normal.y >= 0.0 ? -fold : fold;
+	return normalize(normal);
+}
+
 void main() {
-	vec4 position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+	vec3 vertexPosition = inBoundsMin + inPosition * inBoundsExtent;
+	vec4 position = ubo.proj * ubo.view * ubo.model * vec4(vertexPosition, 1.0);
 	
 	// -- Out
-	fragNormal = inNormal;
-	fragPosition = inPosition;
+	fragNormal = decodeOctahedral(inNormal);
+	fragPosition = vertexPosition;
 	lightDirection = normalize(vec3(-5.0, 2.0, 5.0) - vec3(position));
 
 	// -- Position
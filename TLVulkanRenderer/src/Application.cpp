@@ -5,6 +5,7 @@
 #include "renderer/vulkan/VulkanRenderer.h"
 #include "renderer/vulkan/VulkanRaytracer.h"
 #include "Camera.h"
+#include "LoadProfiler.h"
 
 static int frame;
 static int fpstracker;
@@ -103,7 +104,10 @@ Application::Application(
 	m_renderingMode(renderingMode),
     m_window(nullptr)
 {
+	m_startTime = std::chrono::high_resolution_clock::now();
+
 	// Initialize glfw
+	ProfileScope windowScope("Create window");
 	glfwInit();
 	
 	// Create window
@@ -119,10 +123,23 @@ Application::Application(
 	glfwSetKeyCallback(m_window, keyCallback);
 	glfwSetCursorPosCallback(m_window, mousePositionCallback);
 	glfwSetMouseButtonCallback(m_window, mouseButtonCallback);
+	windowScope.End();
 
 	// Extra filename
 	std::string inputFilename(argv[1]);
-	m_scene = new Scene(inputFilename);
+
+	SceneOptions sceneOptions;
+	for (int i = 2; i < argc; ++i)
+	{
+		const std::string option(argv[i]);
+		if (option.compare(0, 15, "--profile-json=") == 0)
+		{
+			m_profileFileName = option.substr(15);
+			continue;
+		}
+		ParseSceneOption(argv[i], sceneOptions);
+	}
+	m_scene = new Scene(inputFilename, sceneOptions);
 
 	g_camera = Camera(width, height);
 
@@ -175,6 +192,10 @@ void Application::Run() {
 
 		// Update title bar
 		string title = "Vulkan Rasterizer | " + std::to_string(fps) + " FPS | " + std::to_string(timeElapsed) + " ms";
+		if (m_scene->Loading())
+		{
+			title += " | Loading";
+		}
 		glfwSetWindowTitle(m_window, title.c_str());
 
 		// Update camera
@@ -196,6 +217,19 @@ void Application::Run() {
 		m_renderer->Update();
 		m_renderer->Render();
 
+		if (frame == 0)
+		{
+			auto firstFrame = std::chrono::high_resolution_clock::now();
+			printf("First frame after %.2f ms\n", std::chrono::duration<double, std::milli>(firstFrame - m_startTime).count());
+
+			// An asynchronous load is still running at this point, its remaining stages show as such
+			LoadProfiler::Global().Print();
+			if (!m_profileFileName.empty() && !LoadProfiler::Global().WriteJson(m_profileFileName))
+			{
+				printf("Failed to write startup profile %s\n", m_profileFileName.c_str());
+			}
+		}
+
 		frame++;
 		fpstracker++;
 	}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <chrono>
+#include <string>
 #include "renderer/Renderer.h"
 #include "renderer/vulkan/VulkanRenderer.h"
 #include "Scene.h"
@@ -32,5 +34,11 @@ private:
 	Scene* m_scene;
 	Renderer* m_renderer;
 
+	// Construction start, for the time to the first frame
+	std::chrono::high_resolution_clock::time_point m_startTime;
+
+	// Where to write the startup profile as JSON, from --profile-json=<file>. Empty to only print it.
+	std::string m_profileFileName;
+
 };
 
@@ -0,0 +1,1061 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <random>
+#include <thread>
+#include <glm/gtc/matrix_transform.hpp>
+#include "Benchmark.h"
+#include "Scene.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "mesh/MeshSimplify.h"
+#include "mesh/VertexCache.h"
+#include "mesh/VertexQuantization.h"
+
+// Runs per thread count, the median is reported
+static const int BENCHMARK_RUN_COUNT = 5;
+
+// Random rays traced through each layout
+static const int TRAVERSAL_RAY_COUNT = 1 << 16;
+
+// Same as EPSILON in raytrace.comp
+static const float TRAVERSAL_EPSILON = 0.0001f;
+
+static bool
+SameTree(
+	const BVH& a,
+	const BVH& b
+	)
+{
+	return a.nodes.size() == b.nodes.size() &&
+		a.primitiveIndices == b.primitiveIndices &&
+		std::memcmp(a.nodes.data(), b.nodes.data(), a.nodes.size() * sizeof(BVHNode)) == 0;
+}
+
+void
+BenchmarkBVHBuild(
+	const std::vector<std::string>& fileNames,
+	int maxThreadCount
+	)
+{
+	if (maxThreadCount <= 0)
+	{
+		maxThreadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	}
+
+	// 1, 2, 4, ... and always the full thread count
+	std::vector<int> threadCounts;
+	for (int threadCount = 1; threadCount < maxThreadCount; threadCount *= 2)
+	{
+		threadCounts.push_back(threadCount);
+	}
+	threadCounts.push_back(maxThreadCount);
+
+	for (const std::string& fileName : fileNames)
+	{
+		Scene scene(fileName);
+		std::vector<AABB> triangleBounds = scene.TriangleBounds();
+
+		printf("\n%s: %zu triangles\n", fileName.c_str(), triangleBounds.size());
+		printf("%8s %12s %10s %12s\n", "threads", "median ms", "speedup", "same tree");
+
+		BVH reference;
+		reference.Build(triangleBounds);
+
+		double singleThreadTime = 0.0;
+		for (int threadCount : threadCounts)
+		{
+			ThreadPool pool(threadCount);
+
+			std::vector<double> times;
+			bool sameTree = true;
+			for (int run = 0; run < BENCHMARK_RUN_COUNT; ++run)
+			{
+				BVH bvh;
+				auto start = std::chrono::high_resolution_clock::now();
+				bvh.Build(triangleBounds, &pool);
+				auto end = std::chrono::high_resolution_clock::now();
+
+				times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+				sameTree = sameTree && SameTree(bvh, reference);
+			}
+
+			std::sort(times.begin(), times.end());
+			double median = times[times.size() / 2];
+			if (threadCount == 1)
+			{
+				singleThreadTime = median;
+			}
+
+			printf("%8d %12.2f %9.2fx %12s\n",
+				threadCount,
+				median,
+				singleThreadTime / median,
+				sameTree ? "yes" : "NO");
+		}
+	}
+}
+
+// -------- Traversal -----------
+
+namespace
+{
+	struct TraversalRay
+	{
+		glm::vec3 origin;
+		glm::vec3 direction;
+		glm::vec3 inverseDirection;
+
+		// Closest hit that counts, like secondaryRoot in raytrace.comp for secondary rays
+		float tStart;
+
+		// Secondary rays traverse the coarse copy of each instance, see TwoLevelBVH::BottomLevel.
+		// Only in the instance they leave, hits closer than its error are ignored.
+		bool secondary;
+		int fromInstance;
+	};
+
+	/**
+	 * \brief Work done by one layout, summed over every ray
+	 */
+	struct TraversalStats
+	{
+		long long nodes = 0;
+		long long boxes = 0;
+		long long triangles = 0;
+
+		// Instance of the closest hit so far
+		int hitInstance = -1;
+	};
+}
+
+static TraversalRay
+MakeTraversalRay(
+	const glm::vec3& origin,
+	const glm::vec3& direction
+	)
+{
+	TraversalRay ray;
+	ray.origin = origin;
+	ray.direction = direction;
+	ray.tStart = TRAVERSAL_EPSILON;
+	ray.secondary = false;
+	ray.fromInstance = -1;
+
+	// Same clamping as safeInverse in raytrace.comp
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float sign = direction[axis] < 0.0f ? -1.0f : 1.0f;
+		ray.inverseDirection[axis] = 1.0f / (sign * std::max(std::abs(direction[axis]), 1e-8f));
+	}
+	return ray;
+}
+
+/**
+ * \brief Slab test, mirrors nodeIntersect in raytrace.comp
+ */
+static bool
+IntersectBox(
+	const glm::vec3& boxMin,
+	const glm::vec3& boxMax,
+	const TraversalRay& ray,
+	float tMax,
+	float& outEnter
+	)
+{
+	glm::vec3 t0 = (boxMin - ray.origin) * ray.inverseDirection;
+	glm::vec3 t1 = (boxMax - ray.origin) * ray.inverseDirection;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+	outEnter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+	return outEnter <= tExit;
+}
+
+/**
+ * \brief Moller-Trumbore, mirrors triangleIntersect in raytrace.comp
+ * \return distance along the ray, negative when missed
+ */
+static float
+IntersectTriangle(
+	const Scene& scene,
+	int triangle,
+	const TraversalRay& ray
+	)
+{
+	const TriangleRecord& record = scene.triangleRecords[triangle];
+	glm::vec3 vert0 = glm::vec3(record.vert0);
+	glm::vec3 edge1 = glm::vec3(record.edge1);
+	glm::vec3 edge2 = glm::vec3(record.edge2);
+
+	glm::vec3 pvec = glm::cross(ray.direction, edge2);
+	float det = glm::dot(pvec, edge1);
+	if (std::abs(det) < TRAVERSAL_EPSILON)
+	{
+		return -1.0f;
+	}
+	float inverseDet = 1.0f / det;
+
+	glm::vec3 tvec = ray.origin - vert0;
+	float u = glm::dot(pvec, tvec) * inverseDet;
+	if (u < 0.0f || u > 1.0f)
+	{
+		return -1.0f;
+	}
+
+	glm::vec3 qvec = glm::cross(tvec, edge1);
+	float v = glm::dot(ray.direction, qvec) * inverseDet;
+	if (v < 0.0f || u + v > 1.0f)
+	{
+		return -1.0f;
+	}
+
+	return glm::dot(edge2, qvec) * inverseDet;
+}
+
+static bool
+TraceLevel(
+	const Scene& scene,
+	EBVHLayout layout,
+	int rootNode,
+	bool isTopLevel,
+	bool anyHit,
+	const TraversalRay& ray,
+	float& tMin,
+	TraversalStats& stats
+);
+
+/**
+ * \brief Intersect the primitives of a leaf, instances for the top level and triangles for a bottom level
+ * \return true once an any-hit query found a hit and traversal can stop
+ */
+static bool
+TracePrimitives(
+	const Scene& scene,
+	EBVHLayout layout,
+	int first,
+	int count,
+	bool isTopLevel,
+	bool anyHit,
+	const TraversalRay& ray,
+	float& tMin,
+	TraversalStats& stats
+	)
+{
+	const TwoLevelBVH& bvh = scene.bvh;
+	for (int i = first; i < first + count; ++i)
+	{
+		if (isTopLevel)
+		{
+			const BVHInstance& instance = bvh.instances[i];
+			const TwoLevelBVH::BottomLevel* bottomLevel = &bvh.bottomLevels[bvh.instanceBottomLevels[instance.instanceId]];
+			TraversalRay objectRay = MakeTraversalRay(
+				glm::vec3(instance.worldToObject * glm::vec4(ray.origin, 1.0f)),
+				glm::mat3(instance.worldToObject) * ray.direction);
+			if (ray.secondary && bottomLevel->secondaryBottomLevel >= 0)
+			{
+				if (instance.instanceId == ray.fromInstance)
+				{
+					objectRay.tStart = std::max(TRAVERSAL_EPSILON, bottomLevel->secondaryError / glm::length(objectRay.direction));
+				}
+				bottomLevel = &bvh.bottomLevels[bottomLevel->secondaryBottomLevel];
+			}
+			const float tBefore = tMin;
+			if (TraceLevel(scene, layout, layout == BVH_LAYOUT_WIDE ? bottomLevel->rootWideNode : bottomLevel->rootNode, false, anyHit, objectRay, tMin, stats))
+			{
+				return true;
+			}
+			if (tMin < tBefore)
+			{
+				stats.hitInstance = instance.instanceId;
+			}
+			continue;
+		}
+
+		++stats.triangles;
+		float t = IntersectTriangle(scene, i, ray);
+		if (t > ray.tStart && t < tMin)
+		{
+			tMin = t;
+			if (anyHit)
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/**
+ * \brief Closest hit in one level of the packed hierarchy, the same front to back stack traversal as raytrace.comp.
+ *        Any-hit queries stop at the first hit closer than tMin and order children like the occlusion traversal of raytrace.comp.
+ * \return true once an any-hit query found a hit
+ */
+static bool
+TraceLevel(
+	const Scene& scene,
+	EBVHLayout layout,
+	int rootNode,
+	bool isTopLevel,
+	bool anyHit,
+	const TraversalRay& ray,
+	float& tMin,
+	TraversalStats& stats
+	)
+{
+	const TwoLevelBVH& bvh = scene.bvh;
+	int stack[BVH::MAX_TRAVERSAL_DEPTH];
+	int stackSize = 0;
+
+	if (layout == BVH_LAYOUT_BINARY)
+	{
+		float tEnter;
+		++stats.boxes;
+		if (IntersectBox(bvh.nodes[rootNode].aabbMin, bvh.nodes[rootNode].aabbMax, ray, tMin, tEnter))
+		{
+			stack[stackSize++] = rootNode;
+		}
+
+		while (stackSize > 0)
+		{
+			const BVHNode& node = bvh.nodes[stack[--stackSize]];
+			++stats.nodes;
+
+			if (node.IsLeaf())
+			{
+				if (TracePrimitives(scene, layout, node.leftFirst, node.primitiveCount, isTopLevel, anyHit, ray, tMin, stats))
+				{
+					return true;
+				}
+				continue;
+			}
+
+			std::pair<float, int> children[2];
+			int hitCount = 0;
+			for (int c = 0; c < 2; ++c)
+			{
+				const BVHNode& child = bvh.nodes[node.leftFirst + c];
+				++stats.boxes;
+				if (IntersectBox(child.aabbMin, child.aabbMax, ray, tMin, tEnter))
+				{
+					children[hitCount++] = std::make_pair(tEnter, node.leftFirst + c);
+				}
+			}
+
+			// Far child first so that the near one is popped next, any-hit queries take the near side of the split axis
+			if (anyHit)
+			{
+				bool nearIsRight = ray.direction[node.SplitAxis()] < 0.0f;
+				if (hitCount == 2 && !nearIsRight)
+				{
+					std::swap(children[0], children[1]);
+				}
+			}
+			else
+			{
+				std::sort(children, children + hitCount, std::greater<std::pair<float, int>>());
+			}
+			for (int c = 0; c < hitCount && stackSize < BVH::MAX_TRAVERSAL_DEPTH; ++c)
+			{
+				stack[stackSize++] = children[c].second;
+			}
+		}
+		return false;
+	}
+
+	stack[stackSize++] = rootNode;
+	while (stackSize > 0)
+	{
+		const WideBVHNode& node = bvh.wideNodes[stack[--stackSize]];
+		++stats.nodes;
+
+		glm::vec3 step;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			int exponent = static_cast<int>((node.exponentsAndInteriorMask >> (8 * axis)) & 0xFF) - 127;
+			step[axis] = std::ldexp(1.0f, exponent);
+		}
+		uint32_t interiorMask = node.exponentsAndInteriorMask >> 24;
+		glm::vec3 directionSign = glm::sign(ray.direction);
+
+		std::pair<float, int> children[WideBVH::WIDTH];
+		int hitCount = 0;
+		for (int c = 0; c < WideBVH::WIDTH; ++c)
+		{
+			if (node.meta[c] == 0)
+			{
+				continue;
+			}
+
+			glm::vec3 boxMin = node.origin + glm::vec3(node.quantizedMin[0][c], node.quantizedMin[1][c], node.quantizedMin[2][c]) * step;
+			glm::vec3 boxMax = node.origin + glm::vec3(node.quantizedMax[0][c], node.quantizedMax[1][c], node.quantizedMax[2][c]) * step;
+
+			float tEnter;
+			++stats.boxes;
+			if (!IntersectBox(boxMin, boxMax, ray, tMin, tEnter))
+			{
+				continue;
+			}
+
+			if (interiorMask & (1u << c))
+			{
+				float key = anyHit ? glm::dot(boxMin + boxMax, directionSign) : tEnter;
+				children[hitCount++] = std::make_pair(key, node.childBase + (node.meta[c] & 7));
+			}
+			else if (TracePrimitives(scene, layout, node.primitiveBase + (node.meta[c] & 31), node.meta[c] >> 5, isTopLevel, anyHit, ray, tMin, stats))
+			{
+				return true;
+			}
+		}
+
+		std::sort(children, children + hitCount, std::greater<std::pair<float, int>>());
+		for (int c = 0; c < hitCount && stackSize < BVH::MAX_TRAVERSAL_DEPTH; ++c)
+		{
+			stack[stackSize++] = children[c].second;
+		}
+	}
+	return false;
+}
+
+/**
+ * \brief Rays from a sphere around the scene towards random points inside it, the same ones on every run
+ * \return radius of the sphere
+ */
+static float
+MakeSceneRays(
+	const TwoLevelBVH& bvh,
+	std::vector<TraversalRay>& outRays,
+	glm::vec3& outCenter
+	)
+{
+	const BVHNode& root = bvh.topLevel.nodes[0];
+	outCenter = (root.aabbMin + root.aabbMax) * 0.5f;
+	float radius = glm::length(root.aabbMax - root.aabbMin) * 0.75f;
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	outRays.resize(TRAVERSAL_RAY_COUNT);
+	for (TraversalRay& ray : outRays)
+	{
+		float z = 2.0f * uniform(random) - 1.0f;
+		float phi = 6.28318530718f * uniform(random);
+		float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+		glm::vec3 origin = outCenter + radius * glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+		glm::vec3 target = root.aabbMin + (root.aabbMax - root.aabbMin) * glm::vec3(uniform(random), uniform(random), uniform(random));
+		ray = MakeTraversalRay(origin, glm::normalize(target - origin));
+	}
+	return radius;
+}
+
+void
+BenchmarkBVHTraversal(
+	const std::vector<std::string>& fileNames
+	)
+{
+	SceneOptions options;
+	options.bvhLayout = BVH_LAYOUT_WIDE;
+	options.useCache = false;
+
+	SceneOptions spatialSplitOptions = options;
+	spatialSplitOptions.spatialSplits = true;
+
+	// The linear BVH the ray tracer builds on the device, only with the binary layout
+	SceneOptions linearOptions = options;
+	linearOptions.bvhLayout = BVH_LAYOUT_BINARY;
+	linearOptions.deviceBvh = true;
+
+	for (const std::string& fileName : fileNames)
+	{
+		// The wide layout keeps its binary BVHs packed as well, so both layouts share the same triangle order
+		Scene scene(fileName, options);
+		Scene spatialSplitScene(fileName, spatialSplitOptions);
+		Scene linearScene(fileName, linearOptions);
+		const TwoLevelBVH& bvh = scene.bvh;
+		if (scene.indices.empty())
+		{
+			continue;
+		}
+
+		std::vector<TraversalRay> rays;
+		glm::vec3 center;
+		float radius = MakeSceneRays(bvh, rays, center);
+
+		printf("\n%s: %zu triangles, %zu with spatial splits, %d rays\n", fileName.c_str(), scene.indices.size(), spatialSplitScene.indices.size(), TRAVERSAL_RAY_COUNT);
+		printf("%10s %10s %10s %10s %12s %12s %12s %10s\n", "layout", "nodes", "bytes/tri", "SAH cost", "nodes/ray", "boxes/ray", "tris/ray", "ms");
+
+		struct Configuration
+		{
+			const char* name;
+			const Scene* scene;
+			EBVHLayout layout;
+		};
+		const Configuration configurations[] = {
+			{ "binary", &scene, BVH_LAYOUT_BINARY },
+			{ "wide", &scene, BVH_LAYOUT_WIDE },
+			{ "sbvh", &spatialSplitScene, BVH_LAYOUT_BINARY },
+			{ "sbvh-wide", &spatialSplitScene, BVH_LAYOUT_WIDE },
+			{ "lbvh", &linearScene, BVH_LAYOUT_BINARY }
+		};
+		const int configurationCount = sizeof(configurations) / sizeof(configurations[0]);
+
+		std::vector<float> hits[configurationCount];
+		for (int c = 0; c < configurationCount; ++c)
+		{
+			const Configuration& configuration = configurations[c];
+			const TwoLevelBVH& configurationBvh = configuration.scene->bvh;
+			TraversalStats stats;
+
+			auto start = std::chrono::high_resolution_clock::now();
+			for (const TraversalRay& ray : rays)
+			{
+				float tMin = FLT_MAX;
+				TraceLevel(*configuration.scene, configuration.layout, 0, true, false, ray, tMin, stats);
+				hits[c].push_back(tMin);
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+
+			// Triangle weighted SAH cost of the bottom levels
+			double sahCost = 0.0;
+			for (const TwoLevelBVH::BottomLevel& bottomLevel : configurationBvh.bottomLevels)
+			{
+				sahCost += static_cast<double>(bottomLevel.bvh.SAHCost()) * bottomLevel.sourceTriangleCount / scene.indices.size();
+			}
+
+			size_t nodeCount = configuration.layout == BVH_LAYOUT_WIDE ? configurationBvh.wideNodes.size() : configurationBvh.nodes.size();
+			size_t nodeBytes = configuration.layout == BVH_LAYOUT_WIDE ? nodeCount * sizeof(WideBVHNode) : nodeCount * sizeof(BVHNode);
+			printf("%10s %10zu %10.1f %10.2f %12.1f %12.1f %12.1f %10.2f\n",
+				configuration.name,
+				nodeCount,
+				static_cast<double>(nodeBytes) / scene.indices.size(),
+				sahCost,
+				static_cast<double>(stats.nodes) / rays.size(),
+				static_cast<double>(stats.boxes) / rays.size(),
+				static_cast<double>(stats.triangles) / rays.size(),
+				std::chrono::duration<double, std::milli>(end - start).count());
+		}
+
+		// Quantized boxes are only ever larger and spatial splits only clip boxes to the triangles inside them,
+		// so every configuration must find the same closest hits as the plain binary BVH
+		for (int c = 1; c < configurationCount; ++c)
+		{
+			int mismatches = 0;
+			for (size_t i = 0; i < rays.size(); ++i)
+			{
+				mismatches += hits[0][i] != hits[c][i] ? 1 : 0;
+			}
+			printf("%d of %zu closest hits differ between binary and %s\n", mismatches, rays.size(), configurations[c].name);
+		}
+
+		// Shadow rays cut off inside the scene, occlusion queries against closest hits with the same cut off
+		float lightDistance = radius;
+		printf("%10s %12s %12s %12s %12s %10s %10s\n", "shadow", "nodes/ray", "any nodes", "tris/ray", "any tris", "ms", "any ms");
+		for (int c = 0; c < configurationCount; ++c)
+		{
+			const Configuration& configuration = configurations[c];
+			TraversalStats closestStats;
+			TraversalStats anyHitStats;
+
+			auto start = std::chrono::high_resolution_clock::now();
+			for (const TraversalRay& ray : rays)
+			{
+				float tMin = lightDistance;
+				TraceLevel(*configuration.scene, configuration.layout, 0, true, false, ray, tMin, closestStats);
+			}
+			auto middle = std::chrono::high_resolution_clock::now();
+
+			int mismatches = 0;
+			for (size_t i = 0; i < rays.size(); ++i)
+			{
+				float tMin = lightDistance;
+				bool occluded = TraceLevel(*configuration.scene, configuration.layout, 0, true, true, rays[i], tMin, anyHitStats);
+				mismatches += occluded != (hits[c][i] < lightDistance) ? 1 : 0;
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+
+			printf("%10s %12.1f %12.1f %12.1f %12.1f %10.2f %10.2f\n",
+				configuration.name,
+				static_cast<double>(closestStats.nodes) / rays.size(),
+				static_cast<double>(anyHitStats.nodes) / rays.size(),
+				static_cast<double>(closestStats.triangles) / rays.size(),
+				static_cast<double>(anyHitStats.triangles) / rays.size(),
+				std::chrono::duration<double, std::milli>(middle - start).count(),
+				std::chrono::duration<double, std::milli>(end - middle).count());
+			if (mismatches > 0)
+			{
+				printf("%d of %zu occlusion queries disagree with the closest hits of %s\n", mismatches, rays.size(), configuration.name);
+			}
+		}
+	}
+}
+
+// -------- Levels of detail -----------
+
+void
+BenchmarkLods(
+	const std::vector<std::string>& fileNames
+	)
+{
+	// Only welded vertices can be collapsed onto each other
+	SceneOptions options;
+	options.useCache = false;
+	options.weldVertices = true;
+	options.generateLods = true;
+
+	for (const std::string& fileName : fileNames)
+	{
+		Scene scene(fileName, options);
+		const GeometryArena& arena = scene.geometryArena;
+		const MeshTable& meshes = scene.meshes;
+		const TwoLevelBVH& bvh = scene.bvh;
+		if (scene.indices.empty() || arena.lods.empty())
+		{
+			continue;
+		}
+
+		// Meshes with fewer levels count their coarsest level for the levels they do not have.
+		// The chains are built again on one thread to time the simplification on its own.
+		std::vector<size_t> levelTriangles(MESH_MAX_LODS, 0);
+		double simplifyTime = 0.0;
+		for (size_t m = 0; m < meshes.Size(); ++m)
+		{
+			for (uint32_t l = 0; l < MESH_MAX_LODS; ++l)
+			{
+				levelTriangles[l] += arena.lods[meshes.firstLod[m] + std::min(l, meshes.lodCount[m] - 1)].indexCount / 3;
+			}
+
+			std::vector<uint32_t> indices(meshes.indexCount[m]);
+			WidenIndices(arena.indices.data() + meshes.firstIndex[m] * arena.indexSize, arena.indexSize, indices.size(), indices.data());
+			std::vector<std::vector<uint32_t>> levels;
+			std::vector<float> errors;
+			auto start = std::chrono::high_resolution_clock::now();
+			BuildLodChain(indices.data(), indices.size(), arena.positions.data() + meshes.baseVertex[m], meshes.vertexCount[m], levels, errors);
+			auto end = std::chrono::high_resolution_clock::now();
+			simplifyTime += std::chrono::duration<double, std::milli>(end - start).count();
+		}
+
+		printf("\n%s: %zu meshes, %zu levels of detail, simplified in %.2f ms on one thread\n", fileName.c_str(), meshes.Size(), arena.lods.size(), simplifyTime);
+		printf("%10s %12s %10s\n", "level", "triangles", "of full");
+		for (uint32_t l = 0; l < MESH_MAX_LODS; ++l)
+		{
+			printf("%10u %12zu %9.1f%%\n", l, levelTriangles[l], levelTriangles[0] == 0 ? 0.0 : 100.0 * levelTriangles[l] / levelTriangles[0]);
+		}
+
+		// Bottom levels without a coarse copy are traced by secondary rays as they are
+		std::vector<bool> isSecondary(bvh.bottomLevels.size(), false);
+		for (const TwoLevelBVH::BottomLevel& bottomLevel : bvh.bottomLevels)
+		{
+			if (bottomLevel.secondaryBottomLevel >= 0)
+			{
+				isSecondary[bottomLevel.secondaryBottomLevel] = true;
+			}
+		}
+		size_t primaryTriangles = 0;
+		size_t secondaryTriangles = 0;
+		for (size_t b = 0; b < bvh.bottomLevels.size(); ++b)
+		{
+			const TwoLevelBVH::BottomLevel& bottomLevel = bvh.bottomLevels[b];
+			primaryTriangles += isSecondary[b] ? 0 : bottomLevel.sourceTriangleCount;
+			secondaryTriangles += isSecondary[b] || bottomLevel.secondaryBottomLevel < 0 ? bottomLevel.sourceTriangleCount : 0;
+		}
+		printf("Ray tracer: %zu triangles for camera rays, %zu for shadow and bounce rays\n", primaryTriangles, secondaryTriangles);
+
+		// Shadow rays from where camera rays hit the scene towards a light above it, through the full and the coarse triangles
+		std::vector<TraversalRay> rays;
+		glm::vec3 center;
+		float radius = MakeSceneRays(bvh, rays, center);
+		glm::vec3 light = center + glm::vec3(0.0f, radius, 0.0f);
+
+		std::vector<TraversalRay> shadowRays;
+		std::vector<float> lightDistances;
+		for (const TraversalRay& ray : rays)
+		{
+			TraversalStats stats;
+			float tMin = FLT_MAX;
+			TraceLevel(scene, bvh.layout, 0, true, false, ray, tMin, stats);
+			if (tMin < FLT_MAX)
+			{
+				glm::vec3 hitPoint = ray.origin + tMin * ray.direction;
+				float lightDistance = glm::length(light - hitPoint);
+				shadowRays.push_back(MakeTraversalRay(hitPoint, (light - hitPoint) / lightDistance));
+				shadowRays.back().fromInstance = stats.hitInstance;
+				lightDistances.push_back(lightDistance);
+			}
+		}
+		if (shadowRays.empty())
+		{
+			continue;
+		}
+
+		printf("%10s %12s %12s %12s %10s\n", "shadow", "nodes/ray", "boxes/ray", "tris/ray", "ms");
+		std::vector<bool> occluded[2];
+		for (int secondary = 0; secondary < 2; ++secondary)
+		{
+			TraversalStats stats;
+			auto start = std::chrono::high_resolution_clock::now();
+			for (size_t i = 0; i < shadowRays.size(); ++i)
+			{
+				TraversalRay ray = shadowRays[i];
+				ray.secondary = secondary != 0;
+				float tMin = lightDistances[i];
+				occluded[secondary].push_back(TraceLevel(scene, bvh.layout, 0, true, true, ray, tMin, stats));
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+
+			printf("%10s %12.1f %12.1f %12.1f %10.2f\n",
+				secondary != 0 ? "coarse" : "full",
+				static_cast<double>(stats.nodes) / shadowRays.size(),
+				static_cast<double>(stats.boxes) / shadowRays.size(),
+				static_cast<double>(stats.triangles) / shadowRays.size(),
+				std::chrono::duration<double, std::milli>(end - start).count());
+		}
+
+		int mismatches = 0;
+		for (size_t i = 0; i < shadowRays.size(); ++i)
+		{
+			mismatches += occluded[0][i] != occluded[1][i] ? 1 : 0;
+		}
+		printf("%d of %zu shadow rays disagree between the full and the coarse triangles\n", mismatches, shadowRays.size());
+	}
+}
+
+// -------- Vertex cache -----------
+
+static VertexCacheStats
+AnalyzeMesh(
+	const Scene& scene,
+	size_t mesh
+	)
+{
+	const GeometryArena& arena = scene.geometryArena;
+	const MeshTable& meshes = scene.meshes;
+	std::vector<uint32_t> indices(meshes.indexCount[mesh]);
+	WidenIndices(arena.indices.data() + meshes.firstIndex[mesh] * arena.indexSize, arena.indexSize, indices.size(), indices.data());
+	return AnalyzeVertexCache(indices.data(), indices.size(), meshes.vertexCount[mesh]);
+}
+
+void
+ReportVertexCache(
+	const std::vector<std::string>& fileNames
+	)
+{
+	SceneOptions options;
+	options.useCache = false;
+
+	SceneOptions optimizedOptions = options;
+	optimizedOptions.optimizeVertexCache = true;
+
+	for (const std::string& fileName : fileNames)
+	{
+		Scene scene(fileName, options);
+		Scene optimizedScene(fileName, optimizedOptions);
+
+		printf("\n%s: %zu meshes, FIFO cache of %u vertices\n", fileName.c_str(), scene.meshes.Size(), VERTEX_CACHE_SIZE);
+		printf("%8s %10s %10s %10s %10s %10s %10s\n", "mesh", "triangles", "vertices", "ACMR", "opt ACMR", "ATVR", "opt ATVR");
+
+		double triangleCount = 0.0;
+		double acmr = 0.0;
+		double optimizedAcmr = 0.0;
+		for (size_t m = 0; m < scene.meshes.Size(); ++m)
+		{
+			const uint32_t meshTriangleCount = scene.meshes.indexCount[m] / 3;
+			VertexCacheStats stats = AnalyzeMesh(scene, m);
+			VertexCacheStats optimizedStats = AnalyzeMesh(optimizedScene, m);
+
+			printf("%8zu %10u %10u %10.3f %10.3f %10.3f %10.3f\n",
+				m,
+				meshTriangleCount,
+				scene.meshes.vertexCount[m],
+				stats.acmr,
+				optimizedStats.acmr,
+				stats.atvr,
+				optimizedStats.atvr);
+
+			triangleCount += meshTriangleCount;
+			acmr += stats.acmr * meshTriangleCount;
+			optimizedAcmr += optimizedStats.acmr * meshTriangleCount;
+		}
+
+		if (triangleCount > 0.0)
+		{
+			printf("%8s %10.0f %10s %10.3f %10.3f\n", "all", triangleCount, "", acmr / triangleCount, optimizedAcmr / triangleCount);
+		}
+	}
+}
+
+// -------- Draw recording -----------
+
+namespace
+{
+	/**
+	 * \brief A mesh the way the renderer used to look it up, allocated on its own with its attributes and buffer offsets in maps
+	 */
+	struct MapMeshData
+	{
+		std::map<EVertexAttributeType, VertexAttributeInfo> vertexAttributes;
+		std::map<EVertexAttributeType, uint64_t> vertexBufferOffsets;
+
+		uint32_t firstIndex;
+		int32_t baseVertex;
+	};
+
+	/**
+	 * \brief Stands in for the vertex and index buffer binds and the indexed draw of one mesh in a command buffer
+	 */
+	struct RecordedDraw
+	{
+		uint64_t positionOffset;
+		uint64_t normalOffset;
+		uint64_t indexOffset;
+		uint32_t indexCount;
+		uint32_t firstIndex;
+		int32_t vertexOffset;
+		uint32_t firstInstance;
+	};
+}
+
+static bool
+SameDraws(
+	const std::vector<RecordedDraw>& a,
+	const std::vector<RecordedDraw>& b
+	)
+{
+	return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(RecordedDraw)) == 0;
+}
+
+void
+BenchmarkDrawRecording(
+	const std::vector<int>& meshCounts
+	)
+{
+	printf("%10s %12s %12s %10s %12s\n", "meshes", "map ms", "table ms", "speedup", "same draws");
+
+	std::mt19937 random(1);
+	std::uniform_int_distribution<uint32_t> triangleCounts(1, 4096);
+	for (int meshCount : meshCounts)
+	{
+		// The same meshes in both layouts, packed back to back like the arena
+		MeshTable table;
+		std::vector<MapMeshData*> mapMeshes;
+		uint32_t firstIndex = 0;
+		for (int m = 0; m < meshCount; ++m)
+		{
+			MeshData mesh;
+			mesh.indexCount = 3 * triangleCounts(random);
+			mesh.firstIndex = firstIndex;
+			mesh.baseVertex = static_cast<int32_t>(firstIndex / 2);
+			mesh.vertexCount = mesh.indexCount / 2;
+			mesh.vertexAttributes[INDEX] = { sizeof(uint16_t), mesh.indexCount, 1, sizeof(uint16_t) };
+			mesh.vertexAttributes[POSITION] = { sizeof(glm::vec3), mesh.vertexCount, 3, sizeof(float) };
+			mesh.vertexAttributes[NORMAL] = { sizeof(glm::vec3), mesh.vertexCount, 3, sizeof(float) };
+			table.Add(mesh);
+			firstIndex += mesh.indexCount;
+
+			MapMeshData* mapMesh = new MapMeshData();
+			for (int attribute = INDEX; attribute <= NORMAL; ++attribute)
+			{
+				mapMesh->vertexAttributes.insert(std::make_pair(static_cast<EVertexAttributeType>(attribute), mesh.vertexAttributes[attribute]));
+			}
+			mapMesh->vertexBufferOffsets[INDEX] = 0;
+			mapMesh->vertexBufferOffsets[POSITION] = 1 << 20;
+			mapMesh->vertexBufferOffsets[NORMAL] = 1 << 21;
+			mapMesh->firstIndex = mesh.firstIndex;
+			mapMesh->baseVertex = mesh.baseVertex;
+			mapMeshes.push_back(mapMesh);
+		}
+		const uint64_t tableOffsets[VERTEX_ATTRIBUTE_COUNT] = { 0, 1 << 20, 1 << 21, 0 };
+
+		std::vector<RecordedDraw> mapDraws(meshCount);
+		std::vector<RecordedDraw> tableDraws(meshCount);
+		std::vector<double> mapTimes;
+		std::vector<double> tableTimes;
+		for (int run = 0; run < BENCHMARK_RUN_COUNT; ++run)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			for (int m = 0; m < meshCount; ++m)
+			{
+				const MapMeshData* mesh = mapMeshes[m];
+				RecordedDraw& draw = mapDraws[m];
+				draw.positionOffset = mesh->vertexBufferOffsets.at(POSITION);
+				draw.normalOffset = mesh->vertexBufferOffsets.at(NORMAL);
+				draw.indexOffset = mesh->vertexBufferOffsets.at(INDEX);
+				draw.indexCount = static_cast<uint32_t>(mesh->vertexAttributes.at(INDEX).count);
+				draw.firstIndex = mesh->firstIndex;
+				draw.vertexOffset = mesh->baseVertex;
+				draw.firstInstance = static_cast<uint32_t>(m);
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			mapTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+
+			start = std::chrono::high_resolution_clock::now();
+			for (int m = 0; m < meshCount; ++m)
+			{
+				RecordedDraw& draw = tableDraws[m];
+				draw.positionOffset = tableOffsets[POSITION];
+				draw.normalOffset = tableOffsets[NORMAL];
+				draw.indexOffset = tableOffsets[INDEX];
+				draw.indexCount = table.indexCount[m];
+				draw.firstIndex = table.firstIndex[m];
+				draw.vertexOffset = table.baseVertex[m];
+				draw.firstInstance = static_cast<uint32_t>(m);
+			}
+			end = std::chrono::high_resolution_clock::now();
+			tableTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+		}
+
+		std::sort(mapTimes.begin(), mapTimes.end());
+		std::sort(tableTimes.begin(), tableTimes.end());
+		double mapMedian = mapTimes[mapTimes.size() / 2];
+		double tableMedian = tableTimes[tableTimes.size() / 2];
+		printf("%10d %12.3f %12.3f %9.2fx %12s\n",
+			meshCount,
+			mapMedian,
+			tableMedian,
+			tableMedian > 0.0 ? mapMedian / tableMedian : 0.0,
+			SameDraws(mapDraws, tableDraws) ? "yes" : "NO");
+
+		for (MapMeshData* mesh : mapMeshes)
+		{
+			delete mesh;
+		}
+	}
+}
+
+// -------- Vertex transform -----------
+
+namespace
+{
+	/**
+	 * \brief Everything a primitive decodes its vertices into
+	 */
+	struct TransformedVertices
+	{
+		std::vector<glm::vec3> worldPositions;
+		std::vector<glm::vec4> storedPositions;
+		std::vector<glm::vec3> worldNormals;
+		std::vector<uint32_t> encodedNormals;
+
+		explicit TransformedVertices(
+			size_t vertexCount
+			)
+			: worldPositions(vertexCount),
+			storedPositions(vertexCount),
+			worldNormals(vertexCount),
+			encodedNormals(vertexCount)
+		{
+		}
+	};
+}
+
+template <typename T>
+static bool
+SameValues(
+	const std::vector<T>& a,
+	const std::vector<T>& b
+	)
+{
+	return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0;
+}
+
+static bool
+SameVertices(
+	const TransformedVertices& a,
+	const TransformedVertices& b
+	)
+{
+	return SameValues(a.worldPositions, b.worldPositions) &&
+		SameValues(a.storedPositions, b.storedPositions) &&
+		SameValues(a.worldNormals, b.worldNormals) &&
+		SameValues(a.encodedNormals, b.encodedNormals);
+}
+
+void
+BenchmarkVertexTransform(
+	size_t vertexCount
+	)
+{
+	// Random vertices under a node with rotation, non-uniform scale and translation
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> coordinates(-100.0f, 100.0f);
+	std::uniform_real_distribution<float> directions(-1.0f, 1.0f);
+	std::vector<glm::vec3> positions(vertexCount);
+	std::vector<glm::vec3> normals(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		positions[v] = glm::vec3(coordinates(random), coordinates(random), coordinates(random));
+		normals[v] = glm::vec3(directions(random), directions(random), directions(random));
+	}
+
+	glm::mat4 matrix = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f, -2.0f, 10.0f)) *
+		glm::rotate(glm::mat4(1.0f), 0.7f, glm::normalize(glm::vec3(1.0f, 2.0f, 3.0f))) *
+		glm::scale(glm::mat4(1.0f), glm::vec3(2.0f, 0.5f, 1.5f));
+	glm::mat3 matrixNormal = glm::transpose(glm::inverse(glm::mat3(matrix)));
+
+	printf("%u vertices, single thread\n", static_cast<unsigned>(vertexCount));
+	printf("%10s %14s %12s %10s %10s\n", "path", "positions ms", "normals ms", "speedup", "same");
+
+	// Per vertex with glm, the way primitives were decoded
+	TransformedVertices reference(vertexCount);
+	std::vector<double> positionTimes;
+	std::vector<double> normalTimes;
+	for (int run = 0; run < BENCHMARK_RUN_COUNT; ++run)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			glm::vec4 worldPosition = matrix * glm::vec4(positions[v], 1.0f);
+			reference.storedPositions[v] = worldPosition;
+			reference.worldPositions[v] = glm::vec3(worldPosition);
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		positionTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+
+		start = std::chrono::high_resolution_clock::now();
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			glm::vec3 worldNormal = glm::normalize(matrixNormal * normals[v]);
+			reference.encodedNormals[v] = EncodeOctahedral(worldNormal);
+			reference.worldNormals[v] = worldNormal;
+		}
+		end = std::chrono::high_resolution_clock::now();
+		normalTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+	}
+	std::sort(positionTimes.begin(), positionTimes.end());
+	std::sort(normalTimes.begin(), normalTimes.end());
+	double referenceMedian = positionTimes[positionTimes.size() / 2] + normalTimes[normalTimes.size() / 2];
+	printf("%10s %14.2f %12.2f %9.2fx %10s\n", "glm", positionTimes[positionTimes.size() / 2], normalTimes[normalTimes.size() / 2], 1.0, "yes");
+
+	// Batch kernels at every level up to the detected one
+	const ESimdLevel detected = DetectSimdLevel();
+	for (int level = SIMD_LEVEL_SCALAR; level <= detected; ++level)
+	{
+		SetSimdLevel(static_cast<ESimdLevel>(level));
+
+		TransformedVertices batch(vertexCount);
+		positionTimes.clear();
+		normalTimes.clear();
+		for (int run = 0; run < BENCHMARK_RUN_COUNT; ++run)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			TransformPositions(positions.data(), vertexCount, matrix, false, batch.worldPositions.data(), batch.storedPositions.data());
+			auto end = std::chrono::high_resolution_clock::now();
+			positionTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+
+			start = std::chrono::high_resolution_clock::now();
+			TransformNormals(normals.data(), vertexCount, matrixNormal, false, batch.worldNormals.data(), batch.encodedNormals.data());
+			end = std::chrono::high_resolution_clock::now();
+			normalTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+		}
+		std::sort(positionTimes.begin(), positionTimes.end());
+		std::sort(normalTimes.begin(), normalTimes.end());
+		double median = positionTimes[positionTimes.size() / 2] + normalTimes[normalTimes.size() / 2];
+		printf("%10s %14.2f %12.2f %9.2fx %10s\n",
+			SimdLevelName(static_cast<ESimdLevel>(level)),
+			positionTimes[positionTimes.size() / 2],
+			normalTimes[normalTimes.size() / 2],
+			median > 0.0 ? referenceMedian / median : 0.0,
+			SameVertices(reference, batch) ? "yes" : "NO");
+	}
+	SetSimdLevel(detected);
+}
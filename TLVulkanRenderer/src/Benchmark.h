@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/**
+ * \brief Rebuild the triangle BVH of each scene with 1 up to maxThreadCount threads and print the build times.
+ *        Also checks that every thread count produces exactly the same tree.
+ * \param fileNames glTF scenes to load
+ * \param maxThreadCount 0 uses every hardware thread
+ */
+void
+BenchmarkBVHBuild(
+	const std::vector<std::string>& fileNames,
+	int maxThreadCount = 0
+);
+
+/**
+ * \brief Trace the same random rays through the binary and the wide BVH layout of each scene on the CPU, built with and without spatial splits, and through the linear BVH built for the device.
+ *        Prints bytes per triangle, SAH cost and the nodes, boxes and triangles each ray visits, and checks that all of them find the same hits.
+ *        Then compares any-hit occlusion queries with closest hit queries over the same shadow ray length.
+ * \param fileNames glTF scenes to load
+ */
+void
+BenchmarkBVHTraversal(
+	const std::vector<std::string>& fileNames
+);
+
+/**
+ * \brief Load each scene with levels of detail and print the triangles of every level and the time simplification takes.
+ *        Then traces shadow rays from camera ray hits through the full triangles and through the coarse copy secondary rays may use,
+ *        and prints the work per ray and how many rays the two disagree on.
+ * \param fileNames glTF scenes to load
+ */
+void
+BenchmarkLods(
+	const std::vector<std::string>& fileNames
+);
+
+/**
+ * \brief Print the simulated post-transform cache behaviour, ACMR and ATVR, of every mesh of each scene as loaded and with SceneOptions::optimizeVertexCache
+ * \param fileNames glTF scenes to load
+ */
+void
+ReportVertexCache(
+	const std::vector<std::string>& fileNames
+);
+
+/**
+ * \brief Time recording one draw per mesh from the mesh table against the per-mesh maps the renderer used to look meshes up in,
+ *        over synthetic scenes of each mesh count. Only the CPU side of recording is timed, the draws go to a plain array.
+ */
+void
+BenchmarkDrawRecording(
+	const std::vector<int>& meshCounts
+);
+
+/**
+ * \brief Time transforming the positions and normals of a synthetic mesh by a node matrix one vertex at a time with glm,
+ *        then with TransformPositions and TransformNormals at every SIMD level this CPU supports, and check that all of them write the same vertices
+ */
+void
+BenchmarkVertexTransform(
+	size_t vertexCount
+);
@@ -0,0 +1,63 @@
+#include "BinaryStream.h"
+
+// -------- Writer -----------
+
+void
+BinaryWriter::WriteString(
+	const std::string& value
+	)
+{
+	Write<uint64_t>(value.size());
+	m_data.insert(m_data.end(), value.begin(), value.end());
+}
+
+const std::vector<Byte>&
+BinaryWriter::Data() const
+{
+	return m_data;
+}
+
+void
+BinaryWriter::Align()
+{
+	m_data.resize((m_data.size() + ARRAY_ALIGNMENT - 1) / ARRAY_ALIGNMENT * ARRAY_ALIGNMENT, 0);
+}
+
+// -------- Reader -----------
+
+BinaryReader::BinaryReader(
+	const Byte* data,
+	size_t size
+	) :
+	m_data(data),
+	m_size(size),
+	m_offset(0)
+{
+}
+
+bool
+BinaryReader::ReadString(
+	std::string& outValue
+	)
+{
+	uint64_t length;
+	if (!Read(length) || length > m_size - m_offset)
+	{
+		return false;
+	}
+	outValue.assign(reinterpret_cast<const char*>(m_data + m_offset), static_cast<size_t>(length));
+	m_offset += static_cast<size_t>(length);
+	return true;
+}
+
+bool
+BinaryReader::Align()
+{
+	size_t aligned = (m_offset + BinaryWriter::ARRAY_ALIGNMENT - 1) / BinaryWriter::ARRAY_ALIGNMENT * BinaryWriter::ARRAY_ALIGNMENT;
+	if (aligned > m_size)
+	{
+		return false;
+	}
+	m_offset = aligned;
+	return true;
+}
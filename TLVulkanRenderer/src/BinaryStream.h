@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "Typedef.h"
+
+/**
+ * \brief Appends plain values and arrays to a byte buffer.
+ *        Array payloads start on ARRAY_ALIGNMENT so that a mapped file can be read with aligned copies.
+ */
+class BinaryWriter
+{
+public:
+
+	static const size_t ARRAY_ALIGNMENT = 16;
+
+	template <typename T>
+	void
+	Write(
+		const T& value
+		)
+	{
+		static_assert(std::is_standard_layout<T>::value, "Only plain values can be written");
+		const Byte* bytes = reinterpret_cast<const Byte*>(&value);
+		m_data.insert(m_data.end(), bytes, bytes + sizeof(T));
+	}
+
+	template <typename T>
+	void
+	WriteVector(
+		const std::vector<T>& values
+		)
+	{
+		static_assert(std::is_standard_layout<T>::value, "Only plain values can be written");
+		Write<uint64_t>(values.size());
+		Align();
+		const Byte* bytes = reinterpret_cast<const Byte*>(values.data());
+		m_data.insert(m_data.end(), bytes, bytes + values.size() * sizeof(T));
+	}
+
+	void
+	WriteString(
+		const std::string& value
+	);
+
+	const std::vector<Byte>&
+	Data() const;
+
+private:
+
+	void
+	Align();
+
+	std::vector<Byte> m_data;
+};
+
+/**
+ * \brief Reads back what a BinaryWriter wrote. Every read is bounds checked and returns false once the data ran out,
+ *        so a truncated or corrupted file is rejected instead of read past its end.
+ */
+class BinaryReader
+{
+public:
+	BinaryReader(
+		const Byte* data,
+		size_t size
+	);
+
+	template <typename T>
+	bool
+	Read(
+		T& outValue
+		)
+	{
+		static_assert(std::is_standard_layout<T>::value, "Only plain values can be read");
+		if (m_size - m_offset < sizeof(T))
+		{
+			return false;
+		}
+		std::memcpy(&outValue, m_data + m_offset, sizeof(T));
+		m_offset += sizeof(T);
+		return true;
+	}
+
+	template <typename T>
+	bool
+	ReadVector(
+		std::vector<T>& outValues
+		)
+	{
+		static_assert(std::is_standard_layout<T>::value, "Only plain values can be read");
+		uint64_t count;
+		if (!Read(count) || !Align() || count > (m_size - m_offset) / sizeof(T))
+		{
+			return false;
+		}
+		outValues.resize(static_cast<size_t>(count));
+		std::memcpy(outValues.data(), m_data + m_offset, outValues.size() * sizeof(T));
+		m_offset += outValues.size() * sizeof(T);
+		return true;
+	}
+
+	bool
+	ReadString(
+		std::string& outValue
+	);
+
+private:
+
+	bool
+	Align();
+
+	const Byte* m_data;
+	size_t m_size;
+	size_t m_offset;
+};
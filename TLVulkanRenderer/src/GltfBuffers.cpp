@@ -0,0 +1,268 @@
+#include <algorithm>
+#include <cstdio>
+#include "GltfBuffers.h"
+
+// Binary glTF 1.0 header: magic, version, length, scene length and scene format, followed by the JSON scene and the body
+static const size_t BINARY_GLTF_HEADER_SIZE = 20;
+
+static std::string
+GetDirectory(
+	const std::string& fileName
+	)
+{
+	size_t separator = fileName.find_last_of("/\\");
+	return separator == std::string::npos ? std::string() : fileName.substr(0, separator + 1);
+}
+
+bool
+GltfBuffers::Open(
+	const tinygltf::Scene& scene,
+	const std::string& fileName,
+	const MappedFile* binaryFile
+	)
+{
+	m_scene = &scene;
+	m_buffers.clear();
+	m_files.clear();
+	m_mappedSize = 0;
+
+	for (const auto& namedBuffer : scene.buffers)
+	{
+		const tinygltf::Buffer& buffer = namedBuffer.second;
+
+		// Data URIs were decoded by the loader
+		if (!buffer.data.empty())
+		{
+			m_buffers[namedBuffer.first] = { buffer.data.data(), buffer.data.size() };
+			continue;
+		}
+
+		// The body of binary glTF, which the loader already validated
+		if (binaryFile != nullptr && buffer.uri.compare("data:,") == 0)
+		{
+			uint32_t length;
+			uint32_t sceneLength;
+			std::memcpy(&length, binaryFile->Data() + 8, sizeof(uint32_t));
+			std::memcpy(&sceneLength, binaryFile->Data() + 12, sizeof(uint32_t));
+			size_t bodyOffset = BINARY_GLTF_HEADER_SIZE + sceneLength;
+			m_buffers[namedBuffer.first] = { binaryFile->Data() + bodyOffset, length - bodyOffset };
+			continue;
+		}
+
+		std::unique_ptr<MappedFile> file(new MappedFile());
+		if (!file->Open(GetDirectory(fileName) + buffer.uri))
+		{
+			printf("Failed to map glTF buffer %s\n", buffer.uri.c_str());
+			return false;
+		}
+		m_buffers[namedBuffer.first] = { file->Data(), file->Size() };
+		m_mappedSize += file->Size();
+		m_files.push_back(std::move(file));
+	}
+
+	if (binaryFile != nullptr)
+	{
+		m_mappedSize += binaryFile->Size();
+	}
+
+	// Reject views past the end of their buffer up front, accessors are only checked against their view
+	for (const auto& namedView : scene.bufferViews)
+	{
+		const tinygltf::BufferView& bufferView = namedView.second;
+		auto buffer = m_buffers.find(bufferView.buffer);
+		if (buffer == m_buffers.end() || bufferView.byteOffset + bufferView.byteLength > buffer->second.size)
+		{
+			printf("glTF buffer view %s does not fit in buffer %s\n", namedView.first.c_str(), bufferView.buffer.c_str());
+			return false;
+		}
+	}
+
+	return true;
+}
+
+AccessorReader
+GltfBuffers::Reader(
+	const tinygltf::Accessor& accessor
+	) const
+{
+	size_t componentSize = AccessorReader::ComponentSize(accessor.componentType);
+	int componentCount = AccessorReader::ComponentCount(accessor.type);
+	size_t elementSize = componentSize * componentCount;
+	if (elementSize == 0)
+	{
+		printf("glTF accessor %s has an unsupported type\n", accessor.name.c_str());
+		return AccessorReader();
+	}
+
+	size_t byteStride = accessor.byteStride != 0 ? accessor.byteStride : elementSize;
+	const Byte* data = AccessorData(accessor, byteStride, elementSize);
+	if (data == nullptr)
+	{
+		return AccessorReader();
+	}
+	return AccessorReader(data, byteStride, accessor.count, accessor.componentType, componentCount, accessor.normalized);
+}
+
+size_t
+GltfBuffers::MappedSize() const
+{
+	return m_mappedSize;
+}
+
+const Byte*
+GltfBuffers::AccessorData(
+	const tinygltf::Accessor& accessor,
+	size_t byteStride,
+	size_t elementSize
+	) const
+{
+	auto bufferView = m_scene->bufferViews.find(accessor.bufferView);
+	if (bufferView == m_scene->bufferViews.end())
+	{
+		return nullptr;
+	}
+
+	// The last element has to end inside the view, a byte length of 0 means the rest of the buffer
+	const BufferBytes& buffer = m_buffers.at(bufferView->second.buffer);
+	size_t viewLength = bufferView->second.byteLength != 0 ? bufferView->second.byteLength : buffer.size - bufferView->second.byteOffset;
+	size_t end = accessor.count == 0 ? accessor.byteOffset : accessor.byteOffset + (accessor.count - 1) * byteStride + elementSize;
+	if (end > viewLength)
+	{
+		printf("glTF accessor %s does not fit in buffer view %s\n", accessor.name.c_str(), accessor.bufferView.c_str());
+		return nullptr;
+	}
+
+	return buffer.data + bufferView->second.byteOffset + accessor.byteOffset;
+}
+
+// -------- Accessor reader -----------
+
+AccessorReader::AccessorReader(
+	const Byte* data,
+	size_t byteStride,
+	size_t count,
+	int componentType,
+	int componentCount,
+	bool normalized
+	) :
+	m_data(data),
+	m_byteStride(byteStride),
+	m_count(count),
+	m_componentType(componentType),
+	m_componentCount(componentCount),
+	m_componentSize(ComponentSize(componentType)),
+	m_normalized(normalized)
+{
+}
+
+size_t
+AccessorReader::ComponentSize(
+	int componentType
+	)
+{
+	switch (componentType)
+	{
+	case TINYGLTF_COMPONENT_TYPE_BYTE:
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+		return 1;
+	case TINYGLTF_COMPONENT_TYPE_SHORT:
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+		return 2;
+	case TINYGLTF_COMPONENT_TYPE_INT:
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+	case TINYGLTF_COMPONENT_TYPE_FLOAT:
+		return 4;
+	case TINYGLTF_COMPONENT_TYPE_DOUBLE:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+int
+AccessorReader::ComponentCount(
+	int type
+	)
+{
+	switch (type)
+	{
+	case TINYGLTF_TYPE_SCALAR:
+		return 1;
+	case TINYGLTF_TYPE_VEC2:
+		return 2;
+	case TINYGLTF_TYPE_VEC3:
+		return 3;
+	case TINYGLTF_TYPE_VEC4:
+	case TINYGLTF_TYPE_MAT2:
+		return 4;
+	case TINYGLTF_TYPE_MAT3:
+		return 9;
+	case TINYGLTF_TYPE_MAT4:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+template <typename T>
+static T
+ReadComponent(
+	const Byte* data
+	)
+{
+	T value;
+	std::memcpy(&value, data, sizeof(T));
+	return value;
+}
+
+float
+AccessorReader::ReadFloat(
+	size_t element,
+	int component
+	) const
+{
+	const Byte* data = m_data + element * m_byteStride + component * m_componentSize;
+	switch (m_componentType)
+	{
+	// Normalized signed integers are clamped, the two smallest values both map to -1
+	case TINYGLTF_COMPONENT_TYPE_BYTE:
+		return m_normalized ? std::max(ReadComponent<int8_t>(data) / 127.0f, -1.0f) : ReadComponent<int8_t>(data);
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+		return m_normalized ? ReadComponent<uint8_t>(data) / 255.0f : ReadComponent<uint8_t>(data);
+	case TINYGLTF_COMPONENT_TYPE_SHORT:
+		return m_normalized ? std::max(ReadComponent<int16_t>(data) / 32767.0f, -1.0f) : ReadComponent<int16_t>(data);
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+		return m_normalized ? ReadComponent<uint16_t>(data) / 65535.0f : ReadComponent<uint16_t>(data);
+	case TINYGLTF_COMPONENT_TYPE_INT:
+		return static_cast<float>(ReadComponent<int32_t>(data));
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+		return static_cast<float>(ReadComponent<uint32_t>(data));
+	case TINYGLTF_COMPONENT_TYPE_DOUBLE:
+		return static_cast<float>(ReadComponent<double>(data));
+	default:
+		return ReadComponent<float>(data);
+	}
+}
+
+uint32_t
+AccessorReader::ReadUint(
+	size_t element,
+	int component
+	) const
+{
+	const Byte* data = m_data + element * m_byteStride + component * m_componentSize;
+	switch (m_componentType)
+	{
+	case TINYGLTF_COMPONENT_TYPE_BYTE:
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+		return ReadComponent<uint8_t>(data);
+	case TINYGLTF_COMPONENT_TYPE_SHORT:
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+		return ReadComponent<uint16_t>(data);
+	case TINYGLTF_COMPONENT_TYPE_INT:
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+		return ReadComponent<uint32_t>(data);
+	default:
+		return static_cast<uint32_t>(ReadFloat(element, component));
+	}
+}
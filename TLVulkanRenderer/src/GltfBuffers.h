@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+#include "tinygltfloader/tiny_gltf_loader.h"
+
+/**
+ * \brief Elements of an accessor of any glTF component type, converted as they are read.
+ *        Integers are read as they are, or mapped to [0, 1] and [-1, 1] if the accessor is normalized.
+ */
+class AccessorReader
+{
+public:
+	AccessorReader() :
+		m_data(nullptr),
+		m_byteStride(0),
+		m_count(0),
+		m_componentType(TINYGLTF_COMPONENT_TYPE_FLOAT),
+		m_componentCount(0),
+		m_componentSize(0),
+		m_normalized(false)
+	{
+	}
+
+	AccessorReader(
+		const Byte* data,
+		size_t byteStride,
+		size_t count,
+		int componentType,
+		int componentCount,
+		bool normalized
+	);
+
+	/**
+	 * \brief Bytes per component of a TINYGLTF_COMPONENT_TYPE_***, 0 if unknown
+	 */
+	static size_t
+	ComponentSize(
+		int componentType
+	);
+
+	/**
+	 * \brief Components per element of a TINYGLTF_TYPE_***, 0 if unknown
+	 */
+	static int
+	ComponentCount(
+		int type
+	);
+
+	float
+	ReadFloat(
+		size_t element,
+		int component
+	) const;
+
+	uint32_t
+	ReadUint(
+		size_t element,
+		int component
+	) const;
+
+	/**
+	 * \brief Element as a float vector, components the accessor does not have are 0
+	 */
+	template <typename V>
+	V
+	ReadVector(
+		size_t element
+		) const
+	{
+		const int vectorLength = static_cast<int>(sizeof(V) / sizeof(float));
+		V value(0.0f);
+		if (m_componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && m_componentCount >= vectorLength)
+		{
+			std::memcpy(&value, m_data + element * m_byteStride, sizeof(V));
+			return value;
+		}
+		for (int c = 0; c < vectorLength && c < m_componentCount; ++c)
+		{
+			value[c] = ReadFloat(element, c);
+		}
+		return value;
+	}
+
+	size_t
+	Count() const
+	{
+		return m_count;
+	}
+
+	bool
+	Empty() const
+	{
+		return m_count == 0;
+	}
+
+	int
+	ComponentType() const
+	{
+		return m_componentType;
+	}
+
+	size_t
+	ComponentSize() const
+	{
+		return m_componentSize;
+	}
+
+	/**
+	 * \brief True if the elements are tightly packed and can be converted in bulk from Data()
+	 */
+	bool
+	IsPacked() const
+	{
+		return m_byteStride == m_componentSize * m_componentCount;
+	}
+
+	const Byte*
+	Data() const
+	{
+		return m_data;
+	}
+
+private:
+	const Byte* m_data;
+	size_t m_byteStride;
+	size_t m_count;
+	int m_componentType;
+	int m_componentCount;
+	size_t m_componentSize;
+	bool m_normalized;
+};
+
+/**
+ * \brief Bytes of every buffer of a glTF scene without copying them. External .bin files and the body of binary glTF are mapped,
+ *        the few buffers embedded as data URIs are used from the loaded scene. Load the scene with TinyGLTFLoader::SetLoadBufferData(false).
+ */
+class GltfBuffers
+{
+public:
+	/**
+	 * \param scene must outlive the views handed out
+	 * \param binaryFile mapping of the file itself for binary glTF, nullptr for ASCII glTF
+	 * \return false if a buffer could not be mapped or is shorter than its views
+	 */
+	bool
+	Open(
+		const tinygltf::Scene& scene,
+		const std::string& fileName,
+		const MappedFile* binaryFile
+	);
+
+	/**
+	 * \brief Elements of an accessor whatever their component type, empty if they do not fit inside their buffer view or the type is unknown
+	 */
+	AccessorReader
+	Reader(
+		const tinygltf::Accessor& accessor
+	) const;
+
+	/**
+	 * \brief Bytes of buffers mapped from disk, only the pages touched while loading become resident
+	 */
+	size_t
+	MappedSize() const;
+
+private:
+	const Byte*
+	AccessorData(
+		const tinygltf::Accessor& accessor,
+		size_t byteStride,
+		size_t elementSize
+	) const;
+
+	struct BufferBytes
+	{
+		const Byte* data;
+		size_t size;
+	};
+
+	const tinygltf::Scene* m_scene = nullptr;
+	std::map<std::string, BufferBytes> m_buffers;
+	std::vector<std::unique_ptr<MappedFile>> m_files;
+	size_t m_mappedSize = 0;
+};
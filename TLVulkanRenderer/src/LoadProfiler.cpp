@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <new>
+#include "LoadProfiler.h"
+#include "Utilities.h"
+
+static std::atomic<uint64_t> g_allocationCount(0);
+static std::atomic<uint64_t> g_allocatedBytes(0);
+
+// Stages the calling thread has open, the depth of the next one it begins
+static thread_local int g_openStageCount = 0;
+
+// -------- Allocation counting -----------
+
+// Every allocation through new goes through these replacements, the counters are only ever read as differences
+void*
+operator new(
+	std::size_t size
+	)
+{
+	g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+	g_allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	void* memory = std::malloc(size > 0 ? size : 1);
+	if (memory == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void*
+operator new[](
+	std::size_t size
+	)
+{
+	return operator new(size);
+}
+
+void
+operator delete(
+	void* memory
+	) noexcept
+{
+	std::free(memory);
+}
+
+void
+operator delete[](
+	void* memory
+	) noexcept
+{
+	std::free(memory);
+}
+
+void
+operator delete(
+	void* memory,
+	std::size_t
+	) noexcept
+{
+	std::free(memory);
+}
+
+void
+operator delete[](
+	void* memory,
+	std::size_t
+	) noexcept
+{
+	std::free(memory);
+}
+
+AllocationCounts
+CountAllocations()
+{
+	AllocationCounts counts;
+	counts.count = g_allocationCount.load(std::memory_order_relaxed);
+	counts.bytes = g_allocatedBytes.load(std::memory_order_relaxed);
+	return counts;
+}
+
+// -------- Stages -----------
+
+LoadProfiler::LoadProfiler()
+	: m_start(std::chrono::high_resolution_clock::now())
+{
+	// Growing the table is counted against the stages open at the time, keep that out of the way
+	m_stages.reserve(256);
+}
+
+LoadProfiler&
+LoadProfiler::Global()
+{
+	static LoadProfiler profiler;
+	return profiler;
+}
+
+size_t
+LoadProfiler::BeginStage(
+	const char* name
+	)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	std::thread::id threadId = std::this_thread::get_id();
+	auto thread = std::find(m_threads.begin(), m_threads.end(), threadId);
+	if (thread == m_threads.end())
+	{
+		thread = m_threads.insert(m_threads.end(), threadId);
+	}
+
+	// Until the stage ends its counts hold the totals it started from
+	AllocationCounts allocations = CountAllocations();
+	ProfileStage stage;
+	stage.name = name;
+	stage.thread = static_cast<int>(thread - m_threads.begin());
+	stage.depth = g_openStageCount++;
+	stage.startMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - m_start).count();
+	stage.durationMs = 0.0;
+	stage.allocationCount = allocations.count;
+	stage.allocatedBytes = allocations.bytes;
+	stage.finished = false;
+	m_stages.push_back(stage);
+	return m_stages.size() - 1;
+}
+
+void
+LoadProfiler::EndStage(
+	size_t stage
+	)
+{
+	auto end = std::chrono::high_resolution_clock::now();
+	AllocationCounts allocations = CountAllocations();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	ProfileStage& profileStage = m_stages[stage];
+	profileStage.durationMs = std::chrono::duration<double, std::milli>(end - m_start).count() - profileStage.startMs;
+	profileStage.allocationCount = allocations.count - profileStage.allocationCount;
+	profileStage.allocatedBytes = allocations.bytes - profileStage.allocatedBytes;
+	profileStage.finished = true;
+	--g_openStageCount;
+}
+
+double
+LoadProfiler::StageElapsedMs(
+	size_t stage
+	) const
+{
+	auto now = std::chrono::high_resolution_clock::now();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	const ProfileStage& profileStage = m_stages[stage];
+	if (profileStage.finished)
+	{
+		return profileStage.durationMs;
+	}
+	return std::chrono::duration<double, std::milli>(now - m_start).count() - profileStage.startMs;
+}
+
+std::vector<ProfileStage>
+LoadProfiler::Stages() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stages;
+}
+
+// -------- Output -----------
+
+void
+LoadProfiler::Print() const
+{
+	std::vector<ProfileStage> stages = Stages();
+
+	printf("Startup profile, %zu stages:\n", stages.size());
+	printf("  %-40s %6s %10s %10s %12s %10s\n", "stage", "thread", "start ms", "time ms", "allocations", "alloc MB");
+	for (const ProfileStage& stage : stages)
+	{
+		std::string name = std::string(2 * stage.depth, ' ') + stage.name;
+		if (!stage.finished)
+		{
+			printf("  %-40s %6d %10.2f %10s\n", name.c_str(), stage.thread, stage.startMs, "running");
+			continue;
+		}
+		printf("  %-40s %6d %10.2f %10.2f %12llu %10.2f\n",
+			name.c_str(),
+			stage.thread,
+			stage.startMs,
+			stage.durationMs,
+			static_cast<unsigned long long>(stage.allocationCount),
+			stage.allocatedBytes / (1024.0 * 1024.0));
+	}
+
+	AllocationCounts allocations = CountAllocations();
+	printf("  %llu allocations, %.1f MB allocated in total, peak RSS %.1f MB\n",
+		static_cast<unsigned long long>(allocations.count),
+		allocations.bytes / (1024.0 * 1024.0),
+		PeakResidentSetSize() / (1024.0 * 1024.0));
+}
+
+bool
+LoadProfiler::WriteJson(
+	const std::string& fileName
+	) const
+{
+	std::vector<ProfileStage> stages = Stages();
+	AllocationCounts allocations = CountAllocations();
+
+	std::ofstream file(fileName, std::ios::trunc);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	// Stage names are literals from the instrumented code, none of them need escaping
+	file << std::fixed << std::setprecision(3);
+	file << "{\n";
+	file << "\t\"allocationCount\": " << allocations.count << ",\n";
+	file << "\t\"allocatedBytes\": " << allocations.bytes << ",\n";
+	file << "\t\"peakResidentSetBytes\": " << PeakResidentSetSize() << ",\n";
+	file << "\t\"stages\": [";
+	for (size_t s = 0; s < stages.size(); ++s)
+	{
+		const ProfileStage& stage = stages[s];
+		file << (s == 0 ? "\n" : ",\n");
+		file << "\t\t{ \"name\": \"" << stage.name << "\"";
+		file << ", \"thread\": " << stage.thread;
+		file << ", \"depth\": " << stage.depth;
+		file << ", \"startMs\": " << stage.startMs;
+		file << ", \"finished\": " << (stage.finished ? "true" : "false");
+		if (stage.finished)
+		{
+			file << ", \"durationMs\": " << stage.durationMs;
+			file << ", \"allocationCount\": " << stage.allocationCount;
+			file << ", \"allocatedBytes\": " << stage.allocatedBytes;
+		}
+		file << " }";
+	}
+	file << "\n\t]\n}\n";
+	return file.good();
+}
+
+// -------- Scopes -----------
+
+ProfileScope::ProfileScope(
+	const char* name
+	)
+	: m_stage(LoadProfiler::Global().BeginStage(name)),
+	m_ended(false)
+{
+}
+
+ProfileScope::~ProfileScope()
+{
+	End();
+}
+
+void
+ProfileScope::End()
+{
+	if (!m_ended)
+	{
+		LoadProfiler::Global().EndStage(m_stage);
+		m_ended = true;
+	}
+}
+
+double
+ProfileScope::ElapsedMs() const
+{
+	return LoadProfiler::Global().StageElapsedMs(m_stage);
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * \brief Allocations made through operator new by every thread since the program started
+ */
+struct AllocationCounts
+{
+	uint64_t count;
+	uint64_t bytes;
+};
+
+AllocationCounts
+CountAllocations();
+
+/**
+ * \brief One timed stage of startup, see ProfileScope
+ */
+struct ProfileStage
+{
+	// String literal, stages only keep the pointer
+	const char* name;
+
+	// Index of the thread in the order threads first recorded a stage, and how many stages it had open when this one started
+	int thread;
+	int depth;
+
+	double startMs;
+	double durationMs;
+
+	// Made by every thread while the stage ran, stages nested in it and stages running alongside it on other threads included
+	uint64_t allocationCount;
+	uint64_t allocatedBytes;
+
+	bool finished;
+};
+
+/**
+ * \brief Stages of scene loading and renderer construction in the order they started.
+ *        Prints them as a breakdown table, or writes them as JSON to compare startup across builds.
+ */
+class LoadProfiler
+{
+public:
+	LoadProfiler();
+
+	/**
+	 * \brief Profiler every ProfileScope records into
+	 */
+	static LoadProfiler&
+	Global();
+
+	/**
+	 * \return index of the stage, to end it with
+	 */
+	size_t
+	BeginStage(
+		const char* name
+	);
+
+	void
+	EndStage(
+		size_t stage
+	);
+
+	/**
+	 * \return duration of a finished stage, or how long a running one has been going
+	 */
+	double
+	StageElapsedMs(
+		size_t stage
+	) const;
+
+	std::vector<ProfileStage>
+	Stages() const;
+
+	/**
+	 * \brief Print the stages as a table, nested stages indented under their parent. Stages still running are marked as such.
+	 */
+	void
+	Print() const;
+
+	/**
+	 * \return false if the file could not be written
+	 */
+	bool
+	WriteJson(
+		const std::string& fileName
+	) const;
+
+private:
+	mutable std::mutex m_mutex;
+	std::chrono::high_resolution_clock::time_point m_start;
+	std::vector<ProfileStage> m_stages;
+	std::vector<std::thread::id> m_threads;
+};
+
+/**
+ * \brief Time the enclosing block as a stage of the global profiler, nested in the stages open on the same thread.
+ *        End stops it early, for stages that are not a block of their own. ElapsedMs reports the same duration in log lines.
+ */
+class ProfileScope
+{
+public:
+	explicit ProfileScope(
+		const char* name
+	);
+
+	~ProfileScope();
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+	void
+	End();
+
+	double
+	ElapsedMs() const;
+
+private:
+	size_t m_stage;
+	bool m_ended;
+};
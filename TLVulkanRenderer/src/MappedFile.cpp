@@ -0,0 +1,158 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile() :
+	m_file(INVALID_HANDLE_VALUE),
+	m_mapping(nullptr),
+	m_data(nullptr),
+	m_size(0)
+{
+}
+
+bool
+MappedFile::Open(
+	const std::string& fileName
+	)
+{
+	Close();
+
+	m_file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mapping == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	m_data = static_cast<const Byte*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (m_data == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	m_size = static_cast<size_t>(size.QuadPart);
+	return true;
+}
+
+void
+MappedFile::Close()
+{
+	if (m_data != nullptr)
+	{
+		UnmapViewOfFile(m_data);
+	}
+	if (m_mapping != nullptr)
+	{
+		CloseHandle(m_mapping);
+	}
+	if (m_file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_file);
+	}
+
+	m_file = INVALID_HANDLE_VALUE;
+	m_mapping = nullptr;
+	m_data = nullptr;
+	m_size = 0;
+}
+
+#else
+
+MappedFile::MappedFile() :
+	m_file(-1),
+	m_data(nullptr),
+	m_size(0)
+{
+}
+
+bool
+MappedFile::Open(
+	const std::string& fileName
+	)
+{
+	Close();
+
+	m_file = open(fileName.c_str(), O_RDONLY);
+	if (m_file == -1)
+	{
+		return false;
+	}
+
+	struct stat status;
+	if (fstat(m_file, &status) != 0 || status.st_size == 0)
+	{
+		Close();
+		return false;
+	}
+
+	void* data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, m_file, 0);
+	if (data == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+
+	m_data = static_cast<const Byte*>(data);
+	m_size = static_cast<size_t>(status.st_size);
+	return true;
+}
+
+void
+MappedFile::Close()
+{
+	if (m_data != nullptr)
+	{
+		munmap(const_cast<Byte*>(m_data), m_size);
+	}
+	if (m_file != -1)
+	{
+		close(m_file);
+	}
+
+	m_file = -1;
+	m_data = nullptr;
+	m_size = 0;
+}
+
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+const Byte*
+MappedFile::Data() const
+{
+	return m_data;
+}
+
+size_t
+MappedFile::Size() const
+{
+	return m_size;
+}
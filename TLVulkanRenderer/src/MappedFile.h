@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include "Typedef.h"
+
+/**
+ * \brief Read-only memory mapping of a whole file. Pages are only read from disk once they are touched.
+ */
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	/**
+	 * \return false if the file does not exist or could not be mapped
+	 */
+	bool
+	Open(
+		const std::string& fileName
+	);
+
+	void
+	Close();
+
+	const Byte*
+	Data() const;
+
+	size_t
+	Size() const;
+
+private:
+#ifdef _WIN32
+	void* m_file;
+	void* m_mapping;
+#else
+	int m_file;
+#endif
+	const Byte* m_data;
+	size_t m_size;
+};
@@ -10,25 +10,27 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include "Scene.h"
-
-static std::map<int, int> GLTF_COMPONENT_LENGTH_LOOKUP = {
-	{ TINYGLTF_TYPE_SCALAR, 1 },
-	{ TINYGLTF_TYPE_VEC2, 2 },
-	{ TINYGLTF_TYPE_VEC3, 3 },
-	{ TINYGLTF_TYPE_VEC4, 4 },
-	{ TINYGLTF_TYPE_MAT2, 4 },
-	{ TINYGLTF_TYPE_MAT3, 9 },
-	{ TINYGLTF_TYPE_MAT4, 16 }
-};
-
-static std::map<int, int> GLTF_COMPONENT_BYTE_SIZE_LOOKUP = {
-	{ TINYGLTF_COMPONENT_TYPE_BYTE , 1 },
-	{ TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE, 1 },
-	{ TINYGLTF_COMPONENT_TYPE_SHORT, 2 },
-	{ TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT, 2 },
-	{ TINYGLTF_COMPONENT_TYPE_FLOAT, 4 }
-};
+#include "GltfBuffers.h"
+#include "LoadProfiler.h"
+#include "SceneCache.h"
+#include "SceneFile.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "Utilities.h"
+#include "mesh/Meshlet.h"
+#include "mesh/MeshSimplify.h"
+#include "mesh/VertexCache.h"
+#include "mesh/VertexQuantization.h"
+#include "mesh/VertexWeld.h"
 
 static std::string PrintMode(int mode) {
 	if (mode == TINYGLTF_MODE_POINTS)
@@ -935,258 +937,2032 @@ void TraverseGLTFNode(
 	}
 }
 
-static std::string GetFilePathExtension(const std::string &FileName) {
-	if (FileName.find_last_of(".") != std::string::npos)
-		return FileName.substr(FileName.find_last_of(".") + 1);
-	return "";
+/**
+ * \brief Build a bottom level BVH for each triangle range, one instance per placement and the top level over all instances.
+ *        Each triangle range is reordered so that bottom level leaves address contiguous triangles.
+ *        With spatial splits a range grows by the triangles its bottom level references more than once.
+ * \param secondaryBottomLevels coarse copy and its error for the first bottom levels, see TwoLevelBVH::BottomLevel
+ */
+static void BuildTwoLevelBVH(
+	Scene& scene,
+	const std::vector<int>& bottomLevelFirstTriangles,
+	const std::vector<std::pair<int, glm::mat4>>& instances,
+	const std::vector<std::pair<int, float>>& secondaryBottomLevels,
+	const SceneOptions& options,
+	ThreadPool* pool
+)
+{
+	ProfileScope profileScope("Build BVH");
+
+	TwoLevelBVH& bvh = scene.bvh;
+	std::vector<glm::ivec4>& indices = scene.indices;
+	std::vector<AABB> triangleBounds;
+	if (!options.spatialSplits)
+	{
+		triangleBounds = scene.TriangleBounds(pool);
+	}
+
+	bvh.Clear();
+	bvh.layout = options.bvhLayout;
+	std::vector<glm::ivec4> sortedIndices;
+	sortedIndices.reserve(indices.size());
+	for (size_t b = 0; b < bottomLevelFirstTriangles.size(); ++b)
+	{
+		int first = bottomLevelFirstTriangles[b];
+		int last = b + 1 < bottomLevelFirstTriangles.size() ? bottomLevelFirstTriangles[b + 1] : static_cast<int>(indices.size());
+		int sortedFirst = static_cast<int>(sortedIndices.size());
+
+		auto gatherTriangleVertices = [&]()
+		{
+			std::vector<glm::vec3> triangleVertices(3 * (last - first));
+			ParallelFor(pool, first, last, BVH::PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+			{
+				for (int i = begin; i < end; ++i)
+				{
+					triangleVertices[3 * (i - first)] = glm::vec3(scene.verticePositions[indices[i].x]);
+					triangleVertices[3 * (i - first) + 1] = glm::vec3(scene.verticePositions[indices[i].y]);
+					triangleVertices[3 * (i - first) + 2] = glm::vec3(scene.verticePositions[indices[i].z]);
+				}
+			});
+			return triangleVertices;
+		};
+
+		int bottomLevel;
+		if (b == 0 && options.deviceBvh && options.bvhLayout == BVH_LAYOUT_BINARY)
+		{
+			// Same tree as the device build, which starts from this triangle order
+			bottomLevel = bvh.AddLinearBottomLevel(sortedFirst, gatherTriangleVertices());
+		}
+		else if (options.spatialSplits)
+		{
+			bottomLevel = bvh.AddSpatialSplitBottomLevel(sortedFirst, gatherTriangleVertices(), options.duplicationBudget, pool);
+		}
+		else
+		{
+			bottomLevel = bvh.AddBottomLevel(
+				sortedFirst,
+				std::vector<AABB>(triangleBounds.begin() + first, triangleBounds.begin() + last),
+				pool);
+		}
+
+		const std::vector<int>& order = bvh.bottomLevels[bottomLevel].bvh.primitiveIndices;
+		sortedIndices.resize(sortedFirst + order.size());
+		ParallelFor(pool, 0, static_cast<int>(order.size()), BVH::PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; ++i)
+			{
+				sortedIndices[sortedFirst + i] = indices[first + order[i]];
+			}
+		});
+	}
+	const size_t sourceTriangleCount = indices.size();
+	indices.swap(sortedIndices);
+
+	for (size_t b = 0; b < secondaryBottomLevels.size(); ++b)
+	{
+		bvh.bottomLevels[b].secondaryBottomLevel = secondaryBottomLevels[b].first;
+		bvh.bottomLevels[b].secondaryError = secondaryBottomLevels[b].second;
+	}
+	for (const std::pair<int, glm::mat4>& instance : instances)
+	{
+		bvh.AddInstance(instance.first, instance.second);
+	}
+	bvh.Build();
+	profileScope.End();
+
+	printf("BVH: %zu triangles in %zu bottom levels, %zu instances (%.1fx instancing), %zu %s nodes (%.1f bytes per triangle), built in %.2f ms on %d threads\n",
+		sourceTriangleCount,
+		bvh.bottomLevels.size(),
+		bvh.instances.size(),
+		bvh.InstancingFactor(),
+		bvh.NodeCount(),
+		bvh.layout == BVH_LAYOUT_WIDE ? "wide" : "binary",
+		sourceTriangleCount == 0 ? 0.0 : static_cast<double>(bvh.NodeCount() * bvh.NodeSize()) / sourceTriangleCount,
+		profileScope.ElapsedMs(),
+		pool ? pool->ThreadCount() : 1);
+
+	if (options.spatialSplits)
+	{
+		printf("  spatial splits: %zu triangle references (+%.1f%%, budget +%.1f%%)\n",
+			indices.size(),
+			sourceTriangleCount == 0 ? 0.0 : 100.0 * (indices.size() - sourceTriangleCount) / sourceTriangleCount,
+			100.0 * options.duplicationBudget);
+	}
+
+	// The builders keep every level within the traversal stack, see BVH::MAX_TRAVERSAL_DEPTH
+	for (const TwoLevelBVH::BottomLevel& bottomLevel : bvh.bottomLevels)
+	{
+		printf("  bottom level: %d triangles, %d references, depth %d, SAH cost %.2f\n",
+			bottomLevel.sourceTriangleCount,
+			bottomLevel.triangleCount,
+			bottomLevel.bvh.Depth(),
+			bottomLevel.bvh.SAHCost());
+	}
 }
 
-Scene::Scene(
-	std::string fileName
-	)
+// -------- Scene loading -----------
+
+/**
+ * \brief Where one glTF primitive goes while loading, worked out serially so that primitives can then be decoded in parallel
+ */
+struct PrimitiveLoad
 {
-	tinygltf::Scene scene;
-	tinygltf::TinyGLTFLoader loader;
-	std::string err;
-	std::string ext = GetFilePathExtension(fileName);
+	const tinygltf::Primitive* primitive;
+
+	// Entry of Scene::meshes
+	int mesh;
+	glm::mat4 matrix;
+	glm::mat3 matrixNormal;
+
+	// Ray tracer geometry is only stored for the first placement of an instanced mesh, and kept in object space
+	bool storeGeometry;
+	bool isInstanced;
+	int materialId;
+	int bottomLevel;
+
+	// First element of the primitive in verticePositions and verticeNormals, and in indices
+	int firstVertex;
+	int firstTriangle;
+};
 
-	bool ret = false;
-	if (ext.compare("glb") == 0) {
-		// binary glTF.
-		ret = loader.LoadBinaryFromFile(&scene, &err, fileName.c_str());
-	} else {
-		// ascii glTF.
-		ret = loader.LoadASCIIFromFile(&scene, &err, fileName.c_str());
+/**
+ * \brief Number of elements of a primitive attribute that fit in their buffer, 0 if the primitive does not have it
+ */
+static size_t
+AttributeCount(
+	const tinygltf::Scene& scene,
+	const GltfBuffers& buffers,
+	const tinygltf::Primitive& primitive,
+	const std::string& attributeName
+)
+{
+	auto attribute = primitive.attributes.find(attributeName);
+	if (attribute == primitive.attributes.end())
+	{
+		return 0;
 	}
+	return buffers.Reader(scene.accessors.at(attribute->second)).Count();
+}
 
-	if (!err.empty())
+/**
+ * \brief What a primitive without a material, or a material without values, is shaded with
+ */
+static Material
+MakeDefaultMaterial()
+{
+	Material material;
+	material.diffuse = glm::vec4(0.0f);
+	material.ambient = glm::vec4(0.0f);
+	material.emission = glm::vec4(0.0f);
+	material.specular = glm::vec4(0.0f);
+	material.shininess = 0.0f;
+	material.transparency = 1.0f;
+	material._pad = glm::ivec2(0);
+	return material;
+}
+
+static Material
+LoadMaterial(
+	const tinygltf::Scene& scene,
+	const std::string& materialName,
+	int materialId
+)
+{
+	//TextureData* dev_diffuseTex = NULL;
+	int diffuseTexWidth = 0;
+	int diffuseTexHeight = 0;
+	Material material = MakeDefaultMaterial();
+	const tinygltf::Material &mat = scene.materials.at(materialName);
+	printf("material.name = %s\n", mat.name.c_str());
+
+	if (mat.values.find("diffuse") != mat.values.end())
 	{
-		printf("Err: %s\n", err.c_str());
+		std::string diffuseTexName = mat.values.at("diffuse").string_value;
+		if (scene.textures.find(diffuseTexName) != scene.textures.end())
+		{
+			const tinygltf::Texture &tex = scene.textures.at(diffuseTexName);
+			if (scene.images.find(tex.source) != scene.images.end())
+			{
+				const tinygltf::Image &image = scene.images.at(tex.source);
+
+				// Texture bytes
+				size_t s = image.image.size() * sizeof(Byte);
+				diffuseTexWidth = image.width;
+				diffuseTexHeight = image.height;
+			}
+		}
+		else
+		{
+			auto diff = mat.values.at("diffuse").number_array;
+			material.diffuse = glm::vec4(diff.at(0), diff.at(1), diff.at(2), diff.at(3));
+		}
 	}
 
-	if (!ret)
+	if (mat.values.find("ambient") != mat.values.end())
 	{
-		printf("Failed to parse glTF\n");
-		return;
+		auto amb = mat.values.at("ambient").number_array;
+		material.ambient = glm::vec4(amb.at(0), amb.at(1), amb.at(2), amb.at(3));
 	}
+	if (mat.values.find("emission") != mat.values.end())
+	{
+		auto em = mat.values.at("emission").number_array;
+		material.emission = glm::vec4(em.at(0), em.at(1), em.at(2), em.at(3));
 
-	// ----------- Transformation matrix --------- 
-	std::map<std::string, glm::mat4> nodeString2Matrix;
-	auto rootNodeNamesList = scene.scenes.at(scene.defaultScene);
-	for (auto& sceneNode : rootNodeNamesList)
+	}
+	if (mat.values.find("specular") != mat.values.end())
 	{
-		TraverseGLTFNode(nodeString2Matrix, scene, sceneNode, glm::mat4(1.0f));
+		auto spec = mat.values.at("specular").number_array;
+		material.specular = glm::vec4(spec.at(0), spec.at(1), spec.at(2), spec.at(3));
+
+	}
+	if (mat.values.find("shininess") != mat.values.end())
+	{
+		material.shininess = mat.values.at("shininess").number_array.at(0);
 	}
 
-	// -------- For each mesh -----------
-	
-	for (auto& nodeString : nodeString2Matrix)
+	if (mat.values.find("transparency") != mat.values.end())
+	{
+		material.transparency = mat.values.at("transparency").number_array.at(0);
+	}
+
+	// Hack for light material
+	if (materialId == 9 || materialId == 8) {
+		material.shininess = 1;
+	}
+	return material;
+}
+
+// -------- Material interning -----------
+
+/**
+ * \brief Materials with the same values are stored once, looked up by a hash of everything but the padding
+ */
+typedef std::unordered_multimap<uint64_t, int> MaterialLookup;
+
+static uint64_t
+HashMaterial(
+	const Material& material
+)
+{
+	// FNV-1a
+	const Byte* bytes = reinterpret_cast<const Byte*>(&material);
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t b = 0; b < offsetof(Material, _pad); ++b)
 	{
+		hash = (hash ^ bytes[b]) * 1099511628211ull;
+	}
+	return hash;
+}
 
-		const tinygltf::Node& node = scene.nodes.at(nodeString.first);
-		const glm::mat4 & matrix = nodeString.second;
-		const glm::mat3 & matrixNormal = glm::transpose(glm::inverse(glm::mat3(matrix)));
+/**
+ * \return Index of the material in materials, appended if no material there has the same values
+ */
+static int
+InternMaterial(
+	const Material& material,
+	std::vector<Material>& materials,
+	MaterialLookup& lookup
+)
+{
+	uint64_t hash = HashMaterial(material);
+	auto candidates = lookup.equal_range(hash);
+	for (auto candidate = candidates.first; candidate != candidates.second; ++candidate)
+	{
+		if (std::memcmp(&materials[candidate->second], &material, offsetof(Material, _pad)) == 0)
+		{
+			return candidate->second;
+		}
+	}
 
-		int materialId = 0;
-		for (auto& meshName : node.meshes)
+	int materialId = static_cast<int>(materials.size());
+	materials.push_back(material);
+	lookup.insert(std::make_pair(hash, materialId));
+	return materialId;
+}
+
+/**
+ * \brief Read every attribute of a primitive once from the mapped buffers and write it straight to its world space range of the
+ *        geometry arena and, for the first placement, to the ray tracer's arrays at the offsets of the sizing pass.
+ *        Primitives write disjoint ranges, so any number of them can be decoded at once.
+ */
+static void
+DecodePrimitive(
+	const PrimitiveLoad& load,
+	const tinygltf::Scene& scene,
+	const GltfBuffers& buffers,
+	Scene& target,
+	ThreadPool* pool
+)
+{
+	const tinygltf::Primitive& primitive = *load.primitive;
+	MeshTable& meshes = target.meshes;
+	const int mesh = load.mesh;
+	GeometryArena& arena = target.geometryArena;
+
+	// -------- Indices ----------
+	{
+		// Get accessor info
+		const tinygltf::Accessor& indexAccessor = scene.accessors.at(primitive.indices);
+		int componentLength = AccessorReader::ComponentCount(indexAccessor.type);
+		AccessorReader in = buffers.Reader(indexAccessor);
+		int indexCount = static_cast<int>(in.Count());
+
+		// Unsigned integer indices are widened in bulk, anything else one by one
+		std::vector<uint32_t> wideIndices(indexCount);
+		bool bulkWiden = in.IsPacked() && in.ComponentSize() <= sizeof(uint32_t) && in.ComponentType() != TINYGLTF_COMPONENT_TYPE_FLOAT;
+		ParallelFor(pool, 0, indexCount, BVH::PARALLEL_GRAIN_SIZE, [&](int begin, int end)
 		{
-			auto& mesh = scene.meshes.at(meshName);
-			for (size_t i = 0; i < mesh.primitives.size(); i++)
+			if (bulkWiden)
 			{
-				auto primitive = mesh.primitives[i];
-				if (primitive.indices.empty())
+				WidenIndices(in.Data() + begin * in.ComponentSize(), in.ComponentSize(), end - begin, wideIndices.data() + begin);
+				return;
+			}
+			for (int i = begin; i < end; ++i)
+			{
+				wideIndices[i] = in.ReadUint(i, 0);
+			}
+		});
+
+		// Rasterizer indices stay local to the primitive, in the width of the arena
+		Byte* rasterIndices = arena.indices.data() + meshes.firstIndex[mesh] * arena.indexSize;
+		if (arena.indexSize == sizeof(uint16_t))
+		{
+			uint16_t* packedIndices = reinterpret_cast<uint16_t*>(rasterIndices);
+			ParallelFor(pool, 0, indexCount, BVH::PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+			{
+				NarrowIndices(wideIndices.data() + begin, end - begin, packedIndices + begin);
+			});
+		}
+		else
+		{
+			std::memcpy(rasterIndices, wideIndices.data(), indexCount * sizeof(uint32_t));
+		}
+
+		VertexAttributeInfo attributeInfo = {
+			arena.indexSize,
+			in.Count(),
+			componentLength,
+			static_cast<int>(arena.indexSize)
+		};
+		meshes.vertexAttributes[mesh][EVertexAttributeType::INDEX] = attributeInfo;
+
+		if (load.storeGeometry)
+		{
+			glm::ivec4* triangles = target.indices.data() + load.firstTriangle;
+			ParallelFor(pool, 0, indexCount / 3, BVH::PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+			{
+				MakeTriangles(wideIndices.data() + 3 * begin, end - begin, load.firstVertex, load.materialId, triangles + begin);
+			});
+		}
+	}
+
+	// -------- Attributes -----------
+
+	for (auto& attribute : primitive.attributes)
+	{
+
+		// Get accessor info
+		const tinygltf::Accessor& accessor = scene.accessors.at(attribute.second);
+		int componentLength = AccessorReader::ComponentCount(accessor.type);
+
+		// Whatever their component type, attributes are unpacked to floats
+		int componentTypeByteSize = sizeof(float);
+
+		EVertexAttributeType attributeType;
+		size_t packedStride = 0;
+		size_t count = 0;
+
+		// -------- Position attribute -----------
+
+		if (attribute.first.compare("POSITION") == 0)
+		{
+			attributeType = EVertexAttributeType::POSITION;
+			AccessorReader positions = buffers.Reader(accessor);
+			packedStride = sizeof(glm::vec3);
+			count = positions.Count();
+			glm::vec3* worldPositions = arena.positions.data() + meshes.baseVertex[mesh];
+			glm::vec4* storedPositions = target.verticePositions.data() + load.firstVertex;
+			bool bulkTransform = positions.IsPacked() && positions.ComponentType() == TINYGLTF_COMPONENT_TYPE_FLOAT && componentLength == 3;
+			ParallelFor(pool, 0, static_cast<int>(count), BVH::PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+			{
+				if (bulkTransform)
 				{
+					// Instanced meshes stay in object space
+					TransformPositions(
+						reinterpret_cast<const glm::vec3*>(positions.Data()) + begin,
+						end - begin,
+						load.matrix,
+						load.isInstanced,
+						worldPositions + begin,
+						load.storeGeometry ? storedPositions + begin : nullptr);
 					return;
 				}
+				for (int p = begin; p < end; ++p)
+				{
+					glm::vec3 position = positions.ReadVector<glm::vec3>(p);
+					glm::vec4 worldPosition = load.matrix * glm::vec4(position, 1.0f);
+					if (load.storeGeometry)
+					{
+						// Instanced meshes stay in object space
+						storedPositions[p] = load.isInstanced ? glm::vec4(position, 1.0f) : worldPosition;
+					}
+					worldPositions[p] = glm::vec3(worldPosition);
+				}
+			});
+		}
 
-				MeshData* geom = new MeshData();
+		// -------- Normal attribute -----------
 
-				// -------- Indices ----------
+		else if (attribute.first.compare("NORMAL") == 0)
+		{
+			attributeType = EVertexAttributeType::NORMAL;
+			AccessorReader normals = buffers.Reader(accessor);
+			packedStride = sizeof(glm::vec3);
+			glm::vec3* worldNormals = arena.normals.data() + meshes.baseVertex[mesh];
+			uint32_t* storedNormals = target.verticeNormals.data() + load.firstVertex;
+			// Vertices only have room for as many normals as positions
+			count = std::min<size_t>(normals.Count(), meshes.vertexCount[mesh]);
+			bool bulkTransform = normals.IsPacked() && normals.ComponentType() == TINYGLTF_COMPONENT_TYPE_FLOAT && componentLength == 3;
+			ParallelFor(pool, 0, static_cast<int>(count), BVH::PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+			{
+				if (bulkTransform)
 				{
-					// Get accessor info
-					auto indexAccessor = scene.accessors.at(primitive.indices);
-					auto indexBufferView = scene.bufferViews.at(indexAccessor.bufferView);
-					auto indexBuffer = scene.buffers.at(indexBufferView.buffer);
-
-					int componentLength = GLTF_COMPONENT_LENGTH_LOOKUP.at(indexAccessor.type);
-					int componentTypeByteSize = GLTF_COMPONENT_BYTE_SIZE_LOOKUP.at(indexAccessor.componentType);
-
-					// Extra index data
-					int bufferOffset = indexBufferView.byteOffset + indexAccessor.byteOffset;
-					int bufferLength = indexAccessor.count * componentLength * componentTypeByteSize;
-					auto first = indexBuffer.data.begin() + bufferOffset;
-					auto last = indexBuffer.data.begin() + bufferOffset + bufferLength;
-					std::vector<Byte> data = std::vector<Byte>(first, last);
-
-					VertexAttributeInfo attributeInfo = {
-						indexAccessor.byteStride,
-						indexAccessor.count,
-						componentLength,
-						componentTypeByteSize
-					};
-					geom->vertexAttributes.insert(std::make_pair(EVertexAttributeType::INDEX, attributeInfo));
-					geom->vertexData.insert(std::make_pair(EVertexAttributeType::INDEX, data));
-
-					int indicesCount = indexAccessor.count;
-					uint16_t* in = reinterpret_cast<uint16_t*>(data.data());
-					for (auto iCount = 0; iCount < indicesCount; iCount += 3)
+					TransformNormals(
+						reinterpret_cast<const glm::vec3*>(normals.Data()) + begin,
+						end - begin,
+						load.matrixNormal,
+						load.isInstanced,
+						worldNormals + begin,
+						load.storeGeometry ? storedNormals + begin : nullptr);
+					return;
+				}
+				for (int p = begin; p < end; ++p)
+				{
+					glm::vec3 normal = normals.ReadVector<glm::vec3>(p);
+					glm::vec3 worldNormal = glm::normalize(load.matrixNormal * normal);
+					if (load.storeGeometry)
 					{
-						indices.push_back(glm::ivec4(in[iCount], in[iCount + 1], in[iCount + 2], materialId));
+						storedNormals[p] = EncodeOctahedral(load.isInstanced ? normal : worldNormal);
 					}
+					worldNormals[p] = worldNormal;
 				}
+			});
+		}
 
-				// -------- Attributes -----------
+		// -------- Texcoord attribute -----------
 
-				for (auto& attribute : primitive.attributes)
+		else if (attribute.first.compare("TEXCOORD_0") == 0)
+		{
+			attributeType = EVertexAttributeType::TEXCOORD;
+			AccessorReader texcoords = buffers.Reader(accessor);
+			packedStride = sizeof(glm::vec2);
+			count = std::min<size_t>(texcoords.Count(), meshes.vertexCount[mesh]);
+			glm::vec2* packedTexcoords = arena.texcoords.data() + meshes.baseVertex[mesh];
+			ParallelFor(pool, 0, static_cast<int>(count), BVH::PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+			{
+				for (int p = begin; p < end; ++p)
 				{
+					packedTexcoords[p] = texcoords.ReadVector<glm::vec2>(p);
+				}
+			});
+		}
 
-					// Get accessor info
-					auto& accessor = scene.accessors.at(attribute.second);
-					auto& bufferView = scene.bufferViews.at(accessor.bufferView);
-					auto& buffer = scene.buffers.at(bufferView.buffer);
-					int componentLength = GLTF_COMPONENT_LENGTH_LOOKUP.at(accessor.type);
-					int componentTypeByteSize = GLTF_COMPONENT_BYTE_SIZE_LOOKUP.at(accessor.componentType);
+		if (packedStride != 0)
+		{
+			VertexAttributeInfo attributeInfo = {
+				packedStride,
+				count,
+				componentLength,
+				componentTypeByteSize
+			};
+			meshes.vertexAttributes[mesh][attributeType] = attributeInfo;
+		}
+	}
+}
 
-					// Extra vertex data from buffer
-					int bufferOffset = bufferView.byteOffset + accessor.byteOffset;
-					int bufferLength = accessor.count * componentLength * componentTypeByteSize;
-					auto first = buffer.data.begin() + bufferOffset;
-					auto last = buffer.data.begin() + bufferOffset + bufferLength;
-					std::vector<Byte> data = std::vector<Byte>(first, last);
+/**
+ * \brief Merge identical vertices of every primitive and compact the arena and ray tracer arrays to match.
+ *        Primitives are welded on their own, so ranges never cross and every index stays local to its primitive.
+ */
+static void
+WeldPrimitives(
+	std::vector<PrimitiveLoad>& loads,
+	Scene& target,
+	ThreadPool* pool
+)
+{
+	GeometryArena& arena = target.geometryArena;
+	MeshTable& meshes = target.meshes;
 
-					EVertexAttributeType attributeType;
+	// -------- Remaps -----------
 
-					// -------- Position attribute -----------
+	// Stored primitives are keyed on the ray tracer's vertices, they may be in object space where the arena is not.
+	// Merging vertices that match there also merges them in the arena, since both come from the same transform.
+	// Normals are compared in their octahedral encoding, arena normals of merged vertices may differ below its precision.
+	std::vector<std::vector<uint32_t>> remaps(loads.size());
+	std::vector<uint32_t> uniqueCounts(loads.size());
+	ParallelFor(pool, 0, static_cast<int>(loads.size()), 1, [&](int begin, int end)
+	{
+		for (int p = begin; p < end; ++p)
+		{
+			const PrimitiveLoad& load = loads[p];
+			const int mesh = load.mesh;
+			std::vector<VertexStream> streams;
+			if (load.storeGeometry)
+			{
+				streams.push_back({ target.verticePositions.data() + load.firstVertex, sizeof(glm::vec4) });
+				streams.push_back({ target.verticeNormals.data() + load.firstVertex, sizeof(uint32_t) });
+			}
+			else
+			{
+				streams.push_back({ arena.positions.data() + meshes.baseVertex[mesh], sizeof(glm::vec3) });
+				streams.push_back({ arena.normals.data() + meshes.baseVertex[mesh], sizeof(glm::vec3) });
+			}
+			streams.push_back({ arena.texcoords.data() + meshes.baseVertex[mesh], sizeof(glm::vec2) });
+			uniqueCounts[p] = WeldVertices(streams, meshes.vertexCount[mesh], remaps[p]);
+		}
+	});
 
-					if (attribute.first.compare("POSITION") == 0)
-					{
-						attributeType = EVertexAttributeType::POSITION;	
-						int positionCount = accessor.count;
-						glm::vec3* positions = reinterpret_cast<glm::vec3*>(data.data());
-						for (auto p = 0; p < positionCount; ++p)
-						{
-							positions[p] = glm::vec3(matrix * glm::vec4(positions[p], 1.0f));
-							verticePositions.push_back(glm::vec4(positions[p], 1.0f));
-						}
-					}
+	// -------- Ranges -----------
 
-					// -------- Normal attribute -----------
+	// Same order as the decode pass, so welding an already welded scene changes nothing
+	std::vector<int32_t> baseVertices(loads.size());
+	std::vector<int> firstVertices(loads.size());
+	std::map<int, IndexRange> bakedRanges;
+	uint32_t arenaVertexCount = 0;
+	int storedVertexCount = 0;
+	for (size_t p = 0; p < loads.size(); ++p)
+	{
+		baseVertices[p] = arenaVertexCount;
+		arenaVertexCount += uniqueCounts[p];
+		if (loads[p].storeGeometry)
+		{
+			firstVertices[p] = storedVertexCount;
+			bakedRanges[loads[p].firstVertex] = { storedVertexCount, static_cast<int>(uniqueCounts[p]) };
+			storedVertexCount += uniqueCounts[p];
+		}
+	}
 
-					else if (attribute.first.compare("NORMAL") == 0)
-					{
-						attributeType = EVertexAttributeType::NORMAL;
-						int normalCount = accessor.count;
-						glm::vec3* normals = reinterpret_cast<glm::vec3*>(data.data());
-						for (auto p = 0; p < normalCount; ++p)
-						{
-							normals[p] = glm::normalize(matrixNormal * glm::vec4(normals[p], 1.0f));
-							verticeNormals.push_back(glm::vec4(normals[p], 0.0f));
-						}
-					}
+	// -------- Scatter -----------
 
-					// -------- Texcoord attribute -----------
+	GeometryArena welded;
+	welded.indexSize = arena.indexSize;
+	welded.positions.resize(arenaVertexCount);
+	welded.normals.resize(arenaVertexCount);
+	welded.texcoords.resize(arenaVertexCount);
+	std::vector<glm::vec4> weldedPositions(storedVertexCount);
+	std::vector<uint32_t> weldedNormals(storedVertexCount);
 
-					else if (attribute.first.compare("TEXCOORD_0") == 0)
-					{
-						attributeType = EVertexAttributeType::TEXCOORD;
-					}
+	ParallelFor(pool, 0, static_cast<int>(loads.size()), 1, [&](int begin, int end)
+	{
+		for (int p = begin; p < end; ++p)
+		{
+			PrimitiveLoad& load = loads[p];
+			const int mesh = load.mesh;
+			const std::vector<uint32_t>& remap = remaps[p];
+
+			RemapVertices(arena.positions.data() + meshes.baseVertex[mesh], remap, welded.positions.data() + baseVertices[p]);
+			RemapVertices(arena.normals.data() + meshes.baseVertex[mesh], remap, welded.normals.data() + baseVertices[p]);
+			RemapVertices(arena.texcoords.data() + meshes.baseVertex[mesh], remap, welded.texcoords.data() + baseVertices[p]);
+
+			Byte* rasterIndices = arena.indices.data() + meshes.firstIndex[mesh] * arena.indexSize;
+			for (uint32_t i = 0; i < meshes.indexCount[mesh]; ++i)
+			{
+				if (arena.indexSize == sizeof(uint16_t))
+				{
+					uint16_t* index = reinterpret_cast<uint16_t*>(rasterIndices) + i;
+					*index = static_cast<uint16_t>(remap[*index]);
+				}
+				else
+				{
+					uint32_t* index = reinterpret_cast<uint32_t*>(rasterIndices) + i;
+					*index = remap[*index];
+				}
+			}
+
+			if (load.storeGeometry)
+			{
+				RemapVertices(target.verticePositions.data() + load.firstVertex, remap, weldedPositions.data() + firstVertices[p]);
+				RemapVertices(target.verticeNormals.data() + load.firstVertex, remap, weldedNormals.data() + firstVertices[p]);
 
-					VertexAttributeInfo attributeInfo = {
-						accessor.byteStride,
-						accessor.count,
-						componentLength,
-						componentTypeByteSize
-					};
-					geom->vertexAttributes.insert(std::make_pair(attributeType, attributeInfo));
-					geom->vertexData.insert(std::make_pair(attributeType, data));
-
-					// ----------Materials-------------
-
-					//TextureData* dev_diffuseTex = NULL;
-					int diffuseTexWidth = 0;
-					int diffuseTexHeight = 0;
-					Material material;
-					if (!primitive.material.empty())
+				glm::ivec4* triangles = target.indices.data() + load.firstTriangle;
+				for (uint32_t t = 0; t < meshes.indexCount[mesh] / 3; ++t)
+				{
+					for (int corner = 0; corner < 3; ++corner)
 					{
-						const tinygltf::Material &mat = scene.materials.at(primitive.material);
-						printf("material.name = %s\n", mat.name.c_str());
-
-						if (mat.values.find("diffuse") != mat.values.end())
-						{
-							std::string diffuseTexName = mat.values.at("diffuse").string_value;
-							if (scene.textures.find(diffuseTexName) != scene.textures.end())
-							{
-								const tinygltf::Texture &tex = scene.textures.at(diffuseTexName);
-								if (scene.images.find(tex.source) != scene.images.end())
-								{
-									const tinygltf::Image &image = scene.images.at(tex.source);
-
-									// Texture bytes
-									size_t s = image.image.size() * sizeof(Byte);
-									diffuseTexWidth = image.width;
-									diffuseTexHeight = image.height;
-								}
-							}
-							else
-							{
-								auto diff = mat.values.at("diffuse").number_array;
-								material.diffuse = glm::vec4(diff.at(0), diff.at(1), diff.at(2), diff.at(3));
-							}
-						}
-
-						if (mat.values.find("ambient") != mat.values.end())
-						{
-							auto amb = mat.values.at("ambient").number_array;
-							material.ambient = glm::vec4(amb.at(0), amb.at(1), amb.at(2), amb.at(3));
-						}
-						if (mat.values.find("emission") != mat.values.end())
-						{
-							auto em = mat.values.at("emission").number_array;
-							material.emission = glm::vec4(em.at(0), em.at(1), em.at(2), em.at(3));
-
-						}
-						if (mat.values.find("specular") != mat.values.end())
-						{
-							auto spec = mat.values.at("specular").number_array;
-							material.specular = glm::vec4(spec.at(0), spec.at(1), spec.at(2), spec.at(3));
-
-						}
-						if (mat.values.find("shininess") != mat.values.end())
-						{
-							material.shininess = mat.values.at("shininess").number_array.at(0);
-						}
-
-						if (mat.values.find("transparency") != mat.values.end())
-						{
-							material.transparency = mat.values.at("transparency").number_array.at(0);
-						}
-						else
-						{
-							material.transparency = 1.0f;
-						}
-
-						// Hack for light material
-						if (materialId == 9 || materialId == 8) {
-							material.shininess = 1;
-						}
-						materials.push_back(material);
-						++materialId;
+						triangles[t][corner] = firstVertices[p] + remap[triangles[t][corner] - load.firstVertex];
 					}
 				}
+				load.firstVertex = firstVertices[p];
+			}
 
-				meshesData.push_back(geom);
+			meshes.baseVertex[mesh] = baseVertices[p];
+			meshes.vertexCount[mesh] = uniqueCounts[p];
+			for (int attribute = 0; attribute < VERTEX_ATTRIBUTE_COUNT; ++attribute)
+			{
+				if (attribute != EVertexAttributeType::INDEX)
+				{
+					VertexAttributeInfo& attributeInfo = meshes.vertexAttributes[mesh][attribute];
+					attributeInfo.count = std::min<size_t>(attributeInfo.count, meshes.vertexCount[mesh]);
+				}
 			}
 		}
+	});
+
+	// Baked vertex ranges are looked up by where they used to start
+	for (auto& sceneNode : target.sceneNodes)
+	{
+		for (IndexRange& range : sceneNode.second.bakedVertices)
+		{
+			range = bakedRanges.at(range.first);
+		}
 	}
 
-	Dump(scene);
+	welded.indices = std::move(arena.indices);
+	arena = std::move(welded);
+	target.verticePositions.swap(weldedPositions);
+	target.verticeNormals.swap(weldedNormals);
 }
 
+/**
+ * \brief Reorder the arena triangles of every mesh for the vertex cache and overdraw, then its vertices for fetching
+ * \return ACMR of all meshes together before and after
+ */
+static std::pair<float, float>
+OptimizeMeshes(
+	const MeshTable& meshes,
+	GeometryArena& arena,
+	ThreadPool* pool
+)
+{
+	std::vector<VertexCacheStats> statsBefore(meshes.Size());
+	std::vector<VertexCacheStats> statsAfter(meshes.Size());
+	ParallelFor(pool, 0, static_cast<int>(meshes.Size()), 1, [&](int begin, int end)
+	{
+		for (int m = begin; m < end; ++m)
+		{
+			const uint32_t vertexCount = meshes.vertexCount[m];
+			Byte* rasterIndices = arena.indices.data() + meshes.firstIndex[m] * arena.indexSize;
+			std::vector<uint32_t> indices(meshes.indexCount[m]);
+			WidenIndices(rasterIndices, arena.indexSize, indices.size(), indices.data());
+
+			statsBefore[m] = AnalyzeVertexCache(indices.data(), indices.size(), vertexCount);
 
-Scene::~Scene()
+			glm::vec3* positions = arena.positions.data() + meshes.baseVertex[m];
+			glm::vec3* normals = arena.normals.data() + meshes.baseVertex[m];
+			glm::vec2* texcoords = arena.texcoords.data() + meshes.baseVertex[m];
+
+			std::vector<uint32_t> clusters;
+			OptimizeVertexCache(indices.data(), indices.size(), vertexCount, clusters);
+			OptimizeOverdraw(indices.data(), indices.size(), positions, vertexCount, clusters);
+
+			statsAfter[m] = AnalyzeVertexCache(indices.data(), indices.size(), vertexCount);
+
+			std::vector<uint32_t> remap;
+			OptimizeVertexFetch(indices.data(), indices.size(), vertexCount, remap);
+			std::vector<glm::vec3> oldPositions(positions, positions + vertexCount);
+			std::vector<glm::vec3> oldNormals(normals, normals + vertexCount);
+			std::vector<glm::vec2> oldTexcoords(texcoords, texcoords + vertexCount);
+			RemapVertices(oldPositions.data(), remap, positions);
+			RemapVertices(oldNormals.data(), remap, normals);
+			RemapVertices(oldTexcoords.data(), remap, texcoords);
+
+			if (arena.indexSize == sizeof(uint16_t))
+			{
+				NarrowIndices(indices.data(), indices.size(), reinterpret_cast<uint16_t*>(rasterIndices));
+			}
+			else
+			{
+				std::memcpy(rasterIndices, indices.data(), indices.size() * sizeof(uint32_t));
+			}
+		}
+	});
+
+	// Weighted by triangle count, as if all meshes were one
+	double triangleCount = 0.0;
+	double before = 0.0;
+	double after = 0.0;
+	for (size_t m = 0; m < meshes.Size(); ++m)
+	{
+		double meshTriangleCount = meshes.indexCount[m] / 3;
+		triangleCount += meshTriangleCount;
+		before += statsBefore[m].acmr * meshTriangleCount;
+		after += statsAfter[m].acmr * meshTriangleCount;
+	}
+	if (triangleCount == 0.0)
+	{
+		return std::make_pair(0.0f, 0.0f);
+	}
+	return std::make_pair(static_cast<float>(before / triangleCount), static_cast<float>(after / triangleCount));
+}
+
+/**
+ * \brief Split every mesh of the arena into meshlets, once welding and the vertex cache optimization have settled its triangle order
+ * \return fill rate of all meshlets together
+ */
+static MeshletStats
+BuildArenaMeshlets(
+	MeshTable& meshes,
+	GeometryArena& arena,
+	ThreadPool* pool
+)
+{
+	// Meshes are split on their own, then appended in mesh order
+	std::vector<std::vector<Meshlet>> meshMeshlets(meshes.Size());
+	std::vector<std::vector<uint32_t>> meshVertices(meshes.Size());
+	std::vector<std::vector<uint8_t>> meshTriangles(meshes.Size());
+	ParallelFor(pool, 0, static_cast<int>(meshes.Size()), 1, [&](int begin, int end)
+	{
+		for (int m = begin; m < end; ++m)
+		{
+			std::vector<uint32_t> indices(meshes.indexCount[m]);
+			WidenIndices(arena.indices.data() + meshes.firstIndex[m] * arena.indexSize, arena.indexSize, indices.size(), indices.data());
+			BuildMeshlets(
+				indices.data(),
+				indices.size(),
+				arena.positions.data() + meshes.baseVertex[m],
+				meshes.vertexCount[m],
+				meshMeshlets[m],
+				meshVertices[m],
+				meshTriangles[m]);
+		}
+	});
+
+	arena.meshlets.clear();
+	arena.meshletVertices.clear();
+	arena.meshletTriangles.clear();
+	for (size_t m = 0; m < meshes.Size(); ++m)
+	{
+		const uint32_t firstVertex = static_cast<uint32_t>(arena.meshletVertices.size());
+		const uint32_t firstTriangle = static_cast<uint32_t>(arena.meshletTriangles.size() / 3);
+		meshes.firstMeshlet[m] = static_cast<uint32_t>(arena.meshlets.size());
+		meshes.meshletCount[m] = static_cast<uint32_t>(meshMeshlets[m].size());
+		for (Meshlet& meshlet : meshMeshlets[m])
+		{
+			meshlet.firstVertex += firstVertex;
+			meshlet.firstTriangle += firstTriangle;
+			arena.meshlets.push_back(meshlet);
+		}
+		arena.meshletVertices.insert(arena.meshletVertices.end(), meshVertices[m].begin(), meshVertices[m].end());
+		arena.meshletTriangles.insert(arena.meshletTriangles.end(), meshTriangles[m].begin(), meshTriangles[m].end());
+	}
+	return AnalyzeMeshlets(arena.meshlets.data(), arena.meshlets.size());
+}
+
+// -------- Levels of detail -----------
+
+/**
+ * \brief How far the coarse copy secondary rays trace may stray from the full triangles, relative to the radius of their bottom level
+ */
+static const float SECONDARY_RAY_LOD_ERROR = 0.01f;
+
+/**
+ * \brief Simplify every mesh of the arena into a chain of levels of detail, appended to the arena indices after the full meshes
+ * \return triangles of each level of all meshes together, the full meshes first
+ */
+static std::vector<size_t>
+BuildArenaLods(
+	MeshTable& meshes,
+	GeometryArena& arena,
+	bool optimizeVertexCache,
+	ThreadPool* pool
+)
 {
-	for (MeshData* geom : meshesData) {
-		delete geom;
-		geom = nullptr;
+	std::vector<std::vector<std::vector<uint32_t>>> meshLevels(meshes.Size());
+	std::vector<std::vector<float>> meshErrors(meshes.Size());
+	ParallelFor(pool, 0, static_cast<int>(meshes.Size()), 1, [&](int begin, int end)
+	{
+		for (int m = begin; m < end; ++m)
+		{
+			std::vector<uint32_t> indices(meshes.indexCount[m]);
+			WidenIndices(arena.indices.data() + meshes.firstIndex[m] * arena.indexSize, arena.indexSize, indices.size(), indices.data());
+			BuildLodChain(
+				indices.data(),
+				indices.size(),
+				arena.positions.data() + meshes.baseVertex[m],
+				meshes.vertexCount[m],
+				meshLevels[m],
+				meshErrors[m]);
+
+			// Collapses leave the triangles in their old order, with holes where the cache used to be warm
+			if (optimizeVertexCache)
+			{
+				for (std::vector<uint32_t>& level : meshLevels[m])
+				{
+					std::vector<uint32_t> clusters;
+					OptimizeVertexCache(level.data(), level.size(), meshes.vertexCount[m], clusters);
+				}
+			}
+		}
+	});
+
+	arena.lods.clear();
+	std::vector<size_t> levelTriangles(1, 0);
+	for (size_t m = 0; m < meshes.Size(); ++m)
+	{
+		meshes.firstLod[m] = static_cast<uint32_t>(arena.lods.size());
+		meshes.lodCount[m] = static_cast<uint32_t>(1 + meshLevels[m].size());
+		arena.lods.push_back({ meshes.firstIndex[m], meshes.indexCount[m], 0.0f });
+		levelTriangles[0] += meshes.indexCount[m] / 3;
+
+		for (size_t l = 0; l < meshLevels[m].size(); ++l)
+		{
+			const std::vector<uint32_t>& level = meshLevels[m][l];
+			const uint32_t firstIndex = static_cast<uint32_t>(arena.indices.size() / arena.indexSize);
+			arena.indices.resize(arena.indices.size() + level.size() * arena.indexSize);
+			Byte* rasterIndices = arena.indices.data() + firstIndex * arena.indexSize;
+			if (arena.indexSize == sizeof(uint16_t))
+			{
+				NarrowIndices(level.data(), level.size(), reinterpret_cast<uint16_t*>(rasterIndices));
+			}
+			else
+			{
+				std::memcpy(rasterIndices, level.data(), level.size() * sizeof(uint32_t));
+			}
+			arena.lods.push_back({ firstIndex, static_cast<uint32_t>(level.size()), meshErrors[m][l] });
+
+			if (levelTriangles.size() < l + 2)
+			{
+				levelTriangles.push_back(0);
+			}
+			levelTriangles[l + 1] += level.size() / 3;
+		}
+	}
+	return levelTriangles;
+}
+
+/**
+ * \brief Append a coarser copy of the triangles of every bottom level to the ray tracer geometry, for shadow and bounce rays to trace instead.
+ *        Stored primitives are simplified on their own over their own vertices, within SECONDARY_RAY_LOD_ERROR of the radius of their bottom level.
+ * \param bottomLevelFirstTriangles receives the triangle range of each copy, after the ranges of the bottom levels
+ * \return secondary bottom level and error of each bottom level, -1 where simplifying removed nothing
+ */
+static std::vector<std::pair<int, float>>
+BuildSecondaryTriangles(
+	const std::vector<PrimitiveLoad>& loads,
+	Scene& target,
+	std::vector<int>& bottomLevelFirstTriangles,
+	ThreadPool* pool
+)
+{
+	const MeshTable& meshes = target.meshes;
+	const size_t bottomLevelCount = bottomLevelFirstTriangles.size();
+
+	std::vector<AABB> bottomLevelBounds(bottomLevelCount);
+	for (const PrimitiveLoad& load : loads)
+	{
+		if (load.storeGeometry)
+		{
+			for (uint32_t v = 0; v < meshes.vertexCount[load.mesh]; ++v)
+			{
+				bottomLevelBounds[load.bottomLevel].Grow(glm::vec3(target.verticePositions[load.firstVertex + v]));
+			}
+		}
+	}
+
+	std::vector<std::vector<uint32_t>> coarseIndices(loads.size());
+	std::vector<float> errors(loads.size(), 0.0f);
+	ParallelFor(pool, 0, static_cast<int>(loads.size()), 1, [&](int begin, int end)
+	{
+		for (int p = begin; p < end; ++p)
+		{
+			const PrimitiveLoad& load = loads[p];
+			if (!load.storeGeometry)
+			{
+				continue;
+			}
+
+			const uint32_t vertexCount = meshes.vertexCount[load.mesh];
+			const uint32_t triangleCount = meshes.indexCount[load.mesh] / 3;
+			std::vector<glm::vec3> positions(vertexCount);
+			for (uint32_t v = 0; v < vertexCount; ++v)
+			{
+				positions[v] = glm::vec3(target.verticePositions[load.firstVertex + v]);
+			}
+			std::vector<uint32_t> indices(3 * triangleCount);
+			for (uint32_t t = 0; t < triangleCount; ++t)
+			{
+				for (int corner = 0; corner < 3; ++corner)
+				{
+					indices[3 * t + corner] = target.indices[load.firstTriangle + t][corner] - load.firstVertex;
+				}
+			}
+
+			const AABB& bounds = bottomLevelBounds[load.bottomLevel];
+			const float targetError = SECONDARY_RAY_LOD_ERROR * 0.5f * glm::length(bounds.max - bounds.min);
+			errors[p] = SimplifyMesh(indices.data(), indices.size(), positions.data(), vertexCount, 0, targetError, coarseIndices[p]);
+		}
+	});
+
+	// Copies go after every bottom level, in bottom level order
+	const int sourceTriangleTotal = static_cast<int>(target.indices.size());
+	std::vector<std::pair<int, float>> secondaryBottomLevels(bottomLevelCount, std::make_pair(-1, 0.0f));
+	for (size_t b = 0; b < bottomLevelCount; ++b)
+	{
+		const int last = b + 1 < bottomLevelCount ? bottomLevelFirstTriangles[b + 1] : sourceTriangleTotal;
+		const int sourceTriangleCount = last - bottomLevelFirstTriangles[b];
+		size_t coarseTriangleCount = 0;
+		float error = 0.0f;
+		for (size_t p = 0; p < loads.size(); ++p)
+		{
+			if (loads[p].storeGeometry && loads[p].bottomLevel == static_cast<int>(b))
+			{
+				coarseTriangleCount += coarseIndices[p].size() / 3;
+				error = std::max(error, errors[p]);
+			}
+		}
+		if (coarseTriangleCount == 0 || coarseTriangleCount >= static_cast<size_t>(sourceTriangleCount))
+		{
+			continue;
+		}
+
+		secondaryBottomLevels[b] = std::make_pair(static_cast<int>(bottomLevelFirstTriangles.size()), error);
+		bottomLevelFirstTriangles.push_back(static_cast<int>(target.indices.size()));
+		for (size_t p = 0; p < loads.size(); ++p)
+		{
+			if (loads[p].storeGeometry && loads[p].bottomLevel == static_cast<int>(b))
+			{
+				const size_t firstTriangle = target.indices.size();
+				target.indices.resize(firstTriangle + coarseIndices[p].size() / 3);
+				MakeTriangles(coarseIndices[p].data(), coarseIndices[p].size() / 3, loads[p].firstVertex, loads[p].materialId, target.indices.data() + firstTriangle);
+			}
+		}
+	}
+	return secondaryBottomLevels;
+}
+
+// -------- Asynchronous loading -----------
+
+/**
+ * \brief Triangles of the first batch an asynchronous load publishes, every later batch doubles it.
+ *        The first meshes show up quickly while merging stays linear in the scene size overall.
+ */
+static const int ASYNC_LOAD_FIRST_BATCH_TRIANGLES = 1 << 14;
+
+/**
+ * \brief Primitives decoded by the loading thread, ready to be appended to the scene.
+ *        Every placement is baked into world space from the arena, vertex and triangle indices are local to the batch.
+ */
+struct LoadBatch
+{
+	std::vector<MeshData> meshes;
+	GeometryArena arena;
+
+	// Only the first batch carries the materials, every batch references them
+	std::vector<Material> materials;
+
+	std::vector<glm::ivec4> indices;
+	std::vector<glm::vec4> verticePositions;
+	std::vector<uint32_t> verticeNormals;
+
+	/**
+	 * \brief Built on the loading thread over indices, which are already in its leaf order
+	 */
+	TwoLevelBVH::BottomLevel bottomLevel;
+};
+
+/**
+ * \brief State shared by a scene and the thread loading it, see SceneOptions::asyncLoad
+ */
+struct AsyncSceneLoad
+{
+	std::chrono::high_resolution_clock::time_point start;
+	std::thread thread;
+
+	std::mutex mutex;
+	std::vector<LoadBatch> batches;
+	std::unique_ptr<Scene> scene;
+	bool cancelled = false;
+
+	// Main thread only
+	int mergedBatchCount = 0;
+};
+
+/**
+ * \brief Copy decoded primitives [begin, end) out of the scene being loaded and hand them to the main thread
+ * \return false once the load was cancelled
+ */
+static bool
+PublishBatch(
+	AsyncSceneLoad& progress,
+	const std::vector<PrimitiveLoad>& loads,
+	size_t begin,
+	size_t end,
+	const Scene& scene,
+	ThreadPool* pool
+)
+{
+	const GeometryArena& arena = scene.geometryArena;
+	LoadBatch batch;
+	batch.arena.indexSize = arena.indexSize;
+	if (begin == 0)
+	{
+		batch.materials = scene.materials;
+	}
+
+	std::vector<uint32_t> wideIndices;
+	for (size_t p = begin; p < end; ++p)
+	{
+		const MeshData source = scene.meshes.Get(loads[p].mesh);
+		MeshData mesh = source;
+		mesh.firstIndex = static_cast<uint32_t>(batch.arena.indices.size() / arena.indexSize);
+		mesh.baseVertex = static_cast<int32_t>(batch.arena.positions.size());
+		batch.meshes.push_back(mesh);
+
+		const Byte* indices = arena.indices.data() + source.firstIndex * arena.indexSize;
+		batch.arena.indices.insert(batch.arena.indices.end(), indices, indices + source.indexCount * arena.indexSize);
+		batch.arena.positions.insert(batch.arena.positions.end(), arena.positions.begin() + source.baseVertex, arena.positions.begin() + source.baseVertex + source.vertexCount);
+		batch.arena.normals.insert(batch.arena.normals.end(), arena.normals.begin() + source.baseVertex, arena.normals.begin() + source.baseVertex + source.vertexCount);
+		batch.arena.texcoords.insert(batch.arena.texcoords.end(), arena.texcoords.begin() + source.baseVertex, arena.texcoords.begin() + source.baseVertex + source.vertexCount);
+
+		// The arena already holds every placement in world space, instanced or not
+		const int firstVertex = static_cast<int>(batch.verticePositions.size());
+		for (uint32_t v = 0; v < source.vertexCount; ++v)
+		{
+			batch.verticePositions.push_back(glm::vec4(arena.positions[source.baseVertex + v], 1.0f));
+			batch.verticeNormals.push_back(EncodeOctahedral(arena.normals[source.baseVertex + v]));
+		}
+
+		wideIndices.resize(source.indexCount);
+		WidenIndices(indices, arena.indexSize, source.indexCount, wideIndices.data());
+		const size_t firstTriangle = batch.indices.size();
+		batch.indices.resize(firstTriangle + source.indexCount / 3);
+		MakeTriangles(wideIndices.data(), source.indexCount / 3, firstVertex, loads[p].materialId, batch.indices.data() + firstTriangle);
+	}
+
+	// -------- Bottom level -----------
+
+	std::vector<AABB> triangleBounds(batch.indices.size());
+	for (size_t t = 0; t < batch.indices.size(); ++t)
+	{
+		triangleBounds[t].Grow(glm::vec3(batch.verticePositions[batch.indices[t].x]));
+		triangleBounds[t].Grow(glm::vec3(batch.verticePositions[batch.indices[t].y]));
+		triangleBounds[t].Grow(glm::vec3(batch.verticePositions[batch.indices[t].z]));
+	}
+
+	TwoLevelBVH builder;
+	builder.layout = scene.Options().bvhLayout;
+	builder.AddBottomLevel(0, triangleBounds, pool);
+	batch.bottomLevel = std::move(builder.bottomLevels[0]);
+
+	const std::vector<int>& order = batch.bottomLevel.bvh.primitiveIndices;
+	std::vector<glm::ivec4> sortedIndices(order.size());
+	for (size_t t = 0; t < order.size(); ++t)
+	{
+		sortedIndices[t] = batch.indices[order[t]];
+	}
+	batch.indices.swap(sortedIndices);
+
+	std::lock_guard<std::mutex> lock(progress.mutex);
+	progress.batches.push_back(std::move(batch));
+	return !progress.cancelled;
+}
+
+/**
+ * \brief Whether the scene waiting for the load is being deleted, checked between load stages
+ */
+static bool
+LoadCancelled(
+	AsyncSceneLoad* progress
+)
+{
+	if (progress == nullptr)
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(progress->mutex);
+	return progress->cancelled;
+}
+
+static std::string GetFilePathExtension(const std::string &FileName) {
+	if (FileName.find_last_of(".") != std::string::npos)
+		return FileName.substr(FileName.find_last_of(".") + 1);
+	return "";
+}
+
+static std::string GetBaseDirectory(const std::string &FileName) {
+	if (FileName.find_last_of("/\\") != std::string::npos)
+		return FileName.substr(0, FileName.find_last_of("/\\"));
+	return "";
+}
+
+bool
+ParseSceneOption(
+	const std::string& flag,
+	SceneOptions& options
+	)
+{
+	if (flag == "--wide-bvh")
+	{
+		options.bvhLayout = BVH_LAYOUT_WIDE;
+	}
+	else if (flag == "--no-cache")
+	{
+		options.useCache = false;
+	}
+	else if (flag == "--sbvh")
+	{
+		options.spatialSplits = true;
+	}
+	else if (flag == "--gpu-bvh")
+	{
+		options.deviceBvh = true;
+	}
+	else if (flag == "--weld")
+	{
+		options.weldVertices = true;
+	}
+	else if (flag == "--optimize-vertex-cache")
+	{
+		options.optimizeVertexCache = true;
+	}
+	else if (flag == "--lod")
+	{
+		options.generateLods = true;
+	}
+	else if (flag == "--async-load")
+	{
+		options.asyncLoad = true;
+	}
+	else if (flag.compare(0, 15, "--split-budget=") == 0)
+	{
+		options.duplicationBudget = static_cast<float>(std::atof(flag.c_str() + 15));
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+Scene::Scene(
+	const SceneOptions& options
+	)
+{
+	m_options = options;
+	m_threadPool.reset(new ThreadPool());
+}
+
+Scene::Scene(
+	std::string fileName,
+	const SceneOptions& options
+	)
+	: Scene(options)
+{
+	ProfileScope profileScope("Scene");
+
+	// The device build rebuilds bottom level 0 in place, it has no use for batches
+	if (!options.asyncLoad || options.deviceBvh)
+	{
+		Load(fileName, nullptr);
+		return;
+	}
+
+	// Start out empty, with a top level root no ray enters
+	m_asyncLoad.reset(new AsyncSceneLoad());
+	m_asyncLoad->start = std::chrono::high_resolution_clock::now();
+	bvh.layout = options.bvhLayout;
+	bvh.Build();
+
+	SceneOptions loadOptions = options;
+	loadOptions.asyncLoad = false;
+	AsyncSceneLoad* progress = m_asyncLoad.get();
+	m_asyncLoad->thread = std::thread([progress, fileName, loadOptions]()
+	{
+		std::unique_ptr<Scene> scene(new Scene(loadOptions));
+		scene->Load(fileName, progress);
+
+		std::lock_guard<std::mutex> lock(progress->mutex);
+		progress->scene = std::move(scene);
+	});
+}
+
+void
+Scene::Load(
+	const std::string& fileName,
+	AsyncSceneLoad* progress
+	)
+{
+	ProfileScope profileScope("Load scene");
+	const SceneOptions& options = m_options;
+	std::string ext = GetFilePathExtension(fileName);
+
+	// -------- Scene file -----------
+
+	// Converted ahead of time by SceneConverter, everything is already built and only copied out of the mapping
+	if (ext.compare("tlscene") == 0)
+	{
+		ProfileScope sceneFileScope("Map scene file");
+		m_sceneFile.reset(new SceneFile());
+		if (!m_sceneFile->Open(fileName) || !LoadSceneFile(*this, *m_sceneFile))
+		{
+			printf("Failed to load scene file %s, convert it again with SceneConverter\n", fileName.c_str());
+			m_sceneFile.reset();
+			return;
+		}
+		m_sceneFile->ReadOptions(m_options);
+
+		printf("Loaded %s in %.2f ms: %zu triangles, %zu vertices, %zu BVH nodes, %.1f MB mapped, peak RSS %.1f MB\n",
+			fileName.c_str(),
+			profileScope.ElapsedMs(),
+			indices.size(),
+			verticePositions.size(),
+			bvh.NodeCount(),
+			m_sceneFile->FileSize() / (1024.0 * 1024.0),
+			PeakResidentSetSize() / (1024.0 * 1024.0));
+		return;
+	}
+
+	// -------- Cache -----------
+
+	// Everything below only depends on the file contents and the options, a matching cache skips all of it
+	const std::string cacheFileName = SceneCacheFileName(fileName);
+	uint64_t contentHash = 0;
+	bool cached = false;
+	if (options.useCache)
+	{
+		ProfileScope hashScope("Hash scene files");
+		contentHash = HashSceneFiles(fileName);
+		hashScope.End();
+
+		ProfileScope cacheScope("Read scene cache");
+		cached = LoadSceneCache(*this, cacheFileName, contentHash, options);
+	}
+	if (cached)
+	{
+		printf("Loaded %s from scene cache in %.2f ms: %zu triangles, %zu vertices, %zu BVH nodes, peak RSS %.1f MB\n",
+			fileName.c_str(),
+			profileScope.ElapsedMs(),
+			indices.size(),
+			verticePositions.size(),
+			bvh.NodeCount(),
+			PeakResidentSetSize() / (1024.0 * 1024.0));
+		UpdateTriangleRecords();
+		return;
+	}
+
+	ProfileScope parseScope("Parse glTF");
+	tinygltf::Scene scene;
+	tinygltf::TinyGLTFLoader loader;
+	std::string err;
+
+	// Buffers are mapped instead of read, the loader only parses the JSON
+	loader.SetLoadBufferData(false);
+	MappedFile binaryFile;
+
+	bool ret = false;
+	if (ext.compare("glb") == 0) {
+		// binary glTF.
+		ret = binaryFile.Open(fileName) &&
+			loader.LoadBinaryFromMemory(&scene, &err, binaryFile.Data(), static_cast<unsigned int>(binaryFile.Size()), GetBaseDirectory(fileName));
+	} else {
+		// ascii glTF.
+		ret = loader.LoadASCIIFromFile(&scene, &err, fileName.c_str());
+	}
+
+	if (!err.empty())
+	{
+		printf("Err: %s\n", err.c_str());
+	}
+
+	if (!ret)
+	{
+		printf("Failed to parse glTF\n");
+		return;
+	}
+
+	parseScope.End();
+
+	// A cancelled load stops at the next stage, only the one in progress still runs to its end
+	if (LoadCancelled(progress))
+	{
+		return;
+	}
+
+	ProfileScope bufferScope("Map glTF buffers");
+	GltfBuffers buffers;
+	if (!buffers.Open(scene, fileName, binaryFile.Data() != nullptr ? &binaryFile : nullptr))
+	{
+		printf("Failed to map glTF buffers\n");
+		return;
+	}
+
+	bufferScope.End();
+
+	// ----------- Transformation matrix --------- 
+	ProfileScope traverseScope("Traverse nodes");
+	std::map<std::string, glm::mat4> nodeString2Matrix;
+	auto rootNodeNamesList = scene.scenes.at(scene.defaultScene);
+	for (auto& sceneNode : rootNodeNamesList)
+	{
+		TraverseGLTFNode(nodeString2Matrix, scene, sceneNode, glm::mat4(1.0f));
+	}
+
+	// -------- Instancing -----------
+
+	// Meshes placed by several nodes are stored once in object space and traced through instances.
+	// Everything else is baked into world space in bottom level 0, which has a single identity instance.
+	std::map<std::string, int> meshReferenceCount;
+	for (auto& nodeString : nodeString2Matrix)
+	{
+		for (auto& meshName : scene.nodes.at(nodeString.first).meshes)
+		{
+			meshReferenceCount[meshName]++;
+		}
+	}
+
+	std::vector<int> bottomLevelTriangleCounts(1, 0);
+	std::map<std::string, int> meshBottomLevel;
+	std::vector<std::pair<int, glm::mat4>> instances = { { 0, glm::mat4(1.0f) } };
+	traverseScope.End();
+
+	// -------- Sizing pass -----------
+
+	ProfileScope sizingScope("Size primitives");
+
+	// Where each primitive lands in the scene arrays only depends on the primitives before it.
+	// Working that out first lets the decode pass below fill the arrays in any order.
+	std::vector<PrimitiveLoad> primitiveLoads;
+	int storedVertexCount = 0;
+	uint32_t arenaVertexCount = 0;
+	uint32_t arenaIndexCount = 0;
+	uint32_t largestVertexCount = 0;
+	MaterialLookup materialLookup;
+	int materialReferenceCount = 0;
+	for (auto& nodeString : nodeString2Matrix)
+	{
+
+		const tinygltf::Node& node = scene.nodes.at(nodeString.first);
+		const glm::mat4 & matrix = nodeString.second;
+		const glm::mat3 & matrixNormal = glm::transpose(glm::inverse(glm::mat3(matrix)));
+
+		SceneNode& sceneNode = sceneNodes[nodeString.first];
+		sceneNode.worldMatrix = matrix;
+
+		int materialId = 0;
+		for (auto& meshName : node.meshes)
+		{
+			// Ray tracer geometry is only stored for the first placement of an instanced mesh
+			int bottomLevel = 0;
+			bool storeGeometry = true;
+			bool isInstanced = meshReferenceCount.at(meshName) > 1;
+			if (isInstanced)
+			{
+				auto sharedMesh = meshBottomLevel.find(meshName);
+				if (sharedMesh != meshBottomLevel.end())
+				{
+					bottomLevel = sharedMesh->second;
+					storeGeometry = false;
+				}
+				else
+				{
+					bottomLevel = static_cast<int>(bottomLevelTriangleCounts.size());
+					bottomLevelTriangleCounts.push_back(0);
+					meshBottomLevel.insert(std::make_pair(meshName, bottomLevel));
+				}
+				sceneNode.instances.push_back(static_cast<int>(instances.size()));
+				instances.push_back(std::make_pair(bottomLevel, matrix));
+			}
+
+			auto& mesh = scene.meshes.at(meshName);
+			for (size_t i = 0; i < mesh.primitives.size(); i++)
+			{
+				const tinygltf::Primitive& primitive = mesh.primitives[i];
+
+				// Non-indexed primitives are skipped, everything after them is still placed from the counts so far
+				if (primitive.indices.empty())
+				{
+					continue;
+				}
+
+				PrimitiveLoad load;
+				load.primitive = &primitive;
+				load.mesh = static_cast<int>(meshes.Size());
+				load.matrix = matrix;
+				load.matrixNormal = matrixNormal;
+				load.storeGeometry = storeGeometry;
+				load.isInstanced = isInstanced;
+				load.bottomLevel = bottomLevel;
+
+				// Primitive indices are local to its own vertices
+				load.firstVertex = storedVertexCount;
+				load.firstTriangle = bottomLevelTriangleCounts[bottomLevel];
+
+				// The rasterizer draws every placement from its own range of the arena
+				int vertexCount = static_cast<int>(AttributeCount(scene, buffers, primitive, "POSITION"));
+				int indexCount = static_cast<int>(buffers.Reader(scene.accessors.at(primitive.indices)).Count());
+				MeshData meshData;
+				meshData.firstIndex = arenaIndexCount;
+				meshData.indexCount = indexCount;
+				meshData.baseVertex = arenaVertexCount;
+				meshData.vertexCount = vertexCount;
+				meshes.Add(meshData);
+				arenaIndexCount += indexCount;
+				arenaVertexCount += vertexCount;
+				largestVertexCount = std::max(largestVertexCount, meshData.vertexCount);
+
+				if (storeGeometry)
+				{
+					storedVertexCount += vertexCount;
+					bottomLevelTriangleCounts[bottomLevel] += indexCount / 3;
+
+					if (!isInstanced)
+					{
+						sceneNode.bakedVertices.push_back({ load.firstVertex, vertexCount });
+					}
+				}
+
+				// ----------Materials-------------
+
+				// Triangles reference their material in the interned table. The light material hack still counts
+				// one material per attribute of each primitive of the node, the way materials used to be stored.
+				Material material = MakeDefaultMaterial();
+				if (!primitive.material.empty())
+				{
+					material = LoadMaterial(scene, primitive.material, materialId);
+					materialId += static_cast<int>(primitive.attributes.size());
+				}
+				load.materialId = InternMaterial(material, materials, materialLookup);
+				++materialReferenceCount;
+
+				primitiveLoads.push_back(load);
+			}
+		}
+	}
+
+	// Bottom levels own contiguous triangle ranges
+	std::vector<int> bottomLevelFirstTriangles;
+	int triangleCount = 0;
+	for (int bottomLevelTriangleCount : bottomLevelTriangleCounts)
+	{
+		bottomLevelFirstTriangles.push_back(triangleCount);
+		triangleCount += bottomLevelTriangleCount;
+	}
+	for (PrimitiveLoad& load : primitiveLoads)
+	{
+		load.firstTriangle += bottomLevelFirstTriangles[load.bottomLevel];
+	}
+	sizingScope.End();
+
+	// -------- Decode pass -----------
+
+	ProfileScope decodeScope("Decode primitives");
+	verticePositions.resize(storedVertexCount);
+	verticeNormals.resize(storedVertexCount);
+	indices.resize(triangleCount);
+
+	// Attributes a primitive does not have stay zero
+	geometryArena.indexSize = largestVertexCount <= 65536 ? sizeof(uint16_t) : sizeof(uint32_t);
+	geometryArena.indices.resize(arenaIndexCount * geometryArena.indexSize);
+	geometryArena.positions.resize(arenaVertexCount);
+	geometryArena.normals.resize(arenaVertexCount);
+	geometryArena.texcoords.resize(arenaVertexCount);
+
+	// Large primitives split their vertices across threads as well.
+	// An asynchronous load decodes batches of growing size and publishes each one as soon as it is done.
+	int batchBegin = 0;
+	int batchTriangleCount = ASYNC_LOAD_FIRST_BATCH_TRIANGLES;
+	while (batchBegin < static_cast<int>(primitiveLoads.size()))
+	{
+		int batchEnd = static_cast<int>(primitiveLoads.size());
+		if (progress != nullptr)
+		{
+			int batchTriangles = 0;
+			batchEnd = batchBegin;
+			while (batchEnd < static_cast<int>(primitiveLoads.size()) && batchTriangles < batchTriangleCount)
+			{
+				batchTriangles += meshes.indexCount[primitiveLoads[batchEnd++].mesh] / 3;
+			}
+			batchTriangleCount *= 2;
+		}
+
+		ParallelFor(m_threadPool.get(), batchBegin, batchEnd, 1, [&](int begin, int end)
+		{
+			for (int p = begin; p < end; ++p)
+			{
+				DecodePrimitive(primitiveLoads[p], scene, buffers, *this, m_threadPool.get());
+			}
+		});
+
+		if (progress != nullptr && !PublishBatch(*progress, primitiveLoads, batchBegin, batchEnd, *this, m_threadPool.get()))
+		{
+			return;
+		}
+		batchBegin = batchEnd;
+	}
+
+	decodeScope.End();
+	printf("Decoded %zu primitives, %d vertices, %d triangles and %zu materials (%d references) in %.2f ms on %d threads\n",
+		primitiveLoads.size(),
+		storedVertexCount,
+		triangleCount,
+		materials.size(),
+		materialReferenceCount,
+		decodeScope.ElapsedMs(),
+		m_threadPool->ThreadCount());
+
+	// -------- Vertex welding -----------
+
+	if (LoadCancelled(progress))
+	{
+		return;
+	}
+
+	if (options.weldVertices)
+	{
+		ProfileScope weldScope("Weld vertices");
+		size_t unweldedCount = geometryArena.positions.size();
+		WeldPrimitives(primitiveLoads, *this, m_threadPool.get());
+		weldScope.End();
+
+		printf("Welded %zu -> %zu vertices, %zu -> %zu ray tracer vertices, in %.2f ms\n",
+			unweldedCount,
+			geometryArena.positions.size(),
+			static_cast<size_t>(storedVertexCount),
+			verticePositions.size(),
+			weldScope.ElapsedMs());
+	}
+
+	// -------- Vertex cache -----------
+
+	if (LoadCancelled(progress))
+	{
+		return;
+	}
+
+	if (options.optimizeVertexCache)
+	{
+		ProfileScope optimizeScope("Optimize vertex cache");
+		std::pair<float, float> acmr = OptimizeMeshes(meshes, geometryArena, m_threadPool.get());
+		optimizeScope.End();
+
+		printf("Optimized %zu meshes for the vertex cache, ACMR %.3f -> %.3f, in %.2f ms\n",
+			meshes.Size(),
+			acmr.first,
+			acmr.second,
+			optimizeScope.ElapsedMs());
+	}
+
+	// -------- Meshlets -----------
+
+	if (LoadCancelled(progress))
+	{
+		return;
+	}
+
+	ProfileScope meshletScope("Build meshlets");
+	MeshletStats meshletStats = BuildArenaMeshlets(meshes, geometryArena, m_threadPool.get());
+	meshletScope.End();
+
+	printf("Built %zu meshlets for %zu meshes, %.1f%% vertex and %.1f%% triangle fill, in %.2f ms\n",
+		meshletStats.meshletCount,
+		meshes.Size(),
+		100.0f * meshletStats.vertexFill,
+		100.0f * meshletStats.triangleFill,
+		meshletScope.ElapsedMs());
+
+	// -------- Levels of detail -----------
+
+	if (LoadCancelled(progress))
+	{
+		return;
+	}
+
+	std::vector<std::pair<int, float>> secondaryBottomLevels;
+	if (options.generateLods)
+	{
+		ProfileScope lodScope("Build levels of detail");
+		std::vector<size_t> levelTriangles = BuildArenaLods(meshes, geometryArena, options.optimizeVertexCache, m_threadPool.get());
+		const size_t primaryTriangleCount = indices.size();
+		secondaryBottomLevels = BuildSecondaryTriangles(primitiveLoads, *this, bottomLevelFirstTriangles, m_threadPool.get());
+		lodScope.End();
+
+		std::string levels;
+		for (size_t l = 0; l < levelTriangles.size(); ++l)
+		{
+			levels += (l == 0 ? "" : " -> ") + std::to_string(levelTriangles[l]);
+		}
+		printf("Built %zu levels of detail for %zu meshes (%s triangles), %zu of %zu ray tracer triangles for secondary rays, in %.2f ms\n",
+			geometryArena.lods.size(),
+			meshes.Size(),
+			levels.c_str(),
+			indices.size() - primaryTriangleCount,
+			primaryTriangleCount,
+			lodScope.ElapsedMs());
+	}
+
+	// -------- Acceleration structure -----------
+
+	if (LoadCancelled(progress))
+	{
+		return;
+	}
+
+	ProfileScope bvhScope("Acceleration structure");
+	BuildTwoLevelBVH(*this, bottomLevelFirstTriangles, instances, secondaryBottomLevels, options, m_threadPool.get());
+	UpdateBakedTriangles();
+	UpdateTriangleRecords();
+	bvhScope.End();
+
+	if (LoadCancelled(progress))
+	{
+		return;
+	}
+
+	ProfileScope dumpScope("Dump glTF");
+	Dump(scene);
+	dumpScope.End();
+
+	printf("Loaded %s in %.2f ms, %.1f MB mapped, peak RSS %.1f MB\n",
+		fileName.c_str(),
+		profileScope.ElapsedMs(),
+		buffers.MappedSize() / (1024.0 * 1024.0),
+		PeakResidentSetSize() / (1024.0 * 1024.0));
+
+	if (options.useCache)
+	{
+		ProfileScope saveCacheScope("Write scene cache");
+		if (!SaveSceneCache(*this, cacheFileName, contentHash, options))
+		{
+			printf("Failed to write scene cache %s\n", cacheFileName.c_str());
+		}
+	}
+}
+
+
+std::vector<AABB>
+Scene::TriangleBounds(
+	ThreadPool* pool
+	) const
+{
+	std::vector<AABB> triangleBounds(indices.size());
+	ParallelFor(pool, 0, static_cast<int>(indices.size()), BVH::PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			triangleBounds[i].Grow(glm::vec3(verticePositions[indices[i].x]));
+			triangleBounds[i].Grow(glm::vec3(verticePositions[indices[i].y]));
+			triangleBounds[i].Grow(glm::vec3(verticePositions[indices[i].z]));
+		}
+	});
+	return triangleBounds;
+}
+
+// -------- Dynamic nodes -----------
+
+void
+Scene::SetNodeTransform(
+	const std::string& nodeName,
+	const glm::mat4& worldMatrix
+	)
+{
+	auto found = sceneNodes.find(nodeName);
+	if (found == sceneNodes.end())
+	{
+		printf("Unknown node %s\n", nodeName.c_str());
+		return;
+	}
+
+	SceneNode& node = found->second;
+
+	// Baked vertices only know their world position, move them by the change of transform
+	glm::mat4 delta = worldMatrix * glm::inverse(node.worldMatrix);
+	glm::mat3 deltaNormal = glm::transpose(glm::inverse(glm::mat3(delta)));
+	for (const IndexRange& range : node.bakedVertices)
+	{
+		for (int v = range.first; v < range.first + range.count; ++v)
+		{
+			verticePositions[v] = delta * verticePositions[v];
+			verticeNormals[v] = EncodeOctahedral(deltaNormal * DecodeOctahedral(verticeNormals[v]));
+		}
+		m_changedVertices.push_back(range);
+	}
+
+	for (int triangle : node.bakedTriangles)
+	{
+		UpdateTriangleRecord(triangle);
+		m_changedTriangles.push_back(triangle);
+		bvh.MarkTriangleDirty(0, triangle);
+	}
+	for (int triangle : node.bakedSecondaryTriangles)
+	{
+		UpdateTriangleRecord(triangle);
+		m_changedTriangles.push_back(triangle);
+		bvh.MarkTriangleDirty(bvh.bottomLevels[0].secondaryBottomLevel, triangle);
+	}
+
+	for (int instance : node.instances)
+	{
+		bvh.SetInstanceTransform(instance, worldMatrix);
+	}
+
+	node.worldMatrix = worldMatrix;
+}
+
+SceneUpdate
+Scene::UpdateLoad()
+{
+	SceneUpdate update;
+	if (!m_asyncLoad)
+	{
+		return update;
+	}
+
+	std::vector<LoadBatch> batches;
+	std::unique_ptr<Scene> loaded;
+	{
+		std::lock_guard<std::mutex> lock(m_asyncLoad->mutex);
+		batches.swap(m_asyncLoad->batches);
+		loaded = std::move(m_asyncLoad->scene);
+	}
+
+	auto now = std::chrono::high_resolution_clock::now();
+	const double elapsed = std::chrono::duration<double, std::milli>(now - m_asyncLoad->start).count();
+
+	// -------- Final scene -----------
+
+	// Welded, optimized and instanced, it supersedes every batch, including any still pending
+	if (loaded)
+	{
+		m_asyncLoad->thread.join();
+		std::swap(meshes, loaded->meshes);
+		std::swap(geometryArena, loaded->geometryArena);
+		materials.swap(loaded->materials);
+		indices.swap(loaded->indices);
+		verticePositions.swap(loaded->verticePositions);
+		verticeNormals.swap(loaded->verticeNormals);
+		triangleRecords.swap(loaded->triangleRecords);
+		std::swap(bvh, loaded->bvh);
+		sceneNodes.swap(loaded->sceneNodes);
+		m_sceneFile.swap(loaded->m_sceneFile);
+		m_options = loaded->m_options;
+		m_changedVertices.clear();
+		m_changedTriangles.clear();
+
+		printf("Asynchronous load complete after %.2f ms, %d batches shown before: %zu triangles, %zu vertices, %zu BVH nodes\n",
+			elapsed,
+			m_asyncLoad->mergedBatchCount,
+			indices.size(),
+			verticePositions.size(),
+			bvh.NodeCount());
+		m_asyncLoad.reset();
+
+		update.reloaded = true;
+		update.changedNodes.push_back({ 0, static_cast<int>(bvh.NodeCount()) });
+		update.changedInstances.push_back({ 0, static_cast<int>(bvh.instances.size()) });
+		update.changedVertices.push_back({ 0, static_cast<int>(verticePositions.size()) });
+		update.changedTriangles.push_back({ 0, static_cast<int>(indices.size()) });
+		return update;
+	}
+
+	if (batches.empty())
+	{
+		return update;
+	}
+
+	// -------- Batches -----------
+
+	const int firstVertex = static_cast<int>(verticePositions.size());
+	const int firstTriangle = static_cast<int>(indices.size());
+	for (LoadBatch& batch : batches)
+	{
+		const uint32_t firstIndex = static_cast<uint32_t>(geometryArena.indices.size() / batch.arena.indexSize);
+		const int32_t baseVertex = static_cast<int32_t>(geometryArena.positions.size());
+		for (MeshData mesh : batch.meshes)
+		{
+			mesh.firstIndex += firstIndex;
+			mesh.baseVertex += baseVertex;
+			meshes.Add(mesh);
+		}
+		geometryArena.indexSize = batch.arena.indexSize;
+		geometryArena.indices.insert(geometryArena.indices.end(), batch.arena.indices.begin(), batch.arena.indices.end());
+		geometryArena.positions.insert(geometryArena.positions.end(), batch.arena.positions.begin(), batch.arena.positions.end());
+		geometryArena.normals.insert(geometryArena.normals.end(), batch.arena.normals.begin(), batch.arena.normals.end());
+		geometryArena.texcoords.insert(geometryArena.texcoords.end(), batch.arena.texcoords.begin(), batch.arena.texcoords.end());
+		if (!batch.materials.empty())
+		{
+			materials.swap(batch.materials);
+		}
+
+		const int vertexOffset = static_cast<int>(verticePositions.size());
+		const int triangleOffset = static_cast<int>(indices.size());
+		for (glm::ivec4 triangle : batch.indices)
+		{
+			indices.push_back(glm::ivec4(triangle.x + vertexOffset, triangle.y + vertexOffset, triangle.z + vertexOffset, triangle.w));
+		}
+		verticePositions.insert(verticePositions.end(), batch.verticePositions.begin(), batch.verticePositions.end());
+		verticeNormals.insert(verticeNormals.end(), batch.verticeNormals.begin(), batch.verticeNormals.end());
+
+		batch.bottomLevel.firstTriangle = triangleOffset;
+		bvh.bottomLevels.push_back(std::move(batch.bottomLevel));
+		bvh.AddInstance(static_cast<int>(bvh.bottomLevels.size()) - 1, glm::mat4(1.0f));
+	}
+	bvh.Build();
+
+	triangleRecords.resize(indices.size());
+	ParallelFor(m_threadPool.get(), firstTriangle, static_cast<int>(indices.size()), BVH::PARALLEL_GRAIN_SIZE, [this](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			UpdateTriangleRecord(i);
+		}
+	});
+
+	if (m_asyncLoad->mergedBatchCount == 0)
+	{
+		printf("Asynchronous load showed its first %zu triangles after %.2f ms\n", indices.size(), elapsed);
+	}
+	m_asyncLoad->mergedBatchCount += static_cast<int>(batches.size());
+
+	update.reloaded = true;
+	update.changedNodes.push_back({ 0, static_cast<int>(bvh.NodeCount()) });
+	update.changedInstances.push_back({ 0, static_cast<int>(bvh.instances.size()) });
+	update.changedVertices.push_back({ firstVertex, static_cast<int>(verticePositions.size()) - firstVertex });
+	update.changedTriangles.push_back({ firstTriangle, static_cast<int>(indices.size()) - firstTriangle });
+	return update;
+}
+
+bool
+Scene::Loading() const
+{
+	return m_asyncLoad != nullptr;
+}
+
+SceneUpdate
+Scene::UpdateBVH()
+{
+	SceneUpdate update;
+	if (bvh.nodes.empty())
+	{
+		return update;
+	}
+
+	std::vector<int> changedNodes;
+	std::vector<int> changedInstances;
+	bool needsRebuild = bvh.Refit(
+		[this](int triangle)
+		{
+			AABB bounds;
+			bounds.Grow(glm::vec3(verticePositions[indices[triangle].x]));
+			bounds.Grow(glm::vec3(verticePositions[indices[triangle].y]));
+			bounds.Grow(glm::vec3(verticePositions[indices[triangle].z]));
+			return bounds;
+		},
+		changedNodes,
+		changedInstances);
+
+	update.changedVertices.swap(m_changedVertices);
+	update.changedTriangles = MakeIndexRanges(m_changedTriangles);
+	m_changedTriangles.clear();
+
+	if (needsRebuild)
+	{
+		RebuildBVH();
+		update.rebuilt = true;
+		return update;
+	}
+
+	update.changedNodes = MakeIndexRanges(changedNodes);
+	update.changedInstances = MakeIndexRanges(changedInstances);
+	return update;
+}
+
+const SceneOptions&
+Scene::Options() const
+{
+	return m_options;
+}
+
+const SceneFile*
+Scene::File() const
+{
+	return m_sceneFile.get();
+}
+
+void
+Scene::RebuildBVH()
+{
+	std::vector<std::pair<int, glm::mat4>> instances;
+	for (size_t i = 0; i < bvh.instanceTransforms.size(); ++i)
+	{
+		instances.push_back(std::make_pair(bvh.instanceBottomLevels[i], bvh.instanceTransforms[i]));
+	}
+
+	std::vector<std::pair<int, float>> secondaryBottomLevels;
+	for (const TwoLevelBVH::BottomLevel& bottomLevel : bvh.bottomLevels)
+	{
+		secondaryBottomLevels.push_back(std::make_pair(bottomLevel.secondaryBottomLevel, bottomLevel.secondaryError));
+	}
+
+	printf("Refitted BVH degraded past %.1fx its built SAH cost, rebuilding\n", BVH::REBUILD_SAH_GROWTH);
+	std::vector<int> bottomLevelFirstTriangles = RestoreSourceTriangles();
+	BuildTwoLevelBVH(*this, bottomLevelFirstTriangles, instances, secondaryBottomLevels, m_options, m_threadPool.get());
+	UpdateBakedTriangles();
+	UpdateTriangleRecords();
+}
+
+std::vector<int>
+Scene::RestoreSourceTriangles()
+{
+	std::vector<int> bottomLevelFirstTriangles;
+	std::vector<glm::ivec4> sourceIndices;
+	for (const TwoLevelBVH::BottomLevel& bottomLevel : bvh.bottomLevels)
+	{
+		const int first = static_cast<int>(sourceIndices.size());
+		bottomLevelFirstTriangles.push_back(first);
+		sourceIndices.resize(first + bottomLevel.sourceTriangleCount);
+
+		// Every reference of a triangle has the same indices, whichever is written last wins
+		const std::vector<int>& order = bottomLevel.bvh.primitiveIndices;
+		for (int slot = 0; slot < static_cast<int>(order.size()); ++slot)
+		{
+			sourceIndices[first + order[slot]] = indices[bottomLevel.firstTriangle + slot];
+		}
+	}
+	indices.swap(sourceIndices);
+	return bottomLevelFirstTriangles;
+}
+
+void
+Scene::UpdateBakedTriangles()
+{
+	// Owner node of every baked vertex
+	std::vector<SceneNode*> vertexOwners(verticePositions.size(), nullptr);
+	for (auto& sceneNode : sceneNodes)
+	{
+		sceneNode.second.bakedTriangles.clear();
+		sceneNode.second.bakedSecondaryTriangles.clear();
+		for (const IndexRange& range : sceneNode.second.bakedVertices)
+		{
+			std::fill(vertexOwners.begin() + range.first, vertexOwners.begin() + range.first + range.count, &sceneNode.second);
+		}
+	}
+
+	if (bvh.bottomLevels.empty())
+	{
+		return;
+	}
+
+	const TwoLevelBVH::BottomLevel& bakedLevel = bvh.bottomLevels[0];
+	for (int t = bakedLevel.firstTriangle; t < bakedLevel.firstTriangle + bakedLevel.triangleCount; ++t)
+	{
+		SceneNode* owner = vertexOwners[indices[t].x];
+		if (owner != nullptr)
+		{
+			owner->bakedTriangles.push_back(t);
+		}
+	}
+
+	// The coarse copy moves with the vertices it shares with bottom level 0
+	if (bakedLevel.secondaryBottomLevel >= 0)
+	{
+		const TwoLevelBVH::BottomLevel& secondaryLevel = bvh.bottomLevels[bakedLevel.secondaryBottomLevel];
+		for (int t = secondaryLevel.firstTriangle; t < secondaryLevel.firstTriangle + secondaryLevel.triangleCount; ++t)
+		{
+			SceneNode* owner = vertexOwners[indices[t].x];
+			if (owner != nullptr)
+			{
+				owner->bakedSecondaryTriangles.push_back(t);
+			}
+		}
+	}
+}
+
+void
+Scene::UpdateTriangleRecords()
+{
+	triangleRecords.resize(indices.size());
+	ParallelFor(m_threadPool.get(), 0, static_cast<int>(indices.size()), BVH::PARALLEL_GRAIN_SIZE, [this](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			UpdateTriangleRecord(i);
+		}
+	});
+}
+
+void
+Scene::UpdateTriangleRecord(
+	int triangle
+	)
+{
+	const glm::ivec4& index = indices[triangle];
+	TriangleRecord& record = triangleRecords[triangle];
+	record.vert0 = verticePositions[index.x];
+	record.edge1 = verticePositions[index.y] - record.vert0;
+	record.edge2 = verticePositions[index.z] - record.vert0;
+}
+
+Scene::~Scene()
+{
+	// The loading thread stops after its current batch or load stage, deleting a scene still waits for that one to finish
+	if (m_asyncLoad)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_asyncLoad->mutex);
+			m_asyncLoad->cancelled = true;
+		}
+		m_asyncLoad->thread.join();
 	}
 }
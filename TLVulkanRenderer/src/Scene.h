@@ -1,21 +1,269 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include "tinygltfloader/tiny_gltf_loader.h"
 #include "SceneUtil.h"
+#include "accel/TwoLevelBVH.h"
 
 class Camera;
+class SceneFile;
+class ThreadPool;
+struct AsyncSceneLoad;
+
+/**
+ * \brief What UpdateBVH or UpdateLoad changed, so that renderers only upload those ranges
+ */
+struct SceneUpdate
+{
+	/**
+	 * \brief The BVH was rebuilt, triangle order and node count may have changed and every ray tracing buffer must be uploaded again
+	 */
+	bool rebuilt = false;
+
+	/**
+	 * \brief An asynchronous load added meshes or replaced the scene with its final version. Any array may have changed size,
+	 *        buffers have to be grown before the changed ranges are uploaded, and the rasterizer draws every mesh again.
+	 */
+	bool reloaded = false;
+
+	std::vector<IndexRange> changedNodes;
+	std::vector<IndexRange> changedInstances;
+	std::vector<IndexRange> changedVertices;
+	std::vector<IndexRange> changedTriangles;
+};
+
+/**
+ * \brief How a scene is prepared for rendering
+ */
+struct SceneOptions
+{
+	/**
+	 * \brief Node layout built for the ray tracer, it picks the matching traversal when it creates its pipeline
+	 */
+	EBVHLayout bvhLayout = BVH_LAYOUT_BINARY;
+
+	/**
+	 * \brief Build bottom levels with spatial splits, slower to build but faster to trace through long and thin triangles.
+	 *        Split triangles are stored once per reference. Refits grow their leaves back to the whole triangles.
+	 */
+	bool spatialSplits = false;
+
+	/**
+	 * \brief Extra triangle references spatial splits may create, as a fraction of the triangle count
+	 */
+	float duplicationBudget = 0.3f;
+
+	/**
+	 * \brief Build bottom level 0, the geometry baked into world space, as a linear BVH the ray tracer rebuilds on the device every frame.
+	 *        The CPU keeps refitting its own copy for the top level bounds. Binary layout only, spatial splits are not used for that level.
+	 */
+	bool deviceBvh = false;
+
+	/**
+	 * \brief Merge the vertices of each primitive whose position, normal and texture coordinates are identical, see mesh/VertexWeld.h.
+	 *        Shrinks both the rasterizer's geometry arena and the ray tracer's vertex arrays.
+	 */
+	bool weldVertices = false;
+
+	/**
+	 * \brief Reorder the rasterizer's triangles for the post-transform vertex cache and for less overdraw, then its vertices in the order they are fetched,
+	 *        see mesh/VertexCache.h. The ray tracer's arrays are left alone, the BVH sorts its triangles anyway.
+	 */
+	bool optimizeVertexCache = false;
+
+	/**
+	 * \brief Simplify every mesh into a chain of levels of detail the rasterizer picks from by projected error, see mesh/MeshSimplify.h.
+	 *        The ray tracer gets a coarser copy of its triangles for shadow and bounce rays, camera rays still hit the full meshes.
+	 */
+	bool generateLods = false;
+
+	/**
+	 * \brief Load from and save to the scene cache next to the glTF file, see SceneCache.h
+	 */
+	bool useCache = true;
+
+	/**
+	 * \brief Load on a background thread and return an empty scene right away. Decoded meshes are handed to the renderers in batches
+	 *        through Scene::UpdateLoad, baked into world space, until the final scene replaces them. Not used with deviceBvh.
+	 */
+	bool asyncLoad = false;
+};
+
+/**
+ * \brief Apply one command line flag (--wide-bvh, --sbvh, --split-budget=<fraction>, --gpu-bvh, --weld, --optimize-vertex-cache, --lod, --no-cache, --async-load)
+ * \return false if the flag is not a scene option
+ */
+bool
+ParseSceneOption(
+	const std::string& flag,
+	SceneOptions& options
+);
+
 class Scene
 {
 public:
-	Scene(std::string fileName);
+	Scene(
+		std::string fileName,
+		const SceneOptions& options = SceneOptions()
+	);
 	~Scene();
+
+	/**
+	 * \brief Bounding box of every triangle in indices
+	 */
+	std::vector<AABB>
+	TriangleBounds(
+		ThreadPool* pool = nullptr
+	) const;
+
+	// -------- Dynamic nodes -----------
+
+	/**
+	 * \brief Move a glTF node to a new world matrix. Children are not moved along.
+	 *        The BVH is only refit on the next UpdateBVH, so several nodes can be moved per frame.
+	 */
+	void
+	SetNodeTransform(
+		const std::string& nodeName,
+		const glm::mat4& worldMatrix
+	);
+
+	/**
+	 * \brief Refit the BVH to the nodes moved since the last update, or rebuild it once refits degraded it too much
+	 */
+	SceneUpdate
+	UpdateBVH();
+
+	// -------- Asynchronous loading -----------
+
+	/**
+	 * \brief Take over what the loading thread finished since the last call, see SceneOptions::asyncLoad.
+	 *        Batches are appended as one new bottom level each, the final scene replaces everything.
+	 */
+	SceneUpdate
+	UpdateLoad();
+
+	/**
+	 * \return true until UpdateLoad took over the final scene
+	 */
+	bool
+	Loading() const;
+
+	const SceneOptions&
+	Options() const;
+
+	/**
+	 * \brief Scene file this scene was loaded from, nullptr for glTF files. It stays mapped for the lifetime of the scene,
+	 *        renderers copy its GPU layout sections straight into staging memory instead of converting them again.
+	 */
+	const SceneFile*
+	File() const;
 	
 	Camera* camera;
-	std::vector<MeshData*> meshesData;
+	MeshTable meshes;
+
+	/**
+	 * \brief Vertices and indices of every mesh
+	 */
+	GeometryArena geometryArena;
+
 	std::vector<Material> materials;
 	std::vector<glm::ivec4> indices;
 	std::vector<glm::vec4> verticePositions;
-	std::vector<glm::vec4> verticeNormals;
+
+	/**
+	 * \brief Octahedral unit normals, one per entry of verticePositions, see mesh/VertexQuantization.h
+	 */
+	std::vector<uint32_t> verticeNormals;
+
+	/**
+	 * \brief Positions of every triangle in indices, in the same order. Traversal only reads these,
+	 *        indices and normals are fetched once for the closest hit.
+	 */
+	std::vector<TriangleRecord> triangleRecords;
+
+	/**
+	 * \brief Instances of bottom level hierarchies. Each bottom level owns a contiguous range of indices stored in its leaf order.
+	 *        Vertices of instanced meshes are stored once, in object space.
+	 */
+	TwoLevelBVH bvh;
+
+	/**
+	 * \brief What the ray tracer stores for each glTF node
+	 */
+	struct SceneNode
+	{
+		glm::mat4 worldMatrix;
+
+		/**
+		 * \brief BVH instances placed by this node
+		 */
+		std::vector<int> instances;
+
+		/**
+		 * \brief Vertices and triangles baked into world space in bottom level 0
+		 */
+		std::vector<IndexRange> bakedVertices;
+		std::vector<int> bakedTriangles;
+
+		/**
+		 * \brief Triangles of the coarser copy of bottom level 0 secondary rays trace, over the same baked vertices
+		 */
+		std::vector<int> bakedSecondaryTriangles;
+	};
+	std::map<std::string, SceneNode> sceneNodes;
+
+private:
+
+	/**
+	 * \brief Scene without anything loaded yet, the loading thread fills one of these
+	 */
+	explicit Scene(
+		const SceneOptions& options
+	);
+
+	/**
+	 * \brief Load a scene file, a scene cache or a glTF file. With progress, decoded primitives are also published in batches.
+	 */
+	void
+	Load(
+		const std::string& fileName,
+		AsyncSceneLoad* progress
+	);
+
+	void
+	RebuildBVH();
+
+	/**
+	 * \brief Undo the leaf order and duplicates of every bottom level, so that each owns its original triangles again
+	 * \return first triangle of each bottom level
+	 */
+	std::vector<int>
+	RestoreSourceTriangles();
+
+	/**
+	 * \brief Find the baked triangles of each node again after bottom level 0 has been reordered
+	 */
+	void
+	UpdateBakedTriangles();
+
+	/**
+	 * \brief Recompute the triangle records of every triangle in indices
+	 */
+	void
+	UpdateTriangleRecords();
+
+	void
+	UpdateTriangleRecord(
+		int triangle
+	);
+
+	SceneOptions m_options;
+	std::unique_ptr<SceneFile> m_sceneFile;
+	std::unique_ptr<AsyncSceneLoad> m_asyncLoad;
+	std::unique_ptr<ThreadPool> m_threadPool;
+	std::vector<IndexRange> m_changedVertices;
+	std::vector<int> m_changedTriangles;
 };
 
@@ -0,0 +1,404 @@
+#include <cstdio>
+#include <fstream>
+#include "SceneCache.h"
+#include "BinaryStream.h"
+#include "MappedFile.h"
+#include "Scene.h"
+
+// Same configuration tinygltfloader includes picojson with
+#define PICOJSON_USE_INT64
+#include "tinygltfloader/picojson.h"
+
+// 'TLSC'
+static const uint32_t SCENE_CACHE_MAGIC = 0x43534C54;
+
+namespace
+{
+	struct SceneCacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t contentHash;
+		int32_t bvhLayout;
+		int32_t spatialSplits;
+		float duplicationBudget;
+		int32_t deviceBvh;
+		int32_t weldVertices;
+		int32_t optimizeVertexCache;
+		int32_t generateLods;
+	};
+}
+
+// -------- Hash -----------
+
+static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+static const uint64_t FNV_PRIME = 1099511628211ull;
+
+/**
+ * \brief FNV-1a over 64-bit words instead of bytes, large files are hashed at memory speed
+ */
+static uint64_t
+HashBytes(
+	const Byte* data,
+	size_t size,
+	uint64_t hash
+	)
+{
+	size_t wordCount = size / sizeof(uint64_t);
+	for (size_t i = 0; i < wordCount; ++i)
+	{
+		uint64_t word;
+		std::memcpy(&word, data + i * sizeof(uint64_t), sizeof(uint64_t));
+		hash = (hash ^ word) * FNV_PRIME;
+	}
+	for (size_t i = wordCount * sizeof(uint64_t); i < size; ++i)
+	{
+		hash = (hash ^ data[i]) * FNV_PRIME;
+	}
+	return (hash ^ size) * FNV_PRIME;
+}
+
+static std::string
+GetDirectory(
+	const std::string& fileName
+	)
+{
+	size_t separator = fileName.find_last_of("/\\");
+	return separator == std::string::npos ? std::string() : fileName.substr(0, separator + 1);
+}
+
+/**
+ * \brief Buffer files referenced by a glTF JSON document, data URIs are part of the document itself
+ */
+static std::vector<std::string>
+ExternalBufferUris(
+	const Byte* json,
+	size_t size
+	)
+{
+	std::vector<std::string> uris;
+
+	picojson::value document;
+	const char* text = reinterpret_cast<const char*>(json);
+	std::string error = picojson::parse(document, text, text + size);
+	if (!error.empty() || !document.is<picojson::object>() || !document.contains("buffers"))
+	{
+		return uris;
+	}
+
+	// glTF 1.0 stores buffers by id, glTF 2.0 in an array
+	std::vector<picojson::value> buffers;
+	const picojson::value& bufferList = document.get("buffers");
+	if (bufferList.is<picojson::object>())
+	{
+		for (const auto& buffer : bufferList.get<picojson::object>())
+		{
+			buffers.push_back(buffer.second);
+		}
+	}
+	else if (bufferList.is<picojson::array>())
+	{
+		buffers = bufferList.get<picojson::array>();
+	}
+
+	for (const picojson::value& buffer : buffers)
+	{
+		if (buffer.is<picojson::object>() && buffer.contains("uri") && buffer.get("uri").is<std::string>())
+		{
+			const std::string& uri = buffer.get("uri").get<std::string>();
+			if (uri.compare(0, 5, "data:") != 0)
+			{
+				uris.push_back(uri);
+			}
+		}
+	}
+	return uris;
+}
+
+uint64_t
+HashSceneFiles(
+	const std::string& fileName
+	)
+{
+	MappedFile file;
+	if (!file.Open(fileName))
+	{
+		return 0;
+	}
+
+	uint64_t hash = HashBytes(file.Data(), file.Size(), FNV_OFFSET_BASIS);
+
+	// Binary glTF carries its buffers in the same file
+	bool isBinary = fileName.size() >= 4 && fileName.compare(fileName.size() - 4, 4, ".glb") == 0;
+	if (!isBinary)
+	{
+		for (const std::string& uri : ExternalBufferUris(file.Data(), file.Size()))
+		{
+			MappedFile buffer;
+			if (buffer.Open(GetDirectory(fileName) + uri))
+			{
+				hash = HashBytes(buffer.Data(), buffer.Size(), hash);
+			}
+		}
+	}
+
+	return hash;
+}
+
+std::string
+SceneCacheFileName(
+	const std::string& fileName
+	)
+{
+	return fileName + ".tlcache";
+}
+
+// -------- Load -----------
+
+void
+ClearScene(
+	Scene& scene
+	)
+{
+	scene.meshes.Clear();
+	scene.geometryArena = GeometryArena();
+	scene.materials.clear();
+	scene.indices.clear();
+	scene.verticePositions.clear();
+	scene.verticeNormals.clear();
+	scene.triangleRecords.clear();
+	scene.bvh.Clear();
+	scene.sceneNodes.clear();
+}
+
+bool
+ReadMeshes(
+	BinaryReader& reader,
+	Scene& scene
+	)
+{
+	MeshTable& outMeshes = scene.meshes;
+	return reader.ReadVector(outMeshes.firstIndex) &&
+		reader.ReadVector(outMeshes.indexCount) &&
+		reader.ReadVector(outMeshes.baseVertex) &&
+		reader.ReadVector(outMeshes.vertexCount) &&
+		reader.ReadVector(outMeshes.firstMeshlet) &&
+		reader.ReadVector(outMeshes.meshletCount) &&
+		reader.ReadVector(outMeshes.firstLod) &&
+		reader.ReadVector(outMeshes.lodCount) &&
+		reader.ReadVector(outMeshes.vertexAttributes) &&
+		outMeshes.indexCount.size() == outMeshes.Size() &&
+		outMeshes.baseVertex.size() == outMeshes.Size() &&
+		outMeshes.vertexCount.size() == outMeshes.Size() &&
+		outMeshes.firstMeshlet.size() == outMeshes.Size() &&
+		outMeshes.meshletCount.size() == outMeshes.Size() &&
+		outMeshes.firstLod.size() == outMeshes.Size() &&
+		outMeshes.lodCount.size() == outMeshes.Size() &&
+		outMeshes.vertexAttributes.size() == outMeshes.Size();
+}
+
+static bool
+ReadGeometryArena(
+	BinaryReader& reader,
+	GeometryArena& outArena
+	)
+{
+	return reader.ReadVector(outArena.positions) &&
+		reader.ReadVector(outArena.normals) &&
+		reader.ReadVector(outArena.texcoords) &&
+		reader.ReadVector(outArena.indices) &&
+		reader.Read(outArena.indexSize) &&
+		reader.ReadVector(outArena.meshlets) &&
+		reader.ReadVector(outArena.meshletVertices) &&
+		reader.ReadVector(outArena.meshletTriangles) &&
+		reader.ReadVector(outArena.lods);
+}
+
+bool
+ReadSceneNodes(
+	BinaryReader& reader,
+	Scene& scene
+	)
+{
+	std::map<std::string, Scene::SceneNode>& outSceneNodes = scene.sceneNodes;
+	uint64_t nodeCount;
+	if (!reader.Read(nodeCount))
+	{
+		return false;
+	}
+
+	for (uint64_t n = 0; n < nodeCount; ++n)
+	{
+		std::string name;
+		Scene::SceneNode node;
+		if (!reader.ReadString(name) ||
+			!reader.Read(node.worldMatrix) ||
+			!reader.ReadVector(node.instances) ||
+			!reader.ReadVector(node.bakedVertices) ||
+			!reader.ReadVector(node.bakedTriangles) ||
+			!reader.ReadVector(node.bakedSecondaryTriangles))
+		{
+			return false;
+		}
+		outSceneNodes.insert(std::make_pair(name, std::move(node)));
+	}
+	return true;
+}
+
+bool
+LoadSceneCache(
+	Scene& scene,
+	const std::string& cacheFileName,
+	uint64_t contentHash,
+	const SceneOptions& options
+	)
+{
+	MappedFile file;
+	if (!file.Open(cacheFileName))
+	{
+		return false;
+	}
+
+	BinaryReader reader(file.Data(), file.Size());
+
+	SceneCacheHeader header;
+	if (!reader.Read(header) ||
+		header.magic != SCENE_CACHE_MAGIC ||
+		header.version != SCENE_CACHE_VERSION ||
+		header.contentHash != contentHash ||
+		header.bvhLayout != options.bvhLayout ||
+		header.spatialSplits != (options.spatialSplits ? 1 : 0) ||
+		(options.spatialSplits && header.duplicationBudget != options.duplicationBudget) ||
+		header.deviceBvh != (options.deviceBvh ? 1 : 0) ||
+		header.weldVertices != (options.weldVertices ? 1 : 0) ||
+		header.optimizeVertexCache != (options.optimizeVertexCache ? 1 : 0) ||
+		header.generateLods != (options.generateLods ? 1 : 0))
+	{
+		return false;
+	}
+
+	bool loaded = ReadMeshes(reader, scene) &&
+		ReadGeometryArena(reader, scene.geometryArena) &&
+		reader.ReadVector(scene.materials) &&
+		reader.ReadVector(scene.indices) &&
+		reader.ReadVector(scene.verticePositions) &&
+		reader.ReadVector(scene.verticeNormals) &&
+		ReadSceneNodes(reader, scene) &&
+		scene.bvh.Read(reader);
+
+	if (!loaded)
+	{
+		printf("Scene cache %s is corrupted, ignoring it\n", cacheFileName.c_str());
+		ClearScene(scene);
+	}
+	return loaded;
+}
+
+// -------- Save -----------
+
+void
+WriteMeshes(
+	BinaryWriter& writer,
+	const Scene& scene
+	)
+{
+	// One array after the other, like the table
+	const MeshTable& meshes = scene.meshes;
+	writer.WriteVector(meshes.firstIndex);
+	writer.WriteVector(meshes.indexCount);
+	writer.WriteVector(meshes.baseVertex);
+	writer.WriteVector(meshes.vertexCount);
+	writer.WriteVector(meshes.firstMeshlet);
+	writer.WriteVector(meshes.meshletCount);
+	writer.WriteVector(meshes.firstLod);
+	writer.WriteVector(meshes.lodCount);
+	writer.WriteVector(meshes.vertexAttributes);
+}
+
+void
+WriteSceneNodes(
+	BinaryWriter& writer,
+	const Scene& scene
+	)
+{
+	writer.Write<uint64_t>(scene.sceneNodes.size());
+	for (const auto& sceneNode : scene.sceneNodes)
+	{
+		writer.WriteString(sceneNode.first);
+		writer.Write(sceneNode.second.worldMatrix);
+		writer.WriteVector(sceneNode.second.instances);
+		writer.WriteVector(sceneNode.second.bakedVertices);
+		writer.WriteVector(sceneNode.second.bakedTriangles);
+		writer.WriteVector(sceneNode.second.bakedSecondaryTriangles);
+	}
+}
+
+bool
+SaveSceneCache(
+	const Scene& scene,
+	const std::string& cacheFileName,
+	uint64_t contentHash,
+	const SceneOptions& options
+	)
+{
+	BinaryWriter writer;
+
+	SceneCacheHeader header = {};
+	header.magic = SCENE_CACHE_MAGIC;
+	header.version = SCENE_CACHE_VERSION;
+	header.contentHash = contentHash;
+	header.bvhLayout = options.bvhLayout;
+	header.spatialSplits = options.spatialSplits ? 1 : 0;
+	header.duplicationBudget = options.duplicationBudget;
+	header.deviceBvh = options.deviceBvh ? 1 : 0;
+	header.weldVertices = options.weldVertices ? 1 : 0;
+	header.optimizeVertexCache = options.optimizeVertexCache ? 1 : 0;
+	header.generateLods = options.generateLods ? 1 : 0;
+	writer.Write(header);
+
+	WriteMeshes(writer, scene);
+
+	writer.WriteVector(scene.geometryArena.positions);
+	writer.WriteVector(scene.geometryArena.normals);
+	writer.WriteVector(scene.geometryArena.texcoords);
+	writer.WriteVector(scene.geometryArena.indices);
+	writer.Write(scene.geometryArena.indexSize);
+	writer.WriteVector(scene.geometryArena.meshlets);
+	writer.WriteVector(scene.geometryArena.meshletVertices);
+	writer.WriteVector(scene.geometryArena.meshletTriangles);
+	writer.WriteVector(scene.geometryArena.lods);
+
+	writer.WriteVector(scene.materials);
+	writer.WriteVector(scene.indices);
+	writer.WriteVector(scene.verticePositions);
+	writer.WriteVector(scene.verticeNormals);
+
+	WriteSceneNodes(writer, scene);
+
+	scene.bvh.Write(writer);
+
+	// Write next to the cache and swap it in, so that a crash never leaves half a cache behind
+	const std::string temporaryFileName = cacheFileName + ".tmp";
+	{
+		std::ofstream file(temporaryFileName, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			return false;
+		}
+		file.write(reinterpret_cast<const char*>(writer.Data().data()), writer.Data().size());
+		if (!file.good())
+		{
+			return false;
+		}
+	}
+
+	std::remove(cacheFileName.c_str());
+	if (std::rename(temporaryFileName.c_str(), cacheFileName.c_str()) != 0)
+	{
+		std::remove(temporaryFileName.c_str());
+		return false;
+	}
+
+	printf("Wrote scene cache %s (%.1f MB)\n", cacheFileName.c_str(), writer.Data().size() / (1024.0 * 1024.0));
+	return true;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+class BinaryReader;
+class BinaryWriter;
+class Scene;
+struct SceneOptions;
+
+/**
+ * \brief Bump whenever the cached data or anything that changes how it is built changes (BVH build settings, vertex transforms, ...)
+ */
+static const uint32_t SCENE_CACHE_VERSION = 13;
+
+/**
+ * \brief Hash of a glTF file and of every external buffer it references, cached scenes are keyed by it
+ */
+uint64_t
+HashSceneFiles(
+	const std::string& fileName
+);
+
+/**
+ * \brief Cache file written next to the glTF file
+ */
+std::string
+SceneCacheFileName(
+	const std::string& fileName
+);
+
+/**
+ * \brief Memory-map a cache written by SaveSceneCache and restore the flattened geometry, materials, nodes and BVH from it
+ * \return false if there is no cache, or it was written by another version, for other options or for other file contents.
+ *         The scene is left empty in that case.
+ */
+bool
+LoadSceneCache(
+	Scene& scene,
+	const std::string& cacheFileName,
+	uint64_t contentHash,
+	const SceneOptions& options
+);
+
+bool
+SaveSceneCache(
+	const Scene& scene,
+	const std::string& cacheFileName,
+	uint64_t contentHash,
+	const SceneOptions& options
+);
+
+// -------- Serialization -----------
+
+/**
+ * \brief Meshes and scene nodes are not plain arrays, the scene cache and scene files (see SceneFile.h) store them the same way
+ */
+void
+WriteMeshes(
+	BinaryWriter& writer,
+	const Scene& scene
+);
+
+bool
+ReadMeshes(
+	BinaryReader& reader,
+	Scene& scene
+);
+
+void
+WriteSceneNodes(
+	BinaryWriter& writer,
+	const Scene& scene
+);
+
+bool
+ReadSceneNodes(
+	BinaryReader& reader,
+	Scene& scene
+);
+
+/**
+ * \brief Drop everything a failed load may have restored
+ */
+void
+ClearScene(
+	Scene& scene
+);
@@ -0,0 +1,297 @@
+#include <cstdio>
+#include <fstream>
+#include "SceneFile.h"
+#include "BinaryStream.h"
+#include "Scene.h"
+#include "SceneCache.h"
+#include "mesh/VertexQuantization.h"
+
+// 'TLSF'
+static const uint32_t SCENE_FILE_MAGIC = 0x46534C54;
+
+static uint64_t
+AlignUp(
+	uint64_t offset
+	)
+{
+	return (offset + SCENE_FILE_ALIGNMENT - 1) & ~(SCENE_FILE_ALIGNMENT - 1);
+}
+
+// -------- Read -----------
+
+bool
+SceneFile::Open(
+	const std::string& fileName
+	)
+{
+	if (!m_file.Open(fileName))
+	{
+		return false;
+	}
+
+	BinaryReader reader(m_file.Data(), m_file.Size());
+	if (!reader.Read(m_header) ||
+		m_header.magic != SCENE_FILE_MAGIC ||
+		m_header.version != SCENE_FILE_VERSION ||
+		m_header.sectionCount != SCENE_SECTION_COUNT)
+	{
+		m_file.Close();
+		return false;
+	}
+
+	// Sections are stored in order, one entry each
+	for (uint32_t s = 0; s < SCENE_SECTION_COUNT; ++s)
+	{
+		SceneSectionEntry& entry = m_sections[s];
+		if (!reader.Read(entry) ||
+			entry.section != s ||
+			entry.offset % SCENE_FILE_ALIGNMENT != 0 ||
+			entry.offset > m_file.Size() ||
+			entry.size > m_file.Size() - entry.offset)
+		{
+			m_file.Close();
+			return false;
+		}
+	}
+	return true;
+}
+
+const Byte*
+SceneFile::SectionData(
+	ESceneSection section
+	) const
+{
+	const SceneSectionEntry& entry = m_sections[section];
+	return entry.size > 0 ? m_file.Data() + entry.offset : nullptr;
+}
+
+uint64_t
+SceneFile::SectionSize(
+	ESceneSection section
+	) const
+{
+	return m_sections[section].size;
+}
+
+bool
+SceneFile::CopySection(
+	ESceneSection section,
+	void* destination,
+	uint64_t capacity
+	) const
+{
+	const SceneSectionEntry& entry = m_sections[section];
+	if (entry.size > capacity)
+	{
+		return false;
+	}
+	if (entry.size > 0)
+	{
+		std::memcpy(destination, m_file.Data() + entry.offset, static_cast<size_t>(entry.size));
+	}
+	return true;
+}
+
+void
+SceneFile::ReadOptions(
+	SceneOptions& outOptions
+	) const
+{
+	outOptions.bvhLayout = static_cast<EBVHLayout>(m_header.bvhLayout);
+	outOptions.spatialSplits = m_header.spatialSplits != 0;
+	outOptions.duplicationBudget = m_header.duplicationBudget;
+	outOptions.deviceBvh = m_header.deviceBvh != 0;
+	outOptions.weldVertices = m_header.weldVertices != 0;
+	outOptions.optimizeVertexCache = m_header.optimizeVertexCache != 0;
+	outOptions.generateLods = m_header.generateLods != 0;
+}
+
+const SceneFileHeader&
+SceneFile::Header() const
+{
+	return m_header;
+}
+
+uint64_t
+SceneFile::FileSize() const
+{
+	return m_file.Size();
+}
+
+/**
+ * \brief Plain arrays fill their vector with a single copy out of the mapping
+ */
+template <typename T>
+static bool
+ReadArray(
+	const SceneFile& file,
+	ESceneSection section,
+	std::vector<T>& outValues
+	)
+{
+	uint64_t size = file.SectionSize(section);
+	if (size % sizeof(T) != 0)
+	{
+		return false;
+	}
+	outValues.resize(static_cast<size_t>(size / sizeof(T)));
+	return file.CopySection(section, outValues.data(), outValues.size() * sizeof(T));
+}
+
+static BinaryReader
+SectionReader(
+	const SceneFile& file,
+	ESceneSection section
+	)
+{
+	return BinaryReader(file.SectionData(section), static_cast<size_t>(file.SectionSize(section)));
+}
+
+bool
+LoadSceneFile(
+	Scene& scene,
+	const SceneFile& file
+	)
+{
+	BinaryReader meshReader = SectionReader(file, SCENE_SECTION_MESHES);
+	BinaryReader sceneNodeReader = SectionReader(file, SCENE_SECTION_SCENE_NODES);
+	BinaryReader bvhReader = SectionReader(file, SCENE_SECTION_BVH);
+
+	GeometryArena& arena = scene.geometryArena;
+	arena.indexSize = file.Header().indexSize;
+	bool loaded = ReadMeshes(meshReader, scene) &&
+		ReadArray(file, SCENE_SECTION_ARENA_POSITIONS, arena.positions) &&
+		ReadArray(file, SCENE_SECTION_ARENA_NORMALS, arena.normals) &&
+		ReadArray(file, SCENE_SECTION_ARENA_TEXCOORDS, arena.texcoords) &&
+		ReadArray(file, SCENE_SECTION_ARENA_INDICES, arena.indices) &&
+		ReadArray(file, SCENE_SECTION_MATERIALS, scene.materials) &&
+		ReadArray(file, SCENE_SECTION_INDICES, scene.indices) &&
+		ReadArray(file, SCENE_SECTION_POSITIONS, scene.verticePositions) &&
+		ReadArray(file, SCENE_SECTION_NORMALS, scene.verticeNormals) &&
+		ReadArray(file, SCENE_SECTION_TRIANGLE_RECORDS, scene.triangleRecords) &&
+		ReadSceneNodes(sceneNodeReader, scene) &&
+		scene.bvh.Read(bvhReader) &&
+		ReadArray(file, SCENE_SECTION_ARENA_MESHLETS, arena.meshlets) &&
+		ReadArray(file, SCENE_SECTION_ARENA_MESHLET_VERTICES, arena.meshletVertices) &&
+		ReadArray(file, SCENE_SECTION_ARENA_MESHLET_TRIANGLES, arena.meshletTriangles) &&
+		ReadArray(file, SCENE_SECTION_ARENA_LODS, arena.lods);
+
+	// Sections the renderers stream themselves still have to match the scene
+	loaded = loaded &&
+		file.SectionSize(SCENE_SECTION_RASTER_POSITIONS) == arena.positions.size() * sizeof(QuantizedPosition) &&
+		file.SectionSize(SCENE_SECTION_RASTER_NORMALS) == arena.normals.size() * sizeof(uint32_t) &&
+		file.SectionSize(SCENE_SECTION_RASTER_BOUNDS) == scene.meshes.Size() * sizeof(PositionBounds) &&
+		scene.triangleRecords.size() == scene.indices.size() &&
+		(arena.indexSize == sizeof(uint16_t) || arena.indexSize == sizeof(uint32_t)) &&
+		arena.indices.size() % arena.indexSize == 0 &&
+		arena.meshletTriangles.size() % 3 == 0;
+
+	if (!loaded)
+	{
+		ClearScene(scene);
+	}
+	return loaded;
+}
+
+// -------- Write -----------
+
+bool
+SaveSceneFile(
+	const Scene& scene,
+	const std::string& fileName
+	)
+{
+	const SceneOptions& options = scene.Options();
+	const GeometryArena& arena = scene.geometryArena;
+
+	QuantizedArena quantized;
+	QuantizeArena(arena, scene.meshes, quantized);
+
+	BinaryWriter meshWriter;
+	WriteMeshes(meshWriter, scene);
+	BinaryWriter sceneNodeWriter;
+	WriteSceneNodes(sceneNodeWriter, scene);
+	BinaryWriter bvhWriter;
+	scene.bvh.Write(bvhWriter);
+
+	// In ESceneSection order
+	const std::pair<const void*, uint64_t> sections[SCENE_SECTION_COUNT] = {
+		{ meshWriter.Data().data(), meshWriter.Data().size() },
+		{ arena.positions.data(), arena.positions.size() * sizeof(glm::vec3) },
+		{ arena.normals.data(), arena.normals.size() * sizeof(glm::vec3) },
+		{ arena.texcoords.data(), arena.texcoords.size() * sizeof(glm::vec2) },
+		{ arena.indices.data(), arena.indices.size() },
+		{ quantized.positions.data(), quantized.positions.size() * sizeof(QuantizedPosition) },
+		{ quantized.normals.data(), quantized.normals.size() * sizeof(uint32_t) },
+		{ quantized.bounds.data(), quantized.bounds.size() * sizeof(PositionBounds) },
+		{ scene.materials.data(), scene.materials.size() * sizeof(Material) },
+		{ scene.indices.data(), scene.indices.size() * sizeof(glm::ivec4) },
+		{ scene.verticePositions.data(), scene.verticePositions.size() * sizeof(glm::vec4) },
+		{ scene.verticeNormals.data(), scene.verticeNormals.size() * sizeof(uint32_t) },
+		{ scene.triangleRecords.data(), scene.triangleRecords.size() * sizeof(TriangleRecord) },
+		{ sceneNodeWriter.Data().data(), sceneNodeWriter.Data().size() },
+		{ bvhWriter.Data().data(), bvhWriter.Data().size() },
+		{ arena.meshlets.data(), arena.meshlets.size() * sizeof(Meshlet) },
+		{ arena.meshletVertices.data(), arena.meshletVertices.size() * sizeof(uint32_t) },
+		{ arena.meshletTriangles.data(), arena.meshletTriangles.size() },
+		{ arena.lods.data(), arena.lods.size() * sizeof(MeshLod) }
+	};
+
+	SceneFileHeader header = {};
+	header.magic = SCENE_FILE_MAGIC;
+	header.version = SCENE_FILE_VERSION;
+	header.sectionCount = SCENE_SECTION_COUNT;
+	header.bvhLayout = options.bvhLayout;
+	header.spatialSplits = options.spatialSplits ? 1 : 0;
+	header.duplicationBudget = options.duplicationBudget;
+	header.deviceBvh = options.deviceBvh ? 1 : 0;
+	header.weldVertices = options.weldVertices ? 1 : 0;
+	header.optimizeVertexCache = options.optimizeVertexCache ? 1 : 0;
+	header.generateLods = options.generateLods ? 1 : 0;
+	header.indexSize = arena.indexSize;
+
+	SceneSectionEntry entries[SCENE_SECTION_COUNT] = {};
+	uint64_t offset = AlignUp(sizeof(SceneFileHeader) + sizeof(entries));
+	for (uint32_t s = 0; s < SCENE_SECTION_COUNT; ++s)
+	{
+		entries[s].section = s;
+		entries[s].offset = offset;
+		entries[s].size = sections[s].second;
+		offset = AlignUp(offset + sections[s].second);
+	}
+
+	// Write next to the file and swap it in, like the scene cache
+	const std::string temporaryFileName = fileName + ".tmp";
+	{
+		std::ofstream file(temporaryFileName, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			return false;
+		}
+
+		const char padding[SCENE_FILE_ALIGNMENT] = {};
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(entries), sizeof(entries));
+		uint64_t written = sizeof(header) + sizeof(entries);
+		for (uint32_t s = 0; s < SCENE_SECTION_COUNT; ++s)
+		{
+			file.write(padding, static_cast<std::streamsize>(entries[s].offset - written));
+			file.write(static_cast<const char*>(sections[s].first), static_cast<std::streamsize>(sections[s].second));
+			written = entries[s].offset + entries[s].size;
+		}
+		file.write(padding, static_cast<std::streamsize>(offset - written));
+
+		if (!file.good())
+		{
+			return false;
+		}
+	}
+
+	std::remove(fileName.c_str());
+	if (std::rename(temporaryFileName.c_str(), fileName.c_str()) != 0)
+	{
+		std::remove(temporaryFileName.c_str());
+		return false;
+	}
+	return true;
+}
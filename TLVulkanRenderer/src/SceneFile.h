@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "MappedFile.h"
+
+class Scene;
+struct SceneOptions;
+
+/**
+ * \brief Bump whenever a section changes layout or what the BVH builders guarantee, older scene files are rejected and have to be converted again
+ */
+static const uint32_t SCENE_FILE_VERSION = 6;
+
+/**
+ * \brief Every section starts on this boundary, so that it can be copied into staging memory or mapped on its own with aligned copies
+ */
+static const uint64_t SCENE_FILE_ALIGNMENT = 256;
+
+/**
+ * \brief Sections of a .tlscene file. Arrays are stored exactly as the scene holds them or the renderers upload them,
+ *        meshes, scene nodes and the BVH are BinaryWriter streams.
+ */
+enum ESceneSection
+{
+	SCENE_SECTION_MESHES = 0,
+	SCENE_SECTION_ARENA_POSITIONS = 1,
+	SCENE_SECTION_ARENA_NORMALS = 2,
+	SCENE_SECTION_ARENA_TEXCOORDS = 3,
+	SCENE_SECTION_ARENA_INDICES = 4,
+	SCENE_SECTION_RASTER_POSITIONS = 5,	// QuantizedArena, see mesh/VertexQuantization.h
+	SCENE_SECTION_RASTER_NORMALS = 6,
+	SCENE_SECTION_RASTER_BOUNDS = 7,
+	SCENE_SECTION_MATERIALS = 8,
+	SCENE_SECTION_INDICES = 9,
+	SCENE_SECTION_POSITIONS = 10,
+	SCENE_SECTION_NORMALS = 11,
+	SCENE_SECTION_TRIANGLE_RECORDS = 12,
+	SCENE_SECTION_SCENE_NODES = 13,
+	SCENE_SECTION_BVH = 14,
+	SCENE_SECTION_ARENA_MESHLETS = 15,
+	SCENE_SECTION_ARENA_MESHLET_VERTICES = 16,
+	SCENE_SECTION_ARENA_MESHLET_TRIANGLES = 17,
+	SCENE_SECTION_ARENA_LODS = 18,
+	SCENE_SECTION_COUNT = 19
+};
+
+/**
+ * \brief Start of the file, followed by the section table
+ */
+struct SceneFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sectionCount;
+
+	// Options the scene was built with, see SceneOptions
+	int32_t bvhLayout;
+	int32_t spatialSplits;
+	float duplicationBudget;
+	int32_t deviceBvh;
+	int32_t weldVertices;
+	int32_t optimizeVertexCache;
+	int32_t generateLods;
+
+	// GeometryArena::indexSize
+	uint32_t indexSize;
+};
+
+/**
+ * \brief Where a section lies in the file
+ */
+struct SceneSectionEntry
+{
+	uint32_t section;
+	uint32_t pad0;
+	uint64_t offset;
+	uint64_t size;
+};
+
+/**
+ * \brief Pre-baked scene, flattened geometry, materials and acceleration structure as Scene builds them from a glTF file,
+ *        in GPU layout. Loading one is a handful of copies out of a memory mapping, nothing is parsed or transformed.
+ *        The file is a header and a table of SCENE_SECTION_COUNT entries, followed by the sections.
+ */
+class SceneFile
+{
+public:
+	/**
+	 * \return false if the file does not exist, is not a scene file, was written by another version or its section table is out of bounds
+	 */
+	bool
+	Open(
+		const std::string& fileName
+	);
+
+	/**
+	 * \brief Bytes of a section in the mapping, nullptr for an empty section. Pages are read from disk as they are touched.
+	 */
+	const Byte*
+	SectionData(
+		ESceneSection section
+	) const;
+
+	uint64_t
+	SectionSize(
+		ESceneSection section
+	) const;
+
+	/**
+	 * \brief Copy a section into memory the caller owns, usually a mapped staging buffer
+	 * \return false if the section does not fit in capacity bytes
+	 */
+	bool
+	CopySection(
+		ESceneSection section,
+		void* destination,
+		uint64_t capacity
+	) const;
+
+	/**
+	 * \brief Options the scene was converted with, see SceneOptions
+	 */
+	void
+	ReadOptions(
+		SceneOptions& outOptions
+	) const;
+
+	const SceneFileHeader&
+	Header() const;
+
+	uint64_t
+	FileSize() const;
+
+private:
+	MappedFile m_file;
+	SceneFileHeader m_header;
+	SceneSectionEntry m_sections[SCENE_SECTION_COUNT];
+};
+
+/**
+ * \brief Restore a scene from an opened scene file
+ * \return false if a section is corrupted, the scene is left empty in that case
+ */
+bool
+LoadSceneFile(
+	Scene& scene,
+	const SceneFile& file
+);
+
+/**
+ * \brief Write a scene built from a glTF file as a .tlscene file, with the options it was built with
+ */
+bool
+SaveSceneFile(
+	const Scene& scene,
+	const std::string& fileName
+);
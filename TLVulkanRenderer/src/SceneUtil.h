@@ -1,6 +1,10 @@
 #pragma once
+#include <array>
+#include <vector>
 #include "Typedef.h"
 #include <glm/glm.hpp>
+#include "mesh/Meshlet.h"
+#include "mesh/MeshSimplify.h"
 
 // ---------
 // VERTEX
@@ -11,7 +15,8 @@ typedef enum
 	INDEX,
 	POSITION,
 	NORMAL,
-	TEXCOORD
+	TEXCOORD,
+	VERTEX_ATTRIBUTE_COUNT
 } EVertexAttributeType;
 
 typedef struct VertexAttributeInfoTyp
@@ -27,10 +32,141 @@ typedef struct VertexAttributeInfoTyp
 // GEOMETRY
 // ----------
 
+/**
+ * \brief Rasterizer geometry of every primitive in one vertex pool and one index pool, uploaded as a single device buffer.
+ *        Vertices are in world space, once per placement of a mesh. Indices stay local to their primitive.
+ */
+struct GeometryArena
+{
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> texcoords;
+
+	// 16-bit while every primitive has at most 65536 vertices, 32-bit otherwise
+	std::vector<Byte> indices;
+	uint32_t indexSize = sizeof(uint16_t);
+
+	// Every mesh split into meshlets, see mesh/Meshlet.h. Meshlet vertices are local to their mesh like indices,
+	// meshlet triangles are three bytes each, local to their meshlet.
+	std::vector<Meshlet> meshlets;
+	std::vector<uint32_t> meshletVertices;
+	std::vector<uint8_t> meshletTriangles;
+
+	// Levels of detail of every mesh, see mesh/MeshSimplify.h. Coarser levels index the vertices of their mesh
+	// from ranges of indices past the ones of the full meshes.
+	std::vector<MeshLod> lods;
+};
+
+/**
+ * \brief Layout of each vertex attribute of a mesh, indexed by EVertexAttributeType.
+ *        count is 0 for attributes the primitive does not have.
+ */
+typedef std::array<VertexAttributeInfo, VERTEX_ATTRIBUTE_COUNT> VertexAttributeTable;
+
+/**
+ * \brief One glTF primitive for the rasterizer, a range of the scene's GeometryArena.
+ *        Attributes the primitive does not have are zero in the arena.
+ */
 struct MeshData
 {
-	std::map<EVertexAttributeType, std::vector<Byte>> vertexData;
-	std::map<EVertexAttributeType, VertexAttributeInfo> vertexAttributes;
+	VertexAttributeTable vertexAttributes = {};
+
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0;
+
+	// Added to every index of the primitive when it is drawn
+	int32_t baseVertex = 0;
+	uint32_t vertexCount = 0;
+
+	// Range of GeometryArena::meshlets, empty until the scene has built them
+	uint32_t firstMeshlet = 0;
+	uint32_t meshletCount = 0;
+
+	// Range of GeometryArena::lods starting with the full mesh, empty unless the scene was built with levels of detail
+	uint32_t firstLod = 0;
+	uint32_t lodCount = 0;
+};
+
+/**
+ * \brief Every mesh of a scene as a structure of arrays, one entry per mesh in each array.
+ *        Recording draws walks the ranges front to back without touching the attribute layouts.
+ */
+struct MeshTable
+{
+	std::vector<uint32_t> firstIndex;
+	std::vector<uint32_t> indexCount;
+	std::vector<int32_t> baseVertex;
+	std::vector<uint32_t> vertexCount;
+	std::vector<uint32_t> firstMeshlet;
+	std::vector<uint32_t> meshletCount;
+	std::vector<uint32_t> firstLod;
+	std::vector<uint32_t> lodCount;
+	std::vector<VertexAttributeTable> vertexAttributes;
+
+	size_t
+	Size() const
+	{
+		return firstIndex.size();
+	}
+
+	/**
+	 * \return index of the new mesh
+	 */
+	int
+	Add(const MeshData& mesh)
+	{
+		firstIndex.push_back(mesh.firstIndex);
+		indexCount.push_back(mesh.indexCount);
+		baseVertex.push_back(mesh.baseVertex);
+		vertexCount.push_back(mesh.vertexCount);
+		firstMeshlet.push_back(mesh.firstMeshlet);
+		meshletCount.push_back(mesh.meshletCount);
+		firstLod.push_back(mesh.firstLod);
+		lodCount.push_back(mesh.lodCount);
+		vertexAttributes.push_back(mesh.vertexAttributes);
+		return static_cast<int>(firstIndex.size()) - 1;
+	}
+
+	MeshData
+	Get(size_t mesh) const
+	{
+		MeshData meshData;
+		meshData.vertexAttributes = vertexAttributes[mesh];
+		meshData.firstIndex = firstIndex[mesh];
+		meshData.indexCount = indexCount[mesh];
+		meshData.baseVertex = baseVertex[mesh];
+		meshData.vertexCount = vertexCount[mesh];
+		meshData.firstMeshlet = firstMeshlet[mesh];
+		meshData.meshletCount = meshletCount[mesh];
+		meshData.firstLod = firstLod[mesh];
+		meshData.lodCount = lodCount[mesh];
+		return meshData;
+	}
+
+	void
+	Clear()
+	{
+		firstIndex.clear();
+		indexCount.clear();
+		baseVertex.clear();
+		vertexCount.clear();
+		firstMeshlet.clear();
+		meshletCount.clear();
+		firstLod.clear();
+		lodCount.clear();
+		vertexAttributes.clear();
+	}
+};
+
+/**
+ * \brief Triangle as the ray tracer intersects it, laid out to match the std430 TriangleRecord struct in raytrace.comp (48 bytes).
+ *        Vertex 0 and the two edges leaving it, so that Moller-Trumbore starts without following the vertex indices.
+ */
+struct TriangleRecord
+{
+	glm::vec4 vert0;
+	glm::vec4 edge1;
+	glm::vec4 edge2;
 };
 
 // ---------
@@ -0,0 +1,846 @@
+#include <atomic>
+#include <cstring>
+#include <immintrin.h>
+#include "Simd.h"
+#include "mesh/VertexQuantization.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC compiles intrinsics of any instruction set without flags
+#define SIMD_TARGET(isa)
+#else
+// GCC and Clang only emit instructions the function was compiled for
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+// -------- Dispatch -----------
+
+static std::atomic<int> s_simdLevel(-1);
+
+ESimdLevel
+DetectSimdLevel()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse41 = (info[2] & (1 << 19)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+
+	// AVX registers are only usable if the operating system saves them
+	bool avxState = osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+	bool avx2 = false;
+	if (maxLeaf >= 7 && avxState)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	bool sse41 = __builtin_cpu_supports("sse4.1") != 0;
+	bool avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+
+	if (avx2 && sse41)
+	{
+		return SIMD_LEVEL_AVX2;
+	}
+	return sse41 ? SIMD_LEVEL_SSE41 : SIMD_LEVEL_SCALAR;
+}
+
+ESimdLevel
+ActiveSimdLevel()
+{
+	int level = s_simdLevel.load(std::memory_order_relaxed);
+	if (level < 0)
+	{
+		level = DetectSimdLevel();
+		s_simdLevel.store(level, std::memory_order_relaxed);
+	}
+	return static_cast<ESimdLevel>(level);
+}
+
+void
+SetSimdLevel(
+	ESimdLevel level
+)
+{
+	ESimdLevel detected = DetectSimdLevel();
+	s_simdLevel.store(level < detected ? level : detected, std::memory_order_relaxed);
+}
+
+const char*
+SimdLevelName(
+	ESimdLevel level
+)
+{
+	switch (level)
+	{
+	case SIMD_LEVEL_AVX2:
+		return "AVX2";
+	case SIMD_LEVEL_SSE41:
+		return "SSE4.1";
+	default:
+		return "scalar";
+	}
+}
+
+// -------- Widen -----------
+
+template <typename T>
+static void
+WidenIndicesScalar(
+	const uint8_t* data,
+	size_t begin,
+	size_t count,
+	uint32_t* outIndices
+)
+{
+	for (size_t i = begin; i < count; ++i)
+	{
+		T index;
+		std::memcpy(&index, data + i * sizeof(T), sizeof(T));
+		outIndices[i] = index;
+	}
+}
+
+SIMD_TARGET("sse4.1")
+static size_t
+WidenIndicesSSE41(
+	const uint8_t* data,
+	size_t componentSize,
+	size_t count,
+	uint32_t* outIndices
+)
+{
+	size_t i = 0;
+	if (componentSize == 2)
+	{
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 2 * i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(outIndices + i), _mm_cvtepu16_epi32(packed));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(outIndices + i + 4), _mm_cvtepu16_epi32(_mm_srli_si128(packed, 8)));
+		}
+	}
+	else
+	{
+		for (; i + 16 <= count; i += 16)
+		{
+			__m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(outIndices + i), _mm_cvtepu8_epi32(packed));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(outIndices + i + 4), _mm_cvtepu8_epi32(_mm_srli_si128(packed, 4)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(outIndices + i + 8), _mm_cvtepu8_epi32(_mm_srli_si128(packed, 8)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(outIndices + i + 12), _mm_cvtepu8_epi32(_mm_srli_si128(packed, 12)));
+		}
+	}
+	return i;
+}
+
+SIMD_TARGET("avx2")
+static size_t
+WidenIndicesAVX2(
+	const uint8_t* data,
+	size_t componentSize,
+	size_t count,
+	uint32_t* outIndices
+)
+{
+	size_t i = 0;
+	if (componentSize == 2)
+	{
+		for (; i + 16 <= count; i += 16)
+		{
+			__m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 2 * i));
+			__m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 2 * i + 16));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(outIndices + i), _mm256_cvtepu16_epi32(low));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(outIndices + i + 8), _mm256_cvtepu16_epi32(high));
+		}
+	}
+	else
+	{
+		for (; i + 16 <= count; i += 16)
+		{
+			__m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(outIndices + i), _mm256_cvtepu8_epi32(packed));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(outIndices + i + 8), _mm256_cvtepu8_epi32(_mm_srli_si128(packed, 8)));
+		}
+	}
+	return i;
+}
+
+void
+WidenIndices(
+	const uint8_t* data,
+	size_t componentSize,
+	size_t count,
+	uint32_t* outIndices
+)
+{
+	if (componentSize == 4)
+	{
+		std::memcpy(outIndices, data, count * sizeof(uint32_t));
+		return;
+	}
+
+	// Vector loops stop at their last full block, the scalar loop finishes the rest
+	size_t done = 0;
+	switch (ActiveSimdLevel())
+	{
+	case SIMD_LEVEL_AVX2:
+		done = WidenIndicesAVX2(data, componentSize, count, outIndices);
+		break;
+	case SIMD_LEVEL_SSE41:
+		done = WidenIndicesSSE41(data, componentSize, count, outIndices);
+		break;
+	default:
+		break;
+	}
+
+	if (componentSize == 2)
+	{
+		WidenIndicesScalar<uint16_t>(data, done, count, outIndices);
+	}
+	else
+	{
+		WidenIndicesScalar<uint8_t>(data, done, count, outIndices);
+	}
+}
+
+// -------- Narrow -----------
+
+SIMD_TARGET("sse4.1")
+static size_t
+NarrowIndicesSSE41(
+	const uint32_t* indices,
+	size_t count,
+	uint16_t* outIndices
+)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(indices + i));
+		__m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(indices + i + 4));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(outIndices + i), _mm_packus_epi32(low, high));
+	}
+	return i;
+}
+
+SIMD_TARGET("avx2")
+static size_t
+NarrowIndicesAVX2(
+	const uint32_t* indices,
+	size_t count,
+	uint16_t* outIndices
+)
+{
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + i));
+		__m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + i + 8));
+
+		// Packing works within 128-bit lanes, the permute puts the four 64-bit quarters back in order
+		__m256i packed = _mm256_packus_epi32(low, high);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(outIndices + i), _mm256_permute4x64_epi64(packed, 0xD8));
+	}
+	return i;
+}
+
+void
+NarrowIndices(
+	const uint32_t* indices,
+	size_t count,
+	uint16_t* outIndices
+)
+{
+	size_t i = 0;
+	switch (ActiveSimdLevel())
+	{
+	case SIMD_LEVEL_AVX2:
+		i = NarrowIndicesAVX2(indices, count, outIndices);
+		break;
+	case SIMD_LEVEL_SSE41:
+		i = NarrowIndicesSSE41(indices, count, outIndices);
+		break;
+	default:
+		break;
+	}
+
+	for (; i < count; ++i)
+	{
+		outIndices[i] = static_cast<uint16_t>(indices[i]);
+	}
+}
+
+// -------- Triangles -----------
+
+SIMD_TARGET("sse4.1")
+static size_t
+MakeTrianglesSSE41(
+	const uint32_t* indices,
+	size_t triangleCount,
+	int vertexOffset,
+	int materialId,
+	glm::ivec4* outTriangles
+)
+{
+	__m128i offset = _mm_set1_epi32(vertexOffset);
+	__m128i material = _mm_set1_epi32(materialId);
+
+	// Each load reads the first index of the next triangle, so the last triangle is left to the scalar loop
+	size_t t = 0;
+	for (; t + 2 <= triangleCount; ++t)
+	{
+		__m128i triangle = _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(indices + 3 * t)), offset);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(outTriangles + t), _mm_blend_epi16(triangle, material, 0xC0));
+	}
+	return t;
+}
+
+SIMD_TARGET("avx2")
+static size_t
+MakeTrianglesAVX2(
+	const uint32_t* indices,
+	size_t triangleCount,
+	int vertexOffset,
+	int materialId,
+	glm::ivec4* outTriangles
+)
+{
+	__m256i offset = _mm256_set1_epi32(vertexOffset);
+	__m256i material = _mm256_set1_epi32(materialId);
+
+	// Two triangles per iteration, spread from six consecutive indices to two lanes of four
+	__m256i spread = _mm256_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0);
+	size_t t = 0;
+	for (; t + 3 <= triangleCount; t += 2)
+	{
+		__m256i triangles = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + 3 * t));
+		triangles = _mm256_add_epi32(_mm256_permutevar8x32_epi32(triangles, spread), offset);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(outTriangles + t), _mm256_blend_epi32(triangles, material, 0x88));
+	}
+	return t;
+}
+
+void
+MakeTriangles(
+	const uint32_t* indices,
+	size_t triangleCount,
+	int vertexOffset,
+	int materialId,
+	glm::ivec4* outTriangles
+)
+{
+	size_t t = 0;
+	switch (ActiveSimdLevel())
+	{
+	case SIMD_LEVEL_AVX2:
+		t = MakeTrianglesAVX2(indices, triangleCount, vertexOffset, materialId, outTriangles);
+		break;
+	case SIMD_LEVEL_SSE41:
+		t = MakeTrianglesSSE41(indices, triangleCount, vertexOffset, materialId, outTriangles);
+		break;
+	default:
+		break;
+	}
+
+	for (; t < triangleCount; ++t)
+	{
+		outTriangles[t] = glm::ivec4(
+			vertexOffset + static_cast<int>(indices[3 * t]),
+			vertexOffset + static_cast<int>(indices[3 * t + 1]),
+			vertexOffset + static_cast<int>(indices[3 * t + 2]),
+			materialId);
+	}
+}
+
+// -------- Vertices -----------
+
+static const float SNORM16_MAX = 32767.0f;
+
+/**
+ * \brief Broadcast every element of a matrix, column major like glm
+ */
+SIMD_TARGET("sse4.1")
+static void
+BroadcastMatrixSSE41(
+	const float* elements,
+	int elementCount,
+	__m128* outElements
+)
+{
+	for (int e = 0; e < elementCount; ++e)
+	{
+		outElements[e] = _mm_set1_ps(elements[e]);
+	}
+}
+
+/**
+ * \brief Four interleaved vertices are three loads, blends and one shuffle per axis turn them into a register per axis
+ */
+SIMD_TARGET("sse4.1")
+static void
+LoadVerticesSSE41(
+	const float* data,
+	__m128& outX,
+	__m128& outY,
+	__m128& outZ
+)
+{
+	// x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+	__m128 a = _mm_loadu_ps(data);
+	__m128 b = _mm_loadu_ps(data + 4);
+	__m128 c = _mm_loadu_ps(data + 8);
+	__m128 x = _mm_blend_ps(_mm_blend_ps(a, b, 0x4), c, 0x2);
+	__m128 y = _mm_blend_ps(_mm_blend_ps(a, b, 0x9), c, 0x4);
+	__m128 z = _mm_blend_ps(_mm_blend_ps(a, b, 0x2), c, 0x9);
+	outX = _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 2, 3, 0));
+	outY = _mm_shuffle_ps(y, y, _MM_SHUFFLE(2, 3, 0, 1));
+	outZ = _mm_shuffle_ps(z, z, _MM_SHUFFLE(3, 0, 1, 2));
+}
+
+/**
+ * \brief Inverse of LoadVerticesSSE41, the shuffles swap lanes in pairs so they undo themselves
+ */
+SIMD_TARGET("sse4.1")
+static void
+StoreVerticesSSE41(
+	float* data,
+	__m128 x,
+	__m128 y,
+	__m128 z
+)
+{
+	x = _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 2, 3, 0));
+	y = _mm_shuffle_ps(y, y, _MM_SHUFFLE(2, 3, 0, 1));
+	z = _mm_shuffle_ps(z, z, _MM_SHUFFLE(3, 0, 1, 2));
+	_mm_storeu_ps(data, _mm_blend_ps(_mm_blend_ps(x, y, 0x2), z, 0x4));
+	_mm_storeu_ps(data + 4, _mm_blend_ps(_mm_blend_ps(y, z, 0x2), x, 0x4));
+	_mm_storeu_ps(data + 8, _mm_blend_ps(_mm_blend_ps(z, x, 0x2), y, 0x4));
+}
+
+SIMD_TARGET("sse4.1")
+static void
+StorePaddedVerticesSSE41(
+	float* data,
+	__m128 x,
+	__m128 y,
+	__m128 z,
+	__m128 w
+)
+{
+	_MM_TRANSPOSE4_PS(x, y, z, w);
+	_mm_storeu_ps(data, x);
+	_mm_storeu_ps(data + 4, y);
+	_mm_storeu_ps(data + 8, z);
+	_mm_storeu_ps(data + 12, w);
+}
+
+/**
+ * \brief Same rounding as PackSnorm16 in VertexQuantization.cpp, the result is in the low 16 bits of every lane
+ */
+SIMD_TARGET("sse4.1")
+static __m128i
+PackSnorm16SSE41(
+	__m128 value
+)
+{
+	__m128 clamped = _mm_min_ps(_mm_max_ps(value, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+	__m128 rounded = _mm_floor_ps(_mm_add_ps(_mm_mul_ps(clamped, _mm_set1_ps(SNORM16_MAX)), _mm_set1_ps(0.5f)));
+	return _mm_and_si128(_mm_cvtps_epi32(rounded), _mm_set1_epi32(0xFFFF));
+}
+
+/**
+ * \brief EncodeOctahedral of four vertices. Zero vectors encode as 0, and so do the NaN normals of degenerate ones, like the scalar conversion
+ */
+SIMD_TARGET("sse4.1")
+static __m128i
+EncodeOctahedralSSE41(
+	__m128 x,
+	__m128 y,
+	__m128 z
+)
+{
+	__m128 signBit = _mm_set1_ps(-0.0f);
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 length = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(signBit, x), _mm_andnot_ps(signBit, y)), _mm_andnot_ps(signBit, z));
+
+	// Project onto the octahedron, then fold the lower half over the upper one
+	__m128 foldedX = _mm_div_ps(x, length);
+	__m128 foldedY = _mm_div_ps(y, length);
+	__m128 signX = _mm_blendv_ps(_mm_set1_ps(-1.0f), one, _mm_cmpge_ps(foldedX, zero));
+	__m128 signY = _mm_blendv_ps(_mm_set1_ps(-1.0f), one, _mm_cmpge_ps(foldedY, zero));
+	__m128 lowerX = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(signBit, foldedY)), signX);
+	__m128 lowerY = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(signBit, foldedX)), signY);
+	__m128 lower = _mm_cmplt_ps(z, zero);
+	foldedX = _mm_blendv_ps(foldedX, lowerX, lower);
+	foldedY = _mm_blendv_ps(foldedY, lowerY, lower);
+
+	__m128i encoded = _mm_or_si128(PackSnorm16SSE41(foldedX), _mm_slli_epi32(PackSnorm16SSE41(foldedY), 16));
+	return _mm_andnot_si128(_mm_castps_si128(_mm_cmpngt_ps(length, zero)), encoded);
+}
+
+SIMD_TARGET("sse4.1")
+static size_t
+TransformPositionsSSE41(
+	const glm::vec3* positions,
+	size_t count,
+	const glm::mat4& matrix,
+	bool objectSpace,
+	glm::vec3* outWorldPositions,
+	glm::vec4* outStoredPositions
+)
+{
+	// Same order of operations as glm, (m[0] * x + m[1] * y) + (m[2] * z + m[3] * w)
+	__m128 m[16];
+	BroadcastMatrixSSE41(&matrix[0][0], 16, m);
+	__m128 one = _mm_set1_ps(1.0f);
+
+	const float* in = reinterpret_cast<const float*>(positions);
+	size_t v = 0;
+	for (; v + 4 <= count; v += 4)
+	{
+		__m128 x, y, z;
+		LoadVerticesSSE41(in + 3 * v, x, y, z);
+		__m128 worldX = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], x), _mm_mul_ps(m[4], y)), _mm_add_ps(_mm_mul_ps(m[8], z), m[12]));
+		__m128 worldY = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[1], x), _mm_mul_ps(m[5], y)), _mm_add_ps(_mm_mul_ps(m[9], z), m[13]));
+		__m128 worldZ = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[2], x), _mm_mul_ps(m[6], y)), _mm_add_ps(_mm_mul_ps(m[10], z), m[14]));
+		StoreVerticesSSE41(reinterpret_cast<float*>(outWorldPositions + v), worldX, worldY, worldZ);
+
+		if (outStoredPositions == nullptr)
+		{
+			continue;
+		}
+		if (objectSpace)
+		{
+			StorePaddedVerticesSSE41(reinterpret_cast<float*>(outStoredPositions + v), x, y, z, one);
+		}
+		else
+		{
+			__m128 worldW = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[3], x), _mm_mul_ps(m[7], y)), _mm_add_ps(_mm_mul_ps(m[11], z), m[15]));
+			StorePaddedVerticesSSE41(reinterpret_cast<float*>(outStoredPositions + v), worldX, worldY, worldZ, worldW);
+		}
+	}
+	return v;
+}
+
+SIMD_TARGET("sse4.1")
+static size_t
+TransformNormalsSSE41(
+	const glm::vec3* normals,
+	size_t count,
+	const glm::mat3& matrixNormal,
+	bool objectSpace,
+	glm::vec3* outWorldNormals,
+	uint32_t* outEncodedNormals
+)
+{
+	// (m[0] * x + m[1] * y) + m[2] * z, then scaled by 1 / sqrt(dot) like glm::normalize
+	__m128 m[9];
+	BroadcastMatrixSSE41(&matrixNormal[0][0], 9, m);
+	__m128 one = _mm_set1_ps(1.0f);
+
+	const float* in = reinterpret_cast<const float*>(normals);
+	size_t v = 0;
+	for (; v + 4 <= count; v += 4)
+	{
+		__m128 x, y, z;
+		LoadVerticesSSE41(in + 3 * v, x, y, z);
+		__m128 worldX = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], x), _mm_mul_ps(m[3], y)), _mm_mul_ps(m[6], z));
+		__m128 worldY = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[1], x), _mm_mul_ps(m[4], y)), _mm_mul_ps(m[7], z));
+		__m128 worldZ = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[2], x), _mm_mul_ps(m[5], y)), _mm_mul_ps(m[8], z));
+		__m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(worldX, worldX), _mm_mul_ps(worldY, worldY)), _mm_mul_ps(worldZ, worldZ));
+		__m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSquared));
+		worldX = _mm_mul_ps(worldX, inverseLength);
+		worldY = _mm_mul_ps(worldY, inverseLength);
+		worldZ = _mm_mul_ps(worldZ, inverseLength);
+		StoreVerticesSSE41(reinterpret_cast<float*>(outWorldNormals + v), worldX, worldY, worldZ);
+
+		if (outEncodedNormals != nullptr)
+		{
+			__m128i encoded = objectSpace ? EncodeOctahedralSSE41(x, y, z) : EncodeOctahedralSSE41(worldX, worldY, worldZ);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(outEncodedNormals + v), encoded);
+		}
+	}
+	return v;
+}
+
+SIMD_TARGET("avx2")
+static void
+BroadcastMatrixAVX2(
+	const float* elements,
+	int elementCount,
+	__m256* outElements
+)
+{
+	for (int e = 0; e < elementCount; ++e)
+	{
+		outElements[e] = _mm256_set1_ps(elements[e]);
+	}
+}
+
+/**
+ * \brief LoadVerticesSSE41 on eight vertices, four in each 128-bit lane
+ */
+SIMD_TARGET("avx2")
+static void
+LoadVerticesAVX2(
+	const float* data,
+	__m256& outX,
+	__m256& outY,
+	__m256& outZ
+)
+{
+	__m256 a = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(data)), _mm_loadu_ps(data + 12), 1);
+	__m256 b = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(data + 4)), _mm_loadu_ps(data + 16), 1);
+	__m256 c = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(data + 8)), _mm_loadu_ps(data + 20), 1);
+	__m256 x = _mm256_blend_ps(_mm256_blend_ps(a, b, 0x44), c, 0x22);
+	__m256 y = _mm256_blend_ps(_mm256_blend_ps(a, b, 0x99), c, 0x44);
+	__m256 z = _mm256_blend_ps(_mm256_blend_ps(a, b, 0x22), c, 0x99);
+	outX = _mm256_permute_ps(x, _MM_SHUFFLE(1, 2, 3, 0));
+	outY = _mm256_permute_ps(y, _MM_SHUFFLE(2, 3, 0, 1));
+	outZ = _mm256_permute_ps(z, _MM_SHUFFLE(3, 0, 1, 2));
+}
+
+SIMD_TARGET("avx2")
+static void
+StoreVerticesAVX2(
+	float* data,
+	__m256 x,
+	__m256 y,
+	__m256 z
+)
+{
+	x = _mm256_permute_ps(x, _MM_SHUFFLE(1, 2, 3, 0));
+	y = _mm256_permute_ps(y, _MM_SHUFFLE(2, 3, 0, 1));
+	z = _mm256_permute_ps(z, _MM_SHUFFLE(3, 0, 1, 2));
+	__m256 a = _mm256_blend_ps(_mm256_blend_ps(x, y, 0x22), z, 0x44);
+	__m256 b = _mm256_blend_ps(_mm256_blend_ps(y, z, 0x22), x, 0x44);
+	__m256 c = _mm256_blend_ps(_mm256_blend_ps(z, x, 0x22), y, 0x44);
+	_mm_storeu_ps(data, _mm256_castps256_ps128(a));
+	_mm_storeu_ps(data + 4, _mm256_castps256_ps128(b));
+	_mm_storeu_ps(data + 8, _mm256_castps256_ps128(c));
+	_mm_storeu_ps(data + 12, _mm256_extractf128_ps(a, 1));
+	_mm_storeu_ps(data + 16, _mm256_extractf128_ps(b, 1));
+	_mm_storeu_ps(data + 20, _mm256_extractf128_ps(c, 1));
+}
+
+SIMD_TARGET("avx2")
+static void
+StorePaddedVerticesAVX2(
+	float* data,
+	__m256 x,
+	__m256 y,
+	__m256 z,
+	__m256 w
+)
+{
+	// Transpose within each lane, then pair up the vertices of the low and the high lanes
+	__m256 xy0 = _mm256_unpacklo_ps(x, y);
+	__m256 xy1 = _mm256_unpackhi_ps(x, y);
+	__m256 zw0 = _mm256_unpacklo_ps(z, w);
+	__m256 zw1 = _mm256_unpackhi_ps(z, w);
+	__m256 v0 = _mm256_shuffle_ps(xy0, zw0, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 v1 = _mm256_shuffle_ps(xy0, zw0, _MM_SHUFFLE(3, 2, 3, 2));
+	__m256 v2 = _mm256_shuffle_ps(xy1, zw1, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 v3 = _mm256_shuffle_ps(xy1, zw1, _MM_SHUFFLE(3, 2, 3, 2));
+	_mm256_storeu_ps(data, _mm256_permute2f128_ps(v0, v1, 0x20));
+	_mm256_storeu_ps(data + 8, _mm256_permute2f128_ps(v2, v3, 0x20));
+	_mm256_storeu_ps(data + 16, _mm256_permute2f128_ps(v0, v1, 0x31));
+	_mm256_storeu_ps(data + 24, _mm256_permute2f128_ps(v2, v3, 0x31));
+}
+
+SIMD_TARGET("avx2")
+static __m256i
+PackSnorm16AVX2(
+	__m256 value
+)
+{
+	__m256 clamped = _mm256_min_ps(_mm256_max_ps(value, _mm256_set1_ps(-1.0f)), _mm256_set1_ps(1.0f));
+	__m256 rounded = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(clamped, _mm256_set1_ps(SNORM16_MAX)), _mm256_set1_ps(0.5f)));
+	return _mm256_and_si256(_mm256_cvtps_epi32(rounded), _mm256_set1_epi32(0xFFFF));
+}
+
+SIMD_TARGET("avx2")
+static __m256i
+EncodeOctahedralAVX2(
+	__m256 x,
+	__m256 y,
+	__m256 z
+)
+{
+	__m256 signBit = _mm256_set1_ps(-0.0f);
+	__m256 zero = _mm256_setzero_ps();
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 length = _mm256_add_ps(_mm256_add_ps(_mm256_andnot_ps(signBit, x), _mm256_andnot_ps(signBit, y)), _mm256_andnot_ps(signBit, z));
+
+	__m256 foldedX = _mm256_div_ps(x, length);
+	__m256 foldedY = _mm256_div_ps(y, length);
+	__m256 signX = _mm256_blendv_ps(_mm256_set1_ps(-1.0f), one, _mm256_cmp_ps(foldedX, zero, _CMP_GE_OQ));
+	__m256 signY = _mm256_blendv_ps(_mm256_set1_ps(-1.0f), one, _mm256_cmp_ps(foldedY, zero, _CMP_GE_OQ));
+	__m256 lowerX = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_andnot_ps(signBit, foldedY)), signX);
+	__m256 lowerY = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_andnot_ps(signBit, foldedX)), signY);
+	__m256 lower = _mm256_cmp_ps(z, zero, _CMP_LT_OQ);
+	foldedX = _mm256_blendv_ps(foldedX, lowerX, lower);
+	foldedY = _mm256_blendv_ps(foldedY, lowerY, lower);
+
+	__m256i encoded = _mm256_or_si256(PackSnorm16AVX2(foldedX), _mm256_slli_epi32(PackSnorm16AVX2(foldedY), 16));
+	return _mm256_andnot_si256(_mm256_castps_si256(_mm256_cmp_ps(length, zero, _CMP_NGT_UQ)), encoded);
+}
+
+SIMD_TARGET("avx2")
+static size_t
+TransformPositionsAVX2(
+	const glm::vec3* positions,
+	size_t count,
+	const glm::mat4& matrix,
+	bool objectSpace,
+	glm::vec3* outWorldPositions,
+	glm::vec4* outStoredPositions
+)
+{
+	__m256 m[16];
+	BroadcastMatrixAVX2(&matrix[0][0], 16, m);
+	__m256 one = _mm256_set1_ps(1.0f);
+
+	const float* in = reinterpret_cast<const float*>(positions);
+	size_t v = 0;
+	for (; v + 8 <= count; v += 8)
+	{
+		__m256 x, y, z;
+		LoadVerticesAVX2(in + 3 * v, x, y, z);
+		__m256 worldX = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[0], x), _mm256_mul_ps(m[4], y)), _mm256_add_ps(_mm256_mul_ps(m[8], z), m[12]));
+		__m256 worldY = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[1], x), _mm256_mul_ps(m[5], y)), _mm256_add_ps(_mm256_mul_ps(m[9], z), m[13]));
+		__m256 worldZ = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[2], x), _mm256_mul_ps(m[6], y)), _mm256_add_ps(_mm256_mul_ps(m[10], z), m[14]));
+		StoreVerticesAVX2(reinterpret_cast<float*>(outWorldPositions + v), worldX, worldY, worldZ);
+
+		if (outStoredPositions == nullptr)
+		{
+			continue;
+		}
+		if (objectSpace)
+		{
+			StorePaddedVerticesAVX2(reinterpret_cast<float*>(outStoredPositions + v), x, y, z, one);
+		}
+		else
+		{
+			__m256 worldW = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[3], x), _mm256_mul_ps(m[7], y)), _mm256_add_ps(_mm256_mul_ps(m[11], z), m[15]));
+			StorePaddedVerticesAVX2(reinterpret_cast<float*>(outStoredPositions + v), worldX, worldY, worldZ, worldW);
+		}
+	}
+	return v;
+}
+
+SIMD_TARGET("avx2")
+static size_t
+TransformNormalsAVX2(
+	const glm::vec3* normals,
+	size_t count,
+	const glm::mat3& matrixNormal,
+	bool objectSpace,
+	glm::vec3* outWorldNormals,
+	uint32_t* outEncodedNormals
+)
+{
+	__m256 m[9];
+	BroadcastMatrixAVX2(&matrixNormal[0][0], 9, m);
+	__m256 one = _mm256_set1_ps(1.0f);
+
+	const float* in = reinterpret_cast<const float*>(normals);
+	size_t v = 0;
+	for (; v + 8 <= count; v += 8)
+	{
+		__m256 x, y, z;
+		LoadVerticesAVX2(in + 3 * v, x, y, z);
+		__m256 worldX = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[0], x), _mm256_mul_ps(m[3], y)), _mm256_mul_ps(m[6], z));
+		__m256 worldY = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[1], x), _mm256_mul_ps(m[4], y)), _mm256_mul_ps(m[7], z));
+		__m256 worldZ = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m[2], x), _mm256_mul_ps(m[5], y)), _mm256_mul_ps(m[8], z));
+		__m256 lengthSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(worldX, worldX), _mm256_mul_ps(worldY, worldY)), _mm256_mul_ps(worldZ, worldZ));
+		__m256 inverseLength = _mm256_div_ps(one, _mm256_sqrt_ps(lengthSquared));
+		worldX = _mm256_mul_ps(worldX, inverseLength);
+		worldY = _mm256_mul_ps(worldY, inverseLength);
+		worldZ = _mm256_mul_ps(worldZ, inverseLength);
+		StoreVerticesAVX2(reinterpret_cast<float*>(outWorldNormals + v), worldX, worldY, worldZ);
+
+		if (outEncodedNormals != nullptr)
+		{
+			__m256i encoded = objectSpace ? EncodeOctahedralAVX2(x, y, z) : EncodeOctahedralAVX2(worldX, worldY, worldZ);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(outEncodedNormals + v), encoded);
+		}
+	}
+	return v;
+}
+
+void
+TransformPositions(
+	const glm::vec3* positions,
+	size_t count,
+	const glm::mat4& matrix,
+	bool objectSpace,
+	glm::vec3* outWorldPositions,
+	glm::vec4* outStoredPositions
+)
+{
+	size_t v = 0;
+	switch (ActiveSimdLevel())
+	{
+	case SIMD_LEVEL_AVX2:
+		v = TransformPositionsAVX2(positions, count, matrix, objectSpace, outWorldPositions, outStoredPositions);
+		break;
+	case SIMD_LEVEL_SSE41:
+		v = TransformPositionsSSE41(positions, count, matrix, objectSpace, outWorldPositions, outStoredPositions);
+		break;
+	default:
+		break;
+	}
+
+	for (; v < count; ++v)
+	{
+		glm::vec4 worldPosition = matrix * glm::vec4(positions[v], 1.0f);
+		if (outStoredPositions != nullptr)
+		{
+			outStoredPositions[v] = objectSpace ? glm::vec4(positions[v], 1.0f) : worldPosition;
+		}
+		outWorldPositions[v] = glm::vec3(worldPosition);
+	}
+}
+
+void
+TransformNormals(
+	const glm::vec3* normals,
+	size_t count,
+	const glm::mat3& matrixNormal,
+	bool objectSpace,
+	glm::vec3* outWorldNormals,
+	uint32_t* outEncodedNormals
+)
+{
+	size_t v = 0;
+	switch (ActiveSimdLevel())
+	{
+	case SIMD_LEVEL_AVX2:
+		v = TransformNormalsAVX2(normals, count, matrixNormal, objectSpace, outWorldNormals, outEncodedNormals);
+		break;
+	case SIMD_LEVEL_SSE41:
+		v = TransformNormalsSSE41(normals, count, matrixNormal, objectSpace, outWorldNormals, outEncodedNormals);
+		break;
+	default:
+		break;
+	}
+
+	for (; v < count; ++v)
+	{
+		glm::vec3 worldNormal = glm::normalize(matrixNormal * normals[v]);
+		if (outEncodedNormals != nullptr)
+		{
+			outEncodedNormals[v] = EncodeOctahedral(objectSpace ? normals[v] : worldNormal);
+		}
+		outWorldNormals[v] = worldNormal;
+	}
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+/**
+ * \brief Widest instruction set the kernels below may use, picked once from the CPU at run time
+ *        so that a single build runs everywhere and still uses AVX2 where it exists.
+ */
+enum ESimdLevel
+{
+	SIMD_LEVEL_SCALAR = 0,
+	SIMD_LEVEL_SSE41 = 1,
+	SIMD_LEVEL_AVX2 = 2
+};
+
+/**
+ * \brief Instruction set supported by this CPU and operating system
+ */
+ESimdLevel
+DetectSimdLevel();
+
+/**
+ * \brief Instruction set the kernels use, the detected one unless it was lowered with SetSimdLevel
+ */
+ESimdLevel
+ActiveSimdLevel();
+
+/**
+ * \brief Restrict the kernels to a lower instruction set, to compare implementations. Levels above the detected one are clamped.
+ */
+void
+SetSimdLevel(
+	ESimdLevel level
+);
+
+const char*
+SimdLevelName(
+	ESimdLevel level
+);
+
+// -------- Index kernels -----------
+
+/**
+ * \brief Widen tightly packed unsigned indices to 32 bits
+ * \param componentSize bytes per index, 1, 2 or 4
+ */
+void
+WidenIndices(
+	const uint8_t* data,
+	size_t componentSize,
+	size_t count,
+	uint32_t* outIndices
+);
+
+/**
+ * \brief Narrow 32-bit indices that are known to be below 65536 for a 16-bit index buffer
+ */
+void
+NarrowIndices(
+	const uint32_t* indices,
+	size_t count,
+	uint16_t* outIndices
+);
+
+/**
+ * \brief Group indices in threes into ray tracer triangles, (vertexOffset + i0, vertexOffset + i1, vertexOffset + i2, materialId)
+ */
+void
+MakeTriangles(
+	const uint32_t* indices,
+	size_t triangleCount,
+	int vertexOffset,
+	int materialId,
+	glm::ivec4* outTriangles
+);
+
+// -------- Vertex kernels -----------
+
+/**
+ * \brief Transform tightly packed positions by a node matrix, the same as matrix * vec4(position, 1) per vertex
+ * \param outWorldPositions transformed positions without w
+ * \param outStoredPositions optional padded copy, (position, 1) if objectSpace is set, the transformed position otherwise
+ */
+void
+TransformPositions(
+	const glm::vec3* positions,
+	size_t count,
+	const glm::mat4& matrix,
+	bool objectSpace,
+	glm::vec3* outWorldPositions,
+	glm::vec4* outStoredPositions
+);
+
+/**
+ * \brief Transform tightly packed normals by the inverse transpose of a node matrix and normalize them
+ * \param outWorldNormals transformed unit normals
+ * \param outEncodedNormals optional octahedral encoding, see EncodeOctahedral, of the input normal if objectSpace is set,
+ *        of the transformed one otherwise
+ */
+void
+TransformNormals(
+	const glm::vec3* normals,
+	size_t count,
+	const glm::mat3& matrixNormal,
+	bool objectSpace,
+	glm::vec3* outWorldNormals,
+	uint32_t* outEncodedNormals
+);
@@ -0,0 +1,223 @@
+#include <algorithm>
+#include "ThreadPool.h"
+
+// Lets a thread find its own deque, threads that do not belong to the pool share queue 0
+static thread_local const ThreadPool* s_currentPool = nullptr;
+static thread_local int s_currentQueueIndex = 0;
+
+ThreadPool::ThreadPool(
+	int threadCount
+	) :
+	m_queuedTaskCount(0),
+	m_stop(false)
+{
+	if (threadCount <= 0)
+	{
+		threadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	}
+
+	for (int i = 0; i < threadCount; ++i)
+	{
+		m_queues.emplace_back(new TaskQueue());
+	}
+
+	for (int i = 1; i < threadCount; ++i)
+	{
+		m_workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_stop = true;
+	}
+	m_wakeUp.notify_all();
+
+	for (std::thread& worker : m_workers)
+	{
+		worker.join();
+	}
+}
+
+int
+ThreadPool::ThreadCount() const
+{
+	return static_cast<int>(m_queues.size());
+}
+
+void
+ThreadPool::Submit(
+	std::function<void()> task
+	)
+{
+	TaskQueue& queue = *m_queues[CurrentQueueIndex()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(std::move(task));
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		++m_queuedTaskCount;
+	}
+	m_wakeUp.notify_one();
+}
+
+bool
+ThreadPool::RunPendingTask()
+{
+	std::function<void()> task;
+	if (!PopTask(CurrentQueueIndex(), task))
+	{
+		return false;
+	}
+
+	task();
+	return true;
+}
+
+bool
+ThreadPool::PopTask(
+	int queueIndex,
+	std::function<void()>& outTask
+	)
+{
+	// Newest task from our own deque keeps the working set hot
+	{
+		TaskQueue& queue = *m_queues[queueIndex];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.tasks.empty())
+		{
+			outTask = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+			--m_queuedTaskCount;
+			return true;
+		}
+	}
+
+	// Otherwise steal the oldest task of someone else, those tend to be the largest subtrees
+	const int queueCount = static_cast<int>(m_queues.size());
+	for (int i = 1; i < queueCount; ++i)
+	{
+		TaskQueue& victim = *m_queues[(queueIndex + i) % queueCount];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tasks.empty())
+		{
+			outTask = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			--m_queuedTaskCount;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void
+ThreadPool::WorkerLoop(
+	int queueIndex
+	)
+{
+	s_currentPool = this;
+	s_currentQueueIndex = queueIndex;
+
+	while (true)
+	{
+		std::function<void()> task;
+		if (PopTask(queueIndex, task))
+		{
+			task();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_sleepMutex);
+		m_wakeUp.wait(lock, [this]() { return m_stop || m_queuedTaskCount > 0; });
+		if (m_stop)
+		{
+			return;
+		}
+	}
+}
+
+int
+ThreadPool::CurrentQueueIndex() const
+{
+	return s_currentPool == this ? s_currentQueueIndex : 0;
+}
+
+// -------- Task group -----------
+
+TaskGroup::TaskGroup(
+	ThreadPool* pool
+	) :
+	m_pool(pool),
+	m_pendingCount(0)
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+	Wait();
+}
+
+void
+TaskGroup::Run(
+	std::function<void()> task
+	)
+{
+	if (m_pool == nullptr || m_pool->ThreadCount() == 1)
+	{
+		task();
+		return;
+	}
+
+	++m_pendingCount;
+	m_pool->Submit([this, task]()
+	{
+		task();
+		--m_pendingCount;
+	});
+}
+
+void
+TaskGroup::Wait()
+{
+	while (m_pendingCount > 0)
+	{
+		// Help out instead of blocking, our tasks may be sitting in our own deque
+		if (!m_pool->RunPendingTask())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+void
+ParallelFor(
+	ThreadPool* pool,
+	int begin,
+	int end,
+	int grainSize,
+	const std::function<void(int, int)>& body
+	)
+{
+	grainSize = std::max(1, grainSize);
+	if (pool == nullptr || end - begin <= grainSize)
+	{
+		for (int chunkBegin = begin; chunkBegin < end; chunkBegin += grainSize)
+		{
+			body(chunkBegin, std::min(end, chunkBegin + grainSize));
+		}
+		return;
+	}
+
+	TaskGroup group(pool);
+	for (int chunkBegin = begin; chunkBegin < end; chunkBegin += grainSize)
+	{
+		int chunkEnd = std::min(end, chunkBegin + grainSize);
+		group.Run([&body, chunkBegin, chunkEnd]() { body(chunkBegin, chunkEnd); });
+	}
+	group.Wait();
+}
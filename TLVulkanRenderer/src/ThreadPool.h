@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * \brief Work-stealing thread pool. Every thread owns a task deque, it pops its own newest task
+ *        and steals the oldest task of another thread when it runs dry.
+ *        The thread that creates the pool counts as one of its threads and helps out while it waits on a TaskGroup.
+ */
+class ThreadPool
+{
+public:
+
+	/**
+	 * \brief Spawn threadCount - 1 worker threads, 0 uses every hardware thread
+	 */
+	explicit ThreadPool(
+		int threadCount = 0
+	);
+
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int
+	ThreadCount() const;
+
+	/**
+	 * \brief Push a task onto the deque of the calling thread
+	 */
+	void
+	Submit(
+		std::function<void()> task
+	);
+
+	/**
+	 * \brief Run one queued task on the calling thread, own tasks first then stolen ones
+	 * \return false if there was nothing to run
+	 */
+	bool
+	RunPendingTask();
+
+private:
+
+	struct TaskQueue
+	{
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	bool
+	PopTask(
+		int queueIndex,
+		std::function<void()>& outTask
+	);
+
+	void
+	WorkerLoop(
+		int queueIndex
+	);
+
+	int
+	CurrentQueueIndex() const;
+
+	// Queue 0 belongs to the owning thread (and any other thread outside the pool)
+	std::vector<std::unique_ptr<TaskQueue>> m_queues;
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wakeUp;
+	std::atomic<int> m_queuedTaskCount;
+	bool m_stop;
+};
+
+/**
+ * \brief Set of tasks that can be waited on together. Tasks may add more tasks to their own group.
+ *        Without a pool every task runs inline, which keeps single threaded callers on the same code path.
+ */
+class TaskGroup
+{
+public:
+	explicit TaskGroup(
+		ThreadPool* pool
+	);
+
+	~TaskGroup();
+
+	void
+	Run(
+		std::function<void()> task
+	);
+
+	/**
+	 * \brief Execute queued tasks on the calling thread until every task of this group has finished
+	 */
+	void
+	Wait();
+
+private:
+	ThreadPool* m_pool;
+	std::atomic<int> m_pendingCount;
+};
+
+/**
+ * \brief Call body(chunkBegin, chunkEnd) over [begin, end) split in chunks of grainSize.
+ *        Chunk boundaries only depend on the range and grain size, never on the thread count.
+ */
+void
+ParallelFor(
+	ThreadPool* pool,
+	int begin,
+	int end,
+	int grainSize,
+	const std::function<void(int, int)>& body
+);
@@ -1,6 +1,14 @@
 #include <fstream>
 #include <vector>
 
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#include <Psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
 #include "Utilities.h"
 
 glm::vec4 
@@ -39,4 +47,25 @@ LoadSPIR_V(
 	)
 {
 	outShader = ReadBinaryFile(filePath);
-}
\ No newline at end of file
+}
+
+size_t
+PeakResidentSetSize()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		return 0;
+	}
+	return counters.PeakWorkingSetSize;
+#else
+	// Reported in kilobytes on Linux
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+	{
+		return 0;
+	}
+	return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+}
@@ -26,4 +26,10 @@ void
 LoadSPIR_V(
 	const char* filepath, 
 	std::vector<Byte>& outShader
-);
\ No newline at end of file
+);
+
+/**
+ * \brief Largest resident set of this process so far, in bytes
+ */
+size_t
+PeakResidentSetSize();
@@ -0,0 +1,653 @@
+#include <algorithm>
+#include "BVH.h"
+#include "BVHBuild.h"
+#include "BinaryStream.h"
+
+const float BVH::TRAVERSAL_COST = 1.0f;
+const float BVH::INTERSECTION_COST = 1.0f;
+const float BVH::REBUILD_SAH_GROWTH = 1.5f;
+const float BVH::SPATIAL_SPLIT_OVERLAP = 1e-5f;
+
+std::vector<IndexRange>
+MakeIndexRanges(
+	std::vector<int> indices
+	)
+{
+	std::sort(indices.begin(), indices.end());
+
+	std::vector<IndexRange> ranges;
+	for (int index : indices)
+	{
+		if (!ranges.empty() && index <= ranges.back().first + ranges.back().count)
+		{
+			ranges.back().count = index - ranges.back().first + 1;
+			continue;
+		}
+		ranges.push_back({ index, 1 });
+	}
+	return ranges;
+}
+
+// -------- Build state -----------
+
+namespace
+{
+	/**
+	 * \brief Temporary node over a range of primitiveIndices, see BuildArenas
+	 */
+	struct BuildNode
+	{
+		AABB bounds;
+		int first;
+		int count;
+
+		// Split axis, only meaningful once the node has children
+		int axis;
+
+		// Root is at depth 1, like BVH::Depth counts
+		int depth;
+
+		BuildNode* children[2];
+
+		int
+		PrimitiveCount() const
+		{
+			return count;
+		}
+	};
+
+	struct Bin
+	{
+		AABB bounds;
+		int count = 0;
+	};
+
+	struct BinSet
+	{
+		Bin bins[3][BVH::BIN_COUNT];
+	};
+
+	struct BuildContext
+	{
+		const std::vector<AABB>& primitiveBounds;
+		std::vector<glm::vec3> centroids;
+		std::vector<int>& primitiveIndices;
+
+		// Partition scatter target, subtrees only ever touch their own range
+		std::vector<int> scratch;
+
+		ThreadPool* pool;
+
+		BuildArenas<BuildNode> arenas;
+
+		BuildContext(
+			const std::vector<AABB>& bounds,
+			std::vector<int>& indices,
+			ThreadPool* threadPool
+			) :
+			primitiveBounds(bounds),
+			centroids(bounds.size()),
+			primitiveIndices(indices),
+			scratch(bounds.size()),
+			pool(threadPool)
+		{
+		}
+	};
+}
+
+static int
+BinIndex(
+	float centroid,
+	float axisMin,
+	float binScale
+	)
+{
+	return std::min(BVH::BIN_COUNT - 1, static_cast<int>((centroid - axisMin) * binScale));
+}
+
+/**
+ * \brief Find the best binned SAH split of a node, partition its primitives and record the split axis
+ * \return false if the node should stay a leaf
+ */
+static bool
+SplitNode(
+	BuildContext& context,
+	BuildNode& node,
+	int& outMiddle
+	)
+{
+	const int first = node.first;
+	const int count = node.count;
+	const std::vector<int>& indices = context.primitiveIndices;
+
+	// -------- Node bounds ---------
+
+	const int chunkCount = (count + BVH::PARALLEL_GRAIN_SIZE - 1) / BVH::PARALLEL_GRAIN_SIZE;
+	std::vector<AABB> chunkBounds(chunkCount);
+	std::vector<AABB> chunkCentroidBounds(chunkCount);
+	ParallelFor(context.pool, 0, count, BVH::PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+	{
+		AABB bounds;
+		AABB centroidBounds;
+		for (int i = first + begin; i < first + end; ++i)
+		{
+			bounds.Grow(context.primitiveBounds[indices[i]]);
+			centroidBounds.Grow(context.centroids[indices[i]]);
+		}
+		chunkBounds[begin / BVH::PARALLEL_GRAIN_SIZE] = bounds;
+		chunkCentroidBounds[begin / BVH::PARALLEL_GRAIN_SIZE] = centroidBounds;
+	});
+
+	AABB centroidBounds;
+	node.bounds = AABB();
+	for (int c = 0; c < chunkCount; ++c)
+	{
+		node.bounds.Grow(chunkBounds[c]);
+		centroidBounds.Grow(chunkCentroidBounds[c]);
+	}
+
+	if (count == 1)
+	{
+		return false;
+	}
+
+	// -------- Depth limit ---------
+
+	// Where the SAH could take the subtree past the traversal stack, the rest of it is split at the median
+	auto centroid = [&](int p) { return context.centroids[p]; };
+	if (MustSplitAtMedian(node.depth, count))
+	{
+		node.axis = centroidBounds.LargestAxis();
+		outMiddle = first + count / 2;
+		return SplitInHalf(context.primitiveIndices.begin() + first, context.primitiveIndices.begin() + first + count, node.axis, true, centroid);
+	}
+
+	// -------- Binned SAH ---------
+
+	glm::vec3 binScale;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float axisExtent = centroidBounds.max[axis] - centroidBounds.min[axis];
+		binScale[axis] = axisExtent > 0.0f ? BVH::BIN_COUNT / axisExtent : 0.0f;
+	}
+
+	// All three axes are binned in one pass over the primitives, chunks are merged in order
+	std::vector<BinSet> chunkBins(chunkCount);
+	ParallelFor(context.pool, 0, count, BVH::PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+	{
+		BinSet& binSet = chunkBins[begin / BVH::PARALLEL_GRAIN_SIZE];
+		for (int i = first + begin; i < first + end; ++i)
+		{
+			int p = indices[i];
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				int b = BinIndex(context.centroids[p][axis], centroidBounds.min[axis], binScale[axis]);
+				binSet.bins[axis][b].count++;
+				binSet.bins[axis][b].bounds.Grow(context.primitiveBounds[p]);
+			}
+		}
+	});
+
+	const float leafCost = BVH::INTERSECTION_COST * count;
+	const float parentArea = node.bounds.SurfaceArea();
+
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	int bestSplit = 0;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (binScale[axis] == 0.0f)
+		{
+			continue;
+		}
+
+		Bin bins[BVH::BIN_COUNT];
+		for (int c = 0; c < chunkCount; ++c)
+		{
+			for (int b = 0; b < BVH::BIN_COUNT; ++b)
+			{
+				bins[b].count += chunkBins[c].bins[axis][b].count;
+				bins[b].bounds.Grow(chunkBins[c].bins[axis][b].bounds);
+			}
+		}
+
+		// Sweep from both sides to get the area and count on each side of every bin plane
+		float leftArea[BVH::BIN_COUNT - 1];
+		int leftCount[BVH::BIN_COUNT - 1];
+		float rightArea[BVH::BIN_COUNT - 1];
+		int rightCount[BVH::BIN_COUNT - 1];
+
+		AABB leftBox, rightBox;
+		int leftSum = 0, rightSum = 0;
+		for (int b = 0; b < BVH::BIN_COUNT - 1; ++b)
+		{
+			leftSum += bins[b].count;
+			leftBox.Grow(bins[b].bounds);
+			leftCount[b] = leftSum;
+			leftArea[b] = leftBox.SurfaceArea();
+
+			rightSum += bins[BVH::BIN_COUNT - 1 - b].count;
+			rightBox.Grow(bins[BVH::BIN_COUNT - 1 - b].bounds);
+			rightCount[BVH::BIN_COUNT - 2 - b] = rightSum;
+			rightArea[BVH::BIN_COUNT - 2 - b] = rightBox.SurfaceArea();
+		}
+
+		for (int b = 0; b < BVH::BIN_COUNT - 1; ++b)
+		{
+			if (leftCount[b] == 0 || rightCount[b] == 0)
+			{
+				continue;
+			}
+
+			float cost = BVH::TRAVERSAL_COST + BVH::INTERSECTION_COST *
+				(leftArea[b] * leftCount[b] + rightArea[b] * rightCount[b]) / parentArea;
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b;
+			}
+		}
+	}
+
+	// -------- Partition ---------
+
+	if (bestAxis == -1)
+	{
+		// All centroids coincide, there is nothing to bin. Split big nodes in half anyway.
+		node.axis = node.bounds.LargestAxis();
+		outMiddle = first + count / 2;
+		return SplitInHalf(context.primitiveIndices.begin() + first, context.primitiveIndices.begin() + first + count, node.axis, false, centroid);
+	}
+
+	if (bestCost >= leafCost && count <= BVH::MAX_LEAF_SIZE)
+	{
+		return false;
+	}
+
+	// Stable partition so that the primitive order is the same however the chunks are scheduled:
+	// count the left side of every chunk, then scatter both sides to their final offsets
+	auto isLeft = [&](int p)
+	{
+		return BinIndex(context.centroids[p][bestAxis], centroidBounds.min[bestAxis], binScale[bestAxis]) <= bestSplit;
+	};
+
+	std::vector<int> chunkLeftCount(chunkCount);
+	ParallelFor(context.pool, 0, count, BVH::PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+	{
+		int leftCount = 0;
+		for (int i = first + begin; i < first + end; ++i)
+		{
+			leftCount += isLeft(indices[i]) ? 1 : 0;
+		}
+		chunkLeftCount[begin / BVH::PARALLEL_GRAIN_SIZE] = leftCount;
+	});
+
+	std::vector<int> chunkLeftOffset(chunkCount);
+	int totalLeft = 0;
+	for (int c = 0; c < chunkCount; ++c)
+	{
+		chunkLeftOffset[c] = totalLeft;
+		totalLeft += chunkLeftCount[c];
+	}
+
+	ParallelFor(context.pool, 0, count, BVH::PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+	{
+		int chunk = begin / BVH::PARALLEL_GRAIN_SIZE;
+		int left = first + chunkLeftOffset[chunk];
+		int right = first + totalLeft + (begin - chunkLeftOffset[chunk]);
+		for (int i = first + begin; i < first + end; ++i)
+		{
+			int p = indices[i];
+			context.scratch[isLeft(p) ? left++ : right++] = p;
+		}
+	});
+
+	ParallelFor(context.pool, first, first + count, BVH::PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+	{
+		std::copy(context.scratch.begin() + begin, context.scratch.begin() + end, context.primitiveIndices.begin() + begin);
+	});
+
+	node.axis = bestAxis;
+	outMiddle = first + totalLeft;
+	return true;
+}
+
+void
+BVH::Build(
+	const std::vector<AABB>& primitiveBounds,
+	ThreadPool* pool
+	)
+{
+	const int primitiveCount = static_cast<int>(primitiveBounds.size());
+
+	nodes.clear();
+	primitiveIndices.resize(primitiveCount);
+
+	if (primitiveCount == 0)
+	{
+		BuildEmpty();
+		return;
+	}
+
+	BuildContext context(primitiveBounds, primitiveIndices, pool);
+	ParallelFor(pool, 0, primitiveCount, PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			primitiveIndices[i] = i;
+			context.centroids[i] = primitiveBounds[i].Centroid();
+		}
+	});
+
+	// -------- Build ---------
+
+	BuildNode root = { AABB(), 0, primitiveCount, 0, 1, { nullptr, nullptr } };
+	BuildTree(context.arenas, pool, root, [&context](BuildNode& node, std::deque<BuildNode>& arena)
+	{
+		int middle;
+		if (!SplitNode(context, node, middle))
+		{
+			return false;
+		}
+
+		arena.push_back({ AABB(), node.first, middle - node.first, 0, node.depth + 1, { nullptr, nullptr } });
+		node.children[0] = &arena.back();
+		arena.push_back({ AABB(), middle, node.first + node.count - middle, 0, node.depth + 1, { nullptr, nullptr } });
+		node.children[1] = &arena.back();
+		return true;
+	});
+
+	// -------- Flatten ---------
+
+	nodes.reserve(2 * primitiveCount - 1);
+	FlattenTree(root, nodes, [](const BuildNode& buildNode, BVHNode& node)
+	{
+		node.leftFirst = buildNode.first;
+		node.primitiveCount = buildNode.count;
+	});
+
+	FinishBuild();
+}
+
+void
+BVH::BuildEmpty()
+{
+	// Degenerate bounds at infinity so that no ray ever enters the empty root
+	BVHNode root;
+	root.aabbMin = glm::vec3(FLT_MAX);
+	root.aabbMax = glm::vec3(FLT_MAX);
+	root.leftFirst = 0;
+	root.primitiveCount = 0;
+	nodes.assign(1, root);
+	FinishBuild();
+}
+
+void
+BVH::FinishBuild()
+{
+	m_parents.clear();
+	m_primitiveLeaves.clear();
+	m_dirtyNodes.clear();
+	m_isDirty.clear();
+
+	m_cost = 0.0f;
+	for (const BVHNode& node : nodes)
+	{
+		m_cost += NodeCost(node);
+	}
+	m_builtCost = m_cost;
+	m_builtRootArea = AABB(nodes[0].aabbMin, nodes[0].aabbMax).SurfaceArea();
+}
+
+float
+BVH::NodeCost(
+	const BVHNode& node
+	) const
+{
+	float area = AABB(node.aabbMin, node.aabbMax).SurfaceArea();
+	return node.IsLeaf() ? INTERSECTION_COST * node.primitiveCount * area : TRAVERSAL_COST * area;
+}
+
+float
+BVH::SAHCost() const
+{
+	if (nodes.empty())
+	{
+		return 0.0f;
+	}
+
+	float rootArea = AABB(nodes[0].aabbMin, nodes[0].aabbMax).SurfaceArea();
+	if (rootArea <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	float cost = 0.0f;
+	for (const BVHNode& node : nodes)
+	{
+		cost += NodeCost(node);
+	}
+
+	return cost / rootArea;
+}
+
+int
+BVH::Depth() const
+{
+	if (nodes.empty())
+	{
+		return 0;
+	}
+
+	int maxDepth = 0;
+	std::vector<std::pair<int, int>> pending = { { 0, 1 } };
+	while (!pending.empty())
+	{
+		std::pair<int, int> entry = pending.back();
+		pending.pop_back();
+
+		const BVHNode& node = nodes[entry.first];
+		maxDepth = std::max(maxDepth, entry.second);
+		// The empty root is the only interior node without children
+		if (!node.IsLeaf() && nodes.size() > 1)
+		{
+			pending.push_back({ node.leftFirst, entry.second + 1 });
+			pending.push_back({ node.leftFirst + 1, entry.second + 1 });
+		}
+	}
+
+	return maxDepth;
+}
+
+int
+BVH::MedianSplitLevels(
+	int primitiveCount
+	)
+{
+	// The larger half rounds up, every level halves it until it fits a leaf
+	int levels = 0;
+	while (primitiveCount > MAX_LEAF_SIZE)
+	{
+		primitiveCount = primitiveCount - primitiveCount / 2;
+		++levels;
+	}
+	return levels;
+}
+
+void
+BVH::PermutePrimitives(
+	const std::vector<int>& slotOrder
+	)
+{
+	std::vector<int> newSlots(slotOrder.size());
+	std::vector<int> permuted(slotOrder.size());
+	for (int i = 0; i < static_cast<int>(slotOrder.size()); ++i)
+	{
+		newSlots[slotOrder[i]] = i;
+		permuted[i] = primitiveIndices[slotOrder[i]];
+	}
+	primitiveIndices.swap(permuted);
+
+	for (BVHNode& node : nodes)
+	{
+		if (node.IsLeaf())
+		{
+			node.leftFirst = newSlots[node.leftFirst];
+		}
+	}
+
+	// Leaf lookups are rebuilt on the next refit
+	m_parents.clear();
+	m_primitiveLeaves.clear();
+}
+
+// -------- Refit -----------
+
+void
+BVH::PrepareRefit()
+{
+	if (m_parents.size() == nodes.size())
+	{
+		return;
+	}
+
+	m_parents.assign(nodes.size(), -1);
+	m_primitiveLeaves.assign(primitiveIndices.size(), -1);
+	m_isDirty.assign(nodes.size(), false);
+
+	for (int n = 0; n < static_cast<int>(nodes.size()); ++n)
+	{
+		const BVHNode& node = nodes[n];
+		if (node.IsLeaf())
+		{
+			for (int i = node.leftFirst; i < node.leftFirst + node.primitiveCount; ++i)
+			{
+				m_primitiveLeaves[i] = n;
+			}
+		}
+		else if (nodes.size() > 1)
+		{
+			m_parents[node.leftFirst] = n;
+			m_parents[node.leftFirst + 1] = n;
+		}
+	}
+}
+
+void
+BVH::MarkPrimitiveDirty(
+	int primitiveSlot
+	)
+{
+	PrepareRefit();
+
+	int leaf = m_primitiveLeaves[primitiveSlot];
+	if (!m_isDirty[leaf])
+	{
+		m_isDirty[leaf] = true;
+		m_dirtyNodes.push_back(leaf);
+	}
+}
+
+bool
+BVH::HasDirtyNodes() const
+{
+	return !m_dirtyNodes.empty();
+}
+
+void
+BVH::Refit(
+	const std::function<AABB(int)>& primitiveBounds,
+	std::vector<int>& outChangedNodes
+	)
+{
+	for (int leaf : m_dirtyNodes)
+	{
+		m_isDirty[leaf] = false;
+
+		AABB bounds;
+		for (int i = nodes[leaf].leftFirst; i < nodes[leaf].leftFirst + nodes[leaf].primitiveCount; ++i)
+		{
+			bounds.Grow(primitiveBounds(i));
+		}
+
+		// Walk up while bounds keep changing, ancestors above an unchanged node are already up to date
+		int nodeIndex = leaf;
+		while (nodeIndex != -1)
+		{
+			BVHNode& node = nodes[nodeIndex];
+			if (!node.IsLeaf())
+			{
+				bounds = AABB(nodes[node.leftFirst].aabbMin, nodes[node.leftFirst].aabbMax);
+				bounds.Grow(AABB(nodes[node.leftFirst + 1].aabbMin, nodes[node.leftFirst + 1].aabbMax));
+			}
+
+			if (bounds.min == node.aabbMin && bounds.max == node.aabbMax)
+			{
+				break;
+			}
+
+			m_cost -= NodeCost(node);
+			node.aabbMin = bounds.min;
+			node.aabbMax = bounds.max;
+			m_cost += NodeCost(node);
+
+			outChangedNodes.push_back(nodeIndex);
+			nodeIndex = m_parents[nodeIndex];
+		}
+	}
+
+	m_dirtyNodes.clear();
+}
+
+float
+BVH::SAHGrowth() const
+{
+	if (nodes.empty() || m_builtCost <= 0.0f)
+	{
+		return 1.0f;
+	}
+
+	// Both costs are normalized by the root area they were measured with, so that a scene that simply
+	// grows as a whole does not count as degradation
+	float rootArea = AABB(nodes[0].aabbMin, nodes[0].aabbMax).SurfaceArea();
+	if (rootArea <= 0.0f || m_builtRootArea <= 0.0f)
+	{
+		return 1.0f;
+	}
+
+	return (m_cost / rootArea) / (m_builtCost / m_builtRootArea);
+}
+
+// -------- Serialization -----------
+
+void
+BVH::Write(
+	BinaryWriter& writer
+	) const
+{
+	writer.WriteVector(nodes);
+	writer.WriteVector(primitiveIndices);
+	writer.Write(m_cost);
+	writer.Write(m_builtCost);
+	writer.Write(m_builtRootArea);
+}
+
+bool
+BVH::Read(
+	BinaryReader& reader
+	)
+{
+	// Refit lookups are rebuilt on the first refit
+	m_parents.clear();
+	m_primitiveLeaves.clear();
+	m_dirtyNodes.clear();
+	m_isDirty.clear();
+
+	return reader.ReadVector(nodes) &&
+		reader.ReadVector(primitiveIndices) &&
+		reader.Read(m_cost) &&
+		reader.Read(m_builtCost) &&
+		reader.Read(m_builtRootArea);
+}
@@ -0,0 +1,345 @@
+#pragma once
+
+#include <vector>
+#include <cfloat>
+#include <functional>
+#include <glm/glm.hpp>
+
+class ThreadPool;
+class BinaryWriter;
+class BinaryReader;
+
+// ---------
+// BOUNDS
+// ----------
+
+struct AABB
+{
+	glm::vec3 min;
+	glm::vec3 max;
+
+	AABB() : min(FLT_MAX), max(-FLT_MAX) {}
+	AABB(const glm::vec3& minPoint, const glm::vec3& maxPoint) : min(minPoint), max(maxPoint) {}
+
+	void
+	Grow(const glm::vec3& point)
+	{
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+
+	void
+	Grow(const AABB& other)
+	{
+		min = glm::min(min, other.min);
+		max = glm::max(max, other.max);
+	}
+
+	glm::vec3
+	Centroid() const
+	{
+		return (min + max) * 0.5f;
+	}
+
+	bool
+	IsEmpty() const
+	{
+		return min.x > max.x || min.y > max.y || min.z > max.z;
+	}
+
+	int
+	LargestAxis() const
+	{
+		glm::vec3 extent = max - min;
+		return extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+	}
+
+	float
+	SurfaceArea() const
+	{
+		if (IsEmpty())
+		{
+			return 0.0f;
+		}
+		glm::vec3 extent = max - min;
+		return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+	}
+};
+
+// ---------
+// RANGE
+// ----------
+
+/**
+ * \brief Contiguous range of array elements, used to upload only what changed
+ */
+struct IndexRange
+{
+	int first;
+	int count;
+};
+
+/**
+ * \brief Merge a list of element indices into sorted, disjoint ranges. Duplicates are allowed.
+ */
+std::vector<IndexRange>
+MakeIndexRanges(
+	std::vector<int> indices
+);
+
+// ---------
+// BVH
+// ----------
+
+/**
+ * \brief Flattened BVH node, laid out to match the std430 BVHNode struct in raytrace.comp (32 bytes).
+ *        Interior nodes store the index of their left child in leftFirst, the right child is always stored right after it.
+ *        Their primitiveCount is minus the axis they were split along (0, -1 or -2), so that any-hit traversal can order children by ray direction.
+ *        Leaves store the first primitive of a contiguous primitive range in leftFirst.
+ */
+struct BVHNode
+{
+	glm::vec3 aabbMin;
+	int leftFirst;
+	glm::vec3 aabbMax;
+	int primitiveCount;
+
+	bool
+	IsLeaf() const
+	{
+		return primitiveCount > 0;
+	}
+
+	/**
+	 * \brief Axis separating the children of an interior node, the left child lies on its lower side
+	 */
+	int
+	SplitAxis() const
+	{
+		return -primitiveCount;
+	}
+};
+
+/**
+ * \brief Bounding volume hierarchy built with the binned surface area heuristic.
+ *        The builder only sees primitive bounds, so the same class is used for triangles and any other bounded primitive.
+ *        Large subtrees are built in parallel, the result does not depend on the number of threads.
+ * \ref Wald, On fast Construction of SAH-based Bounding Volume Hierarchies, 2007
+ */
+class BVH
+{
+public:
+
+	/**
+	 * \brief Number of centroid bins evaluated per axis for each split
+	 */
+	static const int BIN_COUNT = 16;
+
+	/**
+	 * \brief Leaves are always split when they hold more primitives than this
+	 */
+	static const int MAX_LEAF_SIZE = 4;
+
+	/**
+	 * \brief Deepest tree the shader can traverse, matches BVH_STACK_SIZE in raytrace.comp.
+	 *        Every builder keeps its trees within it, a deeper tree would make the traversal drop nodes.
+	 */
+	static const int MAX_TRAVERSAL_DEPTH = 64;
+
+	/**
+	 * \brief Nodes with at least this many primitives are handed to the thread pool as their own subtree task
+	 */
+	static const int PARALLEL_SUBTREE_SIZE = 4096;
+
+	/**
+	 * \brief Primitives per chunk when binning and partitioning a node in parallel.
+	 *        Fixed so that the reduction order never depends on the thread count.
+	 */
+	static const int PARALLEL_GRAIN_SIZE = 16384;
+
+	/**
+	 * \brief Refitted trees whose SAH cost grew past this factor of their build cost should be rebuilt
+	 */
+	static const float REBUILD_SAH_GROWTH;
+
+	/**
+	 * \brief Relative SAH costs of traversing a node and intersecting a primitive
+	 */
+	static const float TRAVERSAL_COST;
+	static const float INTERSECTION_COST;
+
+	/**
+	 * \brief Spatial splits are only tried when the children of the best object split overlap by more than this fraction of the root area
+	 */
+	static const float SPATIAL_SPLIT_OVERLAP;
+
+	/**
+	 * \brief Quantized bits per axis of the Morton codes BuildLinear sorts by, matches MORTON_AXIS_BITS in lbvh.comp
+	 */
+	static const int LINEAR_MORTON_AXIS_BITS = 10;
+
+	/**
+	 * \brief Bits sorted per radix sort pass of BuildLinear, matches RADIX_BITS in lbvh.comp
+	 */
+	static const int LINEAR_RADIX_BITS = 4;
+
+	/**
+	 * \brief Build the hierarchy, root is always nodes[0]
+	 * \param primitiveBounds bounding box of each primitive
+	 * \param pool threads to build with, builds on the calling thread only when null
+	 */
+	void
+	Build(
+		const std::vector<AABB>& primitiveBounds,
+		ThreadPool* pool = nullptr
+	);
+
+	/**
+	 * \brief Build the hierarchy over triangles with spatial splits, root is always nodes[0].
+	 *        Where object splits leave children overlapping, triangles can be split at a plane instead and referenced from both sides
+	 *        with their clipped bounds, so primitiveIndices may hold a triangle several times.
+	 *        Trees are deterministic like Build, the duplication budget is handed down to children by their size.
+	 * \param triangleVertices three vertices per triangle
+	 * \param duplicationBudget extra references allowed, as a fraction of the triangle count
+	 * \param pool threads to build with, builds on the calling thread only when null
+	 * \ref Stich et al., Spatial Splits in Bounding Volume Hierarchies, 2009
+	 */
+	void
+	BuildSpatialSplits(
+		const std::vector<glm::vec3>& triangleVertices,
+		float duplicationBudget,
+		ThreadPool* pool = nullptr
+	);
+
+	/**
+	 * \brief Build a linear BVH over triangles, the CPU version of the device build in lbvh.comp that produces exactly the same nodes.
+	 *        Triangles are sorted by the Morton code of their centroid and the tree follows the bits of the sorted codes, every leaf holds one triangle.
+	 *        The children of interior node i of Karras' tree are stored at nodes 2i + 1 and 2i + 2, so the device can place nodes without knowing the tree shape first.
+	 *        Much faster to build than the SAH and well suited to a GPU, but slower to trace.
+	 * \param triangleVertices three vertices per triangle
+	 * \ref Karras, Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees, 2012
+	 */
+	void
+	BuildLinear(
+		const std::vector<glm::vec3>& triangleVertices
+	);
+
+	/**
+	 * \brief SAH cost of the whole tree, normalized by the root surface area
+	 */
+	float
+	SAHCost() const;
+
+	/**
+	 * \brief Length of the longest root to leaf path. The shader traversal stack must be at least this deep.
+	 */
+	int
+	Depth() const;
+
+	/**
+	 * \brief Levels below its root that a subtree of primitiveCount primitives needs when every node is split at the median.
+	 *        Builders switch to median splits where the SAH could otherwise take the tree past MAX_TRAVERSAL_DEPTH.
+	 */
+	static int
+	MedianSplitLevels(
+		int primitiveCount
+	);
+
+	/**
+	 * \brief Reorder primitiveIndices without touching the tree, slotOrder[i] is the old position that moves to position i.
+	 *        Only the leaf ranges move, so every leaf range has to stay contiguous and in order.
+	 */
+	void
+	PermutePrimitives(
+		const std::vector<int>& slotOrder
+	);
+
+	// -------- Refit ---------
+
+	/**
+	 * \brief Flag the leaf holding the primitive at this position of primitiveIndices, its bounds are recomputed on the next Refit
+	 */
+	void
+	MarkPrimitiveDirty(
+		int primitiveSlot
+	);
+
+	bool
+	HasDirtyNodes() const;
+
+	/**
+	 * \brief Recompute the bounds of the dirty leaves and walk up to the root, stopping once bounds stop changing.
+	 *        The topology is kept, so quality degrades as primitives move away from where they were at build time.
+	 * \param primitiveBounds current bounds of the primitive at a position of primitiveIndices
+	 * \param outChangedNodes receives every node whose bounds changed
+	 */
+	void
+	Refit(
+		const std::function<AABB(int)>& primitiveBounds,
+		std::vector<int>& outChangedNodes
+	);
+
+	/**
+	 * \brief Current SAH cost relative to the cost right after the last Build
+	 */
+	float
+	SAHGrowth() const;
+
+	// -------- Serialization ---------
+
+	void
+	Write(
+		BinaryWriter& writer
+	) const;
+
+	/**
+	 * \return false if the data was truncated
+	 */
+	bool
+	Read(
+		BinaryReader& reader
+	);
+
+	std::vector<BVHNode> nodes;
+
+	/**
+	 * \brief Leaf primitive ranges index into this array, which maps back to the input primitive index.
+	 *        Callers reorder their primitive data with it so that leaves can address the primitives directly.
+	 *        After BuildSpatialSplits it is longer than the primitive count and split primitives appear once per reference.
+	 */
+	std::vector<int> primitiveIndices;
+
+private:
+
+	/**
+	 * \brief Leave the tree with only the empty root, for builds without primitives
+	 */
+	void
+	BuildEmpty();
+
+	/**
+	 * \brief Reset the refit state and record the cost of the tree that was just built
+	 */
+	void
+	FinishBuild();
+
+	void
+	PrepareRefit();
+
+	float
+	NodeCost(
+		const BVHNode& node
+	) const;
+
+	// Filled on the first refit
+	std::vector<int> m_parents;
+	std::vector<int> m_primitiveLeaves;
+
+	std::vector<int> m_dirtyNodes;
+	std::vector<bool> m_isDirty;
+
+	// Unnormalized SAH sum, kept up to date by Refit
+	float m_cost = 0.0f;
+	float m_builtCost = 0.0f;
+	float m_builtRootArea = 0.0f;
+};
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "BVH.h"
+#include "ThreadPool.h"
+
+// Build steps shared by the SAH builder in BVH.cpp and the spatial split builder in SpatialSplitBVH.cpp.
+// Their temporary nodes have bounds, axis, depth (1 at the root), children[2] and PrimitiveCount().
+
+/**
+ * \brief Temporary nodes of one build, every subtree task allocates from an arena of its own and links nodes by pointer.
+ *        The final node order is only decided once the whole tree exists.
+ */
+template <typename Node>
+class BuildArenas
+{
+public:
+
+	std::deque<Node>*
+	NewArena()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_arenas.emplace_back(new std::deque<Node>());
+		return m_arenas.back().get();
+	}
+
+private:
+
+	std::mutex m_mutex;
+	std::vector<std::unique_ptr<std::deque<Node>>> m_arenas;
+};
+
+/**
+ * \brief Split nodes depth first until every leaf is final, large children are spawned as tasks of their own.
+ *        split(node, arena) adds the two children of node to arena and links them, it returns false if node stays a leaf.
+ */
+template <typename Node, typename SplitFunction>
+void
+BuildSubtree(
+	BuildArenas<Node>& arenas,
+	ThreadPool* pool,
+	Node* root,
+	const SplitFunction& split,
+	TaskGroup& group
+)
+{
+	std::deque<Node>* arena = arenas.NewArena();
+
+	// Explicit stack, degenerate inputs can produce very deep trees
+	std::vector<Node*> pending = { root };
+	while (!pending.empty())
+	{
+		Node* node = pending.back();
+		pending.pop_back();
+
+		if (!split(*node, *arena))
+		{
+			continue;
+		}
+
+		for (int c = 1; c >= 0; --c)
+		{
+			Node* child = node->children[c];
+			if (pool != nullptr && child->PrimitiveCount() >= BVH::PARALLEL_SUBTREE_SIZE)
+			{
+				group.Run([&arenas, pool, child, &split, &group]() { BuildSubtree(arenas, pool, child, split, group); });
+			}
+			else
+			{
+				pending.push_back(child);
+			}
+		}
+	}
+}
+
+/**
+ * \brief Build the tree below root, returns once every subtree task has finished
+ */
+template <typename Node, typename SplitFunction>
+void
+BuildTree(
+	BuildArenas<Node>& arenas,
+	ThreadPool* pool,
+	Node& root,
+	const SplitFunction& split
+)
+{
+	TaskGroup group(pool);
+	BuildSubtree(arenas, pool, &root, split, group);
+	group.Wait();
+}
+
+/**
+ * \brief Emit the tree depth first with the left child first, children pairs are allocated when their parent is emitted.
+ *        emitLeaf(buildNode, node) sets leftFirst and primitiveCount of every leaf.
+ */
+template <typename Node, typename LeafFunction>
+void
+FlattenTree(
+	const Node& root,
+	std::vector<BVHNode>& outNodes,
+	const LeafFunction& emitLeaf
+)
+{
+	outNodes.push_back(BVHNode());
+
+	std::vector<std::pair<const Node*, int>> pending = { { &root, static_cast<int>(outNodes.size()) - 1 } };
+	while (!pending.empty())
+	{
+		const Node* buildNode = pending.back().first;
+		int nodeIndex = pending.back().second;
+		pending.pop_back();
+
+		BVHNode& node = outNodes[nodeIndex];
+		node.aabbMin = buildNode->bounds.min;
+		node.aabbMax = buildNode->bounds.max;
+
+		if (buildNode->children[0] == nullptr)
+		{
+			emitLeaf(*buildNode, node);
+			continue;
+		}
+
+		int leftChild = static_cast<int>(outNodes.size());
+		node.leftFirst = leftChild;
+		node.primitiveCount = -buildNode->axis;
+		outNodes.push_back(BVHNode());
+		outNodes.push_back(BVHNode());
+
+		pending.push_back({ buildNode->children[1], leftChild + 1 });
+		pending.push_back({ buildNode->children[0], leftChild });
+	}
+}
+
+/**
+ * \brief Whether the SAH could take a subtree past the traversal stack, the rest of it is then split at the median
+ */
+inline bool
+MustSplitAtMedian(
+	int depth,
+	int primitiveCount
+)
+{
+	return depth + BVH::MedianSplitLevels(primitiveCount) >= BVH::MAX_TRAVERSAL_DEPTH;
+}
+
+/**
+ * \brief Split that binning cannot choose. With atMedian the primitives are partitioned around the median centroid on axis,
+ *        which takes the fewest levels, otherwise they are split in half as they are, for when all centroids coincide.
+ *        The first half of [begin, end) goes to the left child.
+ * \return false if the node should stay a leaf
+ */
+template <typename Iterator, typename CentroidFunction>
+bool
+SplitInHalf(
+	Iterator begin,
+	Iterator end,
+	int axis,
+	bool atMedian,
+	const CentroidFunction& centroid
+)
+{
+	if (end - begin <= BVH::MAX_LEAF_SIZE)
+	{
+		return false;
+	}
+
+	if (atMedian)
+	{
+		typedef typename std::iterator_traits<Iterator>::value_type Value;
+		std::nth_element(begin, begin + (end - begin) / 2, end, [&](const Value& a, const Value& b)
+		{
+			return centroid(a)[axis] < centroid(b)[axis];
+		});
+	}
+	return true;
+}
@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "BVH.h"
+
+// Reference implementation of the device build in shaders/raytracing/lbvh.comp, every step matches it bit for bit
+
+// Each interior node splits at a later differing bit of the Morton code, then of the 31 bit primitive index for equal codes,
+// so a root to leaf path has at most one interior node per bit plus the leaf
+static_assert(3 * BVH::LINEAR_MORTON_AXIS_BITS + 31 + 1 <= BVH::MAX_TRAVERSAL_DEPTH, "Linear BVH can be deeper than the traversal stack");
+
+// -------- Morton codes -----------
+
+/**
+ * \brief Spread the low 10 bits of v so that two zero bits follow each of them
+ */
+static uint32_t
+ExpandBits(
+	uint32_t v
+	)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+/**
+ * \brief Scale mapping [0, extent] into [0, 1024). Snapped to a power of two so that quantizing is exact on any device.
+ */
+static float
+QuantizationScale(
+	float extent
+	)
+{
+	int exponent;
+	std::frexp(extent, &exponent);
+	return std::ldexp(1.0f, BVH::LINEAR_MORTON_AXIS_BITS - exponent);
+}
+
+/**
+ * \brief 30-bit Morton code of a point, x lands in the highest bit of every triplet
+ */
+static uint32_t
+MortonCode(
+	const glm::vec3& point,
+	const glm::vec3& origin,
+	const glm::vec3& scale
+	)
+{
+	const uint32_t maxCell = (1u << BVH::LINEAR_MORTON_AXIS_BITS) - 1;
+
+	glm::vec3 quantized = (point - origin) * scale;
+	uint32_t x = std::min(static_cast<uint32_t>(quantized.x), maxCell);
+	uint32_t y = std::min(static_cast<uint32_t>(quantized.y), maxCell);
+	uint32_t z = std::min(static_cast<uint32_t>(quantized.z), maxCell);
+	return ExpandBits(x) * 4 + ExpandBits(y) * 2 + ExpandBits(z);
+}
+
+// -------- Karras hierarchy -----------
+
+static int
+CountLeadingZeros(
+	uint32_t v
+	)
+{
+	int count = 0;
+	for (uint32_t bit = 0x80000000u; bit != 0 && (v & bit) == 0; bit >>= 1)
+	{
+		++count;
+	}
+	return count;
+}
+
+/**
+ * \brief Length of the common prefix of two sorted keys, -1 outside the array.
+ *        Equal keys fall back to their positions so that every key is unique.
+ */
+static int
+CommonPrefix(
+	const std::vector<uint32_t>& keys,
+	int i,
+	int j
+	)
+{
+	if (j < 0 || j >= static_cast<int>(keys.size()))
+	{
+		return -1;
+	}
+
+	if (keys[i] == keys[j])
+	{
+		return 32 + CountLeadingZeros(static_cast<uint32_t>(i ^ j));
+	}
+	return CountLeadingZeros(keys[i] ^ keys[j]);
+}
+
+void
+BVH::BuildLinear(
+	const std::vector<glm::vec3>& triangleVertices
+	)
+{
+	const int primitiveCount = static_cast<int>(triangleVertices.size() / 3);
+
+	nodes.clear();
+	primitiveIndices.resize(primitiveCount);
+
+	if (primitiveCount == 0)
+	{
+		BuildEmpty();
+		return;
+	}
+
+	// -------- Morton codes ---------
+
+	// Centroids are kept as vertex sums, three times the centroid, which saves a division
+	std::vector<glm::vec3> centroids(primitiveCount);
+	AABB centroidBounds;
+	for (int i = 0; i < primitiveCount; ++i)
+	{
+		centroids[i] = triangleVertices[3 * i] + triangleVertices[3 * i + 1] + triangleVertices[3 * i + 2];
+		centroidBounds.Grow(centroids[i]);
+	}
+
+	glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+	glm::vec3 scale(QuantizationScale(extent.x), QuantizationScale(extent.y), QuantizationScale(extent.z));
+
+	std::vector<uint32_t> keys(primitiveCount);
+	for (int i = 0; i < primitiveCount; ++i)
+	{
+		keys[i] = MortonCode(centroids[i], centroidBounds.min, scale);
+		primitiveIndices[i] = i;
+	}
+
+	// -------- Sort ---------
+
+	// Least significant digit first, each pass is stable so that equal codes keep their input order like on the device
+	const uint32_t digitCount = 1u << LINEAR_RADIX_BITS;
+	std::vector<uint32_t> sortedKeys(primitiveCount);
+	std::vector<int> sortedIndices(primitiveCount);
+	for (int shift = 0; shift < 32; shift += LINEAR_RADIX_BITS)
+	{
+		std::vector<int> offsets(digitCount + 1, 0);
+		for (uint32_t key : keys)
+		{
+			++offsets[((key >> shift) & (digitCount - 1)) + 1];
+		}
+		for (uint32_t d = 0; d < digitCount; ++d)
+		{
+			offsets[d + 1] += offsets[d];
+		}
+
+		for (int i = 0; i < primitiveCount; ++i)
+		{
+			int slot = offsets[(keys[i] >> shift) & (digitCount - 1)]++;
+			sortedKeys[slot] = keys[i];
+			sortedIndices[slot] = primitiveIndices[i];
+		}
+		keys.swap(sortedKeys);
+		primitiveIndices.swap(sortedIndices);
+	}
+
+	// -------- Hierarchy ---------
+
+	// Interior node i of Karras' tree has its children at slots 2i + 1 and 2i + 2, so siblings stay next to each other.
+	// Where node i itself is stored is only known to its parent, the root is at slot 0.
+	const int interiorCount = primitiveCount - 1;
+	std::vector<int> interiorParents(interiorCount, -1);
+	std::vector<int> interiorSlots(interiorCount, 0);
+	std::vector<int> interiorAxes(interiorCount, 0);
+	std::vector<int> leafParents(primitiveCount, -1);
+	std::vector<int> leafSlots(primitiveCount, 0);
+
+	for (int i = 0; i < interiorCount; ++i)
+	{
+		// Direction of the range covered by node i, then its other end by exponential and binary search
+		int direction = CommonPrefix(keys, i, i + 1) > CommonPrefix(keys, i, i - 1) ? 1 : -1;
+		int minPrefix = CommonPrefix(keys, i, i - direction);
+
+		int maxLength = 2;
+		while (CommonPrefix(keys, i, i + maxLength * direction) > minPrefix)
+		{
+			maxLength *= 2;
+		}
+
+		int length = 0;
+		for (int step = maxLength / 2; step >= 1; step /= 2)
+		{
+			if (CommonPrefix(keys, i, i + (length + step) * direction) > minPrefix)
+			{
+				length += step;
+			}
+		}
+		int j = i + length * direction;
+
+		// Split where the highest bit differing inside the range flips
+		int nodePrefix = CommonPrefix(keys, i, j);
+		int split = 0;
+		for (int divisor = 2; ; divisor *= 2)
+		{
+			int step = (length + divisor - 1) / divisor;
+			if (CommonPrefix(keys, i, i + (split + step) * direction) > nodePrefix)
+			{
+				split += step;
+			}
+			if (step <= 1)
+			{
+				break;
+			}
+		}
+		int gamma = i + split * direction + std::min(direction, 0);
+
+		// That bit is a bit of the split axis, positions only tie inside a single cell and any axis will do there
+		int splitPrefix = CommonPrefix(keys, gamma, gamma + 1);
+		interiorAxes[i] = splitPrefix < 32 ? 2 - (31 - splitPrefix) % 3 : 0;
+
+		int children[2] = { gamma, gamma + 1 };
+		bool childIsLeaf[2] = { std::min(i, j) == gamma, std::max(i, j) == gamma + 1 };
+		for (int c = 0; c < 2; ++c)
+		{
+			if (childIsLeaf[c])
+			{
+				leafParents[children[c]] = i;
+				leafSlots[children[c]] = 2 * i + 1 + c;
+			}
+			else
+			{
+				interiorParents[children[c]] = i;
+				interiorSlots[children[c]] = 2 * i + 1 + c;
+			}
+		}
+	}
+
+	// -------- Fit ---------
+
+	// Leaves walk up towards the root, only the second child to reach a node fits it, like the device does with atomic counters
+	nodes.resize(2 * primitiveCount - 1);
+	std::vector<int> arrivals(interiorCount, 0);
+	for (int k = 0; k < primitiveCount; ++k)
+	{
+		int triangle = primitiveIndices[k];
+		AABB bounds;
+		bounds.Grow(triangleVertices[3 * triangle]);
+		bounds.Grow(triangleVertices[3 * triangle + 1]);
+		bounds.Grow(triangleVertices[3 * triangle + 2]);
+		nodes[leafSlots[k]] = { bounds.min, k, bounds.max, 1 };
+
+		for (int parent = leafParents[k]; parent != -1 && ++arrivals[parent] == 2; parent = interiorParents[parent])
+		{
+			const BVHNode& left = nodes[2 * parent + 1];
+			const BVHNode& right = nodes[2 * parent + 2];
+
+			BVHNode& node = nodes[interiorSlots[parent]];
+			node.aabbMin = glm::min(left.aabbMin, right.aabbMin);
+			node.aabbMax = glm::max(left.aabbMax, right.aabbMax);
+			node.leftFirst = 2 * parent + 1;
+			node.primitiveCount = -interiorAxes[parent];
+		}
+	}
+
+	FinishBuild();
+}
@@ -0,0 +1,674 @@
+#include <algorithm>
+#include "BVH.h"
+#include "BVHBuild.h"
+
+// -------- Build state -----------
+
+namespace
+{
+	/**
+	 * \brief A triangle, or the part of it inside bounds once it has been split
+	 */
+	struct Reference
+	{
+		AABB bounds;
+		int primitive;
+	};
+
+	/**
+	 * \brief Temporary node, see BuildArenas.
+	 *        Split nodes hand their references down to their children, only leaves keep theirs until the tree is flattened.
+	 */
+	struct SpatialBuildNode
+	{
+		AABB bounds;
+		std::vector<Reference> references;
+
+		/**
+		 * \brief Extra references this subtree may still create
+		 */
+		long long duplicationBudget;
+
+		// Split axis, only meaningful once the node has children
+		int axis;
+
+		// Root is at depth 1, like BVH::Depth counts
+		int depth;
+
+		SpatialBuildNode* children[2];
+
+		int
+		PrimitiveCount() const
+		{
+			return static_cast<int>(references.size());
+		}
+	};
+
+	struct ObjectBin
+	{
+		AABB bounds;
+		int count = 0;
+	};
+
+	/**
+	 * \brief References enter the bin they start in and exit the bin they end in, the pieces in between all grow the bin bounds
+	 */
+	struct SpatialBin
+	{
+		AABB bounds;
+		int entries = 0;
+		int exits = 0;
+	};
+
+	struct ObjectBinSet
+	{
+		ObjectBin bins[3][BVH::BIN_COUNT];
+	};
+
+	struct SpatialBinSet
+	{
+		SpatialBin bins[3][BVH::BIN_COUNT];
+	};
+
+	struct SpatialBuildContext
+	{
+		const std::vector<glm::vec3>& vertices;
+
+		// Overlap of object split children past which spatial splits are tried
+		float minOverlapArea;
+
+		ThreadPool* pool;
+
+		BuildArenas<SpatialBuildNode> arenas;
+
+		SpatialBuildContext(
+			const std::vector<glm::vec3>& triangleVertices,
+			ThreadPool* threadPool
+			) :
+			vertices(triangleVertices),
+			minOverlapArea(0.0f),
+			pool(threadPool)
+		{
+		}
+	};
+}
+
+static AABB
+Intersection(
+	const AABB& a,
+	const AABB& b
+	)
+{
+	return AABB(glm::max(a.min, b.min), glm::min(a.max, b.max));
+}
+
+static int
+BinIndex(
+	float position,
+	float axisMin,
+	float binScale
+	)
+{
+	return std::max(0, std::min(BVH::BIN_COUNT - 1, static_cast<int>((position - axisMin) * binScale)));
+}
+
+/**
+ * \brief Bounds of the parts of a reference on either side of an axis aligned plane.
+ *        The triangle itself is clipped, so the pieces are usually much smaller than the reference bounds cut in two.
+ */
+static void
+SplitReference(
+	const SpatialBuildContext& context,
+	const Reference& reference,
+	int axis,
+	float position,
+	AABB& outLeft,
+	AABB& outRight
+	)
+{
+	const glm::vec3* triangle = &context.vertices[3 * reference.primitive];
+
+	AABB left, right;
+	for (int i = 0; i < 3; ++i)
+	{
+		const glm::vec3& a = triangle[i];
+		const glm::vec3& b = triangle[(i + 1) % 3];
+
+		if (a[axis] <= position)
+		{
+			left.Grow(a);
+		}
+		if (a[axis] >= position)
+		{
+			right.Grow(a);
+		}
+
+		// Edges crossing the plane add their intersection point to both sides
+		if ((a[axis] < position && b[axis] > position) || (a[axis] > position && b[axis] < position))
+		{
+			float t = (position - a[axis]) / (b[axis] - a[axis]);
+			glm::vec3 point = a + (b - a) * t;
+			point[axis] = position;
+			left.Grow(point);
+			right.Grow(point);
+		}
+	}
+
+	left.max[axis] = std::min(left.max[axis], position);
+	right.min[axis] = std::max(right.min[axis], position);
+
+	// Earlier splits of the same triangle already bound it tighter
+	outLeft = Intersection(left, reference.bounds);
+	outRight = Intersection(right, reference.bounds);
+}
+
+static float
+SplitCost(
+	float leftArea,
+	int leftCount,
+	float rightArea,
+	int rightCount,
+	float parentArea
+	)
+{
+	return BVH::TRAVERSAL_COST + BVH::INTERSECTION_COST * (leftArea * leftCount + rightArea * rightCount) / parentArea;
+}
+
+/**
+ * \brief Hand the references to two children with SplitInHalf
+ */
+static bool
+SplitReferencesInHalf(
+	const std::vector<Reference>& references,
+	int axis,
+	bool atMedian,
+	std::vector<Reference>& outLeft,
+	std::vector<Reference>& outRight
+	)
+{
+	const int count = static_cast<int>(references.size());
+	outLeft = references;
+	if (!SplitInHalf(outLeft.begin(), outLeft.end(), axis, atMedian, [](const Reference& reference) { return reference.bounds.Centroid(); }))
+	{
+		return false;
+	}
+
+	outRight.assign(outLeft.begin() + count / 2, outLeft.end());
+	outLeft.resize(count / 2);
+	return true;
+}
+
+/**
+ * \brief Find the best object or spatial split of a node, distribute its references among two new children and record the split axis
+ * \return false if the node should stay a leaf
+ */
+static bool
+SplitNode(
+	SpatialBuildContext& context,
+	SpatialBuildNode& node,
+	std::vector<Reference>& outLeft,
+	std::vector<Reference>& outRight
+	)
+{
+	const std::vector<Reference>& references = node.references;
+	const int count = static_cast<int>(references.size());
+
+	// -------- Node bounds ---------
+
+	const int chunkCount = (count + BVH::PARALLEL_GRAIN_SIZE - 1) / BVH::PARALLEL_GRAIN_SIZE;
+	std::vector<AABB> chunkBounds(chunkCount);
+	std::vector<AABB> chunkCentroidBounds(chunkCount);
+	ParallelFor(context.pool, 0, count, BVH::PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+	{
+		AABB bounds;
+		AABB centroidBounds;
+		for (int i = begin; i < end; ++i)
+		{
+			bounds.Grow(references[i].bounds);
+			centroidBounds.Grow(references[i].bounds.Centroid());
+		}
+		chunkBounds[begin / BVH::PARALLEL_GRAIN_SIZE] = bounds;
+		chunkCentroidBounds[begin / BVH::PARALLEL_GRAIN_SIZE] = centroidBounds;
+	});
+
+	AABB centroidBounds;
+	node.bounds = AABB();
+	for (int c = 0; c < chunkCount; ++c)
+	{
+		node.bounds.Grow(chunkBounds[c]);
+		centroidBounds.Grow(chunkCentroidBounds[c]);
+	}
+
+	if (count == 1)
+	{
+		return false;
+	}
+
+	// -------- Depth limit ---------
+
+	// References are not split any more, the median split alone keeps the subtree within the traversal stack
+	if (MustSplitAtMedian(node.depth, count))
+	{
+		node.axis = centroidBounds.LargestAxis();
+		return SplitReferencesInHalf(references, node.axis, true, outLeft, outRight);
+	}
+
+	const float leafCost = BVH::INTERSECTION_COST * count;
+	const float parentArea = node.bounds.SurfaceArea();
+
+	// -------- Object split ---------
+
+	glm::vec3 binScale;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float axisExtent = centroidBounds.max[axis] - centroidBounds.min[axis];
+		binScale[axis] = axisExtent > 0.0f ? BVH::BIN_COUNT / axisExtent : 0.0f;
+	}
+
+	std::vector<ObjectBinSet> chunkObjectBins(chunkCount);
+	ParallelFor(context.pool, 0, count, BVH::PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+	{
+		ObjectBinSet& binSet = chunkObjectBins[begin / BVH::PARALLEL_GRAIN_SIZE];
+		for (int i = begin; i < end; ++i)
+		{
+			glm::vec3 centroid = references[i].bounds.Centroid();
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				int b = BinIndex(centroid[axis], centroidBounds.min[axis], binScale[axis]);
+				binSet.bins[axis][b].count++;
+				binSet.bins[axis][b].bounds.Grow(references[i].bounds);
+			}
+		}
+	});
+
+	float objectCost = FLT_MAX;
+	int objectAxis = -1;
+	int objectSplit = 0;
+	float objectOverlapArea = 0.0f;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (binScale[axis] == 0.0f)
+		{
+			continue;
+		}
+
+		ObjectBin bins[BVH::BIN_COUNT];
+		for (int c = 0; c < chunkCount; ++c)
+		{
+			for (int b = 0; b < BVH::BIN_COUNT; ++b)
+			{
+				bins[b].count += chunkObjectBins[c].bins[axis][b].count;
+				bins[b].bounds.Grow(chunkObjectBins[c].bins[axis][b].bounds);
+			}
+		}
+
+		AABB leftBoxes[BVH::BIN_COUNT - 1];
+		int leftCount[BVH::BIN_COUNT - 1];
+		AABB rightBoxes[BVH::BIN_COUNT - 1];
+		int rightCount[BVH::BIN_COUNT - 1];
+
+		AABB leftBox, rightBox;
+		int leftSum = 0, rightSum = 0;
+		for (int b = 0; b < BVH::BIN_COUNT - 1; ++b)
+		{
+			leftSum += bins[b].count;
+			leftBox.Grow(bins[b].bounds);
+			leftCount[b] = leftSum;
+			leftBoxes[b] = leftBox;
+
+			rightSum += bins[BVH::BIN_COUNT - 1 - b].count;
+			rightBox.Grow(bins[BVH::BIN_COUNT - 1 - b].bounds);
+			rightCount[BVH::BIN_COUNT - 2 - b] = rightSum;
+			rightBoxes[BVH::BIN_COUNT - 2 - b] = rightBox;
+		}
+
+		for (int b = 0; b < BVH::BIN_COUNT - 1; ++b)
+		{
+			if (leftCount[b] == 0 || rightCount[b] == 0)
+			{
+				continue;
+			}
+
+			float cost = SplitCost(leftBoxes[b].SurfaceArea(), leftCount[b], rightBoxes[b].SurfaceArea(), rightCount[b], parentArea);
+			if (cost < objectCost)
+			{
+				objectCost = cost;
+				objectAxis = axis;
+				objectSplit = b;
+				objectOverlapArea = Intersection(leftBoxes[b], rightBoxes[b]).SurfaceArea();
+			}
+		}
+	}
+
+	// -------- Spatial split ---------
+
+	float spatialCost = FLT_MAX;
+	int spatialAxis = -1;
+	int spatialSplit = 0;
+
+	glm::vec3 binWidth = (node.bounds.max - node.bounds.min) / static_cast<float>(BVH::BIN_COUNT);
+
+	// Only worth the clipping where object split children overlap, that is where long and thin triangles are
+	if (node.duplicationBudget > 0 && (objectAxis == -1 || objectOverlapArea > context.minOverlapArea))
+	{
+		std::vector<SpatialBinSet> chunkSpatialBins(chunkCount);
+		ParallelFor(context.pool, 0, count, BVH::PARALLEL_GRAIN_SIZE, [&](int begin, int end)
+		{
+			SpatialBinSet& binSet = chunkSpatialBins[begin / BVH::PARALLEL_GRAIN_SIZE];
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				if (binWidth[axis] <= 0.0f)
+				{
+					continue;
+				}
+
+				const float axisScale = 1.0f / binWidth[axis];
+				for (int i = begin; i < end; ++i)
+				{
+					const Reference& reference = references[i];
+					int firstBin = BinIndex(reference.bounds.min[axis], node.bounds.min[axis], axisScale);
+					int lastBin = BinIndex(reference.bounds.max[axis], node.bounds.min[axis], axisScale);
+
+					// Chop the reference at every bin plane it crosses
+					Reference rest = reference;
+					for (int b = firstBin; b < lastBin; ++b)
+					{
+						AABB piece;
+						SplitReference(context, rest, axis, node.bounds.min[axis] + binWidth[axis] * (b + 1), piece, rest.bounds);
+						binSet.bins[axis][b].bounds.Grow(piece);
+					}
+					binSet.bins[axis][lastBin].bounds.Grow(rest.bounds);
+					binSet.bins[axis][firstBin].entries++;
+					binSet.bins[axis][lastBin].exits++;
+				}
+			}
+		});
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (binWidth[axis] <= 0.0f)
+			{
+				continue;
+			}
+
+			SpatialBin bins[BVH::BIN_COUNT];
+			for (int c = 0; c < chunkCount; ++c)
+			{
+				for (int b = 0; b < BVH::BIN_COUNT; ++b)
+				{
+					bins[b].entries += chunkSpatialBins[c].bins[axis][b].entries;
+					bins[b].exits += chunkSpatialBins[c].bins[axis][b].exits;
+					bins[b].bounds.Grow(chunkSpatialBins[c].bins[axis][b].bounds);
+				}
+			}
+
+			float leftArea[BVH::BIN_COUNT - 1];
+			int leftCount[BVH::BIN_COUNT - 1];
+			float rightArea[BVH::BIN_COUNT - 1];
+			int rightCount[BVH::BIN_COUNT - 1];
+
+			AABB leftBox, rightBox;
+			int leftSum = 0, rightSum = 0;
+			for (int b = 0; b < BVH::BIN_COUNT - 1; ++b)
+			{
+				leftSum += bins[b].entries;
+				leftBox.Grow(bins[b].bounds);
+				leftCount[b] = leftSum;
+				leftArea[b] = leftBox.SurfaceArea();
+
+				rightSum += bins[BVH::BIN_COUNT - 1 - b].exits;
+				rightBox.Grow(bins[BVH::BIN_COUNT - 1 - b].bounds);
+				rightCount[BVH::BIN_COUNT - 2 - b] = rightSum;
+				rightArea[BVH::BIN_COUNT - 2 - b] = rightBox.SurfaceArea();
+			}
+
+			for (int b = 0; b < BVH::BIN_COUNT - 1; ++b)
+			{
+				long long duplicates = static_cast<long long>(leftCount[b]) + rightCount[b] - count;
+				if (leftCount[b] == 0 || rightCount[b] == 0 || duplicates > node.duplicationBudget)
+				{
+					continue;
+				}
+
+				float cost = SplitCost(leftArea[b], leftCount[b], rightArea[b], rightCount[b], parentArea);
+				if (cost < spatialCost)
+				{
+					spatialCost = cost;
+					spatialAxis = axis;
+					spatialSplit = b;
+				}
+			}
+		}
+	}
+
+	const float bestCost = std::min(objectCost, spatialCost);
+	if (bestCost >= leafCost && count <= BVH::MAX_LEAF_SIZE)
+	{
+		return false;
+	}
+
+	outLeft.clear();
+	outRight.clear();
+
+	// -------- Spatial partition ---------
+
+	if (spatialAxis != -1 && spatialCost < objectCost)
+	{
+		const int axis = spatialAxis;
+		const float position = node.bounds.min[axis] + binWidth[axis] * (spatialSplit + 1);
+
+		AABB leftBounds, rightBounds;
+		std::vector<int> straddling;
+		for (int i = 0; i < count; ++i)
+		{
+			const Reference& reference = references[i];
+			if (reference.bounds.max[axis] <= position)
+			{
+				outLeft.push_back(reference);
+				leftBounds.Grow(reference.bounds);
+			}
+			else if (reference.bounds.min[axis] >= position)
+			{
+				outRight.push_back(reference);
+				rightBounds.Grow(reference.bounds);
+			}
+			else
+			{
+				straddling.push_back(i);
+			}
+		}
+
+		// Keep a straddling reference whole on one side when that is cheaper than duplicating it
+		for (int i : straddling)
+		{
+			const Reference& reference = references[i];
+			Reference left = reference;
+			Reference right = reference;
+			SplitReference(context, reference, axis, position, left.bounds, right.bounds);
+
+			const int leftCount = static_cast<int>(outLeft.size());
+			const int rightCount = static_cast<int>(outRight.size());
+
+			AABB unsplitLeft = leftBounds;
+			unsplitLeft.Grow(reference.bounds);
+			AABB unsplitRight = rightBounds;
+			unsplitRight.Grow(reference.bounds);
+			AABB duplicatedLeft = leftBounds;
+			duplicatedLeft.Grow(left.bounds);
+			AABB duplicatedRight = rightBounds;
+			duplicatedRight.Grow(right.bounds);
+
+			float unsplitLeftCost = unsplitLeft.SurfaceArea() * (leftCount + 1) + rightBounds.SurfaceArea() * rightCount;
+			float unsplitRightCost = leftBounds.SurfaceArea() * leftCount + unsplitRight.SurfaceArea() * (rightCount + 1);
+			float duplicatedCost = duplicatedLeft.SurfaceArea() * (leftCount + 1) + duplicatedRight.SurfaceArea() * (rightCount + 1);
+
+			// A triangle that only touches the plane has nothing on one of its sides
+			if (right.bounds.IsEmpty())
+			{
+				unsplitRightCost = FLT_MAX;
+				duplicatedCost = FLT_MAX;
+			}
+			if (left.bounds.IsEmpty())
+			{
+				unsplitLeftCost = FLT_MAX;
+				duplicatedCost = FLT_MAX;
+			}
+
+			if (duplicatedCost < unsplitLeftCost && duplicatedCost < unsplitRightCost)
+			{
+				outLeft.push_back(left);
+				leftBounds = duplicatedLeft;
+				outRight.push_back(right);
+				rightBounds = duplicatedRight;
+			}
+			else if (unsplitLeftCost <= unsplitRightCost)
+			{
+				outLeft.push_back(reference);
+				leftBounds = unsplitLeft;
+			}
+			else
+			{
+				outRight.push_back(reference);
+				rightBounds = unsplitRight;
+			}
+		}
+
+		if (!outLeft.empty() && !outRight.empty())
+		{
+			node.axis = axis;
+			return true;
+		}
+
+		// Every reference ended up on one side, fall back to the object split
+		outLeft.clear();
+		outRight.clear();
+	}
+
+	// -------- Object partition ---------
+
+	if (objectAxis != -1)
+	{
+		for (const Reference& reference : references)
+		{
+			int b = BinIndex(reference.bounds.Centroid()[objectAxis], centroidBounds.min[objectAxis], binScale[objectAxis]);
+			(b <= objectSplit ? outLeft : outRight).push_back(reference);
+		}
+		node.axis = objectAxis;
+		return true;
+	}
+
+	// All centroids coincide, there is nothing to bin. Split big nodes in half anyway.
+	node.axis = node.bounds.LargestAxis();
+	return SplitReferencesInHalf(references, node.axis, false, outLeft, outRight);
+}
+
+void
+BVH::BuildSpatialSplits(
+	const std::vector<glm::vec3>& triangleVertices,
+	float duplicationBudget,
+	ThreadPool* pool
+	)
+{
+	const int triangleCount = static_cast<int>(triangleVertices.size() / 3);
+
+	nodes.clear();
+	primitiveIndices.clear();
+
+	if (triangleCount == 0)
+	{
+		BuildEmpty();
+		return;
+	}
+
+	SpatialBuildContext context(triangleVertices, pool);
+
+	SpatialBuildNode root = { AABB(), std::vector<Reference>(triangleCount), 0, 0, 1, { nullptr, nullptr } };
+	root.duplicationBudget = static_cast<long long>(std::max(0.0f, duplicationBudget) * triangleCount);
+
+	AABB rootBounds;
+	for (int t = 0; t < triangleCount; ++t)
+	{
+		Reference& reference = root.references[t];
+		reference.primitive = t;
+		reference.bounds.Grow(triangleVertices[3 * t]);
+		reference.bounds.Grow(triangleVertices[3 * t + 1]);
+		reference.bounds.Grow(triangleVertices[3 * t + 2]);
+		rootBounds.Grow(reference.bounds);
+	}
+	context.minOverlapArea = SPATIAL_SPLIT_OVERLAP * rootBounds.SurfaceArea();
+
+	// -------- Build ---------
+
+	BuildTree(context.arenas, pool, root, [&context](SpatialBuildNode& node, std::deque<SpatialBuildNode>& arena)
+	{
+		std::vector<Reference> left, right;
+		if (!SplitNode(context, node, left, right))
+		{
+			return false;
+		}
+
+		// What is left of the budget goes to the children by their number of references
+		const long long leftCount = static_cast<long long>(left.size());
+		const long long rightCount = static_cast<long long>(right.size());
+		const long long remainingBudget = node.duplicationBudget - (leftCount + rightCount - static_cast<long long>(node.references.size()));
+		const long long leftBudget = remainingBudget * leftCount / (leftCount + rightCount);
+
+		std::vector<Reference>().swap(node.references);
+
+		arena.push_back({ AABB(), std::move(left), leftBudget, 0, node.depth + 1, { nullptr, nullptr } });
+		node.children[0] = &arena.back();
+		arena.push_back({ AABB(), std::move(right), remainingBudget - leftBudget, 0, node.depth + 1, { nullptr, nullptr } });
+		node.children[1] = &arena.back();
+		return true;
+	});
+
+	// -------- Flatten ---------
+
+	// Leaves append their references to primitiveIndices as they are emitted
+	primitiveIndices.reserve(triangleCount);
+	FlattenTree(root, nodes, [this](const SpatialBuildNode& buildNode, BVHNode& node)
+	{
+		node.leftFirst = static_cast<int>(primitiveIndices.size());
+		node.primitiveCount = buildNode.PrimitiveCount();
+		for (const Reference& reference : buildNode.references)
+		{
+			primitiveIndices.push_back(reference.primitive);
+		}
+	});
+
+	FinishBuild();
+
+	// -------- Refit baseline ---------
+
+	// A refit grows split leaves back to their whole triangles. Measure degradation from the cost the tree has once
+	// that happened everywhere, so that refitting in place is never mistaken for geometry moving apart.
+	// Children are always stored after their parent, so one backwards pass visits them first.
+	std::vector<AABB> refitBounds(nodes.size());
+	float refitCost = 0.0f;
+	for (int n = static_cast<int>(nodes.size()) - 1; n >= 0; --n)
+	{
+		BVHNode refitNode = nodes[n];
+		if (refitNode.IsLeaf())
+		{
+			for (int i = refitNode.leftFirst; i < refitNode.leftFirst + refitNode.primitiveCount; ++i)
+			{
+				for (int v = 0; v < 3; ++v)
+				{
+					refitBounds[n].Grow(triangleVertices[3 * primitiveIndices[i] + v]);
+				}
+			}
+		}
+		else
+		{
+			refitBounds[n] = refitBounds[refitNode.leftFirst];
+			refitBounds[n].Grow(refitBounds[refitNode.leftFirst + 1]);
+		}
+
+		refitNode.aabbMin = refitBounds[n].min;
+		refitNode.aabbMax = refitBounds[n].max;
+		refitCost += NodeCost(refitNode);
+	}
+	m_builtCost = refitCost;
+	m_builtRootArea = refitBounds[0].SurfaceArea();
+}
@@ -0,0 +1,458 @@
+#include "TwoLevelBVH.h"
+#include "BinaryStream.h"
+
+/**
+ * \brief Wide node of a bottom level moved to its position in wideNodes, leaf children point at the owner's triangle range
+ */
+static WideBVHNode
+PackWideNode(
+	WideBVHNode node,
+	int nodeOffset,
+	int firstTriangle
+	)
+{
+	node.childBase += nodeOffset;
+	node.primitiveBase += firstTriangle;
+	return node;
+}
+
+int
+TwoLevelBVH::AddBottomLevel(
+	int firstTriangle,
+	const std::vector<AABB>& triangleBounds,
+	ThreadPool* pool
+	)
+{
+	BottomLevel bottomLevel;
+	bottomLevel.firstTriangle = firstTriangle;
+	bottomLevel.triangleCount = static_cast<int>(triangleBounds.size());
+	bottomLevel.sourceTriangleCount = bottomLevel.triangleCount;
+	bottomLevel.bvh.Build(triangleBounds, pool);
+	if (layout == BVH_LAYOUT_WIDE)
+	{
+		bottomLevel.wideBvh.Build(bottomLevel.bvh);
+	}
+	bottomLevel.rootNode = -1;
+	bottomLevel.rootWideNode = -1;
+	bottomLevel.secondaryBottomLevel = -1;
+	bottomLevel.secondaryError = 0.0f;
+
+	bottomLevels.push_back(std::move(bottomLevel));
+	return static_cast<int>(bottomLevels.size()) - 1;
+}
+
+int
+TwoLevelBVH::AddSpatialSplitBottomLevel(
+	int firstTriangle,
+	const std::vector<glm::vec3>& triangleVertices,
+	float duplicationBudget,
+	ThreadPool* pool
+	)
+{
+	BottomLevel bottomLevel;
+	bottomLevel.firstTriangle = firstTriangle;
+	bottomLevel.sourceTriangleCount = static_cast<int>(triangleVertices.size() / 3);
+	bottomLevel.bvh.BuildSpatialSplits(triangleVertices, duplicationBudget, pool);
+	bottomLevel.triangleCount = static_cast<int>(bottomLevel.bvh.primitiveIndices.size());
+	if (layout == BVH_LAYOUT_WIDE)
+	{
+		bottomLevel.wideBvh.Build(bottomLevel.bvh);
+	}
+	bottomLevel.rootNode = -1;
+	bottomLevel.rootWideNode = -1;
+	bottomLevel.secondaryBottomLevel = -1;
+	bottomLevel.secondaryError = 0.0f;
+
+	bottomLevels.push_back(std::move(bottomLevel));
+	return static_cast<int>(bottomLevels.size()) - 1;
+}
+
+int
+TwoLevelBVH::AddLinearBottomLevel(
+	int firstTriangle,
+	const std::vector<glm::vec3>& triangleVertices
+	)
+{
+	BottomLevel bottomLevel;
+	bottomLevel.firstTriangle = firstTriangle;
+	bottomLevel.triangleCount = static_cast<int>(triangleVertices.size() / 3);
+	bottomLevel.sourceTriangleCount = bottomLevel.triangleCount;
+	bottomLevel.bvh.BuildLinear(triangleVertices);
+	if (layout == BVH_LAYOUT_WIDE)
+	{
+		bottomLevel.wideBvh.Build(bottomLevel.bvh);
+	}
+	bottomLevel.rootNode = -1;
+	bottomLevel.rootWideNode = -1;
+	bottomLevel.secondaryBottomLevel = -1;
+	bottomLevel.secondaryError = 0.0f;
+
+	bottomLevels.push_back(std::move(bottomLevel));
+	return static_cast<int>(bottomLevels.size()) - 1;
+}
+
+int
+TwoLevelBVH::AddInstance(
+	int bottomLevel,
+	const glm::mat4& objectToWorld
+	)
+{
+	instanceBottomLevels.push_back(bottomLevel);
+	instanceTransforms.push_back(objectToWorld);
+	return static_cast<int>(instanceTransforms.size()) - 1;
+}
+
+AABB
+TwoLevelBVH::InstanceBounds(
+	int instance
+	) const
+{
+	const BottomLevel& bottomLevel = bottomLevels[instanceBottomLevels[instance]];
+	const BVHNode& root = bottomLevel.bvh.nodes[0];
+	const glm::mat4& objectToWorld = instanceTransforms[instance];
+
+	AABB bounds;
+	if (bottomLevel.triangleCount == 0)
+	{
+		return bounds;
+	}
+
+	// World bounds of the eight transformed corners
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		glm::vec3 point(
+			(corner & 1) ? root.aabbMax.x : root.aabbMin.x,
+			(corner & 2) ? root.aabbMax.y : root.aabbMin.y,
+			(corner & 4) ? root.aabbMax.z : root.aabbMin.z
+		);
+		bounds.Grow(glm::vec3(objectToWorld * glm::vec4(point, 1.0f)));
+	}
+	return bounds;
+}
+
+void
+TwoLevelBVH::Build()
+{
+	// -------- Top level ---------
+
+	const int instanceCount = static_cast<int>(instanceTransforms.size());
+	std::vector<AABB> instanceBounds(instanceCount);
+	for (int i = 0; i < instanceCount; ++i)
+	{
+		instanceBounds[i] = InstanceBounds(i);
+	}
+	topLevel.Build(instanceBounds);
+	if (layout == BVH_LAYOUT_WIDE)
+	{
+		wideTopLevel.Build(topLevel);
+	}
+
+	nodes = topLevel.nodes;
+	wideNodes = wideTopLevel.nodes;
+
+	// -------- Bottom levels ---------
+
+	// Child indices become absolute positions in the packed array, leaves point at the owner's triangle range
+	for (BottomLevel& bottomLevel : bottomLevels)
+	{
+		const int nodeOffset = static_cast<int>(nodes.size());
+		bottomLevel.rootNode = nodeOffset;
+
+		for (BVHNode node : bottomLevel.bvh.nodes)
+		{
+			node.leftFirst += node.IsLeaf() ? bottomLevel.firstTriangle : nodeOffset;
+			nodes.push_back(node);
+		}
+
+		const int wideNodeOffset = static_cast<int>(wideNodes.size());
+		bottomLevel.rootWideNode = wideNodeOffset;
+
+		for (const WideBVHNode& node : bottomLevel.wideBvh.nodes)
+		{
+			wideNodes.push_back(PackWideNode(node, wideNodeOffset, bottomLevel.firstTriangle));
+		}
+	}
+
+	// -------- Instances ---------
+
+	instances.resize(instanceCount);
+	m_instanceSlots.resize(instanceCount);
+	m_changedInstanceSlots.clear();
+	for (int i = 0; i < instanceCount; ++i)
+	{
+		int instance = topLevel.primitiveIndices[i];
+		m_instanceSlots[instance] = i;
+
+		BVHInstance& gpuInstance = instances[i];
+		gpuInstance.worldToObject = glm::inverse(instanceTransforms[instance]);
+		const BottomLevel& bottomLevel = bottomLevels[instanceBottomLevels[instance]];
+		const BottomLevel& secondaryLevel = bottomLevel.secondaryBottomLevel >= 0 ? bottomLevels[bottomLevel.secondaryBottomLevel] : bottomLevel;
+		gpuInstance.rootNode = layout == BVH_LAYOUT_WIDE ? bottomLevel.rootWideNode : bottomLevel.rootNode;
+		gpuInstance.instanceId = instance;
+		gpuInstance.secondaryRootNode = layout == BVH_LAYOUT_WIDE ? secondaryLevel.rootWideNode : secondaryLevel.rootNode;
+		gpuInstance.secondaryError = bottomLevel.secondaryBottomLevel >= 0 ? bottomLevel.secondaryError : 0.0f;
+	}
+}
+
+void
+TwoLevelBVH::Clear()
+{
+	bottomLevels.clear();
+	instanceTransforms.clear();
+	instanceBottomLevels.clear();
+	topLevel = BVH();
+	wideTopLevel = WideBVH();
+	nodes.clear();
+	wideNodes.clear();
+	instances.clear();
+	m_instanceSlots.clear();
+	m_changedInstanceSlots.clear();
+}
+
+float
+TwoLevelBVH::InstancingFactor() const
+{
+	size_t storedTriangles = 0;
+	for (const BottomLevel& bottomLevel : bottomLevels)
+	{
+		storedTriangles += bottomLevel.sourceTriangleCount;
+	}
+	for (const BottomLevel& bottomLevel : bottomLevels)
+	{
+		if (bottomLevel.secondaryBottomLevel >= 0)
+		{
+			storedTriangles -= bottomLevels[bottomLevel.secondaryBottomLevel].sourceTriangleCount;
+		}
+	}
+
+	size_t instancedTriangles = 0;
+	for (int bottomLevel : instanceBottomLevels)
+	{
+		instancedTriangles += bottomLevels[bottomLevel].sourceTriangleCount;
+	}
+
+	return storedTriangles > 0 ? static_cast<float>(instancedTriangles) / storedTriangles : 1.0f;
+}
+
+const void*
+TwoLevelBVH::NodeData() const
+{
+	return layout == BVH_LAYOUT_WIDE ? static_cast<const void*>(wideNodes.data()) : static_cast<const void*>(nodes.data());
+}
+
+size_t
+TwoLevelBVH::NodeCount() const
+{
+	return layout == BVH_LAYOUT_WIDE ? wideNodes.size() : nodes.size();
+}
+
+size_t
+TwoLevelBVH::NodeSize() const
+{
+	return layout == BVH_LAYOUT_WIDE ? sizeof(WideBVHNode) : sizeof(BVHNode);
+}
+
+// -------- Refit -----------
+
+void
+TwoLevelBVH::SetInstanceTransform(
+	int instance,
+	const glm::mat4& objectToWorld
+	)
+{
+	instanceTransforms[instance] = objectToWorld;
+
+	int slot = m_instanceSlots[instance];
+	instances[slot].worldToObject = glm::inverse(objectToWorld);
+	m_changedInstanceSlots.push_back(slot);
+	topLevel.MarkPrimitiveDirty(slot);
+}
+
+void
+TwoLevelBVH::MarkTriangleDirty(
+	int bottomLevel,
+	int triangle
+	)
+{
+	bottomLevels[bottomLevel].bvh.MarkPrimitiveDirty(triangle - bottomLevels[bottomLevel].firstTriangle);
+}
+
+bool
+TwoLevelBVH::Refit(
+	const std::function<AABB(int)>& triangleBounds,
+	std::vector<int>& outChangedNodes,
+	std::vector<int>& outChangedInstances
+	)
+{
+	bool needsRebuild = false;
+	std::vector<int> changedNodes;
+	std::vector<int> changedWideNodes;
+
+	// -------- Bottom levels ---------
+
+	for (int b = 0; b < static_cast<int>(bottomLevels.size()); ++b)
+	{
+		BottomLevel& bottomLevel = bottomLevels[b];
+		if (!bottomLevel.bvh.HasDirtyNodes())
+		{
+			continue;
+		}
+
+		changedNodes.clear();
+		const int firstTriangle = bottomLevel.firstTriangle;
+		bottomLevel.bvh.Refit([&](int slot) { return triangleBounds(firstTriangle + slot); }, changedNodes);
+
+		// Only bounds changed, child and triangle indices stay packed as they were
+		bool rootChanged = false;
+		for (int node : changedNodes)
+		{
+			BVHNode& packed = nodes[bottomLevel.rootNode + node];
+			packed.aabbMin = bottomLevel.bvh.nodes[node].aabbMin;
+			packed.aabbMax = bottomLevel.bvh.nodes[node].aabbMax;
+			rootChanged = rootChanged || node == 0;
+
+			if (layout == BVH_LAYOUT_BINARY)
+			{
+				outChangedNodes.push_back(bottomLevel.rootNode + node);
+			}
+		}
+
+		if (layout == BVH_LAYOUT_WIDE)
+		{
+			changedWideNodes.clear();
+			bottomLevel.wideBvh.Refit(bottomLevel.bvh, changedNodes, changedWideNodes);
+			for (int node : changedWideNodes)
+			{
+				wideNodes[bottomLevel.rootWideNode + node] = PackWideNode(bottomLevel.wideBvh.nodes[node], bottomLevel.rootWideNode, bottomLevel.firstTriangle);
+				outChangedNodes.push_back(bottomLevel.rootWideNode + node);
+			}
+		}
+
+		// Every instance of a bottom level that grew or shrank has new world bounds
+		if (rootChanged)
+		{
+			for (int instance = 0; instance < static_cast<int>(instanceBottomLevels.size()); ++instance)
+			{
+				if (instanceBottomLevels[instance] == b)
+				{
+					topLevel.MarkPrimitiveDirty(m_instanceSlots[instance]);
+				}
+			}
+		}
+
+		needsRebuild = needsRebuild || bottomLevel.bvh.SAHGrowth() > BVH::REBUILD_SAH_GROWTH;
+	}
+
+	// -------- Top level ---------
+
+	if (topLevel.HasDirtyNodes())
+	{
+		changedNodes.clear();
+		topLevel.Refit([&](int slot) { return InstanceBounds(topLevel.primitiveIndices[slot]); }, changedNodes);
+
+		for (int node : changedNodes)
+		{
+			nodes[node].aabbMin = topLevel.nodes[node].aabbMin;
+			nodes[node].aabbMax = topLevel.nodes[node].aabbMax;
+
+			if (layout == BVH_LAYOUT_BINARY)
+			{
+				outChangedNodes.push_back(node);
+			}
+		}
+
+		if (layout == BVH_LAYOUT_WIDE)
+		{
+			changedWideNodes.clear();
+			wideTopLevel.Refit(topLevel, changedNodes, changedWideNodes);
+			for (int node : changedWideNodes)
+			{
+				wideNodes[node] = wideTopLevel.nodes[node];
+				outChangedNodes.push_back(node);
+			}
+		}
+
+		needsRebuild = needsRebuild || topLevel.SAHGrowth() > BVH::REBUILD_SAH_GROWTH;
+	}
+
+	outChangedInstances.insert(outChangedInstances.end(), m_changedInstanceSlots.begin(), m_changedInstanceSlots.end());
+	m_changedInstanceSlots.clear();
+
+	return needsRebuild;
+}
+
+// -------- Serialization -----------
+
+void
+TwoLevelBVH::Write(
+	BinaryWriter& writer
+	) const
+{
+	writer.Write(static_cast<int32_t>(layout));
+
+	writer.Write<uint64_t>(bottomLevels.size());
+	for (const BottomLevel& bottomLevel : bottomLevels)
+	{
+		writer.Write(bottomLevel.firstTriangle);
+		writer.Write(bottomLevel.triangleCount);
+		writer.Write(bottomLevel.sourceTriangleCount);
+		writer.Write(bottomLevel.rootNode);
+		writer.Write(bottomLevel.rootWideNode);
+		writer.Write(bottomLevel.secondaryBottomLevel);
+		writer.Write(bottomLevel.secondaryError);
+		bottomLevel.bvh.Write(writer);
+		bottomLevel.wideBvh.Write(writer);
+	}
+
+	writer.WriteVector(instanceTransforms);
+	writer.WriteVector(instanceBottomLevels);
+	topLevel.Write(writer);
+	wideTopLevel.Write(writer);
+	writer.WriteVector(nodes);
+	writer.WriteVector(wideNodes);
+	writer.WriteVector(instances);
+	writer.WriteVector(m_instanceSlots);
+}
+
+bool
+TwoLevelBVH::Read(
+	BinaryReader& reader
+	)
+{
+	Clear();
+
+	int32_t storedLayout;
+	uint64_t bottomLevelCount;
+	if (!reader.Read(storedLayout) || !reader.Read(bottomLevelCount))
+	{
+		return false;
+	}
+	layout = static_cast<EBVHLayout>(storedLayout);
+
+	for (uint64_t b = 0; b < bottomLevelCount; ++b)
+	{
+		BottomLevel bottomLevel;
+		if (!reader.Read(bottomLevel.firstTriangle) ||
+			!reader.Read(bottomLevel.triangleCount) ||
+			!reader.Read(bottomLevel.sourceTriangleCount) ||
+			!reader.Read(bottomLevel.rootNode) ||
+			!reader.Read(bottomLevel.rootWideNode) ||
+			!reader.Read(bottomLevel.secondaryBottomLevel) ||
+			!reader.Read(bottomLevel.secondaryError) ||
+			!bottomLevel.bvh.Read(reader) ||
+			!bottomLevel.wideBvh.Read(reader))
+		{
+			return false;
+		}
+		bottomLevels.push_back(std::move(bottomLevel));
+	}
+
+	return reader.ReadVector(instanceTransforms) &&
+		reader.ReadVector(instanceBottomLevels) &&
+		topLevel.Read(reader) &&
+		wideTopLevel.Read(reader) &&
+		reader.ReadVector(nodes) &&
+		reader.ReadVector(wideNodes) &&
+		reader.ReadVector(instances) &&
+		reader.ReadVector(m_instanceSlots);
+}
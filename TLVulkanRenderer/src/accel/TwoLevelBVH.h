@@ -0,0 +1,242 @@
+#pragma once
+
+#include "BVH.h"
+#include "WideBVH.h"
+
+/**
+ * \brief Node layout the ray tracer traverses, matches the BVH_LAYOUT specialization constant of raytrace.comp
+ */
+enum EBVHLayout
+{
+	BVH_LAYOUT_BINARY = 0,
+	BVH_LAYOUT_WIDE = 1
+};
+
+// ---------
+// INSTANCE
+// ----------
+
+/**
+ * \brief Placement of a bottom level hierarchy in the world, laid out to match the std430 BVHInstance struct in raytrace.comp (80 bytes).
+ *        Rays are moved into object space with worldToObject before they traverse the bottom level hierarchy.
+ *        Shadow and bounce rays traverse the secondary root instead, a coarser copy of the same triangles when the scene has levels of detail.
+ */
+struct BVHInstance
+{
+	glm::mat4 worldToObject;
+
+	/**
+	 * \brief Root of the bottom level in the node array of the traversed layout
+	 */
+	int rootNode;
+	int instanceId;
+	int secondaryRootNode;
+
+	/**
+	 * \brief How far the triangles under secondaryRootNode may lie from the full ones, in object space.
+	 *        raytrace.comp traces the coarse copy with secondary rays once that is less than a pixel at the ray origin.
+	 *        Rays leaving the instance ignore its hits closer than that, or they would hit the coarse copy of the surface they leave.
+	 */
+	float secondaryError;
+};
+
+// ---------
+// TWO LEVEL BVH
+// ----------
+
+/**
+ * \brief Top level BVH over instances of shared bottom level BVHs.
+ *        Every hierarchy is packed into a single node array, the top level root is nodes[0].
+ *        Bottom level leaves address absolute triangle indices, top level leaves address the instances array.
+ *        With the wide layout every hierarchy is also collapsed and packed the same way into wideNodes.
+ */
+class TwoLevelBVH
+{
+public:
+
+	/**
+	 * \brief Hierarchy over a contiguous range of triangles, shared by all of its instances
+	 */
+	struct BottomLevel
+	{
+		int firstTriangle;
+
+		/**
+		 * \brief Triangles stored in leaf order. Spatial splits store some triangles more than once, sourceTriangleCount is what was built over.
+		 */
+		int triangleCount;
+		int sourceTriangleCount;
+
+		BVH bvh;
+		WideBVH wideBvh;
+
+		/**
+		 * \brief Position of the bottom level root in nodes and wideNodes, valid after Build
+		 */
+		int rootNode;
+		int rootWideNode;
+
+		/**
+		 * \brief Bottom level secondary rays of every instance of this one trace instead, -1 to trace this one.
+		 *        It holds a coarser copy of the same triangles over the same vertices, at most secondaryError away from them in object space,
+		 *        so it always fits in the bounds of this one. Applied by the next Build.
+		 */
+		int secondaryBottomLevel;
+		float secondaryError;
+	};
+
+	/**
+	 * \brief Build a bottom level hierarchy over triangles [firstTriangle, firstTriangle + triangleBounds.size())
+	 *        Callers have to reorder that triangle range with bvh.primitiveIndices of the returned bottom level.
+	 * \return index of the new bottom level
+	 */
+	int
+	AddBottomLevel(
+		int firstTriangle,
+		const std::vector<AABB>& triangleBounds,
+		ThreadPool* pool = nullptr
+	);
+
+	/**
+	 * \brief Build a bottom level hierarchy with spatial splits, see BVH::BuildSpatialSplits.
+	 *        The triangle range it owns from firstTriangle holds bvh.primitiveIndices.size() triangles, duplicates included.
+	 * \param triangleVertices three vertices per triangle
+	 * \return index of the new bottom level
+	 */
+	int
+	AddSpatialSplitBottomLevel(
+		int firstTriangle,
+		const std::vector<glm::vec3>& triangleVertices,
+		float duplicationBudget,
+		ThreadPool* pool = nullptr
+	);
+
+	/**
+	 * \brief Build a bottom level linear BVH, see BVH::BuildLinear
+	 * \param triangleVertices three vertices per triangle
+	 * \return index of the new bottom level
+	 */
+	int
+	AddLinearBottomLevel(
+		int firstTriangle,
+		const std::vector<glm::vec3>& triangleVertices
+	);
+
+	/**
+	 * \return index of the new instance
+	 */
+	int
+	AddInstance(
+		int bottomLevel,
+		const glm::mat4& objectToWorld
+	);
+
+	/**
+	 * \brief Build the top level hierarchy over the instance world bounds and pack every hierarchy into nodes
+	 */
+	void
+	Build();
+
+	void
+	Clear();
+
+	/**
+	 * \brief Triangles intersected through instancing versus triangles actually stored, secondary bottom levels left out
+	 */
+	float
+	InstancingFactor() const;
+
+	// -------- Traversed nodes ---------
+
+	/**
+	 * \brief Node array the ray tracer traverses, nodes or wideNodes depending on the layout
+	 */
+	const void*
+	NodeData() const;
+
+	size_t
+	NodeCount() const;
+
+	size_t
+	NodeSize() const;
+
+	// -------- Serialization ---------
+
+	void
+	Write(
+		BinaryWriter& writer
+	) const;
+
+	/**
+	 * \return false if the data was truncated
+	 */
+	bool
+	Read(
+		BinaryReader& reader
+	);
+
+	// -------- Refit ---------
+
+	/**
+	 * \brief Move an instance, the top level is refit on the next Refit
+	 */
+	void
+	SetInstanceTransform(
+		int instance,
+		const glm::mat4& objectToWorld
+	);
+
+	/**
+	 * \brief Flag a moved triangle of a bottom level, by its absolute triangle index
+	 */
+	void
+	MarkTriangleDirty(
+		int bottomLevel,
+		int triangle
+	);
+
+	/**
+	 * \brief Refit the dirty bottom levels, then the top level over the instances they moved
+	 * \param triangleBounds current bounds of a triangle by absolute index
+	 * \param outChangedNodes receives every entry of the traversed node array that changed, wideNodes with the wide layout
+	 * \param outChangedInstances receives every entry of instances that changed
+	 * \return true once any level degraded past BVH::REBUILD_SAH_GROWTH and the structure should be rebuilt
+	 */
+	bool
+	Refit(
+		const std::function<AABB(int)>& triangleBounds,
+		std::vector<int>& outChangedNodes,
+		std::vector<int>& outChangedInstances
+	);
+
+	/**
+	 * \brief Has to be set before the first AddBottomLevel, the wide layout reorders the triangles of every bottom level
+	 */
+	EBVHLayout layout = BVH_LAYOUT_BINARY;
+
+	std::vector<BottomLevel> bottomLevels;
+	std::vector<glm::mat4> instanceTransforms;
+	std::vector<int> instanceBottomLevels;
+
+	BVH topLevel;
+	WideBVH wideTopLevel;
+
+	std::vector<BVHNode> nodes;
+	std::vector<WideBVHNode> wideNodes;
+
+	/**
+	 * \brief Instances in top level leaf order
+	 */
+	std::vector<BVHInstance> instances;
+
+private:
+
+	AABB
+	InstanceBounds(
+		int instance
+	) const;
+
+	// Position of each instance in instances
+	std::vector<int> m_instanceSlots;
+	std::vector<int> m_changedInstanceSlots;
+};
@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <cmath>
+#include "WideBVH.h"
+#include "BinaryStream.h"
+
+// A leaf child needs its primitive count and its offset from primitiveBase to fit the 3 + 5 bits of its meta byte
+static_assert(BVH::MAX_LEAF_SIZE <= WideBVH::MAX_LEAF_SIZE, "Binary leaves do not fit a wide leaf child");
+static_assert(BVH::MAX_LEAF_SIZE * (WideBVH::WIDTH - 1) < 32, "Leaf child offsets do not fit 5 bits");
+
+void
+WideBVH::Build(
+	BVH& bvh
+	)
+{
+	std::array<int, WIDTH> noChildren;
+	noChildren.fill(-1);
+
+	nodes.assign(1, WideBVHNode());
+	m_sourceNodes.assign(1, 0);
+	m_childSourceNodes.assign(1, noChildren);
+	m_wideNodes.assign(bvh.nodes.size(), -1);
+	m_wideParents.assign(bvh.nodes.size(), -1);
+
+	// The empty root is the only interior node without children
+	const bool isEmpty = bvh.nodes.size() == 1 && !bvh.nodes[0].IsLeaf();
+
+	std::vector<int> slotOrder;
+	slotOrder.reserve(bvh.primitiveIndices.size());
+
+	// -------- Binary heights ---------
+
+	// Traversing a binary subtree on its own takes as many stack entries as it is high, parents come before their children
+	std::vector<int> heights(bvh.nodes.size(), 1);
+	std::vector<int> preorder;
+	preorder.reserve(bvh.nodes.size());
+	if (!isEmpty)
+	{
+		std::vector<int> unvisited = { 0 };
+		while (!unvisited.empty())
+		{
+			int n = unvisited.back();
+			unvisited.pop_back();
+			preorder.push_back(n);
+			if (!bvh.nodes[n].IsLeaf())
+			{
+				unvisited.push_back(bvh.nodes[n].leftFirst);
+				unvisited.push_back(bvh.nodes[n].leftFirst + 1);
+			}
+		}
+	}
+	for (auto n = preorder.rbegin(); n != preorder.rend(); ++n)
+	{
+		const BVHNode& node = bvh.nodes[*n];
+		if (!node.IsLeaf())
+		{
+			heights[*n] = 1 + std::max(heights[node.leftFirst], heights[node.leftFirst + 1]);
+		}
+	}
+
+	// Every interior child waits on the traversal stack while any of its siblings is traversed. Opening a child only
+	// keeps the stack within BVH::MAX_TRAVERSAL_DEPTH if that wait plus the highest child still fits.
+	// Binary children always fit once the binary tree itself does, so deep paths just end up with narrower nodes.
+	auto stackNeed = [&](const std::vector<int>& childSet)
+	{
+		int interiorCount = 0;
+		int height = 0;
+		for (int child : childSet)
+		{
+			if (!bvh.nodes[child].IsLeaf())
+			{
+				++interiorCount;
+				height = std::max(height, heights[child]);
+			}
+		}
+		return interiorCount == 0 ? 0 : interiorCount - 1 + height;
+	};
+
+	// -------- Collapse ---------
+
+	// Wide node and the stack entries that may lie below it while it is traversed
+	std::vector<std::pair<int, int>> pending = { { 0, 0 } };
+	std::vector<int> children;
+	std::vector<int> opened;
+	std::vector<int> closed;
+	while (!pending.empty())
+	{
+		const int wideIndex = pending.back().first;
+		const int stackBelow = pending.back().second;
+		pending.pop_back();
+
+		const int source = m_sourceNodes[wideIndex];
+		m_wideNodes[source] = wideIndex;
+
+		children.clear();
+		if (bvh.nodes[source].IsLeaf())
+		{
+			// Only a root can be a leaf, it becomes the single child of the wide root
+			children.push_back(source);
+		}
+		else if (!isEmpty)
+		{
+			children.push_back(bvh.nodes[source].leftFirst);
+			children.push_back(bvh.nodes[source].leftFirst + 1);
+		}
+
+		// Open the interior child with the largest surface area until the node is full, it is the one most rays would visit
+		closed.clear();
+		while (static_cast<int>(children.size()) < WIDTH)
+		{
+			int largest = -1;
+			float largestArea = -1.0f;
+			for (int c = 0; c < static_cast<int>(children.size()); ++c)
+			{
+				const BVHNode& child = bvh.nodes[children[c]];
+				float area = AABB(child.aabbMin, child.aabbMax).SurfaceArea();
+				if (!child.IsLeaf() && area > largestArea && std::find(closed.begin(), closed.end(), children[c]) == closed.end())
+				{
+					largest = c;
+					largestArea = area;
+				}
+			}
+
+			if (largest == -1)
+			{
+				break;
+			}
+
+			const int openedSource = children[largest];
+			opened = children;
+			opened[largest] = bvh.nodes[openedSource].leftFirst;
+			opened.insert(opened.begin() + largest + 1, bvh.nodes[openedSource].leftFirst + 1);
+			if (stackBelow + stackNeed(opened) > BVH::MAX_TRAVERSAL_DEPTH)
+			{
+				closed.push_back(openedSource);
+				continue;
+			}
+			children.swap(opened);
+		}
+
+		// -------- Emit ---------
+
+		// Interior children get consecutive wide nodes, leaf children get consecutive primitive slots
+		WideBVHNode node = {};
+		node.childBase = static_cast<int>(nodes.size());
+		node.primitiveBase = static_cast<int>(slotOrder.size());
+
+		std::array<int, WIDTH> childSources = noChildren;
+		uint32_t interiorMask = 0;
+		int interiorCount = 0;
+		for (int c = 0; c < static_cast<int>(children.size()); ++c)
+		{
+			const BVHNode& child = bvh.nodes[children[c]];
+			childSources[c] = children[c];
+			m_wideParents[children[c]] = wideIndex;
+
+			if (child.IsLeaf())
+			{
+				int offset = static_cast<int>(slotOrder.size()) - node.primitiveBase;
+				node.meta[c] = static_cast<uint8_t>((child.primitiveCount << 5) | offset);
+				for (int i = child.leftFirst; i < child.leftFirst + child.primitiveCount; ++i)
+				{
+					slotOrder.push_back(i);
+				}
+			}
+			else
+			{
+				node.meta[c] = static_cast<uint8_t>(8 | interiorCount);
+				interiorMask |= 1u << c;
+				++interiorCount;
+
+				nodes.push_back(WideBVHNode());
+				m_sourceNodes.push_back(children[c]);
+				m_childSourceNodes.push_back(noChildren);
+			}
+		}
+		node.exponentsAndInteriorMask = interiorMask << 24;
+
+		nodes[wideIndex] = node;
+		m_childSourceNodes[wideIndex] = childSources;
+
+		// First child on top of the stack, so that subtrees are emitted depth first
+		for (int i = interiorCount - 1; i >= 0; --i)
+		{
+			pending.push_back({ node.childBase + i, stackBelow + interiorCount - 1 });
+		}
+	}
+
+	bvh.PermutePrimitives(slotOrder);
+
+	// -------- Quantize ---------
+
+	for (int n = 0; n < static_cast<int>(nodes.size()); ++n)
+	{
+		Quantize(bvh, n);
+	}
+}
+
+void
+WideBVH::Quantize(
+	const BVH& bvh,
+	int nodeIndex
+	)
+{
+	WideBVHNode& node = nodes[nodeIndex];
+	const BVHNode& source = bvh.nodes[m_sourceNodes[nodeIndex]];
+
+	node.origin = source.aabbMin;
+
+	// Smallest power of two step that covers the node in 255 steps, stored the way a float stores its exponent
+	glm::vec3 extent = source.aabbMax - source.aabbMin;
+	glm::vec3 inverseStep;
+	uint32_t exponents = 0;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		int exponent = 0;
+		std::frexp(extent[axis] / 255.0f, &exponent);
+		exponent = std::max(-126, std::min(127, exponent));
+
+		exponents |= static_cast<uint32_t>(exponent + 127) << (8 * axis);
+		inverseStep[axis] = std::ldexp(1.0f, -exponent);
+	}
+	node.exponentsAndInteriorMask = (node.exponentsAndInteriorMask & 0xFF000000u) | exponents;
+
+	// Round outwards so that the quantized box always contains the child
+	for (int c = 0; c < WIDTH; ++c)
+	{
+		int child = m_childSourceNodes[nodeIndex][c];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float quantizedMin = 0.0f;
+			float quantizedMax = 0.0f;
+			if (child != -1)
+			{
+				quantizedMin = std::floor((bvh.nodes[child].aabbMin[axis] - node.origin[axis]) * inverseStep[axis]);
+				quantizedMax = std::ceil((bvh.nodes[child].aabbMax[axis] - node.origin[axis]) * inverseStep[axis]);
+			}
+			node.quantizedMin[axis][c] = static_cast<uint8_t>(std::max(0.0f, std::min(255.0f, quantizedMin)));
+			node.quantizedMax[axis][c] = static_cast<uint8_t>(std::max(0.0f, std::min(255.0f, quantizedMax)));
+		}
+	}
+}
+
+void
+WideBVH::Refit(
+	const BVH& bvh,
+	const std::vector<int>& changedBinaryNodes,
+	std::vector<int>& outChangedNodes
+	)
+{
+	// A binary node moves the origin of the wide node collapsed from it, and one child box of its wide parent
+	std::vector<int> changed;
+	for (int binaryNode : changedBinaryNodes)
+	{
+		if (m_wideNodes[binaryNode] != -1)
+		{
+			changed.push_back(m_wideNodes[binaryNode]);
+		}
+		if (m_wideParents[binaryNode] != -1)
+		{
+			changed.push_back(m_wideParents[binaryNode]);
+		}
+	}
+
+	std::sort(changed.begin(), changed.end());
+	changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+	for (int node : changed)
+	{
+		Quantize(bvh, node);
+		outChangedNodes.push_back(node);
+	}
+}
+
+// -------- Serialization -----------
+
+void
+WideBVH::Write(
+	BinaryWriter& writer
+	) const
+{
+	writer.WriteVector(nodes);
+	writer.WriteVector(m_sourceNodes);
+	writer.WriteVector(m_childSourceNodes);
+	writer.WriteVector(m_wideNodes);
+	writer.WriteVector(m_wideParents);
+}
+
+bool
+WideBVH::Read(
+	BinaryReader& reader
+	)
+{
+	return reader.ReadVector(nodes) &&
+		reader.ReadVector(m_sourceNodes) &&
+		reader.ReadVector(m_childSourceNodes) &&
+		reader.ReadVector(m_wideNodes) &&
+		reader.ReadVector(m_wideParents);
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include "BVH.h"
+
+// ---------
+// WIDE NODE
+// ----------
+
+/**
+ * \brief Compressed 8-wide BVH node, laid out to match the std430 WideBVHNode struct in raytrace.comp (80 bytes).
+ *        Child boxes are stored as 8-bit offsets on a per-axis power of two grid that starts at origin.
+ *        Interior children are stored contiguously from childBase, the primitives of all leaf children contiguously from primitiveBase.
+ * \ref Ylitie et al., Efficient Incoherent Ray Traversal on GPUs Through Compressed Wide BVHs, 2017
+ */
+struct WideBVHNode
+{
+	glm::vec3 origin;
+
+	/**
+	 * \brief Grid step of each axis as a biased float exponent in bytes 0-2, byte 3 has bit i set if child i is an interior node
+	 */
+	uint32_t exponentsAndInteriorMask;
+
+	int childBase;
+	int primitiveBase;
+
+	/**
+	 * \brief Per child: 0 for an empty slot, 8 | offset from childBase for interior children,
+	 *        primitive count << 5 | offset from primitiveBase for leaf children
+	 */
+	uint8_t meta[8];
+
+	uint8_t quantizedMin[3][8];
+	uint8_t quantizedMax[3][8];
+};
+
+// ---------
+// WIDE BVH
+// ----------
+
+/**
+ * \brief 8-wide BVH collapsed from a binary BVH. Each wide node pulls up the largest interior descendants of its binary node
+ *        until it has eight children, so binary leaves are kept as they are and become the leaf children.
+ *        The binary BVH stays the source of truth for topology and refits, this is only its compressed traversal layout.
+ */
+class WideBVH
+{
+public:
+
+	static const int WIDTH = 8;
+
+	/**
+	 * \brief Largest leaf child the meta byte can describe
+	 */
+	static const int MAX_LEAF_SIZE = 7;
+
+	/**
+	 * \brief Collapse the binary BVH, root is always nodes[0].
+	 *        The primitives of the binary BVH are reordered so that the leaf children of every wide node are contiguous,
+	 *        the binary nodes stay valid for the new order.
+	 *        Children are only opened as far as the traversal stack allows, see BVH::MAX_TRAVERSAL_DEPTH.
+	 */
+	void
+	Build(
+		BVH& bvh
+	);
+
+	/**
+	 * \brief Quantize the children of every wide node again that was collapsed from a binary node that changed
+	 * \param outChangedNodes receives every wide node that changed
+	 */
+	void
+	Refit(
+		const BVH& bvh,
+		const std::vector<int>& changedBinaryNodes,
+		std::vector<int>& outChangedNodes
+	);
+
+	// -------- Serialization ---------
+
+	void
+	Write(
+		BinaryWriter& writer
+	) const;
+
+	/**
+	 * \return false if the data was truncated
+	 */
+	bool
+	Read(
+		BinaryReader& reader
+	);
+
+	std::vector<WideBVHNode> nodes;
+
+private:
+
+	void
+	Quantize(
+		const BVH& bvh,
+		int node
+	);
+
+	// Binary node each wide node was collapsed from, and the binary node behind each of its children (-1 for empty slots)
+	std::vector<int> m_sourceNodes;
+	std::vector<std::array<int, WIDTH>> m_childSourceNodes;
+
+	// Wide node collapsed from a binary node, and wide node that holds it as a child (-1 if none)
+	std::vector<int> m_wideNodes;
+	std::vector<int> m_wideParents;
+};
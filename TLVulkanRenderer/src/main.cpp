@@ -1,10 +1,63 @@
+#include <cstdlib>
 #include <iostream>
 #include "Application.h"
+#include "Benchmark.h"
 
 int main(int argc, char **argv) {
-	if (argc != 2)
+	if (argc >= 3 && std::string(argv[1]) == "--bench-bvh")
 	{
-		cout << "Usage: [gltf file]" << endl;
+		BenchmarkBVHBuild(std::vector<std::string>(argv + 2, argv + argc));
+		return 0;
+	}
+
+	if (argc >= 3 && std::string(argv[1]) == "--bench-traversal")
+	{
+		BenchmarkBVHTraversal(std::vector<std::string>(argv + 2, argv + argc));
+		return 0;
+	}
+
+	if (argc >= 3 && std::string(argv[1]) == "--bench-lod")
+	{
+		BenchmarkLods(std::vector<std::string>(argv + 2, argv + argc));
+		return 0;
+	}
+
+	if (argc >= 3 && std::string(argv[1]) == "--vertex-cache-report")
+	{
+		ReportVertexCache(std::vector<std::string>(argv + 2, argv + argc));
+		return 0;
+	}
+
+	if (argc >= 2 && std::string(argv[1]) == "--bench-draw-recording")
+	{
+		std::vector<int> meshCounts;
+		for (int i = 2; i < argc; ++i)
+		{
+			meshCounts.push_back(std::atoi(argv[i]));
+		}
+		if (meshCounts.empty())
+		{
+			meshCounts = { 1000, 10000, 100000 };
+		}
+		BenchmarkDrawRecording(meshCounts);
+		return 0;
+	}
+
+	if (argc >= 2 && std::string(argv[1]) == "--bench-vertex-transform")
+	{
+		BenchmarkVertexTransform(argc >= 3 ? std::strtoull(argv[2], nullptr, 10) : 10000000);
+		return 0;
+	}
+
+	if (argc < 2 || std::string(argv[1]).compare(0, 2, "--") == 0)
+	{
+		cout << "Usage: [gltf or tlscene file] [--wide-bvh] [--sbvh] [--split-budget=<fraction>] [--gpu-bvh] [--weld] [--optimize-vertex-cache] [--lod] [--async-load] [--no-cache] [--profile-json=<file>]" << endl;
+		cout << "       --bench-bvh [gltf files...]" << endl;
+		cout << "       --bench-traversal [gltf files...]" << endl;
+		cout << "       --bench-lod [gltf files...]" << endl;
+		cout << "       --vertex-cache-report [gltf files...]" << endl;
+		cout << "       --bench-draw-recording [mesh counts...]" << endl;
+		cout << "       --bench-vertex-transform [vertex count]" << endl;
 		return 0;
 	}
 
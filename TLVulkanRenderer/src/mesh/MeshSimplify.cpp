@@ -0,0 +1,614 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include "MeshSimplify.h"
+#include "VertexWeld.h"
+
+static const uint32_t NO_VERTEX = UINT32_MAX;
+
+/**
+ * \brief A level of the chain is only kept once it got below this fraction of the triangles of the level before
+ */
+static const float LOD_STALL_RATIO = 0.85f;
+
+/**
+ * \brief A pass that removes fewer than this fraction of the triangles means nearly every collapse left is blocked,
+ *        simplification stops there instead of crawling on one collapse per pass
+ */
+static const float MIN_PASS_REDUCTION = 0.005f;
+
+// -------- Quadrics -----------
+
+/**
+ * \brief Sum of squared distances to a set of planes, each weighted by the area of the triangle it came from.
+ *        The symmetric 4x4 matrix is stored as its upper triangle, weight is the total area.
+ */
+struct Quadric
+{
+	double a00, a01, a02, a03;
+	double a11, a12, a13;
+	double a22, a23;
+	double a33;
+	double weight;
+};
+
+static Quadric
+MakePlaneQuadric(
+	const glm::vec3& p0,
+	const glm::vec3& p1,
+	const glm::vec3& p2
+	)
+{
+	Quadric quadric = {};
+	glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+	float length = glm::length(normal);
+	if (length == 0.0f)
+	{
+		return quadric;
+	}
+
+	normal /= length;
+	double x = normal.x;
+	double y = normal.y;
+	double z = normal.z;
+	double d = -glm::dot(normal, p0);
+	double area = 0.5 * length;
+
+	quadric.a00 = area * x * x;
+	quadric.a01 = area * x * y;
+	quadric.a02 = area * x * z;
+	quadric.a03 = area * x * d;
+	quadric.a11 = area * y * y;
+	quadric.a12 = area * y * z;
+	quadric.a13 = area * y * d;
+	quadric.a22 = area * z * z;
+	quadric.a23 = area * z * d;
+	quadric.a33 = area * d * d;
+	quadric.weight = area;
+	return quadric;
+}
+
+static void
+AddQuadric(
+	Quadric& quadric,
+	const Quadric& other
+	)
+{
+	quadric.a00 += other.a00;
+	quadric.a01 += other.a01;
+	quadric.a02 += other.a02;
+	quadric.a03 += other.a03;
+	quadric.a11 += other.a11;
+	quadric.a12 += other.a12;
+	quadric.a13 += other.a13;
+	quadric.a22 += other.a22;
+	quadric.a23 += other.a23;
+	quadric.a33 += other.a33;
+	quadric.weight += other.weight;
+}
+
+/**
+ * \return area weighted root mean square distance of point to the planes of the quadric
+ */
+static float
+QuadricError(
+	const Quadric& quadric,
+	const glm::vec3& point
+	)
+{
+	if (quadric.weight <= 0.0)
+	{
+		return 0.0f;
+	}
+
+	double x = point.x;
+	double y = point.y;
+	double z = point.z;
+	double error =
+		quadric.a00 * x * x + 2.0 * (quadric.a01 * x * y + quadric.a02 * x * z + quadric.a03 * x) +
+		quadric.a11 * y * y + 2.0 * (quadric.a12 * y * z + quadric.a13 * y) +
+		quadric.a22 * z * z + 2.0 * quadric.a23 * z +
+		quadric.a33;
+	return static_cast<float>(std::sqrt(std::max(error, 0.0) / quadric.weight));
+}
+
+// -------- Simplifier -----------
+
+/**
+ * \brief Collapse of every vertex of class source onto class target
+ */
+struct Collapse
+{
+	float error;
+	uint32_t source;
+	uint32_t target;
+
+	bool
+	operator<(const Collapse& other) const
+	{
+		if (error != other.error)
+		{
+			return error < other.error;
+		}
+		return source != other.source ? source < other.source : target < other.target;
+	}
+};
+
+/**
+ * \brief Mesh being simplified. Vertices with the same position form a class, topology and quadrics are tracked per class,
+ *        while triangles keep their own vertices so that normals and texture coordinates on either side of a seam survive.
+ */
+struct Simplifier
+{
+	const glm::vec3* positions;
+	std::vector<uint32_t> indices;
+
+	// Class of every vertex, and the first vertex and the number of referenced vertices of every class
+	std::vector<uint32_t> vertexClasses;
+	std::vector<uint32_t> classVertices;
+	std::vector<uint32_t> classSizes;
+
+	// Classes on borders and non-manifold edges never move
+	std::vector<uint8_t> lockedClasses;
+	std::vector<Quadric> quadrics;
+
+	// Triangles around each class, those of class c are classTriangles[triangleOffsets[c]] to classTriangles[triangleOffsets[c + 1]]
+	std::vector<uint32_t> triangleOffsets;
+	std::vector<uint32_t> classTriangles;
+
+	float error;
+};
+
+static uint64_t
+EdgeKey(
+	uint32_t a,
+	uint32_t b
+	)
+{
+	return a < b ? (static_cast<uint64_t>(a) << 32) | b : (static_cast<uint64_t>(b) << 32) | a;
+}
+
+static const glm::vec3&
+ClassPosition(
+	const Simplifier& simplifier,
+	uint32_t vertexClass
+	)
+{
+	return simplifier.positions[simplifier.classVertices[vertexClass]];
+}
+
+static void
+InitSimplifier(
+	Simplifier& simplifier,
+	const uint32_t* indices,
+	size_t indexCount,
+	const glm::vec3* positions,
+	uint32_t vertexCount
+	)
+{
+	simplifier.positions = positions;
+	simplifier.error = 0.0f;
+
+	const uint32_t classCount = WeldVertices({ { positions, sizeof(glm::vec3) } }, vertexCount, simplifier.vertexClasses);
+	const std::vector<uint32_t>& vertexClasses = simplifier.vertexClasses;
+
+	// Triangles that already collapsed to a line or a point have nothing to keep
+	simplifier.indices.clear();
+	simplifier.indices.reserve(indexCount);
+	for (size_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		uint32_t a = vertexClasses[indices[i]];
+		uint32_t b = vertexClasses[indices[i + 1]];
+		uint32_t c = vertexClasses[indices[i + 2]];
+		if (a != b && b != c && c != a)
+		{
+			simplifier.indices.insert(simplifier.indices.end(), indices + i, indices + i + 3);
+		}
+	}
+
+	// Only referenced vertices count towards a seam, unused duplicates do not split anything
+	std::vector<uint8_t> referenced(vertexCount, 0);
+	for (uint32_t vertex : simplifier.indices)
+	{
+		referenced[vertex] = 1;
+	}
+	simplifier.classVertices.assign(classCount, NO_VERTEX);
+	simplifier.classSizes.assign(classCount, 0);
+	for (uint32_t v = 0; v < vertexCount; ++v)
+	{
+		uint32_t vertexClass = vertexClasses[v];
+		if (simplifier.classVertices[vertexClass] == NO_VERTEX)
+		{
+			simplifier.classVertices[vertexClass] = v;
+		}
+		simplifier.classSizes[vertexClass] += referenced[v];
+	}
+
+	simplifier.quadrics.assign(classCount, Quadric());
+	std::vector<uint64_t> edges;
+	edges.reserve(simplifier.indices.size());
+	for (size_t i = 0; i < simplifier.indices.size(); i += 3)
+	{
+		const uint32_t triangle[3] = { vertexClasses[simplifier.indices[i]], vertexClasses[simplifier.indices[i + 1]], vertexClasses[simplifier.indices[i + 2]] };
+		Quadric quadric = MakePlaneQuadric(ClassPosition(simplifier, triangle[0]), ClassPosition(simplifier, triangle[1]), ClassPosition(simplifier, triangle[2]));
+		for (int corner = 0; corner < 3; ++corner)
+		{
+			AddQuadric(simplifier.quadrics[triangle[corner]], quadric);
+			edges.push_back(EdgeKey(triangle[corner], triangle[(corner + 1) % 3]));
+		}
+	}
+
+	// Border edges belong to a single triangle, non-manifold edges to more than two
+	simplifier.lockedClasses.assign(classCount, 0);
+	std::sort(edges.begin(), edges.end());
+	for (size_t begin = 0; begin < edges.size();)
+	{
+		size_t end = begin + 1;
+		while (end < edges.size() && edges[end] == edges[begin])
+		{
+			++end;
+		}
+		if (end - begin != 2)
+		{
+			simplifier.lockedClasses[static_cast<uint32_t>(edges[begin] >> 32)] = 1;
+			simplifier.lockedClasses[static_cast<uint32_t>(edges[begin])] = 1;
+		}
+		begin = end;
+	}
+}
+
+static void
+BuildClassAdjacency(
+	Simplifier& simplifier
+	)
+{
+	const size_t classCount = simplifier.classVertices.size();
+	simplifier.triangleOffsets.assign(classCount + 1, 0);
+	for (uint32_t vertex : simplifier.indices)
+	{
+		simplifier.triangleOffsets[simplifier.vertexClasses[vertex] + 1]++;
+	}
+	for (size_t c = 0; c < classCount; ++c)
+	{
+		simplifier.triangleOffsets[c + 1] += simplifier.triangleOffsets[c];
+	}
+
+	std::vector<uint32_t> cursors(simplifier.triangleOffsets.begin(), simplifier.triangleOffsets.end() - 1);
+	simplifier.classTriangles.resize(simplifier.indices.size());
+	for (size_t i = 0; i < simplifier.indices.size(); ++i)
+	{
+		simplifier.classTriangles[cursors[simplifier.vertexClasses[simplifier.indices[i]]]++] = static_cast<uint32_t>(i / 3);
+	}
+}
+
+/**
+ * \brief Classes of the triangles around vertexClass, except vertexClass and exclude, sorted and unique
+ */
+static void
+GatherRing(
+	const Simplifier& simplifier,
+	uint32_t vertexClass,
+	uint32_t exclude,
+	std::vector<uint32_t>& outRing
+	)
+{
+	outRing.clear();
+	for (uint32_t i = simplifier.triangleOffsets[vertexClass]; i < simplifier.triangleOffsets[vertexClass + 1]; ++i)
+	{
+		uint32_t triangle = simplifier.classTriangles[i];
+		for (int corner = 0; corner < 3; ++corner)
+		{
+			uint32_t neighbour = simplifier.vertexClasses[simplifier.indices[3 * triangle + corner]];
+			if (neighbour != vertexClass && neighbour != exclude)
+			{
+				outRing.push_back(neighbour);
+			}
+		}
+	}
+	std::sort(outRing.begin(), outRing.end());
+	outRing.erase(std::unique(outRing.begin(), outRing.end()), outRing.end());
+}
+
+/**
+ * \brief Check that moving source onto target keeps the mesh manifold and turns no triangle over.
+ *        Every class around source must be untouched this pass, the positions checked against are still the current ones then.
+ * \param outTargetVertex receives the vertex of target the corners of source take over
+ * \param outRemovedCount receives the number of triangles shared by source and target, the collapse removes them
+ */
+static bool
+CanCollapse(
+	const Simplifier& simplifier,
+	uint32_t source,
+	uint32_t target,
+	const std::vector<uint8_t>& touched,
+	std::vector<uint32_t>& sourceRing,
+	std::vector<uint32_t>& targetRing,
+	uint32_t& outTargetVertex,
+	uint32_t& outRemovedCount
+	)
+{
+	outTargetVertex = NO_VERTEX;
+	outRemovedCount = 0;
+	const glm::vec3& targetPosition = ClassPosition(simplifier, target);
+	for (uint32_t i = simplifier.triangleOffsets[source]; i < simplifier.triangleOffsets[source + 1]; ++i)
+	{
+		const uint32_t* triangle = simplifier.indices.data() + 3 * simplifier.classTriangles[i];
+		uint32_t classes[3];
+		int sourceCorner = 0;
+		int targetCorner = -1;
+		for (int corner = 0; corner < 3; ++corner)
+		{
+			classes[corner] = simplifier.vertexClasses[triangle[corner]];
+			if (touched[classes[corner]])
+			{
+				return false;
+			}
+			sourceCorner = classes[corner] == source ? corner : sourceCorner;
+			targetCorner = classes[corner] == target ? corner : targetCorner;
+		}
+
+		// Triangles on the edge go away. Seen from source they all have to use the same vertex of target, or a seam runs through it.
+		if (targetCorner >= 0)
+		{
+			if (outTargetVertex != NO_VERTEX && outTargetVertex != triangle[targetCorner])
+			{
+				return false;
+			}
+			outTargetVertex = triangle[targetCorner];
+			++outRemovedCount;
+			continue;
+		}
+
+		glm::vec3 corners[3] = { ClassPosition(simplifier, classes[0]), ClassPosition(simplifier, classes[1]), ClassPosition(simplifier, classes[2]) };
+		glm::vec3 normal = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+		corners[sourceCorner] = targetPosition;
+		glm::vec3 movedNormal = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+		if (glm::dot(normal, movedNormal) <= 0.0f)
+		{
+			return false;
+		}
+	}
+
+	if (outRemovedCount == 0)
+	{
+		return false;
+	}
+
+	// Link condition, the only neighbours both share are the far corners of the triangles on the edge.
+	// Another common neighbour would end up with two edges to target, pinching the surface.
+	GatherRing(simplifier, source, target, sourceRing);
+	GatherRing(simplifier, target, source, targetRing);
+	size_t sharedNeighbours = 0;
+	for (size_t s = 0, t = 0; s < sourceRing.size() && t < targetRing.size();)
+	{
+		if (sourceRing[s] == targetRing[t])
+		{
+			++sharedNeighbours;
+			++s;
+			++t;
+		}
+		else if (sourceRing[s] < targetRing[t])
+		{
+			++s;
+		}
+		else
+		{
+			++t;
+		}
+	}
+	return sharedNeighbours == outRemovedCount;
+}
+
+/**
+ * \brief Collapse the cheapest edges whose neighbourhoods do not overlap, until targetTriangleCount or targetError is reached
+ * \return number of triangles removed
+ */
+static size_t
+CollapsePass(
+	Simplifier& simplifier,
+	size_t targetTriangleCount,
+	float targetError
+	)
+{
+	BuildClassAdjacency(simplifier);
+	const std::vector<uint32_t>& vertexClasses = simplifier.vertexClasses;
+
+	std::vector<uint64_t> edges;
+	edges.reserve(simplifier.indices.size());
+	for (size_t i = 0; i < simplifier.indices.size(); i += 3)
+	{
+		for (int corner = 0; corner < 3; ++corner)
+		{
+			edges.push_back(EdgeKey(vertexClasses[simplifier.indices[i + corner]], vertexClasses[simplifier.indices[i + (corner + 1) % 3]]));
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+	// Cheaper direction of every edge. Split vertices cannot move, a triangle would be left with the wrong side of the seam.
+	std::vector<Collapse> collapses;
+	collapses.reserve(edges.size());
+	for (uint64_t edge : edges)
+	{
+		const uint32_t ends[2] = { static_cast<uint32_t>(edge >> 32), static_cast<uint32_t>(edge) };
+		Quadric quadric = simplifier.quadrics[ends[0]];
+		AddQuadric(quadric, simplifier.quadrics[ends[1]]);
+
+		Collapse best = { FLT_MAX, NO_VERTEX, NO_VERTEX };
+		for (int e = 0; e < 2; ++e)
+		{
+			uint32_t source = ends[e];
+			uint32_t target = ends[1 - e];
+			if (simplifier.lockedClasses[source] || simplifier.classSizes[source] != 1)
+			{
+				continue;
+			}
+
+			Collapse collapse = { QuadricError(quadric, ClassPosition(simplifier, target)), source, target };
+			if (collapse < best)
+			{
+				best = collapse;
+			}
+		}
+		if (best.source != NO_VERTEX && best.error <= targetError)
+		{
+			collapses.push_back(best);
+		}
+	}
+	std::sort(collapses.begin(), collapses.end());
+
+	// Each collapse touches the classes around its source, later collapses this pass stay clear of them
+	size_t triangleCount = simplifier.indices.size() / 3;
+	const size_t startTriangleCount = triangleCount;
+	std::vector<uint8_t> touched(simplifier.classVertices.size(), 0);
+	std::vector<uint32_t> vertexTargets(simplifier.vertexClasses.size(), NO_VERTEX);
+	std::vector<uint32_t> sourceRing;
+	std::vector<uint32_t> targetRing;
+	for (const Collapse& collapse : collapses)
+	{
+		if (triangleCount <= targetTriangleCount)
+		{
+			break;
+		}
+
+		uint32_t targetVertex;
+		uint32_t removedCount;
+		if (touched[collapse.source] || touched[collapse.target] ||
+			!CanCollapse(simplifier, collapse.source, collapse.target, touched, sourceRing, targetRing, targetVertex, removedCount))
+		{
+			continue;
+		}
+
+		for (uint32_t i = simplifier.triangleOffsets[collapse.source]; i < simplifier.triangleOffsets[collapse.source + 1]; ++i)
+		{
+			const uint32_t* triangle = simplifier.indices.data() + 3 * simplifier.classTriangles[i];
+			touched[vertexClasses[triangle[0]]] = 1;
+			touched[vertexClasses[triangle[1]]] = 1;
+			touched[vertexClasses[triangle[2]]] = 1;
+		}
+
+		vertexTargets[simplifier.classVertices[collapse.source]] = targetVertex;
+		AddQuadric(simplifier.quadrics[collapse.target], simplifier.quadrics[collapse.source]);
+		simplifier.error = std::max(simplifier.error, collapse.error);
+		triangleCount -= removedCount;
+	}
+
+	if (triangleCount == startTriangleCount)
+	{
+		return 0;
+	}
+
+	// Move the corners of collapsed vertices and drop the triangles that lost their area
+	size_t write = 0;
+	for (size_t i = 0; i < simplifier.indices.size(); i += 3)
+	{
+		uint32_t triangle[3];
+		for (int corner = 0; corner < 3; ++corner)
+		{
+			uint32_t vertex = simplifier.indices[i + corner];
+			triangle[corner] = vertexTargets[vertex] != NO_VERTEX ? vertexTargets[vertex] : vertex;
+		}
+
+		uint32_t a = vertexClasses[triangle[0]];
+		uint32_t b = vertexClasses[triangle[1]];
+		uint32_t c = vertexClasses[triangle[2]];
+		if (a != b && b != c && c != a)
+		{
+			simplifier.indices[write++] = triangle[0];
+			simplifier.indices[write++] = triangle[1];
+			simplifier.indices[write++] = triangle[2];
+		}
+	}
+	simplifier.indices.resize(write);
+	return startTriangleCount - write / 3;
+}
+
+static void
+Simplify(
+	Simplifier& simplifier,
+	size_t targetTriangleCount,
+	float targetError
+	)
+{
+	while (simplifier.indices.size() / 3 > targetTriangleCount)
+	{
+		size_t triangleCount = simplifier.indices.size() / 3;
+		size_t removedCount = CollapsePass(simplifier, targetTriangleCount, targetError);
+		if (removedCount == 0 || removedCount < MIN_PASS_REDUCTION * triangleCount)
+		{
+			break;
+		}
+	}
+}
+
+// -------- Simplification -----------
+
+float
+SimplifyMesh(
+	const uint32_t* indices,
+	size_t indexCount,
+	const glm::vec3* positions,
+	uint32_t vertexCount,
+	size_t targetIndexCount,
+	float targetError,
+	std::vector<uint32_t>& outIndices
+	)
+{
+	Simplifier simplifier;
+	InitSimplifier(simplifier, indices, indexCount, positions, vertexCount);
+	Simplify(simplifier, targetIndexCount / 3, targetError);
+	outIndices = simplifier.indices;
+	return simplifier.error;
+}
+
+void
+BuildLodChain(
+	const uint32_t* indices,
+	size_t indexCount,
+	const glm::vec3* positions,
+	uint32_t vertexCount,
+	std::vector<std::vector<uint32_t>>& outLevels,
+	std::vector<float>& outErrors
+	)
+{
+	outLevels.clear();
+	outErrors.clear();
+	if (indexCount / 3 < 2 * MESH_LOD_MIN_TRIANGLES)
+	{
+		return;
+	}
+
+	Simplifier simplifier;
+	InitSimplifier(simplifier, indices, indexCount, positions, vertexCount);
+
+	size_t previousTriangleCount = indexCount / 3;
+	for (uint32_t level = 1; level < MESH_MAX_LODS && previousTriangleCount / 2 >= MESH_LOD_MIN_TRIANGLES; ++level)
+	{
+		Simplify(simplifier, previousTriangleCount / 2, FLT_MAX);
+
+		size_t triangleCount = simplifier.indices.size() / 3;
+		if (triangleCount > LOD_STALL_RATIO * previousTriangleCount)
+		{
+			break;
+		}
+		outLevels.push_back(simplifier.indices);
+		outErrors.push_back(simplifier.error);
+		previousTriangleCount = triangleCount;
+	}
+}
+
+uint32_t
+SelectLod(
+	const MeshLod* lods,
+	uint32_t lodCount,
+	float maxError
+	)
+{
+	// Errors only grow along the chain
+	uint32_t level = 0;
+	while (level + 1 < lodCount && lods[level + 1].error <= maxError)
+	{
+		++level;
+	}
+	return level;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+/**
+ * \brief Levels of detail a mesh gets at most, the full mesh included. Each level aims for half the triangles of the one before.
+ */
+static const uint32_t MESH_MAX_LODS = 5;
+
+/**
+ * \brief Meshes, or levels, with fewer triangles than this are not simplified any further
+ */
+static const uint32_t MESH_LOD_MIN_TRIANGLES = 64;
+
+/**
+ * \brief One level of detail of a mesh, a range of GeometryArena::indices over the same vertices as the full mesh
+ */
+struct MeshLod
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+
+	// How far the surface of the level strays from the full mesh, in the units of its positions. 0 for the full mesh.
+	float error;
+};
+
+/**
+ * \brief Collapse edges of a mesh with the quadric error metric (Garland and Heckbert 1997) until at most targetIndexCount indices are left
+ *        or every remaining collapse would stray further than targetError from the original surface.
+ *        Vertices only ever collapse onto a neighbour, so the result indexes the original vertices and needs no vertex data of its own.
+ *        Vertices on borders and non-manifold edges stay where they are, and so do vertices split along attribute seams,
+ *        recognized as vertices with exactly the same position.
+ * \param outIndices receives the remaining triangles
+ * \return error of the result, the distance to the original surface of the worst collapse, in the units of positions
+ */
+float
+SimplifyMesh(
+	const uint32_t* indices,
+	size_t indexCount,
+	const glm::vec3* positions,
+	uint32_t vertexCount,
+	size_t targetIndexCount,
+	float targetError,
+	std::vector<uint32_t>& outIndices
+);
+
+/**
+ * \brief Simplify a mesh into up to MESH_MAX_LODS - 1 coarser levels, each with about half the triangles of the one before.
+ *        Every level continues from the previous one and keeps its error quadrics, so errors are measured against the full mesh.
+ *        The chain stops early once a level gets below MESH_LOD_MIN_TRIANGLES or simplification stalls on locked vertices.
+ * \param outLevels receives the indices of each level, coarsest last, the full mesh is not included
+ * \param outErrors receives the error of each level, see SimplifyMesh
+ */
+void
+BuildLodChain(
+	const uint32_t* indices,
+	size_t indexCount,
+	const glm::vec3* positions,
+	uint32_t vertexCount,
+	std::vector<std::vector<uint32_t>>& outLevels,
+	std::vector<float>& outErrors
+);
+
+/**
+ * \return coarsest level whose error is at most maxError, levels are ordered from the full mesh to the coarsest
+ */
+uint32_t
+SelectLod(
+	const MeshLod* lods,
+	uint32_t lodCount,
+	float maxError
+);
@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cmath>
+#include "Meshlet.h"
+
+static const uint8_t UNASSIGNED_VERTEX = 0xFF;
+
+// -------- Bounds -----------
+
+/**
+ * \brief Sphere around the bounding box of the meshlet's vertices, then the cone of its triangle normals
+ */
+static void
+ComputeMeshletBounds(
+	Meshlet& meshlet,
+	const glm::vec3* positions,
+	const uint32_t* vertices,
+	const uint8_t* triangles
+	)
+{
+	glm::vec3 boundsMin = positions[vertices[0]];
+	glm::vec3 boundsMax = boundsMin;
+	for (uint32_t v = 1; v < meshlet.vertexCount; ++v)
+	{
+		boundsMin = glm::min(boundsMin, positions[vertices[v]]);
+		boundsMax = glm::max(boundsMax, positions[vertices[v]]);
+	}
+
+	meshlet.center = (boundsMin + boundsMax) * 0.5f;
+	float radiusSquared = 0.0f;
+	for (uint32_t v = 0; v < meshlet.vertexCount; ++v)
+	{
+		glm::vec3 offset = positions[vertices[v]] - meshlet.center;
+		radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+	}
+	meshlet.radius = std::sqrt(radiusSquared);
+
+	// Degenerate triangles have no direction and are left out
+	std::vector<glm::vec3> normals;
+	normals.reserve(meshlet.triangleCount);
+	glm::vec3 normalSum(0.0f);
+	for (uint32_t t = 0; t < meshlet.triangleCount; ++t)
+	{
+		const glm::vec3& p0 = positions[vertices[triangles[3 * t]]];
+		const glm::vec3& p1 = positions[vertices[triangles[3 * t + 1]]];
+		const glm::vec3& p2 = positions[vertices[triangles[3 * t + 2]]];
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(normal);
+		if (length > 0.0f)
+		{
+			normals.push_back(normal / length);
+			normalSum += normals.back();
+		}
+	}
+
+	float sumLength = glm::length(normalSum);
+	meshlet.coneAxis = sumLength > 0.0f ? normalSum / sumLength : glm::vec3(0.0f, 0.0f, 1.0f);
+	float minimumDot = normals.empty() ? -1.0f : 1.0f;
+	for (const glm::vec3& normal : normals)
+	{
+		minimumDot = std::min(minimumDot, glm::dot(meshlet.coneAxis, normal));
+	}
+
+	// The cone around the normals opens by acos(minimumDot), seen from outside it is culled within asin of that
+	meshlet.coneCutoff = minimumDot <= 0.0f ? 1.0f : std::sqrt(1.0f - minimumDot * minimumDot);
+}
+
+// -------- Build -----------
+
+void
+BuildMeshlets(
+	const uint32_t* indices,
+	size_t indexCount,
+	const glm::vec3* positions,
+	uint32_t vertexCount,
+	std::vector<Meshlet>& outMeshlets,
+	std::vector<uint32_t>& outVertices,
+	std::vector<uint8_t>& outTriangles
+	)
+{
+	// Index of each vertex of the mesh in the meshlet being filled
+	std::vector<uint8_t> localVertices(vertexCount, UNASSIGNED_VERTEX);
+
+	Meshlet meshlet = {};
+	meshlet.firstVertex = static_cast<uint32_t>(outVertices.size());
+	meshlet.firstTriangle = static_cast<uint32_t>(outTriangles.size() / 3);
+
+	auto finishMeshlet = [&]()
+	{
+		ComputeMeshletBounds(meshlet, positions, outVertices.data() + meshlet.firstVertex, outTriangles.data() + 3 * meshlet.firstTriangle);
+		outMeshlets.push_back(meshlet);
+		for (uint32_t v = 0; v < meshlet.vertexCount; ++v)
+		{
+			localVertices[outVertices[meshlet.firstVertex + v]] = UNASSIGNED_VERTEX;
+		}
+
+		meshlet = Meshlet();
+		meshlet.firstVertex = static_cast<uint32_t>(outVertices.size());
+		meshlet.firstTriangle = static_cast<uint32_t>(outTriangles.size() / 3);
+	};
+
+	for (size_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		const uint32_t triangle[3] = { indices[i], indices[i + 1], indices[i + 2] };
+
+		// Repeated vertices of a degenerate triangle are counted twice, which only closes the meshlet a little early
+		uint32_t newVertexCount = 0;
+		for (uint32_t vertex : triangle)
+		{
+			newVertexCount += localVertices[vertex] == UNASSIGNED_VERTEX ? 1 : 0;
+		}
+		if (meshlet.vertexCount + newVertexCount > MESHLET_MAX_VERTICES || meshlet.triangleCount == MESHLET_MAX_TRIANGLES)
+		{
+			finishMeshlet();
+		}
+
+		for (uint32_t vertex : triangle)
+		{
+			if (localVertices[vertex] == UNASSIGNED_VERTEX)
+			{
+				localVertices[vertex] = static_cast<uint8_t>(meshlet.vertexCount++);
+				outVertices.push_back(vertex);
+			}
+			outTriangles.push_back(localVertices[vertex]);
+		}
+		++meshlet.triangleCount;
+	}
+
+	if (meshlet.triangleCount > 0)
+	{
+		finishMeshlet();
+	}
+}
+
+// -------- Culling -----------
+
+void
+ExtractFrustumPlanes(
+	const glm::mat4& clipFromSpace,
+	glm::vec4 outPlanes[6]
+	)
+{
+	// -w <= x, y, z <= w. The near plane is the one of OpenGL clip space, which only keeps a little more with Vulkan's 0 <= z.
+	const glm::mat4 rows = glm::transpose(clipFromSpace);
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		outPlanes[2 * axis] = rows[3] + rows[axis];
+		outPlanes[2 * axis + 1] = rows[3] - rows[axis];
+	}
+
+	for (int p = 0; p < 6; ++p)
+	{
+		outPlanes[p] /= glm::length(glm::vec3(outPlanes[p]));
+	}
+}
+
+bool
+IsMeshletCulled(
+	const Meshlet& meshlet,
+	const glm::vec4 frustumPlanes[6],
+	const glm::vec3& cameraPosition
+	)
+{
+	for (int p = 0; p < 6; ++p)
+	{
+		if (glm::dot(glm::vec3(frustumPlanes[p]), meshlet.center) + frustumPlanes[p].w < -meshlet.radius)
+		{
+			return true;
+		}
+	}
+
+	glm::vec3 toMeshlet = meshlet.center - cameraPosition;
+	return glm::dot(toMeshlet, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(toMeshlet) + meshlet.radius;
+}
+
+// -------- Statistics -----------
+
+MeshletStats
+AnalyzeMeshlets(
+	const Meshlet* meshlets,
+	size_t meshletCount
+	)
+{
+	MeshletStats stats;
+	stats.meshletCount = meshletCount;
+	stats.vertexFill = 0.0f;
+	stats.triangleFill = 0.0f;
+	if (meshletCount == 0)
+	{
+		return stats;
+	}
+
+	double vertexCount = 0.0;
+	double triangleCount = 0.0;
+	for (size_t m = 0; m < meshletCount; ++m)
+	{
+		vertexCount += meshlets[m].vertexCount;
+		triangleCount += meshlets[m].triangleCount;
+	}
+	stats.vertexFill = static_cast<float>(vertexCount / (static_cast<double>(meshletCount) * MESHLET_MAX_VERTICES));
+	stats.triangleFill = static_cast<float>(triangleCount / (static_cast<double>(meshletCount) * MESHLET_MAX_TRIANGLES));
+	return stats;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+/**
+ * \brief Limits of a meshlet, 64 vertices and 124 triangles fit the output of one mesh shader workgroup
+ *        and keep the local triangle indices of a meshlet in 372 bytes
+ */
+static const uint32_t MESHLET_MAX_VERTICES = 64;
+static const uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+/**
+ * \brief Cluster of neighbouring triangles of a mesh, the unit the rasterizer culls against the view frustum and back faces.
+ *        Laid out to match a std430 struct of vec3 center, float radius, vec3 coneAxis, float coneCutoff and four uints (48 bytes).
+ */
+struct Meshlet
+{
+	// Bounding sphere, in the space of the arena positions
+	glm::vec3 center;
+	float radius;
+
+	// Normal cone, every triangle faces away from a camera at cameraPosition if
+	// dot(center - cameraPosition, coneAxis) >= coneCutoff * length(center - cameraPosition) + radius.
+	// coneCutoff is 1 when the triangles face too many directions for that to ever hold.
+	glm::vec3 coneAxis;
+	float coneCutoff;
+
+	// First vertex in GeometryArena::meshletVertices and first triangle in GeometryArena::meshletTriangles
+	uint32_t firstVertex;
+	uint32_t firstTriangle;
+	uint32_t vertexCount;
+	uint32_t triangleCount;
+};
+
+/**
+ * \brief Split the triangles of a mesh into meshlets of at most MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES triangles.
+ *        Triangles are taken in index order and a meshlet is closed as soon as the next triangle does not fit,
+ *        so an index buffer already ordered for the vertex cache gives compact, well filled meshlets.
+ *        Results are appended, meshlet ranges are offsets into outVertices and outTriangles as they were before the call.
+ * \param outVertices receives the vertices of each meshlet, as indices local to the mesh like the index buffer
+ * \param outTriangles receives three indices into the meshlet's own vertices per triangle
+ */
+void
+BuildMeshlets(
+	const uint32_t* indices,
+	size_t indexCount,
+	const glm::vec3* positions,
+	uint32_t vertexCount,
+	std::vector<Meshlet>& outMeshlets,
+	std::vector<uint32_t>& outVertices,
+	std::vector<uint8_t>& outTriangles
+);
+
+/**
+ * \brief Planes of the view frustum of a clip space transform, in the space it transforms from.
+ *        Each plane is a unit normal pointing inside and a distance, extracted as in Gribb and Hartmann 2001.
+ */
+void
+ExtractFrustumPlanes(
+	const glm::mat4& clipFromSpace,
+	glm::vec4 outPlanes[6]
+);
+
+/**
+ * \brief Whether none of the triangles of a meshlet can be seen, either because its bounding sphere is outside the frustum
+ *        or because its normal cone faces away from the camera and back face culling would drop them all
+ * \param frustumPlanes see ExtractFrustumPlanes, in the space of the arena positions like cameraPosition
+ */
+bool
+IsMeshletCulled(
+	const Meshlet& meshlet,
+	const glm::vec4 frustumPlanes[6],
+	const glm::vec3& cameraPosition
+);
+
+/**
+ * \brief How much of the MESHLET_MAX_VERTICES and MESHLET_MAX_TRIANGLES the meshlets use, averaged over all of them
+ */
+struct MeshletStats
+{
+	size_t meshletCount;
+	float vertexFill;
+	float triangleFill;
+};
+
+MeshletStats
+AnalyzeMeshlets(
+	const Meshlet* meshlets,
+	size_t meshletCount
+);
@@ -0,0 +1,337 @@
+#include <algorithm>
+#include "VertexCache.h"
+
+static const uint32_t UNUSED_VERTEX = UINT32_MAX;
+
+// -------- Statistics -----------
+
+VertexCacheStats
+AnalyzeVertexCache(
+	const uint32_t* indices,
+	size_t indexCount,
+	uint32_t vertexCount,
+	uint32_t cacheSize
+	)
+{
+	// A vertex is still cached while fewer than cacheSize others were transformed after it
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	uint32_t timestamp = cacheSize + 1;
+	size_t transformCount = 0;
+	for (size_t i = 0; i < indexCount; ++i)
+	{
+		uint32_t vertex = indices[i];
+		if (timestamp - cacheTime[vertex] > cacheSize)
+		{
+			cacheTime[vertex] = timestamp++;
+			++transformCount;
+		}
+	}
+
+	VertexCacheStats stats;
+	stats.acmr = indexCount >= 3 ? static_cast<float>(transformCount) / (indexCount / 3) : 0.0f;
+	stats.atvr = vertexCount > 0 ? static_cast<float>(transformCount) / vertexCount : 0.0f;
+	return stats;
+}
+
+// -------- Tipsify -----------
+
+/**
+ * \brief Triangles around each vertex, the triangles of vertex v are triangles[offsets[v]] to triangles[offsets[v + 1]]
+ */
+struct VertexAdjacency
+{
+	std::vector<uint32_t> offsets;
+	std::vector<uint32_t> triangles;
+};
+
+static void
+BuildAdjacency(
+	const uint32_t* indices,
+	size_t indexCount,
+	uint32_t vertexCount,
+	VertexAdjacency& outAdjacency
+	)
+{
+	outAdjacency.offsets.assign(vertexCount + 1, 0);
+	for (size_t i = 0; i < indexCount; ++i)
+	{
+		outAdjacency.offsets[indices[i] + 1]++;
+	}
+	for (uint32_t v = 0; v < vertexCount; ++v)
+	{
+		outAdjacency.offsets[v + 1] += outAdjacency.offsets[v];
+	}
+
+	std::vector<uint32_t> cursors(outAdjacency.offsets.begin(), outAdjacency.offsets.end() - 1);
+	outAdjacency.triangles.resize(indexCount);
+	for (size_t i = 0; i < indexCount; ++i)
+	{
+		outAdjacency.triangles[cursors[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+}
+
+void
+OptimizeVertexCache(
+	uint32_t* indices,
+	size_t indexCount,
+	uint32_t vertexCount,
+	std::vector<uint32_t>& outClusters,
+	uint32_t cacheSize
+	)
+{
+	outClusters.clear();
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	VertexAdjacency adjacency;
+	BuildAdjacency(indices, indexCount, vertexCount, adjacency);
+
+	// Triangles each vertex still has to be emitted with
+	std::vector<uint32_t> liveTriangles(vertexCount);
+	for (uint32_t v = 0; v < vertexCount; ++v)
+	{
+		liveTriangles[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+	}
+
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> deadEnd;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> optimized;
+	optimized.reserve(triangleCount * 3);
+
+	uint32_t timestamp = cacheSize + 1;
+	uint32_t cursor = 0;
+	uint32_t fanning = 0;
+	bool restarted = true;
+	while (fanning != UNUSED_VERTEX)
+	{
+		uint32_t emittedCount = static_cast<uint32_t>(optimized.size() / 3);
+		if (restarted && emittedCount < triangleCount && (outClusters.empty() || outClusters.back() != emittedCount))
+		{
+			outClusters.push_back(emittedCount);
+		}
+
+		// Emit every triangle left around the fanning vertex
+		candidates.clear();
+		for (uint32_t a = adjacency.offsets[fanning]; a < adjacency.offsets[fanning + 1]; ++a)
+		{
+			uint32_t triangle = adjacency.triangles[a];
+			if (emitted[triangle])
+			{
+				continue;
+			}
+			emitted[triangle] = true;
+
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				uint32_t vertex = indices[3 * triangle + corner];
+				optimized.push_back(vertex);
+				deadEnd.push_back(vertex);
+				candidates.push_back(vertex);
+				liveTriangles[vertex]--;
+				if (timestamp - cacheTime[vertex] > cacheSize)
+				{
+					cacheTime[vertex] = timestamp++;
+				}
+			}
+		}
+
+		// Next, the neighbour that will still be cached after its own fan, the oldest such one first
+		uint32_t next = UNUSED_VERTEX;
+		int bestPriority = -1;
+		for (uint32_t vertex : candidates)
+		{
+			if (liveTriangles[vertex] == 0)
+			{
+				continue;
+			}
+			int priority = 0;
+			if (timestamp - cacheTime[vertex] + 2 * liveTriangles[vertex] <= cacheSize)
+			{
+				priority = static_cast<int>(timestamp - cacheTime[vertex]);
+			}
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				next = vertex;
+			}
+		}
+
+		// Dead end, go back to recently emitted vertices, or scan for any vertex with triangles left
+		restarted = next == UNUSED_VERTEX;
+		while (next == UNUSED_VERTEX && !deadEnd.empty())
+		{
+			uint32_t vertex = deadEnd.back();
+			deadEnd.pop_back();
+			if (liveTriangles[vertex] > 0)
+			{
+				next = vertex;
+			}
+		}
+		while (next == UNUSED_VERTEX && cursor < vertexCount)
+		{
+			if (liveTriangles[cursor] > 0)
+			{
+				next = cursor;
+			}
+			++cursor;
+		}
+		fanning = next;
+	}
+
+	std::copy(optimized.begin(), optimized.end(), indices);
+}
+
+// -------- Overdraw -----------
+
+void
+OptimizeOverdraw(
+	uint32_t* indices,
+	size_t indexCount,
+	const glm::vec3* positions,
+	uint32_t vertexCount,
+	const std::vector<uint32_t>& clusters,
+	float threshold,
+	uint32_t cacheSize
+	)
+{
+	uint32_t triangleCount = static_cast<uint32_t>(indexCount / 3);
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	// -------- Soft boundaries -----------
+
+	// Splitting a cluster restarts it with a cold cache, only do it once the cluster has paid for that
+	float targetAcmr = AnalyzeVertexCache(indices, indexCount, vertexCount, cacheSize).acmr * threshold;
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	uint32_t timestamp = cacheSize + 1;
+	std::vector<uint32_t> splitClusters;
+	for (size_t c = 0; c < clusters.size(); ++c)
+	{
+		uint32_t clusterEnd = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+		uint32_t clusterStart = clusters[c];
+		uint32_t transformCount = 0;
+		timestamp += cacheSize + 1;
+		splitClusters.push_back(clusterStart);
+
+		for (uint32_t t = clusters[c]; t < clusterEnd; ++t)
+		{
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				uint32_t vertex = indices[3 * t + corner];
+				if (timestamp - cacheTime[vertex] > cacheSize)
+				{
+					cacheTime[vertex] = timestamp++;
+					++transformCount;
+				}
+			}
+
+			if (t + 1 < clusterEnd && transformCount <= targetAcmr * (t + 1 - clusterStart))
+			{
+				clusterStart = t + 1;
+				transformCount = 0;
+				timestamp += cacheSize + 1;
+				splitClusters.push_back(clusterStart);
+			}
+		}
+	}
+
+	// -------- Sort -----------
+
+	// Area weighted centroid and normal of each cluster, and of the whole mesh
+	std::vector<glm::vec3> clusterCentroids(splitClusters.size(), glm::vec3(0.0f));
+	std::vector<glm::vec3> clusterNormals(splitClusters.size(), glm::vec3(0.0f));
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	for (size_t c = 0; c < splitClusters.size(); ++c)
+	{
+		uint32_t clusterEnd = c + 1 < splitClusters.size() ? splitClusters[c + 1] : triangleCount;
+		float clusterArea = 0.0f;
+		for (uint32_t t = splitClusters[c]; t < clusterEnd; ++t)
+		{
+			const glm::vec3& p0 = positions[indices[3 * t]];
+			const glm::vec3& p1 = positions[indices[3 * t + 1]];
+			const glm::vec3& p2 = positions[indices[3 * t + 2]];
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+			glm::vec3 centroid = (p0 + p1 + p2) / 3.0f;
+
+			clusterCentroids[c] += centroid * area;
+			clusterNormals[c] += normal;
+			clusterArea += area;
+			meshCentroid += centroid * area;
+		}
+		if (clusterArea > 0.0f)
+		{
+			clusterCentroids[c] /= clusterArea;
+		}
+		meshArea += clusterArea;
+	}
+	if (meshArea > 0.0f)
+	{
+		meshCentroid /= meshArea;
+	}
+
+	std::vector<float> sortKeys(splitClusters.size());
+	for (size_t c = 0; c < splitClusters.size(); ++c)
+	{
+		float normalLength = glm::length(clusterNormals[c]);
+		sortKeys[c] = normalLength > 0.0f ? glm::dot(clusterCentroids[c] - meshCentroid, clusterNormals[c] / normalLength) : 0.0f;
+	}
+
+	std::vector<uint32_t> order(splitClusters.size());
+	for (size_t c = 0; c < order.size(); ++c)
+	{
+		order[c] = static_cast<uint32_t>(c);
+	}
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+	{
+		return sortKeys[a] > sortKeys[b];
+	});
+
+	std::vector<uint32_t> sorted;
+	sorted.reserve(triangleCount * 3);
+	for (uint32_t c : order)
+	{
+		uint32_t clusterEnd = c + 1 < splitClusters.size() ? splitClusters[c + 1] : triangleCount;
+		sorted.insert(sorted.end(), indices + 3 * splitClusters[c], indices + 3 * clusterEnd);
+	}
+	std::copy(sorted.begin(), sorted.end(), indices);
+}
+
+// -------- Vertex fetch -----------
+
+void
+OptimizeVertexFetch(
+	uint32_t* indices,
+	size_t indexCount,
+	uint32_t vertexCount,
+	std::vector<uint32_t>& outRemap
+	)
+{
+	outRemap.assign(vertexCount, UNUSED_VERTEX);
+	uint32_t nextVertex = 0;
+	for (size_t i = 0; i < indexCount; ++i)
+	{
+		uint32_t& remapped = outRemap[indices[i]];
+		if (remapped == UNUSED_VERTEX)
+		{
+			remapped = nextVertex++;
+		}
+		indices[i] = remapped;
+	}
+
+	for (uint32_t& remapped : outRemap)
+	{
+		if (remapped == UNUSED_VERTEX)
+		{
+			remapped = nextVertex++;
+		}
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+/**
+ * \brief Post-transform cache entries the optimizers and the statistics assume, a FIFO of this size is close to
+ *        what current GPUs reuse within a draw
+ */
+static const uint32_t VERTEX_CACHE_SIZE = 16;
+
+/**
+ * \brief Cache behaviour of an index buffer, simulated with a FIFO of VERTEX_CACHE_SIZE entries
+ */
+struct VertexCacheStats
+{
+	// Vertices transformed per triangle, 0.5 is the best a regular grid can do and 3 the worst
+	float acmr;
+
+	// Vertices transformed per vertex of the mesh, 1 means each one was transformed only once
+	float atvr;
+};
+
+VertexCacheStats
+AnalyzeVertexCache(
+	const uint32_t* indices,
+	size_t indexCount,
+	uint32_t vertexCount,
+	uint32_t cacheSize = VERTEX_CACHE_SIZE
+);
+
+/**
+ * \brief Reorder triangles for the post-transform vertex cache with Tipsify (Sander et al. 2007).
+ *        Fans triangles around one vertex at a time and moves on to the neighbour that is most likely still cached.
+ *        Runs in linear time, so it is cheap enough to do at load.
+ * \param outClusters receives the first triangle of each run Tipsify had to restart from a dead end, where the cache is cold anyway
+ */
+void
+OptimizeVertexCache(
+	uint32_t* indices,
+	size_t indexCount,
+	uint32_t vertexCount,
+	std::vector<uint32_t>& outClusters,
+	uint32_t cacheSize = VERTEX_CACHE_SIZE
+);
+
+/**
+ * \brief Reorder clusters of triangles left by OptimizeVertexCache so that those facing away from the middle of the mesh are drawn first,
+ *        they tend to occlude the rest from any direction. Clusters are split further as long as that costs less than threshold times the current ACMR.
+ */
+void
+OptimizeOverdraw(
+	uint32_t* indices,
+	size_t indexCount,
+	const glm::vec3* positions,
+	uint32_t vertexCount,
+	const std::vector<uint32_t>& clusters,
+	float threshold = 1.05f,
+	uint32_t cacheSize = VERTEX_CACHE_SIZE
+);
+
+/**
+ * \brief Order vertices by their first use in the index buffer so that vertex fetches walk memory forwards.
+ *        Rewrites the indices, unused vertices go to the end.
+ * \param outRemap receives the new index of every vertex, apply it to the vertex data with RemapVertices from mesh/VertexWeld.h
+ */
+void
+OptimizeVertexFetch(
+	uint32_t* indices,
+	size_t indexCount,
+	uint32_t vertexCount,
+	std::vector<uint32_t>& outRemap
+);
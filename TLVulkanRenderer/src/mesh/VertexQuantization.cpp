@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <cmath>
+#include "VertexQuantization.h"
+
+static const float UNORM16_MAX = 65535.0f;
+static const float SNORM16_MAX = 32767.0f;
+
+// -------- Positions -----------
+
+PositionBounds
+ComputePositionBounds(
+	const glm::vec3* positions,
+	size_t count
+	)
+{
+	PositionBounds bounds;
+	if (count == 0)
+	{
+		bounds.boundsMin = glm::vec3(0.0f);
+		bounds.boundsExtent = glm::vec3(0.0f);
+		return bounds;
+	}
+
+	glm::vec3 boundsMin = positions[0];
+	glm::vec3 boundsMax = positions[0];
+	for (size_t v = 1; v < count; ++v)
+	{
+		boundsMin = glm::min(boundsMin, positions[v]);
+		boundsMax = glm::max(boundsMax, positions[v]);
+	}
+	bounds.boundsMin = boundsMin;
+	bounds.boundsExtent = boundsMax - boundsMin;
+	return bounds;
+}
+
+static uint16_t
+QuantizeUnorm16(
+	float value,
+	float offset,
+	float extent
+	)
+{
+	// Flat axes keep every vertex at the minimum
+	if (extent <= 0.0f)
+	{
+		return 0;
+	}
+	float unorm = std::min(std::max((value - offset) / extent, 0.0f), 1.0f);
+	return static_cast<uint16_t>(unorm * UNORM16_MAX + 0.5f);
+}
+
+void
+QuantizePositions(
+	const glm::vec3* positions,
+	size_t count,
+	const PositionBounds& bounds,
+	QuantizedPosition* outPositions
+	)
+{
+	for (size_t v = 0; v < count; ++v)
+	{
+		QuantizedPosition& quantized = outPositions[v];
+		quantized.x = QuantizeUnorm16(positions[v].x, bounds.boundsMin.x, bounds.boundsExtent.x);
+		quantized.y = QuantizeUnorm16(positions[v].y, bounds.boundsMin.y, bounds.boundsExtent.y);
+		quantized.z = QuantizeUnorm16(positions[v].z, bounds.boundsMin.z, bounds.boundsExtent.z);
+		quantized.w = 0;
+	}
+}
+
+glm::vec3
+DequantizePosition(
+	const QuantizedPosition& position,
+	const PositionBounds& bounds
+	)
+{
+	glm::vec3 unorm(position.x / UNORM16_MAX, position.y / UNORM16_MAX, position.z / UNORM16_MAX);
+	return bounds.boundsMin + unorm * bounds.boundsExtent;
+}
+
+// -------- Normals -----------
+
+static float
+SignNotZero(
+	float value
+	)
+{
+	return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+static uint32_t
+PackSnorm16(
+	float value
+	)
+{
+	float clamped = std::min(std::max(value, -1.0f), 1.0f);
+	int16_t snorm = static_cast<int16_t>(std::floor(clamped * SNORM16_MAX + 0.5f));
+	return static_cast<uint16_t>(snorm);
+}
+
+static float
+UnpackSnorm16(
+	uint32_t bits
+	)
+{
+	int16_t snorm = static_cast<int16_t>(static_cast<uint16_t>(bits));
+	return std::max(snorm / SNORM16_MAX, -1.0f);
+}
+
+uint32_t
+EncodeOctahedral(
+	const glm::vec3& normal
+	)
+{
+	float length = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+	if (length == 0.0f)
+	{
+		return 0;
+	}
+
+	// Project onto the octahedron, then fold the lower half over the upper one
+	glm::vec2 folded = glm::vec2(normal.x, normal.y) / length;
+	if (normal.z < 0.0f)
+	{
+		folded = glm::vec2(
+			(1.0f - std::abs(folded.y)) * SignNotZero(folded.x),
+			(1.0f - std::abs(folded.x)) * SignNotZero(folded.y));
+	}
+	return PackSnorm16(folded.x) | (PackSnorm16(folded.y) << 16);
+}
+
+glm::vec3
+DecodeOctahedral(
+	uint32_t encoded
+	)
+{
+	// Same as decodeOctahedral in the shaders
+	glm::vec3 normal(UnpackSnorm16(encoded), UnpackSnorm16(encoded >> 16), 0.0f);
+	normal.z = 1.0f - std::abs(normal.x) - std::abs(normal.y);
+	float fold = std::max(-normal.z, 0.0f);
+	normal.x += normal.x >= 0.0f ? -fold : fold;
+	normal.y += normal.y >= 0.0f ? -fold : fold;
+	return glm::normalize(normal);
+}
+
+void
+EncodeNormals(
+	const glm::vec3* normals,
+	size_t count,
+	uint32_t* outNormals
+	)
+{
+	for (size_t v = 0; v < count; ++v)
+	{
+		outNormals[v] = EncodeOctahedral(normals[v]);
+	}
+}
+
+// -------- Arena -----------
+
+void
+QuantizeArena(
+	const GeometryArena& arena,
+	const MeshTable& meshes,
+	QuantizedArena& outArena
+	)
+{
+	outArena.positions.resize(arena.positions.size());
+	outArena.normals.resize(arena.normals.size());
+	outArena.bounds.resize(meshes.Size());
+	for (size_t m = 0; m < meshes.Size(); ++m)
+	{
+		const glm::vec3* positions = arena.positions.data() + meshes.baseVertex[m];
+		outArena.bounds[m] = ComputePositionBounds(positions, meshes.vertexCount[m]);
+		QuantizePositions(positions, meshes.vertexCount[m], outArena.bounds[m], outArena.positions.data() + meshes.baseVertex[m]);
+	}
+	EncodeNormals(arena.normals.data(), arena.normals.size(), outArena.normals.data());
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "SceneUtil.h"
+
+/**
+ * \brief Position as 16-bit unsigned normalized integers relative to the bounds of its mesh, VK_FORMAT_R16G16B16A16_UNORM.
+ *        w is padding that keeps vertices 8-byte aligned.
+ */
+struct QuantizedPosition
+{
+	uint16_t x;
+	uint16_t y;
+	uint16_t z;
+	uint16_t w;
+};
+
+/**
+ * \brief Turns quantized positions of one mesh back into floats, position = boundsMin + unorm * boundsExtent
+ */
+struct PositionBounds
+{
+	glm::vec3 boundsMin;
+	glm::vec3 boundsExtent;
+};
+
+PositionBounds
+ComputePositionBounds(
+	const glm::vec3* positions,
+	size_t count
+);
+
+/**
+ * \brief Round every position to the nearest of 65536 steps across its bounds, the error is about boundsExtent / 131070 per axis at most
+ */
+void
+QuantizePositions(
+	const glm::vec3* positions,
+	size_t count,
+	const PositionBounds& bounds,
+	QuantizedPosition* outPositions
+);
+
+glm::vec3
+DequantizePosition(
+	const QuantizedPosition& position,
+	const PositionBounds& bounds
+);
+
+/**
+ * \brief Unit vector folded onto an octahedron and stored as two 16-bit signed normalized integers, x in the low half.
+ *        Reads as VK_FORMAT_R16G16_SNORM, or with unpackSnorm2x16 from a storage buffer. A zero vector encodes as +z.
+ */
+uint32_t
+EncodeOctahedral(
+	const glm::vec3& normal
+);
+
+glm::vec3
+DecodeOctahedral(
+	uint32_t encoded
+);
+
+void
+EncodeNormals(
+	const glm::vec3* normals,
+	size_t count,
+	uint32_t* outNormals
+);
+
+// -------- Arena -----------
+
+/**
+ * \brief Vertices of a geometry arena in the layout the rasterizer uploads, indexed like the arena.
+ *        Positions are quantized to the bounds of their mesh, bounds has one entry per mesh.
+ */
+struct QuantizedArena
+{
+	std::vector<QuantizedPosition> positions;
+	std::vector<uint32_t> normals;
+	std::vector<PositionBounds> bounds;
+};
+
+void
+QuantizeArena(
+	const GeometryArena& arena,
+	const MeshTable& meshes,
+	QuantizedArena& outArena
+);
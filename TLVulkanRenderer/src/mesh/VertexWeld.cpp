@@ -0,0 +1,82 @@
+#include <cstring>
+#include "VertexWeld.h"
+
+static const uint32_t EMPTY_SLOT = UINT32_MAX;
+
+static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+static const uint64_t FNV_PRIME = 1099511628211ull;
+
+static uint64_t
+HashVertex(
+	const std::vector<VertexStream>& streams,
+	uint32_t vertex
+	)
+{
+	uint64_t hash = FNV_OFFSET_BASIS;
+	for (const VertexStream& stream : streams)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(stream.data) + vertex * stream.elementSize;
+		for (size_t b = 0; b < stream.elementSize; ++b)
+		{
+			hash = (hash ^ bytes[b]) * FNV_PRIME;
+		}
+	}
+	return hash;
+}
+
+static bool
+VerticesEqual(
+	const std::vector<VertexStream>& streams,
+	uint32_t a,
+	uint32_t b
+	)
+{
+	for (const VertexStream& stream : streams)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(stream.data);
+		if (std::memcmp(bytes + a * stream.elementSize, bytes + b * stream.elementSize, stream.elementSize) != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+uint32_t
+WeldVertices(
+	const std::vector<VertexStream>& streams,
+	uint32_t vertexCount,
+	std::vector<uint32_t>& outRemap
+	)
+{
+	outRemap.resize(vertexCount);
+
+	// Open addressing with linear probing, at most half full. Slots hold the first vertex seen with a given value.
+	size_t tableSize = 16;
+	while (tableSize < 2 * static_cast<size_t>(vertexCount))
+	{
+		tableSize *= 2;
+	}
+	std::vector<uint32_t> table(tableSize, EMPTY_SLOT);
+
+	uint32_t uniqueCount = 0;
+	for (uint32_t v = 0; v < vertexCount; ++v)
+	{
+		size_t slot = HashVertex(streams, v) & (tableSize - 1);
+		while (table[slot] != EMPTY_SLOT && !VerticesEqual(streams, table[slot], v))
+		{
+			slot = (slot + 1) & (tableSize - 1);
+		}
+
+		if (table[slot] == EMPTY_SLOT)
+		{
+			table[slot] = v;
+			outRemap[v] = uniqueCount++;
+		}
+		else
+		{
+			outRemap[v] = outRemap[table[slot]];
+		}
+	}
+	return uniqueCount;
+}
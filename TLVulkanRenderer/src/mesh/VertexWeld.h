@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * \brief One attribute of every vertex, elementSize bytes each and tightly packed
+ */
+struct VertexStream
+{
+	const void* data;
+	size_t elementSize;
+};
+
+/**
+ * \brief Find the unique vertices of a mesh by hashing the bytes of all of their attributes.
+ *        Vertices are only merged when every stream matches exactly. Unique vertices keep the order of their first occurrence,
+ *        so the result is deterministic and meshes can be welded on any number of threads at once.
+ * \param outRemap receives the new index of every vertex
+ * \return number of unique vertices
+ */
+uint32_t
+WeldVertices(
+	const std::vector<VertexStream>& streams,
+	uint32_t vertexCount,
+	std::vector<uint32_t>& outRemap
+);
+
+/**
+ * \brief Move every vertex to its slot in the welded mesh, outVertices needs room for the unique vertices
+ */
+template <typename T>
+void
+RemapVertices(
+	const T* vertices,
+	const std::vector<uint32_t>& remap,
+	T* outVertices
+)
+{
+	for (size_t v = 0; v < remap.size(); ++v)
+	{
+		outVertices[remap[v]] = vertices[v];
+	}
+}
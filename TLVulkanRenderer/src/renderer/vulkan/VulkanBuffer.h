@@ -2,7 +2,6 @@
 
 #include <vulkan/vulkan.h>
 #include "SceneUtil.h"
-#include <map>
 
 namespace VulkanBuffer 
 {
@@ -22,7 +21,8 @@ namespace VulkanBuffer
 	// ===================
 	struct GeometryBufferOffset
 	{
-		std::map<EVertexAttributeType, VkDeviceSize> vertexBufferOffsets;
+		// Indexed by EVertexAttributeType
+		VkDeviceSize vertexBufferOffsets[VERTEX_ATTRIBUTE_COUNT] = {};
 	};
 
 	struct GeometryBuffer
@@ -41,5 +41,21 @@ namespace VulkanBuffer
 		* \brief Handle to the device memory
 		*/
 		VkDeviceMemory vertexBufferMemory;
+
+		/**
+		* \brief Width of the indices at the INDEX offset
+		*/
+		VkIndexType indexType = VK_INDEX_TYPE_UINT16;
+
+		/**
+		* \brief VkDrawIndexedIndirectCommand of every primitive, stored in the same buffer
+		*/
+		VkDeviceSize drawCommandOffset = 0;
+		uint32_t drawCount = 0;
+
+		/**
+		* \brief PositionBounds of every primitive, read per instance. Positions are quantized relative to them.
+		*/
+		VkDeviceSize positionBoundsOffset = 0;
 	};
 }
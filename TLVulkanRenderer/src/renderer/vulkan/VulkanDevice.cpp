@@ -164,8 +164,13 @@ VulkanDevice::SelectPhysicalDevice()
 VkResult
 VulkanDevice::SetupLogicalDevice()
 {
-	// @todo: should add new & interesting features later
-	VkPhysicalDeviceFeatures deviceFeatures = {};
+	// Multi draw indirect lets the rasterizer draw the whole geometry arena with one command,
+	// the first instance of each draw picks its mesh's position bounds
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+	enabledFeatures = {};
+	enabledFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	enabledFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
 
 	// Create logical device info struct and populate it
 	VkDeviceCreateInfo deviceCreateInfo = {};
@@ -190,6 +195,7 @@ VulkanDevice::SetupLogicalDevice()
 
 	deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
+	deviceCreateInfo.pEnabledFeatures = &enabledFeatures;
 
 	// Grab logical device extensions
 	std::vector<const char*> enabledExtensions = GetDeviceRequiredExtensions(physicalDevice);
@@ -769,6 +775,43 @@ VulkanDevice::CopyBuffer(
 	EndSingleTimeCommands(queue, commandPool, copyCommandBuffer);
 }
 
+void
+VulkanDevice::CopyBufferRegions(
+	VkQueue queue,
+	VkCommandPool commandPool,
+	VkBuffer dstBuffer,
+	VkBuffer srcBuffer,
+	const std::vector<VkBufferCopy>& regions,
+	VkPipelineStageFlags readerStages
+) const
+{
+	if (regions.empty())
+	{
+		return;
+	}
+
+	VkCommandBuffer copyCommandBuffer = BeginSingleTimeCommands(commandPool);
+
+	// Frames still in flight may be reading the regions, overwriting them only has to wait for those reads to finish
+	if (readerStages != 0)
+	{
+		vkCmdPipelineBarrier(copyCommandBuffer, readerStages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+	}
+
+	vkCmdCopyBuffer(copyCommandBuffer, srcBuffer, dstBuffer, static_cast<uint32_t>(regions.size()), regions.data());
+
+	if (readerStages != 0)
+	{
+		VkMemoryBarrier memoryBarrier = {};
+		memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		vkCmdPipelineBarrier(copyCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, readerStages, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	}
+
+	EndSingleTimeCommands(queue, commandPool, copyCommandBuffer);
+}
+
 void
 VulkanDevice::CreateImage(
 	uint32_t width,
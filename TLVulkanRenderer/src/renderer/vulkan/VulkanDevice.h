@@ -96,6 +96,11 @@ public:
 	*/
 	QueueFamilyIndices queueFamilyIndices;
 
+	/**
+	* \brief Optional features turned on for the logical device, the ones the physical device supports
+	*/
+	VkPhysicalDeviceFeatures enabledFeatures;
+
 
 	// ================================================
 	// Member functions
@@ -166,6 +171,20 @@ public:
 		VkDeviceSize size
 	) const;
 
+	/**
+	 * \brief Copy several regions between two buffers with a single submit.
+	 *        readerStages are the stages earlier submissions on the queue read dstBuffer at, the copy waits for them and its writes are visible to later reads at the same stages.
+	 */
+	void
+	CopyBufferRegions(
+		VkQueue queue,
+		VkCommandPool commandPool,
+		VkBuffer dstBuffer,
+		VkBuffer srcBuffer,
+		const std::vector<VkBufferCopy>& regions,
+		VkPipelineStageFlags readerStages = 0
+	) const;
+
 	void
 	CreateImage(
 		uint32_t width,
@@ -1,11 +1,20 @@
+#include <algorithm>
 #include "VulkanRaytracer.h"
+#include "LoadProfiler.h"
 #include "Utilities.h"
 #include "Camera.h"
 
+// Buffers cannot be empty, a scene still loading can start out without geometry
+static const VkDeviceSize MIN_STORAGE_BUFFER_SIZE = 16;
+
+// Pass as the binding of a storage buffer no compute descriptor refers to
+static const uint32_t UNBOUND_STORAGE_BUFFER = ~0u;
+
 VulkanRaytracer::VulkanRaytracer(
 	GLFWwindow* window, 
 	Scene* scene): VulkanRenderer(window, scene) 
 {
+	ProfileScope profileScope("Vulkan ray tracer");
 
 	PrepareCompute();
 	PrepareGraphics();
@@ -34,6 +43,10 @@ VulkanRaytracer::Update()
 		m_compute.buffers.uniform.buffer,
 		m_compute.buffers.stagingUniform.buffer,
 		sizeof(m_compute.ubo));
+
+	// Geometry an asynchronous load finished since the last frame, then the BVH refit to nodes moved since then
+	UpdateComputeStorageBuffers(m_scene->UpdateLoad());
+	UpdateComputeStorageBuffers(m_scene->UpdateBVH());
 }
 
 void 
@@ -120,6 +133,35 @@ VulkanRaytracer::~VulkanRaytracer()
 	vkDestroyBuffer(m_vulkanDevice->device, m_compute.buffers.verticePositions.buffer, nullptr);
 	vkFreeMemory(m_vulkanDevice->device, m_compute.buffers.verticePositions.memory, nullptr);
 
+	vkDestroyBuffer(m_vulkanDevice->device, m_compute.buffers.verticeNormals.buffer, nullptr);
+	vkFreeMemory(m_vulkanDevice->device, m_compute.buffers.verticeNormals.memory, nullptr);
+
+	vkDestroyBuffer(m_vulkanDevice->device, m_compute.buffers.triangleRecords.buffer, nullptr);
+	vkFreeMemory(m_vulkanDevice->device, m_compute.buffers.triangleRecords.memory, nullptr);
+
+	vkDestroyBuffer(m_vulkanDevice->device, m_compute.buffers.bvhNodes.buffer, nullptr);
+	vkFreeMemory(m_vulkanDevice->device, m_compute.buffers.bvhNodes.memory, nullptr);
+
+	vkDestroyBuffer(m_vulkanDevice->device, m_compute.buffers.bvhInstances.buffer, nullptr);
+	vkFreeMemory(m_vulkanDevice->device, m_compute.buffers.bvhInstances.memory, nullptr);
+
+	for (VulkanBuffer::StorageBuffer* staging : {
+		&m_compute.buffers.stagingIndices,
+		&m_compute.buffers.stagingVerticePositions,
+		&m_compute.buffers.stagingVerticeNormals,
+		&m_compute.buffers.stagingTriangleRecords,
+		&m_compute.buffers.stagingBvhNodes,
+		&m_compute.buffers.stagingBvhInstances })
+	{
+		vkDestroyBuffer(m_vulkanDevice->device, staging->buffer, nullptr);
+		vkFreeMemory(m_vulkanDevice->device, staging->memory, nullptr);
+	}
+
+	if (m_deviceBvh.enabled)
+	{
+		DestroyDeviceBVHBuild();
+	}
+
 }
 
 void VulkanRaytracer::PrepareGraphics() 
@@ -135,8 +177,6 @@ void VulkanRaytracer::PrepareGraphics()
 VkResult 
 VulkanRaytracer::PrepareGraphicsVertexBuffer() 
 {
-	m_graphics.geometryBuffers.clear();
-
 	const std::vector<uint16_t> indices = {
 		0, 1, 2,
 		0, 2, 3
@@ -160,86 +200,19 @@ VulkanRaytracer::PrepareGraphicsVertexBuffer()
 	m_quad.positions = positions;
 	m_quad.uvs = uvs;
 
-	VulkanBuffer::GeometryBuffer geomBuffer;
-
 	// ----------- Vertex attributes --------------
 
-	VkDeviceSize indexBufferSize = sizeof(indices[0]) * indices.size();
-	VkDeviceSize indexBufferOffset = 0;
-	VkDeviceSize positionBufferSize = sizeof(positions[0]) * positions.size();
-	VkDeviceSize positionBufferOffset = indexBufferSize;
-	VkDeviceSize uvBufferSize = sizeof(uvs[0]) * uvs.size();
-	VkDeviceSize uvBufferOffset = positionBufferOffset + positionBufferSize;
-
-	VkDeviceSize bufferSize = indexBufferSize + positionBufferSize + uvBufferSize;
-	geomBuffer.bufferLayout.vertexBufferOffsets.insert(std::make_pair(INDEX, indexBufferOffset));
-	geomBuffer.bufferLayout.vertexBufferOffsets.insert(std::make_pair(POSITION, positionBufferOffset));
-	geomBuffer.bufferLayout.vertexBufferOffsets.insert(std::make_pair(TEXCOORD, uvBufferOffset));
-
-	// Stage buffer memory on host
-	// We want staging so that we can map the vertex data on the host but
-	// then transfer it to the device local memory for faster performance
-	// This is the recommended way to allocate buffer memory,
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-
-	m_vulkanDevice->CreateBuffer(
-		bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		stagingBuffer
-	);
-
-	// Allocate memory for the buffer
-	m_vulkanDevice->CreateMemory(
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		stagingBuffer,
-		stagingBufferMemory
-	);
+	std::vector<VkDeviceSize> offsets = CreateGeometryBuffer({
+		{ indices.data(), sizeof(indices[0]) * indices.size() },
+		{ positions.data(), sizeof(positions[0]) * positions.size() },
+		{ uvs.data(), sizeof(uvs[0]) * uvs.size() }
+	});
 
-	// Bind buffer with memory
-	VkDeviceSize memoryOffset = 0;
-	vkBindBufferMemory(m_vulkanDevice->device, stagingBuffer, stagingBufferMemory, memoryOffset);
-
-	// Filling the stage buffer with data
-	void* data;
-	vkMapMemory(m_vulkanDevice->device, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy((Byte*)data, (Byte*)indices.data(), static_cast<size_t>(indexBufferSize));
-	memcpy((Byte*)data + positionBufferOffset, (Byte*)positions.data(), static_cast<size_t>(positionBufferSize));
-	memcpy((Byte*)data + uvBufferOffset, (Byte*)uvs.data(), static_cast<size_t>(uvBufferSize));
-	vkUnmapMemory(m_vulkanDevice->device, stagingBufferMemory);
-
-	// -----------------------------------------
-
-	m_vulkanDevice->CreateBuffer(
-		bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-		geomBuffer.vertexBuffer
-	);
-
-	// Allocate memory for the buffer
-	m_vulkanDevice->CreateMemory(
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		geomBuffer.vertexBuffer,
-		geomBuffer.vertexBufferMemory
-	);
-
-	// Bind buffer with memory
-	vkBindBufferMemory(m_vulkanDevice->device, geomBuffer.vertexBuffer, geomBuffer.vertexBufferMemory, memoryOffset);
-
-	// Copy over to vertex buffer in device local memory
-	m_vulkanDevice->CopyBuffer(
-		m_graphics.queue,
-		m_graphics.commandPool,
-		geomBuffer.vertexBuffer,
-		stagingBuffer,
-		bufferSize
-	);
-
-	// Cleanup staging buffer memory
-	vkDestroyBuffer(m_vulkanDevice->device, stagingBuffer, nullptr);
-	vkFreeMemory(m_vulkanDevice->device, stagingBufferMemory, nullptr);
-
-	m_graphics.geometryBuffers.push_back(geomBuffer);
+	VulkanBuffer::GeometryBuffer& geomBuffer = m_graphics.geometryBuffer;
+	geomBuffer.bufferLayout.vertexBufferOffsets[INDEX] = offsets[0];
+	geomBuffer.bufferLayout.vertexBufferOffsets[POSITION] = offsets[1];
+	geomBuffer.bufferLayout.vertexBufferOffsets[TEXCOORD] = offsets[2];
+	geomBuffer.indexType = VK_INDEX_TYPE_UINT16;
 
 	return VK_SUCCESS;
 }
@@ -574,24 +547,21 @@ VulkanRaytracer::PrepareGraphicsCommandBuffers()
 		scissor.extent = m_vulkanDevice->m_swapchain.extent;
 		vkCmdSetScissor(m_graphics.commandBuffers[i], 0, 1, &scissor);
 
-		for (int b = 0; b <m_graphics.geometryBuffers.size(); ++b)
-		{
-			VulkanBuffer::GeometryBuffer& geomBuffer = m_graphics.geometryBuffers[b];
+		VulkanBuffer::GeometryBuffer& geomBuffer = m_graphics.geometryBuffer;
 
-			// Bind vertex buffer
-			VkBuffer vertexBuffers[] = { geomBuffer.vertexBuffer, geomBuffer.vertexBuffer };
-			VkDeviceSize offsets[] = { geomBuffer.bufferLayout.vertexBufferOffsets.at(POSITION), geomBuffer.bufferLayout.vertexBufferOffsets.at(TEXCOORD) };
-			vkCmdBindVertexBuffers(m_graphics.commandBuffers[i], 0, 2, vertexBuffers, offsets);
+		// Bind vertex buffer
+		VkBuffer vertexBuffers[] = { geomBuffer.vertexBuffer, geomBuffer.vertexBuffer };
+		VkDeviceSize offsets[] = { geomBuffer.bufferLayout.vertexBufferOffsets[POSITION], geomBuffer.bufferLayout.vertexBufferOffsets[TEXCOORD] };
+		vkCmdBindVertexBuffers(m_graphics.commandBuffers[i], 0, 2, vertexBuffers, offsets);
 
-			// Bind index buffer
-			vkCmdBindIndexBuffer(m_graphics.commandBuffers[i], geomBuffer.vertexBuffer, geomBuffer.bufferLayout.vertexBufferOffsets.at(INDEX), VK_INDEX_TYPE_UINT16);
+		// Bind index buffer
+		vkCmdBindIndexBuffer(m_graphics.commandBuffers[i], geomBuffer.vertexBuffer, geomBuffer.bufferLayout.vertexBufferOffsets[INDEX], geomBuffer.indexType);
 
-			// Bind uniform buffer
-			vkCmdBindDescriptorSets(m_graphics.commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphics.pipelineLayout, 0, 1, &m_graphics.descriptorSets, 0, nullptr);
+		// Bind uniform buffer
+		vkCmdBindDescriptorSets(m_graphics.commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphics.pipelineLayout, 0, 1, &m_graphics.descriptorSets, 0, nullptr);
 
-			// Record draw command for the triangle!
-			vkCmdDrawIndexed(m_graphics.commandBuffers[i], m_quad.indices.size(), 1, 0, 0, 0);
-		}
+		// Record draw command for the triangle!
+		vkCmdDrawIndexed(m_graphics.commandBuffers[i], m_quad.indices.size(), 1, 0, 0, 0);
 
 		// Record end renderpass
 		vkCmdEndRenderPass(m_graphics.commandBuffers[i]);
@@ -617,14 +587,29 @@ VulkanRaytracer::PrepareGraphicsCommandBuffers()
 void 
 VulkanRaytracer::PrepareCompute() 
 {
+	ProfileScope profileScope("Prepare compute");
 	vkGetDeviceQueue(m_vulkanDevice->device, m_vulkanDevice->queueFamilyIndices.computeFamily, 0, &m_compute.queue);
 
+	ProfileScope textureScope("Ray trace texture");
 	PrepareComputeCommandPool();
 	PrepareRayTraceTextureResources();
+	textureScope.End();
+
+	ProfileScope storageBufferScope("Storage buffers");
 	PrepareComputeStorageBuffer();
 	PrepareComputeUniformBuffer();
+	storageBufferScope.End();
+
+	ProfileScope pipelineScope("Compute pipeline");
 	PrepareComputeDescriptors();
 	PrepareComputePipeline();
+	pipelineScope.End();
+
+	ProfileScope deviceBvhScope("Device BVH build");
+	PrepareDeviceBVHBuild();
+	deviceBvhScope.End();
+
+	ProfileScope commandBufferScope("Compute command buffers");
 	PrepareComputeCommandBuffers();
 }
 
@@ -637,9 +622,9 @@ VulkanRaytracer::PrepareComputeDescriptors()
 		// Output storage image of ray traced result
 		MakeDescriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1),
 		// Uniform buffer for compute
-		MakeDescriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2),
-		// Mesh storage buffers
-		MakeDescriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3)
+		MakeDescriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1),
+		// Mesh, material and BVH storage buffers
+		MakeDescriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 6)
 	};
 
 	VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = MakeDescriptorPoolCreateInfo(
@@ -672,22 +657,34 @@ VulkanRaytracer::PrepareComputeDescriptors()
 			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 			VK_SHADER_STAGE_COMPUTE_BIT
 		),
-		// Binding 3: storage buffer for triangle positions
+		// Binding 4: storage buffer for triangle normals
 		MakeDescriptorSetLayoutBinding(
-			3,
+			4,
 			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 			VK_SHADER_STAGE_COMPUTE_BIT
 		),
-		// Binding 4: storage buffer for triangle normals
+		// Binding 5: storage buffer for materials
 		MakeDescriptorSetLayoutBinding(
-			4,
+			5,
 			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 			VK_SHADER_STAGE_COMPUTE_BIT
 		),
-		// Binding 5: uniform buffer for materials
+		// Binding 6: storage buffer for BVH nodes
 		MakeDescriptorSetLayoutBinding(
-			5,
-			VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			6,
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			VK_SHADER_STAGE_COMPUTE_BIT
+		),
+		// Binding 7: storage buffer for BVH instances
+		MakeDescriptorSetLayoutBinding(
+			7,
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			VK_SHADER_STAGE_COMPUTE_BIT
+		),
+		// Binding 8: storage buffer for triangle records, traversal reads them instead of positions
+		MakeDescriptorSetLayoutBinding(
+			8,
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 			VK_SHADER_STAGE_COMPUTE_BIT
 		),
 	};
@@ -743,25 +740,41 @@ VulkanRaytracer::PrepareComputeDescriptors()
 		MakeWriteDescriptorSet(
 			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 			m_compute.descriptorSets,
-			3, // Binding 3
+			4, // Binding 4
 			1,
-			&m_compute.buffers.verticePositions.descriptor,
+			&m_compute.buffers.verticeNormals.descriptor,
 			nullptr
 		),
 		MakeWriteDescriptorSet(
 			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 			m_compute.descriptorSets,
-			4, // Binding 4
+			5, // Binding 5
 			1,
-			&m_compute.buffers.verticeNormals.descriptor,
+			&m_compute.buffers.materials.descriptor,
 			nullptr
 		),
 		MakeWriteDescriptorSet(
-			VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 			m_compute.descriptorSets,
-			5, // Binding 5
+			6, // Binding 6
 			1,
-			&m_compute.buffers.materials.descriptor,
+			&m_compute.buffers.bvhNodes.descriptor,
+			nullptr
+		),
+		MakeWriteDescriptorSet(
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			m_compute.descriptorSets,
+			7, // Binding 7
+			1,
+			&m_compute.buffers.bvhInstances.descriptor,
+			nullptr
+		),
+		MakeWriteDescriptorSet(
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			m_compute.descriptorSets,
+			8, // Binding 8
+			1,
+			&m_compute.buffers.triangleRecords.descriptor,
 			nullptr
 		),
 	};
@@ -798,138 +811,415 @@ void
 VulkanRaytracer::PrepareComputeStorageBuffer() 
 {
 	// =========== INDICES
-	VulkanBuffer::StorageBuffer stagingBuffer;
-	VkDeviceSize bufferSize = m_scene->indices.size() * sizeof(ivec4);
-
-	// Stage
-	m_vulkanDevice->CreateBufferAndMemory(
-		bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		stagingBuffer.buffer,
-		stagingBuffer.memory
+	CreateComputeStorageBuffer(
+		m_scene->indices.data(),
+		m_scene->indices.size() * sizeof(ivec4),
+		m_compute.buffers.indices,
+		&m_compute.buffers.stagingIndices
 	);
 
-	m_vulkanDevice->MapMemory(
-		m_scene->indices.data(),
-		stagingBuffer.memory,
-		bufferSize,
-		0
-		);
+	// =========== VERTICE POSITIONS
+	CreateComputeStorageBuffer(
+		m_scene->verticePositions.data(),
+		m_scene->verticePositions.size() * sizeof(glm::vec4),
+		m_compute.buffers.verticePositions,
+		&m_compute.buffers.stagingVerticePositions
+	);
 
-	// -----------------------------------------
+	// =========== VERTICE NORMALS
+	// Octahedral, decoded by the shader
+	CreateComputeStorageBuffer(
+		m_scene->verticeNormals.data(),
+		m_scene->verticeNormals.size() * sizeof(uint32_t),
+		m_compute.buffers.verticeNormals,
+		&m_compute.buffers.stagingVerticeNormals
+	);
 
-	m_vulkanDevice->CreateBufferAndMemory(
-		bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		m_compute.buffers.indices.buffer,
-		m_compute.buffers.indices.memory
+	// =========== TRIANGLE RECORDS
+	CreateComputeStorageBuffer(
+		m_scene->triangleRecords.data(),
+		m_scene->triangleRecords.size() * sizeof(TriangleRecord),
+		m_compute.buffers.triangleRecords,
+		&m_compute.buffers.stagingTriangleRecords
 	);
 
-	// Copy over to vertex buffer in device local memory
-	m_vulkanDevice->CopyBuffer(
-		m_compute.queue,
-		m_compute.commandPool,
-		m_compute.buffers.indices.buffer,
-		stagingBuffer.buffer,
-		bufferSize
+	// =========== BVH NODES
+	CreateComputeStorageBuffer(
+		const_cast<void*>(m_scene->bvh.NodeData()),
+		m_scene->bvh.NodeCount() * m_scene->bvh.NodeSize(),
+		m_compute.buffers.bvhNodes,
+		&m_compute.buffers.stagingBvhNodes
 	);
 
-	m_compute.buffers.indices.descriptor = MakeDescriptorBufferInfo(m_compute.buffers.indices.buffer, 0, bufferSize);
+	// =========== BVH INSTANCES
+	CreateComputeStorageBuffer(
+		m_scene->bvh.instances.data(),
+		m_scene->bvh.instances.size() * sizeof(BVHInstance),
+		m_compute.buffers.bvhInstances,
+		&m_compute.buffers.stagingBvhInstances
+	);
+}
 
-	// Cleanup staging buffer memory
-	vkDestroyBuffer(m_vulkanDevice->device, stagingBuffer.buffer, nullptr);
-	vkFreeMemory(m_vulkanDevice->device, stagingBuffer.memory, nullptr);
+void
+VulkanRaytracer::CreateComputeStorageBuffer(
+	void* data,
+	VkDeviceSize bufferSize,
+	VulkanBuffer::StorageBuffer& storageBuffer,
+	VulkanBuffer::StorageBuffer* persistentStagingBuffer,
+	VkDeviceSize capacity
+)
+{
+	VulkanBuffer::StorageBuffer stagingBuffer;
 
-	// =========== VERTICE POSITIONS
-	bufferSize = m_scene->verticePositions.size() * sizeof(glm::vec4);
+	const VkDeviceSize allocationSize = std::max(std::max(bufferSize, capacity), MIN_STORAGE_BUFFER_SIZE);
 
 	// Stage
 	m_vulkanDevice->CreateBufferAndMemory(
-		bufferSize,
+		allocationSize,
 		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 		stagingBuffer.buffer,
 		stagingBuffer.memory
 	);
 
-	m_vulkanDevice->MapMemory(
-		m_scene->verticePositions.data(),
-		stagingBuffer.memory,
-		bufferSize,
-		0
-	);
-
 	// -----------------------------------------
 
 	m_vulkanDevice->CreateBufferAndMemory(
-		bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		allocationSize,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		m_compute.buffers.verticePositions.buffer,
-		m_compute.buffers.verticePositions.memory
+		storageBuffer.buffer,
+		storageBuffer.memory
 	);
 
-	// Copy over to vertex buffer in device local memory
-	m_vulkanDevice->CopyBuffer(
-		m_compute.queue,
-		m_compute.commandPool,
-		m_compute.buffers.verticePositions.buffer,
-		stagingBuffer.buffer,
-		bufferSize
-	);
+	if (bufferSize > 0)
+	{
+		m_vulkanDevice->MapMemory(
+			data,
+			stagingBuffer.memory,
+			bufferSize,
+			0
+		);
+
+		// Copy over to storage buffer in device local memory
+		m_vulkanDevice->CopyBuffer(
+			m_compute.queue,
+			m_compute.commandPool,
+			storageBuffer.buffer,
+			stagingBuffer.buffer,
+			bufferSize
+		);
+	}
 
-	m_compute.buffers.verticePositions.descriptor = MakeDescriptorBufferInfo(m_compute.buffers.verticePositions.buffer, 0, bufferSize);
+	storageBuffer.descriptor = MakeDescriptorBufferInfo(storageBuffer.buffer, 0, allocationSize);
+
+	if (persistentStagingBuffer != nullptr)
+	{
+		stagingBuffer.descriptor = MakeDescriptorBufferInfo(stagingBuffer.buffer, 0, allocationSize);
+		*persistentStagingBuffer = stagingBuffer;
+		return;
+	}
 
 	// Cleanup staging buffer memory
 	vkDestroyBuffer(m_vulkanDevice->device, stagingBuffer.buffer, nullptr);
 	vkFreeMemory(m_vulkanDevice->device, stagingBuffer.memory, nullptr);
+}
 
-	// =========== VERTICE NORMALS
-	bufferSize = m_scene->verticeNormals.size() * sizeof(glm::vec4);
+void
+VulkanRaytracer::UploadComputeStorageBufferRanges(
+	const void* data,
+	VkDeviceSize elementSize,
+	const std::vector<IndexRange>& ranges,
+	VulkanBuffer::StorageBuffer& stagingBuffer,
+	VulkanBuffer::StorageBuffer& storageBuffer
+)
+{
+	std::vector<VkBufferCopy> copyRegions;
+	for (const IndexRange& range : ranges)
+	{
+		if (range.count == 0)
+		{
+			continue;
+		}
 
-	// Stage
-	m_vulkanDevice->CreateBufferAndMemory(
-		bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		VkBufferCopy copyRegion = {};
+		copyRegion.srcOffset = range.first * elementSize;
+		copyRegion.dstOffset = range.first * elementSize;
+		copyRegion.size = range.count * elementSize;
+
+		// Staging memory mirrors the storage buffer layout, only the changed bytes are written
+		m_vulkanDevice->MapMemory(
+			const_cast<Byte*>(static_cast<const Byte*>(data)) + copyRegion.srcOffset,
+			stagingBuffer.memory,
+			copyRegion.size,
+			copyRegion.srcOffset
+		);
+		copyRegions.push_back(copyRegion);
+	}
+	if (copyRegions.empty())
+	{
+		return;
+	}
+
+	// The trace submitted last frame reads the storage buffer, the copy must not overtake it
+	vkWaitForFences(m_vulkanDevice->device, 1, &m_compute.fence, VK_TRUE, UINT64_MAX);
+
+	m_vulkanDevice->CopyBufferRegions(
+		m_compute.queue,
+		m_compute.commandPool,
+		storageBuffer.buffer,
 		stagingBuffer.buffer,
-		stagingBuffer.memory
+		copyRegions
 	);
+}
 
-	m_vulkanDevice->MapMemory(
-		m_scene->verticeNormals.data(),
-		stagingBuffer.memory,
-		bufferSize,
-		0
+bool
+VulkanRaytracer::ResizeComputeStorageBuffer(
+	const void* data,
+	VkDeviceSize size,
+	uint32_t binding,
+	VulkanBuffer::StorageBuffer& storageBuffer,
+	VulkanBuffer::StorageBuffer& stagingBuffer
+)
+{
+	if (size <= storageBuffer.descriptor.range)
+	{
+		return false;
+	}
+
+	vkQueueWaitIdle(m_compute.queue);
+
+	vkDestroyBuffer(m_vulkanDevice->device, storageBuffer.buffer, nullptr);
+	vkFreeMemory(m_vulkanDevice->device, storageBuffer.memory, nullptr);
+	vkDestroyBuffer(m_vulkanDevice->device, stagingBuffer.buffer, nullptr);
+	vkFreeMemory(m_vulkanDevice->device, stagingBuffer.memory, nullptr);
+
+	// Double the capacity, a scene loading in batches grows its buffers many times
+	CreateComputeStorageBuffer(
+		const_cast<void*>(data),
+		size,
+		storageBuffer,
+		&stagingBuffer,
+		storageBuffer.descriptor.range * 2
 	);
 
-	// -----------------------------------------
+	if (binding == UNBOUND_STORAGE_BUFFER)
+	{
+		return true;
+	}
 
-	m_vulkanDevice->CreateBufferAndMemory(
-		bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		m_compute.buffers.verticeNormals.buffer,
-		m_compute.buffers.verticeNormals.memory
+	VkWriteDescriptorSet writeDescriptorSet = MakeWriteDescriptorSet(
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		m_compute.descriptorSets,
+		binding,
+		1,
+		&storageBuffer.descriptor,
+		nullptr
 	);
+	vkUpdateDescriptorSets(m_vulkanDevice->device, 1, &writeDescriptorSet, 0, NULL);
+	return true;
+}
 
-	// Copy over to vertex buffer in device local memory
-	m_vulkanDevice->CopyBuffer(
-		m_compute.queue,
-		m_compute.commandPool,
-		m_compute.buffers.verticeNormals.buffer,
-		stagingBuffer.buffer,
-		bufferSize
+void
+VulkanRaytracer::UpdateComputeStorageBuffers(
+	const SceneUpdate& update
+)
+{
+	if (update.reloaded)
+	{
+		ReloadComputeStorageBuffers(update);
+	}
+	else if (update.rebuilt)
+	{
+		const TwoLevelBVH& bvh = m_scene->bvh;
+
+		// A rebuild can change the node count, and with spatial splits the triangle count.
+		// Buffers that changed size are recreated with their new contents and rebound.
+		bool nodesRecreated = ResizeComputeStorageBuffer(
+			bvh.NodeData(),
+			bvh.NodeCount() * bvh.NodeSize(),
+			6, // Binding 6
+			m_compute.buffers.bvhNodes,
+			m_compute.buffers.stagingBvhNodes
+		);
+		bool indicesRecreated = ResizeComputeStorageBuffer(
+			m_scene->indices.data(),
+			m_scene->indices.size() * sizeof(glm::ivec4),
+			2, // Binding 2
+			m_compute.buffers.indices,
+			m_compute.buffers.stagingIndices
+		);
+		bool triangleRecordsRecreated = ResizeComputeStorageBuffer(
+			m_scene->triangleRecords.data(),
+			m_scene->triangleRecords.size() * sizeof(TriangleRecord),
+			8, // Binding 8
+			m_compute.buffers.triangleRecords,
+			m_compute.buffers.stagingTriangleRecords
+		);
+
+		if (m_deviceBvh.enabled)
+		{
+			// The last dispatch may still be using the descriptor set and the command buffer that are replaced here
+			vkWaitForFences(m_vulkanDevice->device, 1, &m_compute.fence, VK_TRUE, UINT64_MAX);
+
+			// Bottom level 0 may have moved in the node array, the device build is recorded again below
+			UpdateDeviceBVHBuild();
+		}
+
+		if (nodesRecreated || indicesRecreated || triangleRecordsRecreated || m_deviceBvh.enabled)
+		{
+			// The recorded dispatch referenced the old descriptors
+			vkFreeCommandBuffers(m_vulkanDevice->device, m_compute.commandPool, 1, &m_compute.commandBuffer);
+			PrepareComputeCommandBuffers();
+		}
+
+		if (!nodesRecreated)
+		{
+			UploadComputeStorageBufferRanges(bvh.NodeData(), bvh.NodeSize(), { { 0, static_cast<int>(bvh.NodeCount()) } },
+				m_compute.buffers.stagingBvhNodes, m_compute.buffers.bvhNodes);
+		}
+
+		// Triangles were reordered and every instance moved to a new slot
+		if (!indicesRecreated)
+		{
+			UploadComputeStorageBufferRanges(m_scene->indices.data(), sizeof(glm::ivec4), { { 0, static_cast<int>(m_scene->indices.size()) } },
+				m_compute.buffers.stagingIndices, m_compute.buffers.indices);
+		}
+		if (!triangleRecordsRecreated)
+		{
+			UploadComputeStorageBufferRanges(m_scene->triangleRecords.data(), sizeof(TriangleRecord), { { 0, static_cast<int>(m_scene->triangleRecords.size()) } },
+				m_compute.buffers.stagingTriangleRecords, m_compute.buffers.triangleRecords);
+		}
+		UploadComputeStorageBufferRanges(m_scene->bvh.instances.data(), sizeof(BVHInstance), { { 0, static_cast<int>(m_scene->bvh.instances.size()) } },
+			m_compute.buffers.stagingBvhInstances, m_compute.buffers.bvhInstances);
+	}
+	else
+	{
+		UploadComputeStorageBufferRanges(m_scene->bvh.NodeData(), m_scene->bvh.NodeSize(), update.changedNodes,
+			m_compute.buffers.stagingBvhNodes, m_compute.buffers.bvhNodes);
+		UploadComputeStorageBufferRanges(m_scene->bvh.instances.data(), sizeof(BVHInstance), update.changedInstances,
+			m_compute.buffers.stagingBvhInstances, m_compute.buffers.bvhInstances);
+		UploadComputeStorageBufferRanges(m_scene->triangleRecords.data(), sizeof(TriangleRecord), update.changedTriangles,
+			m_compute.buffers.stagingTriangleRecords, m_compute.buffers.triangleRecords);
+	}
+
+	UploadComputeStorageBufferRanges(m_scene->verticePositions.data(), sizeof(glm::vec4), update.changedVertices,
+		m_compute.buffers.stagingVerticePositions, m_compute.buffers.verticePositions);
+	UploadComputeStorageBufferRanges(m_scene->verticeNormals.data(), sizeof(uint32_t), update.changedVertices,
+		m_compute.buffers.stagingVerticeNormals, m_compute.buffers.verticeNormals);
+}
+
+void
+VulkanRaytracer::ReloadComputeStorageBuffers(
+	const SceneUpdate& update
+)
+{
+	const TwoLevelBVH& bvh = m_scene->bvh;
+
+	// Buffers only grow while a scene loads, recreating one uploads all of its contents
+	bool nodesRecreated = ResizeComputeStorageBuffer(
+		bvh.NodeData(),
+		bvh.NodeCount() * bvh.NodeSize(),
+		6, // Binding 6
+		m_compute.buffers.bvhNodes,
+		m_compute.buffers.stagingBvhNodes
+	);
+	bool instancesRecreated = ResizeComputeStorageBuffer(
+		bvh.instances.data(),
+		bvh.instances.size() * sizeof(BVHInstance),
+		7, // Binding 7
+		m_compute.buffers.bvhInstances,
+		m_compute.buffers.stagingBvhInstances
+	);
+	bool indicesRecreated = ResizeComputeStorageBuffer(
+		m_scene->indices.data(),
+		m_scene->indices.size() * sizeof(glm::ivec4),
+		2, // Binding 2
+		m_compute.buffers.indices,
+		m_compute.buffers.stagingIndices
+	);
+	bool triangleRecordsRecreated = ResizeComputeStorageBuffer(
+		m_scene->triangleRecords.data(),
+		m_scene->triangleRecords.size() * sizeof(TriangleRecord),
+		8, // Binding 8
+		m_compute.buffers.triangleRecords,
+		m_compute.buffers.stagingTriangleRecords
+	);
+	bool normalsRecreated = ResizeComputeStorageBuffer(
+		m_scene->verticeNormals.data(),
+		m_scene->verticeNormals.size() * sizeof(uint32_t),
+		4, // Binding 4
+		m_compute.buffers.verticeNormals,
+		m_compute.buffers.stagingVerticeNormals
+	);
+	ResizeComputeStorageBuffer(
+		m_scene->verticePositions.data(),
+		m_scene->verticePositions.size() * sizeof(glm::vec4),
+		UNBOUND_STORAGE_BUFFER,
+		m_compute.buffers.verticePositions,
+		m_compute.buffers.stagingVerticePositions
 	);
 
-	m_compute.buffers.verticeNormals.descriptor = MakeDescriptorBufferInfo(m_compute.buffers.verticeNormals.buffer, 0, bufferSize);
+	// The materials arrive with the first geometry
+	bool materialsRecreated = false;
+	if (sizeof(Material) * m_scene->materials.size() > m_compute.buffers.materials.descriptor.range)
+	{
+		vkQueueWaitIdle(m_compute.queue);
+		vkDestroyBuffer(m_vulkanDevice->device, m_compute.buffers.materials.buffer, nullptr);
+		vkFreeMemory(m_vulkanDevice->device, m_compute.buffers.materials.memory, nullptr);
+		PrepareComputeMaterialBuffer();
 
-	// Cleanup staging buffer memory
-	vkDestroyBuffer(m_vulkanDevice->device, stagingBuffer.buffer, nullptr);
-	vkFreeMemory(m_vulkanDevice->device, stagingBuffer.memory, nullptr);
+		VkWriteDescriptorSet writeDescriptorSet = MakeWriteDescriptorSet(
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			m_compute.descriptorSets,
+			5, // Binding 5
+			1,
+			&m_compute.buffers.materials.descriptor,
+			nullptr
+		);
+		vkUpdateDescriptorSets(m_vulkanDevice->device, 1, &writeDescriptorSet, 0, NULL);
+		materialsRecreated = true;
+	}
 
+	// The placeholder was built with the layout of the command line options, a scene file brings the layout it was converted with
+	bool pipelineRecreated = false;
+	if (bvh.layout != m_compute.bvhLayout)
+	{
+		vkQueueWaitIdle(m_compute.queue);
+		vkDestroyPipeline(m_vulkanDevice->device, m_compute.pipeline, nullptr);
+		PrepareComputeRayTracePipeline();
+		pipelineRecreated = true;
+	}
+
+	if (nodesRecreated || instancesRecreated || indicesRecreated || triangleRecordsRecreated || normalsRecreated || materialsRecreated || pipelineRecreated)
+	{
+		// The recorded dispatch referenced the old descriptors or pipeline
+		vkFreeCommandBuffers(m_vulkanDevice->device, m_compute.commandPool, 1, &m_compute.commandBuffer);
+		PrepareComputeCommandBuffers();
+	}
+
+	// Recreated buffers already hold everything, the vertices are uploaded by the caller either way
+	if (!nodesRecreated)
+	{
+		UploadComputeStorageBufferRanges(bvh.NodeData(), bvh.NodeSize(), update.changedNodes,
+			m_compute.buffers.stagingBvhNodes, m_compute.buffers.bvhNodes);
+	}
+	if (!instancesRecreated)
+	{
+		UploadComputeStorageBufferRanges(bvh.instances.data(), sizeof(BVHInstance), update.changedInstances,
+			m_compute.buffers.stagingBvhInstances, m_compute.buffers.bvhInstances);
+	}
+	if (!indicesRecreated)
+	{
+		UploadComputeStorageBufferRanges(m_scene->indices.data(), sizeof(glm::ivec4), update.changedTriangles,
+			m_compute.buffers.stagingIndices, m_compute.buffers.indices);
+	}
+	if (!triangleRecordsRecreated)
+	{
+		UploadComputeStorageBufferRanges(m_scene->triangleRecords.data(), sizeof(TriangleRecord), update.changedTriangles,
+			m_compute.buffers.stagingTriangleRecords, m_compute.buffers.triangleRecords);
+	}
+	m_logger->info("Ray tracing {} triangles, {} BVH nodes{}", m_scene->indices.size(), bvh.NodeCount(), m_scene->Loading() ? ", still loading" : "");
 }
 
 void VulkanRaytracer::PrepareComputeUniformBuffer() 
@@ -984,8 +1274,14 @@ void VulkanRaytracer::PrepareComputeUniformBuffer()
 
 	m_compute.buffers.uniform.descriptor = MakeDescriptorBufferInfo(m_compute.buffers.uniform.buffer, 0, bufferSize);
 
-	// ====== MATERIALS
-	bufferSize = sizeof(Material) * m_scene->materials.size();
+	PrepareComputeMaterialBuffer();
+}
+
+void
+VulkanRaytracer::PrepareComputeMaterialBuffer()
+{
+	const VkDeviceSize materialsSize = sizeof(Material) * m_scene->materials.size();
+	VkDeviceSize bufferSize = std::max(materialsSize, MIN_STORAGE_BUFFER_SIZE);
 	VkBuffer stagingBuffer;
 	VkDeviceMemory stagingMemory;
 
@@ -1002,7 +1298,7 @@ void VulkanRaytracer::PrepareComputeUniformBuffer()
 	m_vulkanDevice->MapMemory(
 		m_scene->materials.data(),
 		stagingMemory,
-		bufferSize,
+		materialsSize,
 		0
 	);
 
@@ -1010,7 +1306,7 @@ void VulkanRaytracer::PrepareComputeUniformBuffer()
 
 	m_vulkanDevice->CreateBufferAndMemory(
 		bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 		m_compute.buffers.materials.buffer,
 		m_compute.buffers.materials.memory
@@ -1029,7 +1325,6 @@ void VulkanRaytracer::PrepareComputeUniformBuffer()
 	// Cleanup staging buffer memory
 	vkDestroyBuffer(m_vulkanDevice->device, stagingBuffer, nullptr);
 	vkFreeMemory(m_vulkanDevice->device, stagingMemory, nullptr);
-
 }
 
 VkResult
@@ -1095,6 +1390,21 @@ VulkanRaytracer::PrepareComputePipeline()
 	);
 
 	// 6. Create compute shader pipeline
+	PrepareComputeRayTracePipeline();
+
+	// 7. Create fence
+	VkFenceCreateInfo fenceCreateInfo = MakeFenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
+	CheckVulkanResult(
+		vkCreateFence(m_vulkanDevice->device, &fenceCreateInfo, nullptr, &m_compute.fence),
+		"Failed to create fence"
+		);
+
+	return VK_SUCCESS;
+}
+
+void
+VulkanRaytracer::PrepareComputeRayTracePipeline()
+{
 	VkComputePipelineCreateInfo computePipelineCreateInfo = MakeComputePipelineCreateInfo(m_compute.pipelineLayout, 0);
 
 	// Create shader modules from bytecodes
@@ -1108,23 +1418,30 @@ VulkanRaytracer::PrepareComputePipeline()
 
 	computePipelineCreateInfo.stage = MakePipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, raytraceShader);
 
+	// Constant 0 picks the traversal that matches the node layout the scene was built with
+	m_compute.bvhLayout = m_scene->bvh.layout;
+	VkSpecializationMapEntry bvhLayoutEntry = {};
+	bvhLayoutEntry.constantID = 0;
+	bvhLayoutEntry.offset = 0;
+	bvhLayoutEntry.size = sizeof(int32_t);
+
+	VkSpecializationInfo specializationInfo = {};
+	specializationInfo.mapEntryCount = 1;
+	specializationInfo.pMapEntries = &bvhLayoutEntry;
+	specializationInfo.dataSize = sizeof(int32_t);
+	specializationInfo.pData = &m_compute.bvhLayout;
+	computePipelineCreateInfo.stage.pSpecializationInfo = &specializationInfo;
+	m_logger->info("Ray tracing a {} BVH", m_compute.bvhLayout == BVH_LAYOUT_WIDE ? "wide" : "binary");
+
 	CheckVulkanResult(
 		vkCreateComputePipelines(m_vulkanDevice->device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &m_compute.pipeline),
 		"Failed to create compute pipeline"
 	);
 
-
-	// 7. Create fence
-	VkFenceCreateInfo fenceCreateInfo = MakeFenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
-	CheckVulkanResult(
-		vkCreateFence(m_vulkanDevice->device, &fenceCreateInfo, nullptr, &m_compute.fence),
-		"Failed to create fence"
-		);
-
-	return VK_SUCCESS;
+	// The pipeline keeps what it needs, this may run again for every layout change
+	vkDestroyShaderModule(m_vulkanDevice->device, raytraceShader, nullptr);
 }
 
-
 VkResult 
 VulkanRaytracer::PrepareComputeCommandBuffers() {
 
@@ -1140,6 +1457,12 @@ VulkanRaytracer::PrepareComputeCommandBuffers() {
 
 	vkBeginCommandBuffer(m_compute.commandBuffer, &beginInfo);
 
+	// Rebuild the BVH of the geometry baked into world space before tracing it
+	if (m_deviceBvh.enabled)
+	{
+		RecordDeviceBVHBuild(m_compute.commandBuffer);
+	}
+
 	// Record binding to the compute pipeline
 	vkCmdBindPipeline(m_compute.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_compute.pipeline);
 
@@ -1155,3 +1478,401 @@ VulkanRaytracer::PrepareComputeCommandBuffers() {
 
 	return VK_SUCCESS;
 }
+
+// ===========================================================================================
+//
+// DEVICE BVH BUILD
+//
+// ===========================================================================================
+
+// Passes of lbvh.comp, selected by its specialization constant 0
+enum EDeviceBVHPass
+{
+	DEVICE_BVH_PASS_BOUNDS = 0,
+	DEVICE_BVH_PASS_MORTON,
+	DEVICE_BVH_PASS_HISTOGRAM,
+	DEVICE_BVH_PASS_SCAN,
+	DEVICE_BVH_PASS_SCATTER,
+	DEVICE_BVH_PASS_EMIT,
+	DEVICE_BVH_PASS_FIT,
+	DEVICE_BVH_PASS_COUNT
+};
+
+// Matches WORKGROUP_SIZE and RADIX_DIGITS in lbvh.comp
+static const int DEVICE_BVH_WORKGROUP_SIZE = 256;
+static const int DEVICE_BVH_RADIX_DIGITS = 1 << BVH::LINEAR_RADIX_BITS;
+
+// Push constant block of lbvh.comp
+struct DeviceBVHParameters
+{
+	int32_t triangleCount;
+	int32_t firstTriangle;
+	int32_t rootNode;
+	int32_t shift;
+	int32_t inputOffset;
+	int32_t blockCount;
+};
+
+/**
+ * \brief Make writes of the previous commands visible to the next ones, passes always depend on the whole output of the one before
+ */
+static void
+DeviceBVHBarrier(
+	VkCommandBuffer commandBuffer,
+	VkPipelineStageFlags srcStage,
+	VkPipelineStageFlags dstStage
+)
+{
+	VkMemoryBarrier memoryBarrier = {};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		srcStage,
+		dstStage,
+		0,
+		1, &memoryBarrier,
+		0, nullptr,
+		0, nullptr);
+}
+
+void
+VulkanRaytracer::PrepareDeviceBVHBuild()
+{
+	const TwoLevelBVH& bvh = m_scene->bvh;
+	if (!m_scene->Options().deviceBvh)
+	{
+		return;
+	}
+
+	if (bvh.layout != BVH_LAYOUT_BINARY || bvh.bottomLevels.empty() || bvh.bottomLevels[0].triangleCount < 2)
+	{
+		m_logger->warn("Building the BVH on the CPU, the device build needs the binary layout and at least two triangles baked into world space");
+		return;
+	}
+
+	m_deviceBvh.enabled = true;
+	m_deviceBvh.triangleCount = bvh.bottomLevels[0].triangleCount;
+	m_deviceBvh.blockCount = (m_deviceBvh.triangleCount + DEVICE_BVH_WORKGROUP_SIZE - 1) / DEVICE_BVH_WORKGROUP_SIZE;
+
+	// -- Scratch buffers, only ever touched by the device
+
+	auto createScratchBuffer = [this](VkDeviceSize bufferSize, VulkanBuffer::StorageBuffer& scratch)
+	{
+		m_vulkanDevice->CreateBufferAndMemory(
+			bufferSize,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			scratch.buffer,
+			scratch.memory
+		);
+		scratch.descriptor = MakeDescriptorBufferInfo(scratch.buffer, 0, bufferSize);
+	};
+
+	const VkDeviceSize triangleCount = m_deviceBvh.triangleCount;
+	createScratchBuffer(8 * sizeof(uint32_t), m_deviceBvh.centroidBounds);
+	createScratchBuffer(2 * triangleCount * sizeof(uint32_t), m_deviceBvh.keys);
+	createScratchBuffer(2 * triangleCount * sizeof(int32_t), m_deviceBvh.values);
+	createScratchBuffer(DEVICE_BVH_RADIX_DIGITS * m_deviceBvh.blockCount * sizeof(uint32_t), m_deviceBvh.histograms);
+	createScratchBuffer((6 * triangleCount - 4) * sizeof(int32_t), m_deviceBvh.hierarchy);
+
+	// -- Descriptors, indices, positions, nodes then the scratch buffers
+
+	std::vector<VkDescriptorPoolSize> poolSizes = {
+		MakeDescriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 8)
+	};
+
+	VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = MakeDescriptorPoolCreateInfo(
+		poolSizes.size(),
+		poolSizes.data(),
+		1
+	);
+
+	CheckVulkanResult(
+		vkCreateDescriptorPool(m_vulkanDevice->device, &descriptorPoolCreateInfo, nullptr, &m_deviceBvh.descriptorPool),
+		"Failed to create descriptor pool"
+	);
+
+	std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings;
+	for (uint32_t binding = 0; binding < 8; ++binding)
+	{
+		setLayoutBindings.push_back(MakeDescriptorSetLayoutBinding(
+			binding,
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			VK_SHADER_STAGE_COMPUTE_BIT
+		));
+	}
+
+	VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo =
+		MakeDescriptorSetLayoutCreateInfo(
+			setLayoutBindings.data(),
+			setLayoutBindings.size()
+		);
+
+	CheckVulkanResult(
+		vkCreateDescriptorSetLayout(m_vulkanDevice->device, &descriptorSetLayoutCreateInfo, nullptr, &m_deviceBvh.descriptorSetLayout),
+		"Failed to create descriptor set layout"
+	);
+
+	VkDescriptorSetAllocateInfo descriptorSetAllocInfo = MakeDescriptorSetAllocateInfo(m_deviceBvh.descriptorPool, &m_deviceBvh.descriptorSetLayout);
+
+	CheckVulkanResult(
+		vkAllocateDescriptorSets(m_vulkanDevice->device, &descriptorSetAllocInfo, &m_deviceBvh.descriptorSet),
+		"failed to allocate descriptor set"
+	);
+
+	UpdateDeviceBVHBuild();
+
+	// -- Pipelines, one per pass of the same shader
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(DeviceBVHParameters);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = MakePipelineLayoutCreateInfo(&m_deviceBvh.descriptorSetLayout);
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+	CheckVulkanResult(
+		vkCreatePipelineLayout(m_vulkanDevice->device, &pipelineLayoutCreateInfo, nullptr, &m_deviceBvh.pipelineLayout),
+		"Failed to create pipeline layout"
+	);
+
+	VkShaderModule lbvhShader;
+	PrepareShaderModule(
+		"shaders/raytracing/lbvh.comp.spv",
+		lbvhShader
+	);
+	m_logger->info("Loaded {} comp shader", "shaders/raytracing/lbvh.comp.spv");
+
+	m_deviceBvh.pipelines.resize(DEVICE_BVH_PASS_COUNT);
+	for (int32_t pass = 0; pass < DEVICE_BVH_PASS_COUNT; ++pass)
+	{
+		VkSpecializationMapEntry passEntry = {};
+		passEntry.constantID = 0;
+		passEntry.offset = 0;
+		passEntry.size = sizeof(int32_t);
+
+		VkSpecializationInfo specializationInfo = {};
+		specializationInfo.mapEntryCount = 1;
+		specializationInfo.pMapEntries = &passEntry;
+		specializationInfo.dataSize = sizeof(int32_t);
+		specializationInfo.pData = &pass;
+
+		VkComputePipelineCreateInfo computePipelineCreateInfo = MakeComputePipelineCreateInfo(m_deviceBvh.pipelineLayout, 0);
+		computePipelineCreateInfo.stage = MakePipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT, lbvhShader);
+		computePipelineCreateInfo.stage.pSpecializationInfo = &specializationInfo;
+
+		CheckVulkanResult(
+			vkCreateComputePipelines(m_vulkanDevice->device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &m_deviceBvh.pipelines[pass]),
+			"Failed to create compute pipeline"
+		);
+	}
+	vkDestroyShaderModule(m_vulkanDevice->device, lbvhShader, nullptr);
+
+	m_logger->info("Building the BVH of {} triangles on the device every frame", m_deviceBvh.triangleCount);
+
+	// A device that disagrees with the CPU falls back to the CPU refit
+	if (!VerifyDeviceBVHBuild())
+	{
+		m_logger->warn("Building the BVH on the CPU instead");
+		DestroyDeviceBVHBuild();
+		m_deviceBvh.enabled = false;
+		UploadComputeStorageBufferRanges(bvh.NodeData(), bvh.NodeSize(), { { 0, static_cast<int>(bvh.NodeCount()) } },
+			m_compute.buffers.stagingBvhNodes, m_compute.buffers.bvhNodes);
+	}
+}
+
+void
+VulkanRaytracer::DestroyDeviceBVHBuild()
+{
+	for (VkPipeline pipeline : m_deviceBvh.pipelines)
+	{
+		vkDestroyPipeline(m_vulkanDevice->device, pipeline, nullptr);
+	}
+	m_deviceBvh.pipelines.clear();
+	vkDestroyPipelineLayout(m_vulkanDevice->device, m_deviceBvh.pipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(m_vulkanDevice->device, m_deviceBvh.descriptorSetLayout, nullptr);
+	vkDestroyDescriptorPool(m_vulkanDevice->device, m_deviceBvh.descriptorPool, nullptr);
+
+	for (VulkanBuffer::StorageBuffer* scratch : {
+		&m_deviceBvh.centroidBounds,
+		&m_deviceBvh.keys,
+		&m_deviceBvh.values,
+		&m_deviceBvh.histograms,
+		&m_deviceBvh.hierarchy })
+	{
+		vkDestroyBuffer(m_vulkanDevice->device, scratch->buffer, nullptr);
+		vkFreeMemory(m_vulkanDevice->device, scratch->memory, nullptr);
+	}
+}
+
+void
+VulkanRaytracer::UpdateDeviceBVHBuild()
+{
+	const TwoLevelBVH::BottomLevel& bottomLevel = m_scene->bvh.bottomLevels[0];
+	m_deviceBvh.firstTriangle = bottomLevel.firstTriangle;
+	m_deviceBvh.rootNode = bottomLevel.rootNode;
+
+	std::vector<VulkanBuffer::StorageBuffer*> buffers = {
+		&m_compute.buffers.indices,
+		&m_compute.buffers.verticePositions,
+		&m_compute.buffers.bvhNodes,
+		&m_deviceBvh.centroidBounds,
+		&m_deviceBvh.keys,
+		&m_deviceBvh.values,
+		&m_deviceBvh.histograms,
+		&m_deviceBvh.hierarchy
+	};
+
+	std::vector<VkWriteDescriptorSet> writeDescriptorSets;
+	for (uint32_t binding = 0; binding < buffers.size(); ++binding)
+	{
+		writeDescriptorSets.push_back(MakeWriteDescriptorSet(
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			m_deviceBvh.descriptorSet,
+			binding,
+			1,
+			&buffers[binding]->descriptor,
+			nullptr
+		));
+	}
+
+	vkUpdateDescriptorSets(m_vulkanDevice->device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, NULL);
+}
+
+void
+VulkanRaytracer::RecordDeviceBVHBuild(
+	VkCommandBuffer commandBuffer
+)
+{
+	const int triangleCount = m_deviceBvh.triangleCount;
+	const uint32_t blockCount = static_cast<uint32_t>(m_deviceBvh.blockCount);
+
+	// The trace of the previous frame may still read the nodes this build rewrites
+	DeviceBVHBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+	// Empty centroid bounds, min as the largest and max as the smallest ordered bits, and no arrivals yet
+	vkCmdFillBuffer(commandBuffer, m_deviceBvh.centroidBounds.buffer, 0, 4 * sizeof(uint32_t), 0xFFFFFFFF);
+	vkCmdFillBuffer(commandBuffer, m_deviceBvh.centroidBounds.buffer, 4 * sizeof(uint32_t), 4 * sizeof(uint32_t), 0);
+	vkCmdFillBuffer(commandBuffer, m_deviceBvh.hierarchy.buffer, 3 * (triangleCount - 1) * sizeof(int32_t), (triangleCount - 1) * sizeof(int32_t), 0);
+	DeviceBVHBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_deviceBvh.pipelineLayout, 0, 1, &m_deviceBvh.descriptorSet, 0, nullptr);
+
+	DeviceBVHParameters parameters = {};
+	parameters.triangleCount = triangleCount;
+	parameters.firstTriangle = m_deviceBvh.firstTriangle;
+	parameters.rootNode = m_deviceBvh.rootNode;
+	parameters.blockCount = m_deviceBvh.blockCount;
+
+	auto dispatch = [&](EDeviceBVHPass pass, uint32_t groupCount)
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_deviceBvh.pipelines[pass]);
+		vkCmdPushConstants(commandBuffer, m_deviceBvh.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(parameters), &parameters);
+		vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+		DeviceBVHBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+	};
+
+	dispatch(DEVICE_BVH_PASS_BOUNDS, blockCount);
+	dispatch(DEVICE_BVH_PASS_MORTON, blockCount);
+
+	// Keys and values go back and forth between the two halves of their buffers, an even pass count ends in the first one
+	for (int shift = 0; shift < 32; shift += BVH::LINEAR_RADIX_BITS)
+	{
+		parameters.shift = shift;
+		parameters.inputOffset = (shift / BVH::LINEAR_RADIX_BITS) % 2 == 0 ? 0 : triangleCount;
+		dispatch(DEVICE_BVH_PASS_HISTOGRAM, blockCount);
+		dispatch(DEVICE_BVH_PASS_SCAN, 1);
+		dispatch(DEVICE_BVH_PASS_SCATTER, blockCount);
+	}
+
+	dispatch(DEVICE_BVH_PASS_EMIT, blockCount);
+	dispatch(DEVICE_BVH_PASS_FIT, blockCount);
+}
+
+bool
+VulkanRaytracer::VerifyDeviceBVHBuild()
+{
+	const int nodeCount = 2 * m_deviceBvh.triangleCount - 1;
+	const VkDeviceSize nodesSize = nodeCount * sizeof(BVHNode);
+
+	// Build once on its own
+	VkCommandBufferAllocateInfo commandBufferAllocInfo = MakeCommandBufferAllocateInfo(m_compute.commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+	VkCommandBuffer commandBuffer;
+	CheckVulkanResult(
+		vkAllocateCommandBuffers(m_vulkanDevice->device, &commandBufferAllocInfo, &commandBuffer),
+		"Failed to allocate compute command buffers"
+	);
+
+	VkCommandBufferBeginInfo beginInfo = MakeCommandBufferBeginInfo();
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	RecordDeviceBVHBuild(commandBuffer);
+	CheckVulkanResult(
+		vkEndCommandBuffer(commandBuffer),
+		"Failed to record command buffers"
+	);
+
+	VkSubmitInfo submitInfo = MakeSubmitInfo(commandBuffer);
+	CheckVulkanResult(
+		vkQueueSubmit(m_compute.queue, 1, &submitInfo, VK_NULL_HANDLE),
+		"Failed to submit queue"
+	);
+	vkQueueWaitIdle(m_compute.queue);
+	vkFreeCommandBuffers(m_vulkanDevice->device, m_compute.commandPool, 1, &commandBuffer);
+
+	// Read back the nodes of the bottom level
+	VulkanBuffer::StorageBuffer readback;
+	m_vulkanDevice->CreateBufferAndMemory(
+		nodesSize,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		readback.buffer,
+		readback.memory
+	);
+
+	VkBufferCopy copyRegion = {};
+	copyRegion.srcOffset = m_deviceBvh.rootNode * sizeof(BVHNode);
+	copyRegion.dstOffset = 0;
+	copyRegion.size = nodesSize;
+	m_vulkanDevice->CopyBufferRegions(
+		m_compute.queue,
+		m_compute.commandPool,
+		readback.buffer,
+		m_compute.buffers.bvhNodes.buffer,
+		{ copyRegion }
+	);
+
+	void* data;
+	vkMapMemory(m_vulkanDevice->device, readback.memory, 0, nodesSize, 0, &data);
+	const BVHNode* deviceNodes = static_cast<const BVHNode*>(data);
+	const BVHNode* hostNodes = m_scene->bvh.nodes.data() + m_deviceBvh.rootNode;
+
+	int mismatches = 0;
+	for (int n = 0; n < nodeCount; ++n)
+	{
+		const BVHNode& deviceNode = deviceNodes[n];
+		const BVHNode& hostNode = hostNodes[n];
+		if (deviceNode.aabbMin != hostNode.aabbMin ||
+			deviceNode.aabbMax != hostNode.aabbMax ||
+			deviceNode.leftFirst != hostNode.leftFirst ||
+			deviceNode.primitiveCount != hostNode.primitiveCount)
+		{
+			++mismatches;
+		}
+	}
+
+	vkUnmapMemory(m_vulkanDevice->device, readback.memory);
+	vkDestroyBuffer(m_vulkanDevice->device, readback.buffer, nullptr);
+	vkFreeMemory(m_vulkanDevice->device, readback.memory, nullptr);
+
+	if (mismatches > 0)
+	{
+		m_logger->error("Device BVH build differs from the CPU build in {} of {} nodes", mismatches, nodeCount);
+		return false;
+	}
+
+	m_logger->info("Device BVH build matches the CPU build, {} nodes", nodeCount);
+	return true;
+}
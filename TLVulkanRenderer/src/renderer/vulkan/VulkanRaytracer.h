@@ -64,18 +64,151 @@ protected:
 	void
 	PrepareComputeStorageBuffer();
 
+	/**
+	 * \brief Upload data into a device local storage buffer through a staging buffer
+	 * \param stagingBuffer if not null, receives the staging buffer instead of destroying it, for later partial updates
+	 * \param capacity bytes to allocate if more than bufferSize, the descriptor covers all of them
+	 */
+	void
+	CreateComputeStorageBuffer(
+		void* data,
+		VkDeviceSize bufferSize,
+		VulkanBuffer::StorageBuffer& storageBuffer,
+		VulkanBuffer::StorageBuffer* stagingBuffer = nullptr,
+		VkDeviceSize capacity = 0
+	);
+
+	/**
+	 * \brief Copy only the given element ranges of data to a storage buffer, through its persistent staging buffer.
+	 *        Waits for the trace in flight first, it may be reading the buffer.
+	 */
+	void
+	UploadComputeStorageBufferRanges(
+		const void* data,
+		VkDeviceSize elementSize,
+		const std::vector<IndexRange>& ranges,
+		VulkanBuffer::StorageBuffer& stagingBuffer,
+		VulkanBuffer::StorageBuffer& storageBuffer
+	);
+
+	/**
+	 * \brief Recreate a storage buffer and its staging buffer with new contents if they no longer fit, and rebind it.
+	 *        The capacity at least doubles, buffers never shrink.
+	 * \return true if the buffer was recreated, the compute command buffer then has to be recorded again
+	 */
+	bool
+	ResizeComputeStorageBuffer(
+		const void* data,
+		VkDeviceSize size,
+		uint32_t binding,
+		VulkanBuffer::StorageBuffer& storageBuffer,
+		VulkanBuffer::StorageBuffer& stagingBuffer
+	);
+
+	/**
+	 * \brief Apply a scene update (moved nodes, refit or rebuilt BVH) to the ray tracing storage buffers
+	 */
+	void
+	UpdateComputeStorageBuffers(
+		const SceneUpdate& update
+	);
+
+	/**
+	 * \brief Grow the storage buffers to geometry an asynchronous load added or replaced, and upload the changed ranges
+	 */
+	void
+	ReloadComputeStorageBuffers(
+		const SceneUpdate& update
+	);
+
 	void
 	PrepareComputeUniformBuffer();
 
+	void
+	PrepareComputeMaterialBuffer();
+
 	VkResult
 	PrepareRayTraceTextureResources();
 
 	VkResult
 	PrepareComputePipeline();
 
+	/**
+	 * \brief Create the ray tracing pipeline, specialized on the node layout of the scene's BVH.
+	 *        Runs again when an asynchronous load swaps in a scene file converted with another layout.
+	 */
+	void
+	PrepareComputeRayTracePipeline();
+
 	VkResult
 	PrepareComputeCommandBuffers();
 
+	// -----------
+	// DEVICE BVH BUILD
+	// -----------
+
+	/**
+	 * \brief Create the scratch buffers and the pipeline of every pass that rebuild bottom level 0 as a linear BVH on the device, see lbvh.comp.
+	 *        Only enabled with SceneOptions::deviceBvh, after the scene built that level with BVH::BuildLinear.
+	 */
+	void
+	PrepareDeviceBVHBuild();
+
+	/**
+	 * \brief Free the scratch buffers, descriptors and pipelines of the device build, once it is disabled or with the ray tracer
+	 */
+	void
+	DestroyDeviceBVHBuild();
+
+	/**
+	 * \brief Point the build at the current bottom level and buffers, after a BVH rebuild or once buffers were recreated
+	 */
+	void
+	UpdateDeviceBVHBuild();
+
+	/**
+	 * \brief Record every pass of the build, followed by a barrier so that a dispatch recorded next traces the new nodes
+	 */
+	void
+	RecordDeviceBVHBuild(
+		VkCommandBuffer commandBuffer
+	);
+
+	/**
+	 * \brief Run the build once and compare its nodes with the CPU build of the same algorithm.
+	 *        Triangles are still in the order the CPU build sorted them, so both must produce exactly the same nodes.
+	 * \return true if every node matches
+	 */
+	bool
+	VerifyDeviceBVHBuild();
+
+	struct DeviceBVHBuild
+	{
+		bool enabled = false;
+
+		int triangleCount = 0;
+		int firstTriangle = 0;
+		int rootNode = 0;
+
+		// Workgroups per pass over the triangles
+		int blockCount = 0;
+
+		VkDescriptorPool descriptorPool;
+		VkDescriptorSetLayout descriptorSetLayout;
+		VkDescriptorSet descriptorSet;
+		VkPipelineLayout pipelineLayout;
+
+		// One pipeline per pass of lbvh.comp
+		std::vector<VkPipeline> pipelines;
+
+		// -- Scratch buffers
+		VulkanBuffer::StorageBuffer centroidBounds;
+		VulkanBuffer::StorageBuffer keys;
+		VulkanBuffer::StorageBuffer values;
+		VulkanBuffer::StorageBuffer histograms;
+		VulkanBuffer::StorageBuffer hierarchy;
+	} m_deviceBvh;
+
 	struct Quad {
 		std::vector<uint16_t> indices;
 		std::vector<vec2> positions;
@@ -98,6 +231,9 @@ protected:
 		VkPipelineLayout pipelineLayout;
 		VkPipeline pipeline;
 
+		// Node layout the pipeline was specialized on, see BVH_LAYOUT in raytrace.comp
+		int32_t bvhLayout;
+
 		// -- Commands
 		VkCommandPool commandPool;
 		VkCommandBuffer commandBuffer;
@@ -112,6 +248,19 @@ protected:
 			VulkanBuffer::StorageBuffer indices;
 			VulkanBuffer::StorageBuffer verticePositions;
 			VulkanBuffer::StorageBuffer verticeNormals;
+			VulkanBuffer::StorageBuffer triangleRecords;
+
+			// -- Acceleration structure
+			VulkanBuffer::StorageBuffer bvhNodes;
+			VulkanBuffer::StorageBuffer bvhInstances;
+
+			// -- Staging buffers kept around for partial updates of moving nodes
+			VulkanBuffer::StorageBuffer stagingIndices;
+			VulkanBuffer::StorageBuffer stagingVerticePositions;
+			VulkanBuffer::StorageBuffer stagingVerticeNormals;
+			VulkanBuffer::StorageBuffer stagingTriangleRecords;
+			VulkanBuffer::StorageBuffer stagingBvhNodes;
+			VulkanBuffer::StorageBuffer stagingBvhInstances;
 
 		} buffers;
 
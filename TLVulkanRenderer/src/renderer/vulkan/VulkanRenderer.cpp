@@ -8,9 +8,19 @@
 #include <chrono>
 
 #include "VulkanRenderer.h"
+#include "LoadProfiler.h"
 #include "Utilities.h"
 #include "VulkanImage.h"
 #include "VulkanBuffer.h"
+#include "SceneFile.h"
+#include "mesh/Meshlet.h"
+#include "mesh/MeshSimplify.h"
+#include "mesh/VertexQuantization.h"
+
+/**
+ * \brief Largest error a level of detail may project to on screen, in pixels
+ */
+static const float LOD_PIXEL_ERROR = 1.0f;
 
 VulkanRenderer::VulkanRenderer(
 	GLFWwindow* window,
@@ -19,6 +29,8 @@ VulkanRenderer::VulkanRenderer(
 	:
 	Renderer(window, scene)
 {
+	ProfileScope profileScope("Vulkan renderer");
+
     // -- Initialize logger
 
     // Combine console and file logger
@@ -31,7 +43,9 @@ VulkanRenderer::VulkanRenderer(
 
 	// -- Initialize Vulkan
 
+	ProfileScope deviceScope("Create device");
 	m_vulkanDevice = new VulkanDevice(m_window, "Vulkan renderer", m_logger);
+	deviceScope.End();
 
 	// Grabs the first queue in the graphics queue family since we only need one graphics queue anyway
 	vkGetDeviceQueue(m_vulkanDevice->device, m_vulkanDevice->queueFamilyIndices.graphicsFamily, 0, &m_graphics.queue);
@@ -40,6 +54,7 @@ VulkanRenderer::VulkanRenderer(
 	vkGetDeviceQueue(m_vulkanDevice->device, m_vulkanDevice->queueFamilyIndices.presentFamily, 0, &m_presentQueue);
 
 	VkResult result;
+	ProfileScope setupScope("Render pass and framebuffers");
 	result = PrepareGraphicsCommandPool();
 	assert(result == VK_SUCCESS);
 	m_logger->info<std::string>("Created command pool");
@@ -59,6 +74,7 @@ VulkanRenderer::VulkanRenderer(
 	result = PrepareSemaphores();
 	assert(result == VK_SUCCESS);
 	m_logger->info<std::string>("Created semaphores");
+	setupScope.End();
 
 	// -- Prepare compute work
 	PrepareCompute();
@@ -79,9 +95,12 @@ VulkanRenderer::~VulkanRenderer()
 	
 	vkDestroyDescriptorPool(m_vulkanDevice->device, m_graphics.descriptorPool, nullptr);
 
-	for (VulkanBuffer::GeometryBuffer& geomBuffer : m_graphics.geometryBuffers) {
-		vkFreeMemory(m_vulkanDevice->device, geomBuffer.vertexBufferMemory, nullptr);
-		vkDestroyBuffer(m_vulkanDevice->device, geomBuffer.vertexBuffer, nullptr);
+	vkFreeMemory(m_vulkanDevice->device, m_graphics.geometryBuffer.vertexBufferMemory, nullptr);
+	vkDestroyBuffer(m_vulkanDevice->device, m_graphics.geometryBuffer.vertexBuffer, nullptr);
+	if (m_draws.stagingBuffer != VK_NULL_HANDLE)
+	{
+		vkFreeMemory(m_vulkanDevice->device, m_draws.stagingBufferMemory, nullptr);
+		vkDestroyBuffer(m_vulkanDevice->device, m_draws.stagingBuffer, nullptr);
 	}
 
 	vkFreeMemory(m_vulkanDevice->device, m_graphics.m_uniformStagingBufferMemory, nullptr);
@@ -234,35 +253,51 @@ VulkanRenderer::PrepareGraphicsPipeline() {
 	// \see https://www.khronos.org/registry/vulkan/specs/1.0/xhtml/vkspec.html#VkPipelineVertexInputStateCreateInfo
 	// 1. Vertex input stage
 	// Input binding description
-	VertexAttributeInfo positionAttrib = m_scene->meshesData[0]->vertexAttributes.at(POSITION);
-	VertexAttributeInfo normalAttrib = m_scene->meshesData[0]->vertexAttributes.at(NORMAL);
 	std::vector<VkVertexInputBindingDescription> bindingDesc = {
 		MakeVertexInputBindingDescription(
 			0, // binding
-			positionAttrib.byteStride,
+			sizeof(QuantizedPosition),
 			VK_VERTEX_INPUT_RATE_VERTEX
 			),
 		MakeVertexInputBindingDescription(
 			1, // binding
-			normalAttrib.byteStride,
+			sizeof(uint32_t),
 			VK_VERTEX_INPUT_RATE_VERTEX
+		),
+		MakeVertexInputBindingDescription(
+			2, // binding
+			sizeof(PositionBounds),
+			VK_VERTEX_INPUT_RATE_INSTANCE
 		)
 	};
 
 	
 	// Attribute description (position, normal, texcoord etc.)
+	// Positions are 16-bit relative to the bounds of their mesh and normals octahedral, see mesh/VertexQuantization.h
 	std::vector<VkVertexInputAttributeDescription> attribDesc = {
 		MakeVertexInputAttributeDescription(
 			0, // binding
 			0, // location
-			VK_FORMAT_R32G32B32_SFLOAT,
+			VK_FORMAT_R16G16B16A16_UNORM,
 			0  // offset
 			),
 		MakeVertexInputAttributeDescription(
 			1, // binding
 			1, // location
-			VK_FORMAT_R32G32B32_SFLOAT,
+			VK_FORMAT_R16G16_SNORM,
 			0  // offset
+		),
+		MakeVertexInputAttributeDescription(
+			2, // binding
+			2, // location
+			VK_FORMAT_R32G32B32_SFLOAT,
+			offsetof(PositionBounds, boundsMin)
+		),
+		MakeVertexInputAttributeDescription(
+			2, // binding
+			3, // location
+			VK_FORMAT_R32G32B32_SFLOAT,
+			offsetof(PositionBounds, boundsExtent)
 		)
 	};
 
@@ -409,95 +444,374 @@ VulkanRenderer::PrepareGraphicsCommandPool()
 VkResult 
 VulkanRenderer::PrepareGraphicsVertexBuffer()
 {
-	m_graphics.geometryBuffers.clear();
+	const GeometryArena& arena = m_scene->geometryArena;
+	const MeshTable& meshes = m_scene->meshes;
+
+	// One indirect draw per meshlet, or per primitive if it has none. Indices are local to the primitive and rebased by its base vertex.
+	// Its first instance selects the bounds its positions were quantized to. Draws start out at the full meshes.
+	std::vector<VkDrawIndexedIndirectCommand>& drawCommands = m_graphics.drawCommands;
+	std::vector<uint32_t>& firstDraws = m_draws.firstDraws;
+	drawCommands.clear();
+	firstDraws.resize(meshes.Size());
+	for (size_t m = 0; m < meshes.Size(); ++m)
+	{
+		firstDraws[m] = static_cast<uint32_t>(drawCommands.size());
+
+		VkDrawIndexedIndirectCommand drawCommand;
+		drawCommand.indexCount = meshes.indexCount[m];
+		drawCommand.instanceCount = 1;
+		drawCommand.firstIndex = meshes.firstIndex[m];
+		drawCommand.vertexOffset = meshes.baseVertex[m];
+		drawCommand.firstInstance = static_cast<uint32_t>(m);
+		if (meshes.meshletCount[m] == 0)
+		{
+			drawCommands.push_back(drawCommand);
+			continue;
+		}
 
-	for (MeshData* geomData : m_scene->meshesData)
+		// Meshlets take the triangles of their mesh in order
+		for (uint32_t k = 0; k < meshes.meshletCount[m]; ++k)
+		{
+			drawCommand.indexCount = 3 * arena.meshlets[meshes.firstMeshlet[m] + k].triangleCount;
+			drawCommands.push_back(drawCommand);
+			drawCommand.firstIndex += drawCommand.indexCount;
+		}
+	}
+
+	// ----------- Vertex attributes --------------
+
+	// Scene files already store the quantized vertices, they are copied from the mapping into staging memory as is
+	QuantizedArena quantized;
+	std::pair<const void*, VkDeviceSize> positions;
+	std::pair<const void*, VkDeviceSize> normals;
+	std::pair<const void*, VkDeviceSize> positionBounds;
+	const SceneFile* sceneFile = m_scene->File();
+	if (sceneFile != nullptr)
+	{
+		positions = std::make_pair(sceneFile->SectionData(SCENE_SECTION_RASTER_POSITIONS), sceneFile->SectionSize(SCENE_SECTION_RASTER_POSITIONS));
+		normals = std::make_pair(sceneFile->SectionData(SCENE_SECTION_RASTER_NORMALS), sceneFile->SectionSize(SCENE_SECTION_RASTER_NORMALS));
+		positionBounds = std::make_pair(sceneFile->SectionData(SCENE_SECTION_RASTER_BOUNDS), sceneFile->SectionSize(SCENE_SECTION_RASTER_BOUNDS));
+	}
+	else
+	{
+		ProfileScope quantizeScope("Quantize vertices");
+		QuantizeArena(arena, meshes, quantized);
+		positions = std::make_pair(quantized.positions.data(), quantized.positions.size() * sizeof(QuantizedPosition));
+		normals = std::make_pair(quantized.normals.data(), quantized.normals.size() * sizeof(uint32_t));
+		positionBounds = std::make_pair(quantized.bounds.data(), quantized.bounds.size() * sizeof(PositionBounds));
+	}
+
+	std::vector<VkDeviceSize> offsets = CreateGeometryBuffer({
+		{ arena.indices.data(), arena.indices.size() },
+		positions,
+		normals,
+		{ drawCommands.data(), drawCommands.size() * sizeof(VkDrawIndexedIndirectCommand) },
+		positionBounds
+	});
+	m_logger->info("Quantized {} vertices to {} bytes each instead of {}",
+		arena.positions.size(),
+		sizeof(QuantizedPosition) + sizeof(uint32_t),
+		2 * sizeof(glm::vec3));
+
+	VulkanBuffer::GeometryBuffer& geomBuffer = m_graphics.geometryBuffer;
+	geomBuffer.bufferLayout.vertexBufferOffsets[INDEX] = offsets[0];
+	geomBuffer.bufferLayout.vertexBufferOffsets[POSITION] = offsets[1];
+	geomBuffer.bufferLayout.vertexBufferOffsets[NORMAL] = offsets[2];
+	geomBuffer.indexType = arena.indexSize == sizeof(uint32_t) ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16;
+	geomBuffer.drawCommandOffset = offsets[3];
+	geomBuffer.drawCount = static_cast<uint32_t>(drawCommands.size());
+	geomBuffer.positionBoundsOffset = offsets[4];
+
+	// ----------- Levels of detail and meshlet culling --------------
+
+	m_draws.boundingSpheres.clear();
+	m_draws.frameCount = 0;
+	m_draws.statsStart = std::chrono::high_resolution_clock::now();
+	if (!arena.lods.empty())
 	{
-		VulkanBuffer::GeometryBuffer geomBuffer;
-
-		// ----------- Vertex attributes --------------
-
-		std::vector<Byte>& indexData = geomData->vertexData.at(INDEX);
-		VkDeviceSize indexBufferSize = sizeof(indexData[0]) * indexData.size();
-		VkDeviceSize indexBufferOffset = 0;
-		std::vector<Byte>& positionData = geomData->vertexData.at(POSITION);
-		VkDeviceSize positionBufferSize = sizeof(positionData[0]) * positionData.size();
-		VkDeviceSize positionBufferOffset = indexBufferSize;
-		std::vector<Byte>& normalData = geomData->vertexData.at(NORMAL);
-		VkDeviceSize normalBufferSize = sizeof(normalData[0]) * normalData.size();
-		VkDeviceSize normalBufferOffset = positionBufferOffset + positionBufferSize;
-
-		VkDeviceSize bufferSize = indexBufferSize + positionBufferSize + normalBufferSize;
-		geomBuffer.bufferLayout.vertexBufferOffsets.insert(std::make_pair(INDEX, indexBufferOffset));
-		geomBuffer.bufferLayout.vertexBufferOffsets.insert(std::make_pair(POSITION, positionBufferOffset));
-		geomBuffer.bufferLayout.vertexBufferOffsets.insert(std::make_pair(NORMAL, normalBufferOffset));
-
-		// Stage buffer memory on host
-		// We want staging so that we can map the vertex data on the host but
-		// then transfer it to the device local memory for faster performance
-		// This is the recommended way to allocate buffer memory,
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
+		const PositionBounds* bounds = static_cast<const PositionBounds*>(positionBounds.first);
+		for (size_t m = 0; m < meshes.Size(); ++m)
+		{
+			m_draws.boundingSpheres.push_back(glm::vec4(bounds[m].boundsMin + 0.5f * bounds[m].boundsExtent, 0.5f * glm::length(bounds[m].boundsExtent)));
+		}
+	}
 
+	// Without multi-draw the draws are recorded into the command buffers instead
+	if ((!arena.lods.empty() || !arena.meshlets.empty()) &&
+		m_vulkanDevice->enabledFeatures.multiDrawIndirect && m_vulkanDevice->enabledFeatures.drawIndirectFirstInstance && !drawCommands.empty())
+	{
 		m_vulkanDevice->CreateBuffer(
-			bufferSize,
+			drawCommands.size() * sizeof(VkDrawIndexedIndirectCommand),
 			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-			stagingBuffer
+			m_draws.stagingBuffer
 		);
-
-		// Allocate memory for the buffer
 		m_vulkanDevice->CreateMemory(
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			stagingBuffer,
-			stagingBufferMemory
+			m_draws.stagingBuffer,
+			m_draws.stagingBufferMemory
 		);
+		vkBindBufferMemory(m_vulkanDevice->device, m_draws.stagingBuffer, m_draws.stagingBufferMemory, 0);
+	}
 
-		// Bind buffer with memory
-		VkDeviceSize memoryOffset = 0;
-		vkBindBufferMemory(m_vulkanDevice->device, stagingBuffer, stagingBufferMemory, memoryOffset);
+	return VK_SUCCESS;
+}
 
-		// Filling the stage buffer with data
-		void* data;
-		vkMapMemory(m_vulkanDevice->device, stagingBufferMemory, 0, bufferSize, 0, &data);
-		memcpy(data, indexData.data(), static_cast<size_t>(indexBufferSize));
-		memcpy((Byte*)data + positionBufferOffset, positionData.data(), static_cast<size_t>(positionBufferSize));
-		memcpy((Byte*)data + normalBufferOffset, normalData.data(), static_cast<size_t>(normalBufferSize));
-		vkUnmapMemory(m_vulkanDevice->device, stagingBufferMemory);
+std::vector<VkDeviceSize>
+VulkanRenderer::CreateGeometryBuffer(
+	const std::vector<std::pair<const void*, VkDeviceSize>>& sections
+)
+{
+	// Sections start 16-byte aligned, enough for any vertex format and for indirect commands
+	std::vector<VkDeviceSize> offsets;
+	VkDeviceSize bufferSize = 0;
+	for (const auto& section : sections)
+	{
+		offsets.push_back(bufferSize);
+		bufferSize = (bufferSize + section.second + 15) & ~VkDeviceSize(15);
+	}
 
-		// -----------------------------------------
+	// A scene still loading can start out without any geometry, buffers cannot be empty
+	bufferSize = std::max(bufferSize, VkDeviceSize(16));
+	ProfileScope profileScope("Stage and upload geometry");
 
-		m_vulkanDevice->CreateBuffer(
-			bufferSize,
-			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-			geomBuffer.vertexBuffer
-		);
+	// Stage buffer memory on host
+	// We want staging so that we can map the vertex data on the host but
+	// then transfer it to the device local memory for faster performance
+	// This is the recommended way to allocate buffer memory,
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
 
-		// Allocate memory for the buffer
-		m_vulkanDevice->CreateMemory(
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			geomBuffer.vertexBuffer,
-			geomBuffer.vertexBufferMemory
+	m_vulkanDevice->CreateBuffer(
+		bufferSize,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		stagingBuffer
+	);
+
+	// Allocate memory for the buffer
+	m_vulkanDevice->CreateMemory(
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		stagingBuffer,
+		stagingBufferMemory
+	);
+
+	// Bind buffer with memory
+	VkDeviceSize memoryOffset = 0;
+	vkBindBufferMemory(m_vulkanDevice->device, stagingBuffer, stagingBufferMemory, memoryOffset);
+
+	// Filling the stage buffer with data
+	void* data;
+	vkMapMemory(m_vulkanDevice->device, stagingBufferMemory, 0, bufferSize, 0, &data);
+	for (size_t s = 0; s < sections.size(); ++s)
+	{
+		memcpy((Byte*)data + offsets[s], sections[s].first, static_cast<size_t>(sections[s].second));
+	}
+	vkUnmapMemory(m_vulkanDevice->device, stagingBufferMemory);
+
+	// -----------------------------------------
+
+	VulkanBuffer::GeometryBuffer& geomBuffer = m_graphics.geometryBuffer;
+	m_vulkanDevice->CreateBuffer(
+		bufferSize,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+		geomBuffer.vertexBuffer
+	);
+
+	// Allocate memory for the buffer
+	m_vulkanDevice->CreateMemory(
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		geomBuffer.vertexBuffer,
+		geomBuffer.vertexBufferMemory
+	);
+
+	// Bind buffer with memory
+	vkBindBufferMemory(m_vulkanDevice->device, geomBuffer.vertexBuffer, geomBuffer.vertexBufferMemory, memoryOffset);
+
+	// Copy over to vertex buffer in device local memory
+	m_vulkanDevice->CopyBuffer(
+		m_graphics.queue,
+		m_graphics.commandPool,
+		geomBuffer.vertexBuffer, 
+		stagingBuffer, 
+		bufferSize
 		);
 
-		// Bind buffer with memory
-		vkBindBufferMemory(m_vulkanDevice->device, geomBuffer.vertexBuffer, geomBuffer.vertexBufferMemory, memoryOffset);
+	// Cleanup staging buffer memory
+	vkDestroyBuffer(m_vulkanDevice->device, stagingBuffer, nullptr);
+	vkFreeMemory(m_vulkanDevice->device, stagingBufferMemory, nullptr);
 
-		// Copy over to vertex buffer in device local memory
-		m_vulkanDevice->CopyBuffer(
-			m_graphics.queue,
-			m_graphics.commandPool,
-			geomBuffer.vertexBuffer, 
-			stagingBuffer, 
-			bufferSize
-			);
+	return offsets;
+}
 
-		// Cleanup staging buffer memory
-		vkDestroyBuffer(m_vulkanDevice->device, stagingBuffer, nullptr);
-		vkFreeMemory(m_vulkanDevice->device, stagingBufferMemory, nullptr);
+void
+VulkanRenderer::ReloadGraphicsGeometry()
+{
+	// The frame in flight still reads the old geometry buffer
+	vkQueueWaitIdle(m_graphics.queue);
 
-		m_graphics.geometryBuffers.push_back(geomBuffer);
+	vkFreeCommandBuffers(m_vulkanDevice->device, m_graphics.commandPool, m_graphics.commandBuffers.size(), m_graphics.commandBuffers.data());
+	vkFreeMemory(m_vulkanDevice->device, m_graphics.geometryBuffer.vertexBufferMemory, nullptr);
+	vkDestroyBuffer(m_vulkanDevice->device, m_graphics.geometryBuffer.vertexBuffer, nullptr);
+	if (m_draws.stagingBuffer != VK_NULL_HANDLE)
+	{
+		vkFreeMemory(m_vulkanDevice->device, m_draws.stagingBufferMemory, nullptr);
+		vkDestroyBuffer(m_vulkanDevice->device, m_draws.stagingBuffer, nullptr);
+		m_draws.stagingBuffer = VK_NULL_HANDLE;
+		m_draws.stagingBufferMemory = VK_NULL_HANDLE;
+	}
+
+	PrepareGraphicsVertexBuffer();
+	PrepareGraphicsCommandBuffers();
+	m_logger->info("Drawing {} meshes{}", m_scene->meshes.Size(), m_scene->Loading() ? ", still loading" : "");
+}
+
+/**
+ * \brief Point a draw at a range of indices, returns whether it changed
+ */
+static bool
+SetDraw(
+	VkDrawIndexedIndirectCommand& drawCommand,
+	uint32_t firstIndex,
+	uint32_t indexCount,
+	uint32_t instanceCount
+	)
+{
+	if (drawCommand.firstIndex == firstIndex && drawCommand.indexCount == indexCount && drawCommand.instanceCount == instanceCount)
+	{
+		return false;
+	}
+
+	drawCommand.firstIndex = firstIndex;
+	drawCommand.indexCount = indexCount;
+	drawCommand.instanceCount = instanceCount;
+	return true;
+}
+
+void
+VulkanRenderer::UpdateDraws(
+	const GraphicsUniformBufferObject& ubo
+)
+{
+	const GeometryArena& arena = m_scene->geometryArena;
+	const MeshTable& meshes = m_scene->meshes;
+	const bool selectLods = !arena.lods.empty() && m_draws.boundingSpheres.size() == meshes.Size();
+
+	// Culling changes with nearly every camera move, without indirect draws that would re-record the command buffers every frame
+	const bool cullMeshlets = !arena.meshlets.empty() && m_draws.stagingBuffer != VK_NULL_HANDLE;
+	if ((!selectLods && !cullMeshlets) || m_draws.firstDraws.size() != meshes.Size())
+	{
+		return;
+	}
+
+	// Pixels one unit covers at a distance of one unit, the error of a level shrinks on screen with the distance to its mesh.
+	// The projection scales y by the cotangent of half the field of view, flipped for Vulkan.
+	const float pixelsPerUnit = 0.5f * m_vulkanDevice->m_swapchain.extent.height * std::abs(ubo.proj[1][1]);
+	const glm::mat4 modelView = ubo.view * ubo.model;
+
+	// Meshlet bounds are in the space of the arena positions, the one the model matrix transforms from
+	glm::vec4 frustumPlanes[6];
+	ExtractFrustumPlanes(ubo.proj * modelView, frustumPlanes);
+	const glm::vec3 cameraPosition = glm::vec3(glm::inverse(modelView) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+
+	bool changed = false;
+	size_t drawnTriangles = 0;
+	size_t fullTriangles = 0;
+	size_t culledMeshlets = 0;
+	for (size_t m = 0; m < meshes.Size(); ++m)
+	{
+		VkDrawIndexedIndirectCommand* drawCommands = m_graphics.drawCommands.data() + m_draws.firstDraws[m];
+		const uint32_t meshletCount = meshes.meshletCount[m];
+		fullTriangles += meshes.indexCount[m] / 3;
+
+		uint32_t level = 0;
+		if (selectLods && meshes.lodCount[m] > 0)
+		{
+			// Closest point of the bounding sphere, meshes around the camera keep their full detail
+			const glm::vec4& sphere = m_draws.boundingSpheres[m];
+			const float distance = glm::length(glm::vec3(modelView * glm::vec4(glm::vec3(sphere), 1.0f))) - sphere.w;
+			const float maxError = distance > 0.0f ? LOD_PIXEL_ERROR * distance / pixelsPerUnit : 0.0f;
+			level = SelectLod(arena.lods.data() + meshes.firstLod[m], meshes.lodCount[m], maxError);
+		}
+
+		if (level > 0 || meshletCount == 0)
+		{
+			// Meshlets only cover the full mesh, a coarser level is drawn whole by the first draw and the others stay empty
+			const MeshLod lod = level > 0 ? arena.lods[meshes.firstLod[m] + level] : MeshLod{ meshes.firstIndex[m], meshes.indexCount[m], 0.0f };
+			changed |= SetDraw(drawCommands[0], lod.firstIndex, lod.indexCount, 1);
+			for (uint32_t k = 1; k < meshletCount; ++k)
+			{
+				changed |= SetDraw(drawCommands[k], drawCommands[k].firstIndex, drawCommands[k].indexCount, 0);
+			}
+			drawnTriangles += lod.indexCount / 3;
+			continue;
+		}
+
+		// Full detail, every meshlet is drawn unless it is outside the frustum or faces away from the camera
+		uint32_t firstIndex = meshes.firstIndex[m];
+		for (uint32_t k = 0; k < meshletCount; ++k)
+		{
+			const Meshlet& meshlet = arena.meshlets[meshes.firstMeshlet[m] + k];
+			const bool culled = cullMeshlets && IsMeshletCulled(meshlet, frustumPlanes, cameraPosition);
+			changed |= SetDraw(drawCommands[k], firstIndex, 3 * meshlet.triangleCount, culled ? 0 : 1);
+			firstIndex += 3 * meshlet.triangleCount;
+
+			if (culled)
+			{
+				++culledMeshlets;
+			}
+			else
+			{
+				drawnTriangles += meshlet.triangleCount;
+			}
+		}
+	}
+
+	if (changed)
+	{
+		const VkDeviceSize drawCommandSize = m_graphics.drawCommands.size() * sizeof(VkDrawIndexedIndirectCommand);
+		if (m_draws.stagingBuffer != VK_NULL_HANDLE)
+		{
+			void* data;
+			vkMapMemory(m_vulkanDevice->device, m_draws.stagingBufferMemory, 0, drawCommandSize, 0, &data);
+			memcpy(data, m_graphics.drawCommands.data(), static_cast<size_t>(drawCommandSize));
+			vkUnmapMemory(m_vulkanDevice->device, m_draws.stagingBufferMemory);
+
+			VkBufferCopy region = {};
+			region.srcOffset = 0;
+			region.dstOffset = m_graphics.geometryBuffer.drawCommandOffset;
+			region.size = drawCommandSize;
+
+			// The last frame's indirect draws may still be reading the commands
+			m_vulkanDevice->CopyBufferRegions(
+				m_graphics.queue,
+				m_graphics.commandPool,
+				m_graphics.geometryBuffer.vertexBuffer,
+				m_draws.stagingBuffer,
+				{ region },
+				VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT);
+		}
+		else
+		{
+			// The draws are part of the recorded command buffers
+			vkQueueWaitIdle(m_graphics.queue);
+			vkFreeCommandBuffers(m_vulkanDevice->device, m_graphics.commandPool, m_graphics.commandBuffers.size(), m_graphics.commandBuffers.data());
+			PrepareGraphicsCommandBuffers();
+		}
+	}
+
+	++m_draws.frameCount;
+	auto now = std::chrono::high_resolution_clock::now();
+	double elapsed = std::chrono::duration<double, std::milli>(now - m_draws.statsStart).count();
+	if (elapsed >= 1000.0)
+	{
+		m_logger->info("Drawing {} of {} triangles ({}%), {} meshlets culled, {} ms per frame",
+			drawnTriangles,
+			fullTriangles,
+			fullTriangles == 0 ? 100 : 100 * drawnTriangles / fullTriangles,
+			culledMeshlets,
+			elapsed / m_draws.frameCount);
+		m_draws.frameCount = 0;
+		m_draws.statsStart = now;
 	}
-	return VK_SUCCESS;
 }
 
 
@@ -586,6 +900,8 @@ VulkanRenderer::PrepareGraphicsDescriptorSets()
 VkResult 
 VulkanRenderer::PrepareGraphicsCommandBuffers()
 {
+	auto start = std::chrono::high_resolution_clock::now();
+
 	m_graphics.commandBuffers.resize(m_vulkanDevice->m_swapchain.framebuffers.size());
 	// Primary means that can be submitted to a queue, but cannot be called from other command buffers
 	VkCommandBufferAllocateInfo allocInfo = MakeCommandBufferAllocateInfo(m_graphics.commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, m_vulkanDevice->m_swapchain.framebuffers.size());
@@ -620,23 +936,50 @@ VulkanRenderer::PrepareGraphicsCommandBuffers()
 		// Record binding the graphics pipeline
 		vkCmdBindPipeline(m_graphics.commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphics.m_graphicsPipeline);
 
-		for (int b = 0; b <m_graphics.geometryBuffers.size(); ++b)
-		{
-			VulkanBuffer::GeometryBuffer& geomBuffer = m_graphics.geometryBuffers[b];
+		// The whole geometry arena is bound once
+		VulkanBuffer::GeometryBuffer& geomBuffer = m_graphics.geometryBuffer;
 
-			// Bind vertex buffer
-			VkBuffer vertexBuffers[] = { geomBuffer.vertexBuffer, geomBuffer.vertexBuffer };
-			VkDeviceSize offsets[] = { geomBuffer.bufferLayout.vertexBufferOffsets.at(POSITION), geomBuffer.bufferLayout.vertexBufferOffsets.at(NORMAL) };
-			vkCmdBindVertexBuffers(m_graphics.commandBuffers[i], 0, 2, vertexBuffers, offsets);
+		// Bind vertex buffer
+		VkBuffer vertexBuffers[] = { geomBuffer.vertexBuffer, geomBuffer.vertexBuffer, geomBuffer.vertexBuffer };
+		VkDeviceSize offsets[] = { geomBuffer.bufferLayout.vertexBufferOffsets[POSITION], geomBuffer.bufferLayout.vertexBufferOffsets[NORMAL], geomBuffer.positionBoundsOffset };
+		vkCmdBindVertexBuffers(m_graphics.commandBuffers[i], 0, 3, vertexBuffers, offsets);
 
-			// Bind index buffer
-			vkCmdBindIndexBuffer(m_graphics.commandBuffers[i], geomBuffer.vertexBuffer, geomBuffer.bufferLayout.vertexBufferOffsets.at(INDEX), VK_INDEX_TYPE_UINT16);
+		// Bind index buffer
+		vkCmdBindIndexBuffer(m_graphics.commandBuffers[i], geomBuffer.vertexBuffer, geomBuffer.bufferLayout.vertexBufferOffsets[INDEX], geomBuffer.indexType);
 
-			// Bind uniform buffer
-			vkCmdBindDescriptorSets(m_graphics.commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphics.pipelineLayout, 0, 1, &m_graphics.descriptorSets, 0, nullptr);
+		// Bind uniform buffer
+		vkCmdBindDescriptorSets(m_graphics.commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphics.pipelineLayout, 0, 1, &m_graphics.descriptorSets, 0, nullptr);
 
-			// Record draw command for the triangle!
-			vkCmdDrawIndexed(m_graphics.commandBuffers[i], m_scene->meshesData[b]->vertexAttributes.at(INDEX).count, 1, 0, 0, 0);
+		// Record one draw for the whole scene where the device allows it, one per primitive otherwise
+		// Indirect draws can only start past instance 0 with drawIndirectFirstInstance
+		if (m_vulkanDevice->enabledFeatures.multiDrawIndirect && m_vulkanDevice->enabledFeatures.drawIndirectFirstInstance)
+		{
+			vkCmdDrawIndexedIndirect(m_graphics.commandBuffers[i], geomBuffer.vertexBuffer, geomBuffer.drawCommandOffset, geomBuffer.drawCount, sizeof(VkDrawIndexedIndirectCommand));
+		}
+		else
+		{
+			// Consecutive meshlets of a primitive are merged back into one draw, empty draws are skipped
+			const std::vector<VkDrawIndexedIndirectCommand>& drawCommands = m_graphics.drawCommands;
+			for (size_t d = 0; d < drawCommands.size(); )
+			{
+				const VkDrawIndexedIndirectCommand& drawCommand = drawCommands[d];
+				uint32_t indexCount = drawCommand.indexCount;
+				for (++d; d < drawCommands.size(); ++d)
+				{
+					const VkDrawIndexedIndirectCommand& next = drawCommands[d];
+					if (next.instanceCount != drawCommand.instanceCount || next.firstInstance != drawCommand.firstInstance ||
+						next.firstIndex != drawCommand.firstIndex + indexCount)
+					{
+						break;
+					}
+					indexCount += next.indexCount;
+				}
+
+				if (drawCommand.instanceCount > 0)
+				{
+					vkCmdDrawIndexed(m_graphics.commandBuffers[i], indexCount, drawCommand.instanceCount, drawCommand.firstIndex, drawCommand.vertexOffset, drawCommand.firstInstance);
+				}
+			}
 		}
 
 		// Record end renderpass
@@ -649,6 +992,12 @@ VulkanRenderer::PrepareGraphicsCommandBuffers()
 		);
 	}
 
+	auto end = std::chrono::high_resolution_clock::now();
+	m_logger->info("Recorded {} command buffers for {} meshes in {} ms",
+		m_graphics.commandBuffers.size(),
+		m_scene->meshes.Size(),
+		std::chrono::duration<double, std::milli>(end - start).count());
+
 	return VK_SUCCESS;
 }
 
@@ -702,12 +1051,16 @@ VulkanRenderer::PrepareShaderModule(
 void 
 VulkanRenderer::PrepareGraphics() 
 {
+	ProfileScope profileScope("Prepare graphics");
 	VkResult result;
 
+	ProfileScope vertexBufferScope("Vertex buffer");
 	result = PrepareGraphicsVertexBuffer();
 	assert(result == VK_SUCCESS);
 	m_logger->info<std::string>("Created vertex buffer");
+	vertexBufferScope.End();
 
+	ProfileScope descriptorScope("Uniform buffer and descriptors");
 	result = PrepareGraphicsUniformBuffer();
 	assert(result == VK_SUCCESS);
 	m_logger->info<std::string>("Created graphics uniform buffer");
@@ -723,20 +1076,31 @@ VulkanRenderer::PrepareGraphics()
 	result = PrepareGraphicsDescriptorSets();
 	assert(result == VK_SUCCESS);
 	m_logger->info<std::string>("Created descriptor set");
+	descriptorScope.End();
 
+	ProfileScope pipelineScope("Graphics pipeline");
 	result = PrepareGraphicsPipeline();
 	assert(result == VK_SUCCESS);
 	m_logger->info<std::string>("Created graphics pipeline");
+	pipelineScope.End();
 
+	ProfileScope commandBufferScope("Command buffers");
 	result = PrepareGraphicsCommandBuffers();
 	assert(result == VK_SUCCESS);
 	m_logger->info<std::string>("Created command buffers");
+	commandBufferScope.End();
 
 }
 
 void
 VulkanRenderer::Update()
 {
+	// Meshes an asynchronous load finished since the last frame
+	if (m_scene->UpdateLoad().reloaded)
+	{
+		ReloadGraphicsGeometry();
+	}
+
 	static auto startTime = std::chrono::high_resolution_clock::now();
 
 	auto currentTime = std::chrono::high_resolution_clock::now();
@@ -751,6 +1115,8 @@ VulkanRenderer::Update()
 	// The Vulkan's Y coordinate is flipped from OpenGL (glm design), so we need to invert that
 	ubo.proj[1][1] *= -1;
 
+	UpdateDraws(ubo);
+
 	void* data;
 	vkMapMemory(m_vulkanDevice->device, m_graphics.m_uniformStagingBufferMemory, 0, sizeof(GraphicsUniformBufferObject), 0, &data);
 	memcpy(data, &ubo, sizeof(GraphicsUniformBufferObject));
@@ -8,6 +8,7 @@
 #pragma once
 
 #define GLFW_INCLUDE_VULKAN
+#include <chrono>
 #include "spdlog/spdlog.h"
 #include "renderer/Renderer.h"
 #include "VulkanDevice.h"
@@ -78,6 +79,32 @@ protected:
 	virtual VkResult
 	PrepareGraphicsVertexBuffer();
 
+	/**
+	 * \brief Pack sections of data back to back into m_graphics.geometryBuffer, a device local buffer that can be bound
+	 *        as vertex, index and indirect draw buffer, through a staging buffer
+	 * \return offset of each section in the buffer
+	 */
+	std::vector<VkDeviceSize>
+	CreateGeometryBuffer(
+		const std::vector<std::pair<const void*, VkDeviceSize>>& sections
+	);
+
+	/**
+	 * \brief Upload the geometry buffer again and record the draws over it, after an asynchronous load added meshes
+	 */
+	void
+	ReloadGraphicsGeometry();
+
+	/**
+	 * \brief Pick the level of detail of every mesh from the error it projects to on screen, cull the meshlets of the meshes
+	 *        drawn at full detail and rewrite the draws that changed.
+	 *        Logs the triangles drawn against the full meshes and the frame time about once a second.
+	 */
+	void
+	UpdateDraws(
+		const GraphicsUniformBufferObject& ubo
+	);
+
 	virtual VkResult
 	PrepareGraphicsUniformBuffer();
 
@@ -165,7 +192,10 @@ protected:
 		*/
 		VkRenderPass renderPass;
 
-		std::vector<VulkanBuffer::GeometryBuffer> geometryBuffers;
+		/**
+		* \brief Every vertex, index and draw command of the scene in a single buffer
+		*/
+		VulkanBuffer::GeometryBuffer geometryBuffer;
 		
 		/**
 		* \brief Uniform buffers
@@ -196,8 +226,43 @@ protected:
 		*/
 		VkQueue queue;
 
+		/**
+		* \brief Draws as last uploaded, one per meshlet or per primitive without meshlets.
+		*        A primitive at a coarser level of detail is drawn by its first draw, its other ones are left without instances.
+		*/
+		std::vector<VkDrawIndexedIndirectCommand> drawCommands;
+
 	} m_graphics;
 
+	/**
+	 * \brief Per frame draw selection, levels of detail and meshlet culling
+	 */
+	struct {
+
+		/**
+		* \brief Index of the first draw command of every primitive
+		*/
+		std::vector<uint32_t> firstDraws;
+
+		/**
+		* \brief Bounding sphere of every primitive, center and radius, only filled when the scene has levels of detail
+		*/
+		std::vector<glm::vec4> boundingSpheres;
+
+		/**
+		* \brief Host visible copy of the draw commands, copied over the ones in the geometry buffer when they change
+		*/
+		VkBuffer stagingBuffer = VK_NULL_HANDLE;
+		VkDeviceMemory stagingBufferMemory = VK_NULL_HANDLE;
+
+		/**
+		* \brief Frames since the last statistics were logged
+		*/
+		uint32_t frameCount = 0;
+		std::chrono::high_resolution_clock::time_point statsStart;
+
+	} m_draws;
+
 	/**
 	 * \brief Semaphores to signal when to acquire and present swapchain images
 	 */
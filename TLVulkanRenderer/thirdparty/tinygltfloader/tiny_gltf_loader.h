@@ -360,7 +360,8 @@ typedef struct {
   size_t byteOffset;
   size_t byteStride;
   int componentType;  // One of TINYGLTF_COMPONENT_TYPE_***
-  int pad0;
+  bool normalized;    // default: false
+  bool pad0[3];
   size_t count;
   int type;  // One of TINYGLTF_TYPE_***
   int pad1;
@@ -424,7 +425,9 @@ class Node {
 
 typedef struct {
   std::string name;
-  std::vector<unsigned char> data;
+  std::string uri;
+  std::vector<unsigned char> data;  // Empty for external and embedded binary
+                                    // data when buffer loading is disabled
   Value extras;
 } Buffer;
 
@@ -516,8 +519,12 @@ enum SectionCheck {
 
 class TinyGLTFLoader {
  public:
-  TinyGLTFLoader() : bin_data_(NULL), bin_size_(0), is_binary_(false) {
-    pad[0] = pad[1] = pad[2] = pad[3] = pad[4] = pad[5] = pad[6] = 0;
+  TinyGLTFLoader()
+      : bin_data_(NULL),
+        bin_size_(0),
+        is_binary_(false),
+        load_buffer_data_(true) {
+    pad[0] = pad[1] = pad[2] = pad[3] = pad[4] = pad[5] = 0;
   }
   ~TinyGLTFLoader() {}
 
@@ -550,6 +557,11 @@ class TinyGLTFLoader {
                             const std::string &base_dir = "",
                             unsigned int check_sections = REQUIRE_ALL);
 
+  /// When disabled, buffers stored in external files or in the binary glTF
+  /// body are not read, only their `uri` is kept so that the caller can map
+  /// them itself. Data URIs are still decoded. Enabled by default.
+  void SetLoadBufferData(bool load) { load_buffer_data_ = load; }
+
  private:
   /// Loads glTF asset from string(memory).
   /// `length` = strlen(str);
@@ -561,7 +573,8 @@ class TinyGLTFLoader {
   const unsigned char *bin_data_;
   size_t bin_size_;
   bool is_binary_;
-  char pad[7];
+  bool load_buffer_data_;
+  char pad[6];
 };
 
 }  // namespace tinygltf
@@ -1477,7 +1490,7 @@ static bool ParseBuffer(Buffer *buffer, std::string *err,
                         const picojson::object &o, const std::string &basedir,
                         bool is_binary = false,
                         const unsigned char *bin_data = NULL,
-                        size_t bin_size = 0) {
+                        size_t bin_size = 0, bool load_data = true) {
   double byteLength;
   if (!ParseNumberProperty(&byteLength, err, o, "byteLength", true)) {
     return false;
@@ -1487,6 +1500,12 @@ static bool ParseBuffer(Buffer *buffer, std::string *err,
   if (!ParseStringProperty(&uri, err, o, "uri", true)) {
     return false;
   }
+  buffer->uri = uri;
+
+  if (!load_data && !IsDataURI(uri)) {
+    ParseStringProperty(&buffer->name, err, o, "name", false);
+    return true;
+  }
 
   picojson::object::const_iterator type = o.find("type");
   if (type != o.end()) {
@@ -1653,6 +1672,9 @@ static bool ParseAccessor(Accessor *accessor, std::string *err,
   double byteStride = 0.0;
   ParseNumberProperty(&byteStride, err, o, "byteStride", false);
 
+  accessor->normalized = false;
+  ParseBooleanProperty(&accessor->normalized, err, o, "normalized", false);
+
   ParseStringProperty(&accessor->name, err, o, "name", false);
 
   accessor->minValues.clear();
@@ -2235,11 +2257,12 @@ bool TinyGLTFLoader::LoadFromString(Scene *scene, std::string *err,
     for (; it != itEnd; it++) {
       Buffer buffer;
       if (!ParseBuffer(&buffer, err, (it->second).get<picojson::object>(),
-                       base_dir, is_binary_, bin_data_, bin_size_)) {
+                       base_dir, is_binary_, bin_data_, bin_size_,
+                       load_buffer_data_)) {
         return false;
       }
 
-      scene->buffers[it->first] = buffer;
+      std::swap(scene->buffers[it->first], buffer);
     }
   }
 
@@ -2386,8 +2409,21 @@ bool TinyGLTFLoader::LoadFromString(Scene *scene, std::string *err,
         const BufferView &bufferView = scene->bufferViews[image.bufferView];
         const Buffer &buffer = scene->buffers[bufferView.buffer];
 
+        // Buffers that were not loaded are read from where they are stored
+        const unsigned char *bytes = buffer.data.empty() ? NULL : &buffer.data[0];
+        std::vector<unsigned char> external;
+        if (bytes == NULL && is_binary_ && buffer.uri.compare("data:,") == 0) {
+          bytes = bin_data_;
+        } else if (bytes == NULL) {
+          if (!LoadExternalFile(&external, err, buffer.uri, base_dir, 0,
+                                false)) {
+            return false;
+          }
+          bytes = &external[0];
+        }
+
         bool ret = LoadImageData(&image, err, image.width, image.height,
-                                 &buffer.data[bufferView.byteOffset],
+                                 bytes + bufferView.byteOffset,
                                  static_cast<int>(bufferView.byteLength));
         if (!ret) {
           return false;